@@ -0,0 +1,189 @@
+#include "ptyterm-compress.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define PTYTERM_COMPRESS_MIN_MATCH 4
+#define PTYTERM_COMPRESS_HASH_BITS 13
+#define PTYTERM_COMPRESS_MAX_OFFSET 65535
+/* Matches stop this far from the end, and none start in the last
+ * PTYTERM_COMPRESS_MATCH_LIMIT bytes, so the block ends in literals. */
+#define PTYTERM_COMPRESS_LAST_LITERALS 5
+#define PTYTERM_COMPRESS_MATCH_LIMIT 12
+
+static uint32_t read32(const char *data) {
+  uint32_t value;
+
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint32_t hash32(uint32_t value) {
+  return (value * 2654435761u) >> (32 - PTYTERM_COMPRESS_HASH_BITS);
+}
+
+/* Writes length - 15 as a run of 255 bytes and a final byte, after a
+ * token field of 15. */
+static size_t put_length(char *destination, size_t length) {
+  size_t written;
+
+  written = 0;
+  while (length >= 255) {
+    destination[written++] = (char)255;
+    length -= 255;
+  }
+  destination[written++] = (char)length;
+  return written;
+}
+
+/* Emits one sequence and returns its size, or 0 if it does not fit.  A
+ * match_length of 0 makes the final, literal-only sequence. */
+static size_t put_sequence(char *destination, size_t capacity,
+                           const char *literals, size_t literal_length,
+                           size_t offset, size_t match_length) {
+  size_t needed;
+  size_t written;
+  unsigned char token;
+  int final;
+
+  final = match_length == 0;
+  needed = 1 + literal_length + literal_length / 255 + 1;
+  if (!final)
+    needed += 2 + match_length / 255 + 1;
+  if (needed > capacity)
+    return 0;
+
+  token = (unsigned char)((literal_length >= 15 ? 15 : literal_length) << 4);
+  if (!final) {
+    match_length -= PTYTERM_COMPRESS_MIN_MATCH;
+    token |= (unsigned char)(match_length >= 15 ? 15 : match_length);
+  }
+  written = 0;
+  destination[written++] = (char)token;
+  if (literal_length >= 15)
+    written += put_length(destination + written, literal_length - 15);
+  memcpy(destination + written, literals, literal_length);
+  written += literal_length;
+  if (!final) {
+    destination[written++] = (char)(offset & 0xff);
+    destination[written++] = (char)(offset >> 8);
+    if (match_length >= 15)
+      written += put_length(destination + written, match_length - 15);
+  }
+  return written;
+}
+
+/* Compresses size bytes into destination and returns the compressed size,
+ * or 0 when it would not fit in capacity. */
+size_t ptyterm_compress(const char *source, size_t size, char *destination,
+                        size_t capacity) {
+  uint32_t table[1u << PTYTERM_COMPRESS_HASH_BITS];
+  size_t anchor;
+  size_t position;
+  size_t written;
+  size_t part;
+
+  memset(table, 0, sizeof(table));
+  anchor = 0;
+  position = 0;
+  written = 0;
+  while (position + PTYTERM_COMPRESS_MATCH_LIMIT <= size) {
+    uint32_t sequence;
+    uint32_t *slot;
+    size_t candidate;
+    size_t length;
+
+    sequence = read32(source + position);
+    slot = &table[hash32(sequence)];
+    candidate = *slot;
+    *slot = (uint32_t)(position + 1);
+    if (candidate == 0 ||
+        position - (candidate - 1) > PTYTERM_COMPRESS_MAX_OFFSET ||
+        read32(source + candidate - 1) != sequence) {
+      ++position;
+      continue;
+    }
+
+    candidate -= 1;
+    length = PTYTERM_COMPRESS_MIN_MATCH;
+    while (position + length < size - PTYTERM_COMPRESS_LAST_LITERALS &&
+           source[candidate + length] == source[position + length])
+      ++length;
+    part = put_sequence(destination + written, capacity - written,
+                        source + anchor, position - anchor,
+                        position - candidate, length);
+    if (part == 0)
+      return 0;
+    written += part;
+    position += length;
+    anchor = position;
+  }
+
+  part = put_sequence(destination + written, capacity - written,
+                      source + anchor, size - anchor, 0, 0);
+  if (part == 0)
+    return 0;
+  return written + part;
+}
+
+/* Reads a length continuation after a token field of 15. */
+static int get_length(const unsigned char *source, size_t size, size_t *in,
+                      size_t *length) {
+  unsigned char byte;
+
+  do {
+    if (*in >= size)
+      return -1;
+    byte = source[(*in)++];
+    *length += byte;
+  } while (byte == 255);
+  return 0;
+}
+
+/* Decompresses a block into destination and returns its size, or -1 if
+ * the block is malformed or does not fit. */
+ssize_t ptyterm_decompress(const char *source, size_t size, char *destination,
+                           size_t capacity) {
+  const unsigned char *input;
+  size_t in;
+  size_t out;
+
+  input = (const unsigned char *)source;
+  in = 0;
+  out = 0;
+  while (in < size) {
+    unsigned char token;
+    size_t literal_length;
+    size_t match_length;
+    size_t offset;
+
+    token = input[in++];
+    literal_length = token >> 4;
+    if (literal_length == 15 && get_length(input, size, &in, &literal_length) == -1)
+      return -1;
+    if (literal_length > size - in || literal_length > capacity - out)
+      return -1;
+    memcpy(destination + out, input + in, literal_length);
+    in += literal_length;
+    out += literal_length;
+    if (in == size)
+      break;
+
+    if (size - in < 2)
+      return -1;
+    offset = (size_t)input[in] | (size_t)input[in + 1] << 8;
+    in += 2;
+    match_length = token & 0x0f;
+    if (match_length == 15 && get_length(input, size, &in, &match_length) == -1)
+      return -1;
+    match_length += PTYTERM_COMPRESS_MIN_MATCH;
+    if (offset == 0 || offset > out || match_length > capacity - out)
+      return -1;
+    /* Byte by byte, since a match may overlap its own output. */
+    while (match_length-- > 0) {
+      destination[out] = destination[out - offset];
+      ++out;
+    }
+  }
+  return (ssize_t)out;
+}
@@ -0,0 +1,15 @@
+#ifndef PTYTERM_COMPRESS_H
+#define PTYTERM_COMPRESS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* A small LZ77 block codec in the style of LZ4, for history blocks.  A
+ * block is a series of sequences, each a token byte, literal bytes, and a
+ * back reference of at most 64 KiB; the last sequence has literals only. */
+size_t ptyterm_compress(const char *source, size_t size, char *destination,
+                        size_t capacity);
+ssize_t ptyterm_decompress(const char *source, size_t size, char *destination,
+                           size_t capacity);
+
+#endif
@@ -12,7 +12,7 @@
 #include <unistd.h>
 
 #define PTYTERM_CONTROL_MAGIC 0x50545953u
-#define PTYTERM_CONTROL_VERSION 1u
+#define PTYTERM_CONTROL_VERSION 2u
 
 static int fill_sockaddr_un(const char *socket_path, struct sockaddr_un *addr,
                             socklen_t *addrlen) {
@@ -54,14 +54,15 @@ static ssize_t read_all(int fd, void *buffer, size_t size) {
   return (ssize_t)offset;
 }
 
-static ssize_t write_all(int fd, const void *buffer, size_t size) {
+static ssize_t send_all(int fd, const void *buffer, size_t size) {
   size_t offset;
 
   offset = 0;
   while (offset < size) {
     ssize_t chunk;
 
-    chunk = write(fd, (const char *)buffer + offset, size - offset);
+    chunk = send(fd, (const char *)buffer + offset, size - offset,
+                 MSG_NOSIGNAL);
     if (chunk == -1) {
       if (errno == EINTR)
         continue;
@@ -207,18 +208,38 @@ int ptyterm_bind_listen_socket(const char *socket_path) {
   return fd;
 }
 
+void ptyterm_message_header_init(struct ptyterm_message_header *header,
+                                 uint16_t type, uint32_t payload_size) {
+  header->magic = PTYTERM_CONTROL_MAGIC;
+  header->version = PTYTERM_CONTROL_VERSION;
+  header->type = type;
+  header->size = payload_size;
+  header->request_id = 0;
+}
+
+int ptyterm_message_header_check(const struct ptyterm_message_header *header) {
+  if (header->magic != PTYTERM_CONTROL_MAGIC ||
+      header->version != PTYTERM_CONTROL_VERSION) {
+    errno = EPROTO;
+    return -1;
+  }
+  return 0;
+}
+
 int ptyterm_send_message(int fd, uint16_t type, const void *payload,
                          uint32_t payload_size) {
-  struct ptyterm_message_header header;
+  return ptyterm_send_request(fd, 0, type, payload, payload_size);
+}
 
-  header.magic = PTYTERM_CONTROL_MAGIC;
-  header.version = PTYTERM_CONTROL_VERSION;
-  header.type = type;
-  header.size = payload_size;
+int ptyterm_send_request(int fd, uint32_t request_id, uint16_t type,
+                         const void *payload, uint32_t payload_size) {
+  struct ptyterm_message_header header;
 
-  if (write_all(fd, &header, sizeof(header)) == -1)
+  ptyterm_message_header_init(&header, type, payload_size);
+  header.request_id = request_id;
+  if (send_all(fd, &header, sizeof(header)) == -1)
     return -1;
-  if (payload_size > 0 && write_all(fd, payload, payload_size) == -1)
+  if (payload_size > 0 && send_all(fd, payload, payload_size) == -1)
     return -1;
   return 0;
 }
@@ -227,12 +248,8 @@ ssize_t ptyterm_recv_message(int fd, struct ptyterm_message_header *header,
                              void *payload, size_t payload_capacity) {
   if (read_all(fd, header, sizeof(*header)) == -1)
     return -1;
-
-  if (header->magic != PTYTERM_CONTROL_MAGIC ||
-      header->version != PTYTERM_CONTROL_VERSION) {
-    errno = EPROTO;
+  if (ptyterm_message_header_check(header) == -1)
     return -1;
-  }
 
   if (header->size > payload_capacity) {
     if (discard_bytes(fd, header->size) == -1)
@@ -253,12 +270,8 @@ ssize_t ptyterm_recv_message_alloc(int fd, struct ptyterm_message_header *header
   *payload_out = NULL;
   if (read_all(fd, header, sizeof(*header)) == -1)
     return -1;
-
-  if (header->magic != PTYTERM_CONTROL_MAGIC ||
-      header->version != PTYTERM_CONTROL_VERSION) {
-    errno = EPROTO;
+  if (ptyterm_message_header_check(header) == -1)
     return -1;
-  }
 
   if (header->size == 0)
     return 0;
@@ -275,6 +288,133 @@ ssize_t ptyterm_recv_message_alloc(int fd, struct ptyterm_message_header *header
   return (ssize_t)header->size;
 }
 
+/* Like ptyterm_recv_message, and also takes a descriptor passed with the
+ * message, which arrives with its first byte.  fd_out is -1 if none came. */
+ssize_t ptyterm_recv_message_fd(int fd, struct ptyterm_message_header *header,
+                                void *payload, size_t payload_capacity,
+                                int *fd_out) {
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct cmsghdr *cmsg;
+  struct msghdr message;
+  struct iovec iov;
+  ssize_t received;
+
+  *fd_out = -1;
+  memset(&message, 0, sizeof(message));
+  iov.iov_base = header;
+  iov.iov_len = sizeof(*header);
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+  do {
+    received = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+  } while (received == -1 && errno == EINTR);
+  if (received == -1)
+    return -1;
+  if (received == 0) {
+    errno = ECONNRESET;
+    return -1;
+  }
+  for (cmsg = CMSG_FIRSTHDR(&message); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&message, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(fd_out, CMSG_DATA(cmsg), sizeof(*fd_out));
+  }
+
+  if ((size_t)received < sizeof(*header) &&
+      read_all(fd, (char *)header + received,
+               sizeof(*header) - (size_t)received) == -1)
+    goto fail;
+  if (ptyterm_message_header_check(header) == -1)
+    goto fail;
+  if (header->size > payload_capacity) {
+    discard_bytes(fd, header->size);
+    errno = EMSGSIZE;
+    goto fail;
+  }
+  if (header->size > 0 && read_all(fd, payload, header->size) == -1)
+    goto fail;
+  return (ssize_t)header->size;
+
+fail:
+  if (*fd_out >= 0) {
+    close(*fd_out);
+    *fd_out = -1;
+  }
+  return -1;
+}
+
+/* Takes a consistent copy of the published ring state, retrying while the
+ * daemon is in the middle of an update. */
+void ptyterm_shared_ring_read_state(
+    const struct ptyterm_shared_ring_header *header,
+    struct ptyterm_shared_ring_state *state) {
+  uint64_t before;
+  uint64_t after;
+
+  for (;;) {
+    before = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+    if ((before & 1) != 0)
+      continue;
+    state->total_output_bytes =
+        __atomic_load_n(&header->total_output_bytes, __ATOMIC_RELAXED);
+    state->write_limit = __atomic_load_n(&header->write_limit, __ATOMIC_RELAXED);
+    state->ring_start = __atomic_load_n(&header->ring_start, __ATOMIC_RELAXED);
+    state->ring_len = __atomic_load_n(&header->ring_len, __ATOMIC_RELAXED);
+    state->closed = __atomic_load_n(&header->closed, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&header->sequence, __ATOMIC_RELAXED);
+    if (before == after)
+      return;
+  }
+}
+
+/* Copies up to size bytes of output from stream offset into buffer and
+ * returns how many.  Fails with ERANGE when the bytes at offset are no
+ * longer in the ring, or were overwritten while they were being copied. */
+ssize_t ptyterm_shared_ring_copy(const struct ptyterm_shared_ring_header *header,
+                                 const char *ring, uint64_t offset,
+                                 char *buffer, size_t size) {
+  struct ptyterm_shared_ring_state state;
+  uint64_t oldest;
+  size_t position;
+  size_t first;
+
+  if (header->magic != PTYTERM_SHARED_RING_MAGIC || header->capacity == 0) {
+    errno = EPROTO;
+    return -1;
+  }
+  ptyterm_shared_ring_read_state(header, &state);
+  oldest = state.total_output_bytes - state.ring_len;
+  if (offset < oldest) {
+    errno = ERANGE;
+    return -1;
+  }
+  if (offset >= state.total_output_bytes)
+    return 0;
+  if (size > state.total_output_bytes - offset)
+    size = (size_t)(state.total_output_bytes - offset);
+
+  position = (size_t)((state.ring_start + (offset - oldest)) % header->capacity);
+  first = header->capacity - position;
+  if (first > size)
+    first = size;
+  memcpy(buffer, ring + position, first);
+  memcpy(buffer + first, ring, size - first);
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  ptyterm_shared_ring_read_state(header, &state);
+  if (state.write_limit > offset + header->capacity) {
+    errno = ERANGE;
+    return -1;
+  }
+  return (ssize_t)size;
+}
+
 const char *ptyterm_session_state_name(uint32_t state) {
   switch (state) {
   case PTYTERM_SESSION_ATTACHED:
@@ -11,7 +11,13 @@
 #define PTYTERM_REASON_MAX 32
 #define PTYTERM_TASK_NAME_MAX 32
 #define PTYTERM_TTY_NAME_MAX 64
+#define PTYTERM_CURSOR_NAME_MAX 32
 #define PTYTERM_SESSION_ALL (-1)
+/* Largest payload of one recv response; larger reads take several. */
+#define PTYTERM_RECV_CHUNK_MAX 65536
+#define PTYTERM_RECV_UNTIL_MAX 256
+#define PTYTERM_SHARED_RING_MAGIC 0x50545952u
+#define PTYTERM_SHARED_RING_DATA_OFFSET 4096
 
 enum ptyterm_message_type {
   PTYTERM_MESSAGE_LIST_REQUEST = 1,
@@ -37,6 +43,14 @@ enum ptyterm_message_type {
   PTYTERM_MESSAGE_DAEMON_SHUTDOWN_RESPONSE = 21,
   PTYTERM_MESSAGE_SCREEN_SNAPSHOT_REQUEST = 22,
   PTYTERM_MESSAGE_SCREEN_SNAPSHOT_RESPONSE = 23,
+  PTYTERM_MESSAGE_MAP_OUTPUT_REQUEST = 24,
+  PTYTERM_MESSAGE_MAP_OUTPUT_RESPONSE = 25,
+  PTYTERM_MESSAGE_RESIZE_BUFFER_REQUEST = 26,
+  PTYTERM_MESSAGE_RESIZE_BUFFER_RESPONSE = 27,
+  PTYTERM_MESSAGE_SCREEN_DELTA_REQUEST = 28,
+  PTYTERM_MESSAGE_SCREEN_DELTA_RESPONSE = 29,
+  PTYTERM_MESSAGE_CURSOR_DELETE_REQUEST = 30,
+  PTYTERM_MESSAGE_CURSOR_DELETE_RESPONSE = 31,
 };
 
 enum ptyterm_session_state {
@@ -47,6 +61,18 @@ enum ptyterm_session_state {
 
 enum ptyterm_recv_flags {
   PTYTERM_RECV_FLAG_PEEK = 1u << 0,
+  PTYTERM_RECV_FLAG_SINCE = 1u << 1,
+  PTYTERM_RECV_FLAG_BEFORE = 1u << 2,
+  PTYTERM_RECV_FLAG_START = 1u << 3,
+  PTYTERM_RECV_FLAG_END = 1u << 4,
+  PTYTERM_RECV_FLAG_LAST_LINES = 1u << 5,
+  PTYTERM_RECV_FLAG_FROM_LINE = 1u << 6,
+  PTYTERM_RECV_FLAG_MAX_LINES = 1u << 7,
+  PTYTERM_RECV_FLAG_WAIT = 1u << 8,
+};
+
+enum ptyterm_snapshot_flags {
+  PTYTERM_SNAPSHOT_FLAG_BEFORE = 1u << 0,
 };
 
 enum ptyterm_screen_selector {
@@ -60,6 +86,7 @@ struct ptyterm_message_header {
   uint16_t version;
   uint16_t type;
   uint32_t size;
+  uint32_t request_id;
 };
 
 struct ptyterm_list_request {
@@ -94,8 +121,10 @@ struct ptyterm_buffer_info_response {
   uint32_t paused_on_full;
 };
 
+/* buffer_size 0 takes the daemon's --output-buffer. */
 struct ptyterm_create_request {
   uint32_t argc;
+  uint32_t buffer_size;
 };
 
 struct ptyterm_create_response {
@@ -119,10 +148,24 @@ struct ptyterm_send_response {
   char reason[PTYTERM_REASON_MAX];
 };
 
+/* An empty cursor name selects the session's default recv cursor.
+ * since_ms and before_ms are ages relative to the daemon's clock, and
+ * select output by when it was read.  A read that starts at since_ms or
+ * start_offset is positional and leaves the cursor in place. */
 struct ptyterm_recv_request {
   int32_t session_id;
   uint32_t max_bytes;
   uint32_t flags;
+  char cursor[PTYTERM_CURSOR_NAME_MAX];
+  uint32_t lines;
+  uint64_t since_ms;
+  uint64_t before_ms;
+  uint64_t start_offset;
+  uint64_t end_offset;
+  uint64_t from_line;
+  uint64_t timeout_ms;
+  uint32_t until_size;
+  char until[PTYTERM_RECV_UNTIL_MAX];
 };
 
 struct ptyterm_recv_response {
@@ -130,6 +173,8 @@ struct ptyterm_recv_response {
   uint64_t end_offset;
   uint64_t next_recv_offset;
   uint64_t oldest_available_offset;
+  uint64_t lag_bytes;
+  uint64_t range_end_offset;
   uint32_t returned_bytes;
   uint32_t truncated;
   char reason[PTYTERM_REASON_MAX];
@@ -166,9 +211,23 @@ struct ptyterm_resize_response {
   uint16_t cols;
 };
 
+/* Memory is reported per subsystem: session rings, the two screens of
+ * each session, the per-session offset indexes, history kept in memory,
+ * and the rest of each session: its own structure, pending I/O buffers,
+ * and held progress frame.  memory_limit is 0 without
+ * --memory-limit; trimmed_bytes counts ring capacity given up to stay
+ * within it. */
 struct ptyterm_daemon_status_response {
   uint32_t running;
   int32_t daemon_pid;
+  uint64_t memory_limit;
+  uint64_t memory_used;
+  uint64_t ring_bytes;
+  uint64_t screen_bytes;
+  uint64_t index_bytes;
+  uint64_t history_bytes;
+  uint64_t session_bytes;
+  uint64_t trimmed_bytes;
 };
 
 struct ptyterm_daemon_shutdown_response {
@@ -179,6 +238,9 @@ struct ptyterm_daemon_shutdown_response {
 struct ptyterm_screen_snapshot_request {
   int32_t session_id;
   uint32_t screen_selector;
+  uint32_t flags;
+  uint32_t reserved;
+  uint64_t before_ms;
 };
 
 struct ptyterm_screen_snapshot_response {
@@ -198,6 +260,81 @@ struct ptyterm_screen_snapshot_response {
   char fg_task[PTYTERM_TASK_NAME_MAX];
 };
 
+/* Asks for the rows of the screen changed since base_generation.  The
+ * client describes the screen it holds; base_screen and base_rows are 0
+ * when it does not know them. */
+struct ptyterm_screen_delta_request {
+  int32_t session_id;
+  uint32_t screen_selector;
+  uint64_t base_generation;
+  uint32_t base_screen;
+  uint16_t base_rows;
+  uint16_t base_cols;
+};
+
+/* Followed by every row of the screen when full is set, as in a snapshot.
+ * Otherwise followed by row_count uint16_t row numbers, in ascending
+ * order, and then the cells of those rows. */
+struct ptyterm_screen_delta_response {
+  struct ptyterm_screen_snapshot_response screen;
+  uint64_t base_generation;
+  uint32_t full;
+  uint32_t row_count;
+};
+
+/* Answered with a ptyterm_buffer_info_response describing the new ring. */
+struct ptyterm_resize_buffer_request {
+  int32_t session_id;
+  uint32_t buffer_size;
+};
+
+/* Removes a named recv cursor.  Answered with a ptyterm_buffer_info_response,
+ * since a session paused for that cursor may resume. */
+struct ptyterm_cursor_delete_request {
+  int32_t session_id;
+  char cursor[PTYTERM_CURSOR_NAME_MAX];
+};
+
+struct ptyterm_map_output_request {
+  int32_t session_id;
+};
+
+/* Sent with a read-only memfd of the session ring attached as SCM_RIGHTS.
+ * The mapping holds a ptyterm_shared_ring_header followed, at data_offset,
+ * by capacity bytes of ring. */
+struct ptyterm_map_output_response {
+  uint32_t session_id;
+  uint32_t capacity;
+  uint64_t data_offset;
+  uint64_t map_size;
+};
+
+/* Published at the start of a shared ring.  The daemon makes sequence odd
+ * while it updates the fields and even again afterwards.  Before reading
+ * from the master into the ring it raises write_limit to the end of what
+ * it may write, so a reader can tell when bytes it copied were overwritten
+ * underneath it.  The ring's oldest byte is at array index ring_start and
+ * stream offset total_output_bytes - ring_len. */
+struct ptyterm_shared_ring_header {
+  uint32_t magic;
+  uint32_t capacity;
+  uint64_t sequence;
+  uint64_t total_output_bytes;
+  uint64_t write_limit;
+  uint64_t ring_start;
+  uint64_t ring_len;
+  uint32_t closed;
+  uint32_t reserved;
+};
+
+struct ptyterm_shared_ring_state {
+  uint64_t total_output_bytes;
+  uint64_t write_limit;
+  uint64_t ring_start;
+  uint64_t ring_len;
+  uint32_t closed;
+};
+
 struct ptyterm_error_response {
   int32_t error_code;
   char message[PTYTERM_ERROR_MESSAGE_MAX];
@@ -206,12 +343,26 @@ struct ptyterm_error_response {
 int ptyterm_default_socket_path(char *buffer, size_t buffer_size);
 int ptyterm_connect_socket(const char *socket_path);
 int ptyterm_bind_listen_socket(const char *socket_path);
+void ptyterm_message_header_init(struct ptyterm_message_header *header,
+                                 uint16_t type, uint32_t payload_size);
+int ptyterm_message_header_check(const struct ptyterm_message_header *header);
 int ptyterm_send_message(int fd, uint16_t type, const void *payload,
                          uint32_t payload_size);
+int ptyterm_send_request(int fd, uint32_t request_id, uint16_t type,
+                         const void *payload, uint32_t payload_size);
 ssize_t ptyterm_recv_message(int fd, struct ptyterm_message_header *header,
                              void *payload, size_t payload_capacity);
 ssize_t ptyterm_recv_message_alloc(int fd, struct ptyterm_message_header *header,
                                    void **payload_out);
+ssize_t ptyterm_recv_message_fd(int fd, struct ptyterm_message_header *header,
+                                void *payload, size_t payload_capacity,
+                                int *fd_out);
+void ptyterm_shared_ring_read_state(
+    const struct ptyterm_shared_ring_header *header,
+    struct ptyterm_shared_ring_state *state);
+ssize_t ptyterm_shared_ring_copy(const struct ptyterm_shared_ring_header *header,
+                                 const char *ring, uint64_t offset,
+                                 char *buffer, size_t size);
 const char *ptyterm_session_state_name(uint32_t state);
 const char *ptyterm_screen_selector_name(uint32_t selector);
 
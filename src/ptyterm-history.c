@@ -0,0 +1,439 @@
+#include "ptyterm-history.h"
+#include "ptyterm-compress.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+int ptyterm_history_init(struct ptyterm_history *history, const char *directory,
+                         const char *name, size_t segment_size) {
+  int written;
+  size_t i;
+
+  memset(history, 0, sizeof(*history));
+  history->tail_fd = -1;
+  if (segment_size == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  written = snprintf(history->path_prefix, sizeof(history->path_prefix),
+                     "%s/%s", directory, name);
+  if (written < 0 || (size_t)written >= sizeof(history->path_prefix)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  history->segment_size = segment_size;
+  for (i = 0; i < PTYTERM_HISTORY_CACHE_SLOTS; ++i)
+    history->cache_segment[i] = SIZE_MAX;
+  return 0;
+}
+
+int ptyterm_history_init_compressed(struct ptyterm_history *history,
+                                    size_t segment_size) {
+  size_t i;
+
+  memset(history, 0, sizeof(*history));
+  history->tail_fd = -1;
+  if (segment_size == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  history->compressed = 1;
+  history->segment_size = segment_size;
+  for (i = 0; i < PTYTERM_HISTORY_CACHE_SLOTS; ++i)
+    history->cache_segment[i] = SIZE_MAX;
+  return 0;
+}
+
+/* Shrinks the partly filled tail file to the bytes it holds, so the
+ * segment files read back as the plain output stream. */
+static void close_tail_segment(struct ptyterm_history *history) {
+  size_t used;
+
+  if (history->tail_fd < 0)
+    return;
+  used = (size_t)(history->size % history->segment_size);
+  if (used > 0 && ftruncate(history->tail_fd, (off_t)used) == -1)
+    perror("ftruncate(history)");
+  close(history->tail_fd);
+  history->tail_fd = -1;
+}
+
+void ptyterm_history_free(struct ptyterm_history *history) {
+  size_t i;
+
+  close_tail_segment(history);
+  for (i = 0; i < history->segment_count; ++i) {
+    if (history->compressed)
+      free(history->segments[i].data);
+    else if (history->segments[i].data != NULL)
+      munmap(history->segments[i].data, history->segment_size);
+  }
+  free(history->segments);
+  free(history->tail_block);
+  history->tail_block = NULL;
+  for (i = 0; i < PTYTERM_HISTORY_CACHE_SLOTS; ++i) {
+    free(history->cache[i]);
+    history->cache[i] = NULL;
+  }
+  history->stored_bytes = 0;
+  history->segments = NULL;
+  history->segment_count = 0;
+  history->segment_capacity = 0;
+}
+
+static int reserve_segment(struct ptyterm_history *history) {
+  struct ptyterm_history_segment *segments;
+  size_t capacity;
+
+  if (history->segment_count < history->segment_capacity)
+    return 0;
+  capacity = history->segment_capacity == 0 ? 16 : history->segment_capacity * 2;
+  segments = realloc(history->segments, capacity * sizeof(*segments));
+  if (segments == NULL)
+    return -1;
+  history->segments = segments;
+  history->segment_capacity = capacity;
+  return 0;
+}
+
+/* The name of the file holding segment index of the stream. */
+static void segment_path(const struct ptyterm_history *history, size_t index,
+                         char *path, size_t size) {
+  snprintf(path, size, "%s.%06zu", history->path_prefix, index);
+}
+
+/* Frees the oldest full segment, and deletes its file, so that offsets
+ * before the next one can no longer be read.  Returns -1 when there is
+ * nothing but the segment being filled. */
+int ptyterm_history_drop_oldest(struct ptyterm_history *history) {
+  char path[sizeof(history->path_prefix) + 32];
+  struct ptyterm_history_segment *segment;
+  size_t sealed;
+  size_t i;
+
+  sealed = history->segment_count;
+  if (!history->compressed && sealed > 0)
+    sealed -= 1;
+  if (sealed == 0)
+    return -1;
+
+  segment = &history->segments[0];
+  if (history->compressed) {
+    free(segment->data);
+    history->stored_bytes -= segment->size;
+  } else {
+    if (segment->data != NULL)
+      munmap(segment->data, history->segment_size);
+    segment_path(history, history->first_segment, path, sizeof(path));
+    unlink(path);
+    history->stored_bytes -= history->segment_size;
+  }
+  for (i = 0; i < PTYTERM_HISTORY_CACHE_SLOTS; ++i) {
+    if (history->cache_segment[i] == history->first_segment)
+      history->cache_segment[i] = SIZE_MAX;
+  }
+  history->segment_count -= 1;
+  memmove(history->segments, history->segments + 1,
+          history->segment_count * sizeof(*history->segments));
+  history->first_segment += 1;
+  return 0;
+}
+
+/* Drops the oldest segments until the stored bytes fit the limit. */
+static void enforce_limit(struct ptyterm_history *history) {
+  if (history->stored_limit == 0)
+    return;
+  while (history->stored_bytes > history->stored_limit &&
+         ptyterm_history_drop_oldest(history) == 0)
+    ;
+}
+
+static int add_segment(struct ptyterm_history *history) {
+  char path[sizeof(history->path_prefix) + 32];
+  void *data;
+  int error;
+  int fd;
+
+  if (reserve_segment(history) == -1)
+    return -1;
+
+  segment_path(history, history->first_segment + history->segment_count, path,
+               sizeof(path));
+  /* Never reuse a file left by another session or daemon. */
+  fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd == -1)
+    return -1;
+  /* Blocks are allocated now so that a full file system fails this call
+   * instead of raising SIGBUS on a later write through the mapping. */
+  error = posix_fallocate(fd, 0, (off_t)history->segment_size);
+  if (error != 0) {
+    close(fd);
+    unlink(path);
+    errno = error;
+    return -1;
+  }
+  data = mmap(NULL, history->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+              fd, 0);
+  if (data == MAP_FAILED) {
+    error = errno;
+    close(fd);
+    unlink(path);
+    errno = error;
+    return -1;
+  }
+
+  /* Only the tail stays mapped, so a long history does not use up the
+   * process's mappings; full segments are read back with pread(). */
+  close_tail_segment(history);
+  if (history->segment_count > 0) {
+    munmap(history->segments[history->segment_count - 1].data,
+           history->segment_size);
+    history->segments[history->segment_count - 1].data = NULL;
+  }
+  history->tail_fd = fd;
+  history->segments[history->segment_count].data = data;
+  history->segments[history->segment_count].size = history->segment_size;
+  history->segment_count += 1;
+  history->stored_bytes += history->segment_size;
+  enforce_limit(history);
+  return 0;
+}
+
+/* Compresses the full tail block into a segment of its own.  Blocks that
+ * do not shrink are kept raw, which reads tell apart by their size. */
+static int seal_tail_block(struct ptyterm_history *history) {
+  char *data;
+  size_t size;
+
+  if (reserve_segment(history) == -1)
+    return -1;
+  data = malloc(history->segment_size);
+  if (data == NULL)
+    return -1;
+  size = ptyterm_compress(history->tail_block, history->segment_size, data,
+                          history->segment_size - 1);
+  if (size == 0) {
+    free(data);
+    data = history->tail_block;
+    size = history->segment_size;
+    history->tail_block = NULL;
+  } else {
+    char *shrunk;
+
+    shrunk = realloc(data, size);
+    if (shrunk != NULL)
+      data = shrunk;
+  }
+  history->segments[history->segment_count].data = data;
+  history->segments[history->segment_count].size = size;
+  history->segment_count += 1;
+  history->stored_bytes += size;
+  enforce_limit(history);
+  return 0;
+}
+
+static int append_compressed(struct ptyterm_history *history, const char *data,
+                             size_t size) {
+  while (size > 0) {
+    size_t position;
+    size_t chunk;
+
+    if (history->tail_block == NULL) {
+      history->tail_block = malloc(history->segment_size);
+      if (history->tail_block == NULL)
+        return -1;
+    }
+    position = (size_t)(history->size % history->segment_size);
+    chunk = history->segment_size - position;
+    if (chunk > size)
+      chunk = size;
+    memcpy(history->tail_block + position, data, chunk);
+    if (position + chunk == history->segment_size &&
+        seal_tail_block(history) == -1)
+      return -1;
+    history->size += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+  return 0;
+}
+
+/* Fills buffer with the bytes of segment index of the stream, by
+ * decompressing its block or reading its file. */
+static int load_segment(struct ptyterm_history *history, size_t index,
+                        char *buffer) {
+  char path[sizeof(history->path_prefix) + 32];
+  const struct ptyterm_history_segment *segment;
+  ssize_t size;
+  size_t done;
+  int error;
+  int fd;
+
+  if (history->compressed) {
+    segment = &history->segments[index - history->first_segment];
+    size = ptyterm_decompress(segment->data, segment->size, buffer,
+                              history->segment_size);
+    if (size != (ssize_t)history->segment_size) {
+      errno = EIO;
+      return -1;
+    }
+    return 0;
+  }
+
+  segment_path(history, index, path, sizeof(path));
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  done = 0;
+  while (done < history->segment_size) {
+    size = pread(fd, buffer + done, history->segment_size - done, (off_t)done);
+    if (size == -1 && errno == EINTR)
+      continue;
+    if (size <= 0) {
+      error = size == 0 ? EIO : errno;
+      close(fd);
+      errno = error;
+      return -1;
+    }
+    done += (size_t)size;
+  }
+  close(fd);
+  return 0;
+}
+
+/* Returns the bytes of full segment index of the stream, reusing a cache
+ * slot that holds it or else refilling the one read least recently. */
+static const char *cached_segment(struct ptyterm_history *history,
+                                  size_t index) {
+  size_t slot;
+
+  for (slot = 0; slot < PTYTERM_HISTORY_CACHE_SLOTS; ++slot) {
+    if (history->cache_segment[slot] == index)
+      break;
+  }
+  if (slot == PTYTERM_HISTORY_CACHE_SLOTS) {
+    slot = history->cache_next;
+    if (history->cache[slot] == NULL) {
+      history->cache[slot] = malloc(history->segment_size);
+      if (history->cache[slot] == NULL)
+        return NULL;
+    }
+    history->cache_segment[slot] = SIZE_MAX;
+    if (load_segment(history, index, history->cache[slot]) == -1)
+      return NULL;
+    history->cache_segment[slot] = index;
+  }
+  history->cache_next = (slot + 1) % PTYTERM_HISTORY_CACHE_SLOTS;
+  return history->cache[slot];
+}
+
+int ptyterm_history_append(struct ptyterm_history *history, const char *data,
+                           size_t size) {
+  if (history->compressed)
+    return append_compressed(history, data, size);
+  while (size > 0) {
+    size_t position;
+    size_t chunk;
+
+    position = (size_t)(history->size % history->segment_size);
+    if (position == 0 &&
+        history->size / history->segment_size ==
+            history->first_segment + history->segment_count &&
+        add_segment(history) == -1)
+      return -1;
+    chunk = history->segment_size - position;
+    if (chunk > size)
+      chunk = size;
+    memcpy(history->segments[history->segment_count - 1].data + position, data,
+           chunk);
+    history->size += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+  return 0;
+}
+
+/* Points data_out at the stored bytes starting at offset, up to max_bytes
+ * and the end of that offset's segment, and returns how many there are. */
+size_t ptyterm_history_read(struct ptyterm_history *history, uint64_t offset,
+                            size_t max_bytes, const char **data_out) {
+  const struct ptyterm_history_segment *segment;
+  const char *base;
+  size_t position;
+  size_t available;
+  size_t index;
+
+  *data_out = NULL;
+  if (offset < ptyterm_history_oldest(history) || offset >= history->size)
+    return 0;
+  position = (size_t)(offset % history->segment_size);
+  available = history->segment_size - position;
+  if (available > history->size - offset)
+    available = (size_t)(history->size - offset);
+  if (available > max_bytes)
+    available = max_bytes;
+
+  index = (size_t)(offset / history->segment_size);
+  if (!history->compressed ||
+      index - history->first_segment < history->segment_count) {
+    segment = &history->segments[index - history->first_segment];
+    base = segment->data;
+    if (base == NULL || segment->size != history->segment_size) {
+      base = cached_segment(history, index);
+      if (base == NULL)
+        return 0;
+    }
+  } else {
+    base = history->tail_block;
+  }
+  *data_out = base + position;
+  return available;
+}
+
+/* Caps the stored segments at max_bytes, or lifts the cap for 0.  The
+ * segment being filled is always kept, whatever its size. */
+void ptyterm_history_set_limit(struct ptyterm_history *history,
+                               size_t max_bytes) {
+  history->stored_limit = max_bytes;
+  enforce_limit(history);
+}
+
+uint64_t ptyterm_history_size(const struct ptyterm_history *history) {
+  return history->size;
+}
+
+/* The offset of the oldest byte still stored. */
+uint64_t ptyterm_history_oldest(const struct ptyterm_history *history) {
+  return (uint64_t)history->first_segment * history->segment_size;
+}
+
+/* Heap bytes that ptyterm_history_drop_oldest can give back: the full
+ * blocks of an in-memory history.  Dropping segment files frees disk, not
+ * memory. */
+size_t ptyterm_history_droppable(const struct ptyterm_history *history) {
+  return history->compressed ? history->stored_bytes : 0;
+}
+
+/* Heap bytes held by the history: an in-memory history's blocks and
+ * tail, and the read cache.  Segment files are page cache and are not
+ * counted. */
+size_t ptyterm_history_memory(const struct ptyterm_history *history) {
+  size_t size;
+  size_t i;
+
+  size = 0;
+  if (history->compressed)
+    size += history->stored_bytes;
+  if (history->tail_block != NULL)
+    size += history->segment_size;
+  for (i = 0; i < PTYTERM_HISTORY_CACHE_SLOTS; ++i) {
+    if (history->cache[i] != NULL)
+      size += history->segment_size;
+  }
+  return size;
+}
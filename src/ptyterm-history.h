@@ -0,0 +1,62 @@
+#ifndef PTYTERM_HISTORY_H
+#define PTYTERM_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Append-only output history kept in fixed-size segments.  Stream offset N
+ * lives in segment N / segment_size.
+ *
+ * With a directory, segments are files.  Only the newest is mapped, to be
+ * filled; full ones are read back with pread().  Without a directory,
+ * segments are blocks held in memory: the newest is filled raw, and full
+ * ones are compressed.  A read of a full file or a compressed block loads
+ * it into one of two cache slots, so the data returned by the last two
+ * reads stays valid.
+ *
+ * segments[0] is segment first_segment of the stream.  With a limit, the
+ * oldest full segments are dropped once the stored bytes exceed it, and
+ * offsets before the first one left are no longer readable. */
+struct ptyterm_history_segment {
+  char *data;
+  size_t size;
+};
+
+#define PTYTERM_HISTORY_CACHE_SLOTS 2
+
+struct ptyterm_history {
+  char path_prefix[4096];
+  int compressed;
+  size_t segment_size;
+  size_t first_segment;
+  struct ptyterm_history_segment *segments;
+  size_t segment_count;
+  size_t segment_capacity;
+  int tail_fd;
+  char *tail_block;
+  char *cache[PTYTERM_HISTORY_CACHE_SLOTS];
+  size_t cache_segment[PTYTERM_HISTORY_CACHE_SLOTS];
+  size_t cache_next;
+  size_t stored_bytes;
+  size_t stored_limit;
+  uint64_t size;
+};
+
+int ptyterm_history_init(struct ptyterm_history *history, const char *directory,
+                         const char *name, size_t segment_size);
+int ptyterm_history_init_compressed(struct ptyterm_history *history,
+                                    size_t segment_size);
+void ptyterm_history_free(struct ptyterm_history *history);
+int ptyterm_history_append(struct ptyterm_history *history, const char *data,
+                           size_t size);
+size_t ptyterm_history_read(struct ptyterm_history *history, uint64_t offset,
+                            size_t max_bytes, const char **data_out);
+void ptyterm_history_set_limit(struct ptyterm_history *history,
+                               size_t max_bytes);
+int ptyterm_history_drop_oldest(struct ptyterm_history *history);
+uint64_t ptyterm_history_size(const struct ptyterm_history *history);
+uint64_t ptyterm_history_oldest(const struct ptyterm_history *history);
+size_t ptyterm_history_memory(const struct ptyterm_history *history);
+size_t ptyterm_history_droppable(const struct ptyterm_history *history);
+
+#endif
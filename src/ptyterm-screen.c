@@ -1,21 +1,24 @@
 #include "ptyterm-screen.h"
+#include "ptyterm-vt.h"
 
-#include <ctype.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
-enum {
-  PTYTERM_SCREEN_PARSER_TEXT = 0,
-  PTYTERM_SCREEN_PARSER_ESC = 1,
-  PTYTERM_SCREEN_PARSER_CSI = 2,
-  PTYTERM_SCREEN_PARSER_ESC_CHARSET = 3,
-};
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ptyterm-vt-table.h"
 
 static size_t screen_cell_count(uint16_t rows, uint16_t cols) {
   return (size_t)rows * (size_t)cols;
 }
 
+static size_t dirty_word_count(uint16_t rows) {
+  return ((size_t)rows + 63) / 64;
+}
+
 static struct ptyterm_screen_buffer *selected_buffer(
     struct ptyterm_screen_state *state, uint32_t selector) {
   uint32_t resolved;
@@ -45,6 +48,54 @@ static void fill_screen(char *cells, uint16_t rows, uint16_t cols) {
   memset(cells, ' ', screen_cell_count(rows, cols));
 }
 
+static char *row_cells(const struct ptyterm_screen_state *state,
+                       const struct ptyterm_screen_buffer *buffer,
+                       uint16_t row) {
+  return buffer->cells +
+         (size_t)((buffer->top + row) % state->rows) * state->cols;
+}
+
+static void free_buffer(struct ptyterm_screen_buffer *buffer) {
+  free(buffer->cells);
+  free(buffer->row_generations);
+  free(buffer->dirty_rows);
+  buffer->cells = NULL;
+  buffer->row_generations = NULL;
+  buffer->dirty_rows = NULL;
+}
+
+static int alloc_buffer(struct ptyterm_screen_buffer *buffer, uint16_t rows,
+                        uint16_t cols) {
+  buffer->cells = malloc(screen_cell_count(rows, cols));
+  buffer->row_generations = calloc(rows, sizeof(*buffer->row_generations));
+  buffer->dirty_rows = calloc(dirty_word_count(rows),
+                              sizeof(*buffer->dirty_rows));
+  if (buffer->cells == NULL || buffer->row_generations == NULL ||
+      buffer->dirty_rows == NULL) {
+    free_buffer(buffer);
+    return -1;
+  }
+  return 0;
+}
+
+/* Rows changed while feeding get the generation the feed ends with. */
+static void mark_rows(const struct ptyterm_screen_state *state,
+                      struct ptyterm_screen_buffer *buffer, uint16_t first,
+                      uint16_t last) {
+  uint16_t row;
+
+  for (row = first; row <= last && row < state->rows; ++row) {
+    buffer->row_generations[row] = state->generation + 1;
+    buffer->dirty_rows[row / 64] |= UINT64_C(1) << (row % 64);
+  }
+}
+
+static void mark_all_rows(const struct ptyterm_screen_state *state,
+                          struct ptyterm_screen_buffer *buffer) {
+  if (state->rows > 0)
+    mark_rows(state, buffer, 0, state->rows - 1);
+}
+
 static void clamp_cursor(const struct ptyterm_screen_state *state,
                          struct ptyterm_screen_buffer *buffer) {
   if (buffer->cursor_row >= state->rows)
@@ -57,30 +108,24 @@ static void clamp_cursor(const struct ptyterm_screen_state *state,
     buffer->saved_col = state->cols - 1;
 }
 
+/* The top row becomes the new, blank bottom row. */
 static void scroll_up(struct ptyterm_screen_state *state,
                       struct ptyterm_screen_buffer *buffer) {
-  size_t row_bytes;
-  size_t total_bytes;
-
-  row_bytes = state->cols;
-  total_bytes = screen_cell_count(state->rows, state->cols);
-  if (state->rows <= 1 || row_bytes == 0)
+  if (state->rows <= 1 || state->cols == 0)
     return;
-  memmove(buffer->cells, buffer->cells + row_bytes, total_bytes - row_bytes);
-  memset(buffer->cells + total_bytes - row_bytes, ' ', row_bytes);
+  memset(row_cells(state, buffer, 0), ' ', state->cols);
+  buffer->top = (uint16_t)((buffer->top + 1) % state->rows);
+  mark_all_rows(state, buffer);
 }
 
+/* The bottom row becomes the new, blank top row. */
 static void scroll_down(struct ptyterm_screen_state *state,
                         struct ptyterm_screen_buffer *buffer) {
-  size_t row_bytes;
-  size_t total_bytes;
-
-  row_bytes = state->cols;
-  total_bytes = screen_cell_count(state->rows, state->cols);
-  if (state->rows <= 1 || row_bytes == 0)
+  if (state->rows <= 1 || state->cols == 0)
     return;
-  memmove(buffer->cells + row_bytes, buffer->cells, total_bytes - row_bytes);
-  memset(buffer->cells, ' ', row_bytes);
+  buffer->top = (uint16_t)((buffer->top + state->rows - 1) % state->rows);
+  memset(row_cells(state, buffer, 0), ' ', state->cols);
+  mark_all_rows(state, buffer);
 }
 
 static void line_feed(struct ptyterm_screen_state *state,
@@ -95,10 +140,13 @@ static void line_feed(struct ptyterm_screen_state *state,
 
 static void put_char(struct ptyterm_screen_state *state,
                      struct ptyterm_screen_buffer *buffer, char value) {
-  size_t index;
+  char *cell;
 
-  index = (size_t)buffer->cursor_row * state->cols + buffer->cursor_col;
-  buffer->cells[index] = value;
+  cell = row_cells(state, buffer, buffer->cursor_row) + buffer->cursor_col;
+  if (*cell != value) {
+    *cell = value;
+    mark_rows(state, buffer, buffer->cursor_row, buffer->cursor_row);
+  }
   if (buffer->cursor_col + 1 >= state->cols) {
     buffer->cursor_col = 0;
     line_feed(state, buffer);
@@ -107,10 +155,61 @@ static void put_char(struct ptyterm_screen_state *state,
   buffer->cursor_col += 1;
 }
 
+/* Returns how many leading bytes of data are printable ASCII, which the
+ * parser copies straight into the cells. */
+static size_t printable_run(const char *data, size_t size) {
+  size_t i;
+
+  i = 0;
+#ifdef __SSE2__
+  /* Signed compares also reject bytes above 0x7f, which show as '?'. */
+  for (; i + 16 <= size; i += 16) {
+    __m128i bytes;
+    unsigned mask;
+
+    bytes = _mm_loadu_si128((const __m128i *)(data + i));
+    mask = (unsigned)_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1f)),
+                      _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7f))));
+    if (mask != 0xffff)
+      return i + (size_t)__builtin_ctz(~mask);
+  }
+#endif
+  for (; i < size; ++i) {
+    unsigned char byte;
+
+    byte = (unsigned char)data[i];
+    if (byte < 0x20 || byte > 0x7e)
+      break;
+  }
+  return i;
+}
+
+/* Writes a run of printable bytes that ends at or before the end of the
+ * cursor row, as put_char() would one byte at a time. */
+static void put_run(struct ptyterm_screen_state *state,
+                    struct ptyterm_screen_buffer *buffer, const char *data,
+                    size_t size) {
+  char *cells;
+
+  cells = row_cells(state, buffer, buffer->cursor_row) + buffer->cursor_col;
+  if (memcmp(cells, data, size) != 0) {
+    memcpy(cells, data, size);
+    mark_rows(state, buffer, buffer->cursor_row, buffer->cursor_row);
+  }
+  if (buffer->cursor_col + size >= state->cols) {
+    buffer->cursor_col = 0;
+    line_feed(state, buffer);
+    return;
+  }
+  buffer->cursor_col += (uint16_t)size;
+}
+
 static void clear_screen_range(struct ptyterm_screen_state *state,
                                struct ptyterm_screen_buffer *buffer,
                                size_t start, size_t end) {
   size_t total;
+  size_t row;
 
   total = screen_cell_count(state->rows, state->cols);
   if (start > total)
@@ -119,15 +218,23 @@ static void clear_screen_range(struct ptyterm_screen_state *state,
     end = total;
   if (start >= end)
     return;
-  memset(buffer->cells + start, ' ', end - start);
+  for (row = start / state->cols; row * state->cols < end; ++row) {
+    size_t first;
+    size_t last;
+
+    first = row * state->cols < start ? start - row * state->cols : 0;
+    last = (row + 1) * state->cols > end ? end - row * state->cols
+                                         : state->cols;
+    memset(row_cells(state, buffer, (uint16_t)row) + first, ' ', last - first);
+  }
+  mark_rows(state, buffer, (uint16_t)(start / state->cols),
+            (uint16_t)((end - 1) / state->cols));
 }
 
 static void clear_line_range(struct ptyterm_screen_state *state,
                              struct ptyterm_screen_buffer *buffer,
                              uint16_t row, uint16_t start_col,
                              uint16_t end_col) {
-  size_t row_start;
-
   if (row >= state->rows)
     return;
   if (start_col > state->cols)
@@ -137,47 +244,54 @@ static void clear_line_range(struct ptyterm_screen_state *state,
   if (start_col >= end_col)
     return;
 
-  row_start = (size_t)row * state->cols;
-  memset(buffer->cells + row_start + start_col, ' ', end_col - start_col);
+  memset(row_cells(state, buffer, row) + start_col, ' ', end_col - start_col);
+  mark_rows(state, buffer, row, row);
 }
 
 static int default_param(int value, int fallback) {
   return value < 0 ? fallback : value;
 }
 
-static size_t parse_csi_params(const char *buffer, size_t length, int *params,
-                               size_t max_params, int *private_mode) {
-  size_t count;
-  int current;
-  size_t i;
+/* Starts an ESC or CSI sequence with no intermediates and one missing
+ * parameter. */
+static void clear_sequence(struct ptyterm_screen_state *state) {
+  state->intermediate = 0;
+  state->private_marker = 0;
+  state->param_count = 1;
+  state->params[0] = -1;
+}
 
-  *private_mode = 0;
-  count = 0;
-  current = -1;
-  i = 0;
-  if (length > 0 && buffer[0] == '?') {
-    *private_mode = 1;
-    i = 1;
-  }
+static void collect_byte(struct ptyterm_screen_state *state,
+                         unsigned char byte) {
+  if (byte >= 0x3c && byte <= 0x3f)
+    state->private_marker = (char)byte;
+  else
+    state->intermediate = (char)byte;
+}
 
-  for (; i < length; ++i) {
-    unsigned char byte;
+/* Adds a digit to the last parameter.  param_count runs one past
+ * PTYTERM_SCREEN_MAX_PARAMS so that digits of extra parameters are
+ * dropped. */
+static void param_digit(struct ptyterm_screen_state *state,
+                        unsigned char byte) {
+  int *param;
 
-    byte = (unsigned char)buffer[i];
-    if (isdigit(byte)) {
-      current = current < 0 ? (byte - '0') : ((current * 10) + (byte - '0'));
-      continue;
-    }
-    if (byte == ';') {
-      if (count < max_params)
-        params[count++] = current;
-      current = -1;
-    }
-  }
+  if (state->param_count > PTYTERM_SCREEN_MAX_PARAMS)
+    return;
+  param = &state->params[state->param_count - 1];
+  if (*param < 0)
+    *param = byte - '0';
+  else if (*param < 6553)
+    *param = *param * 10 + (byte - '0');
+  else
+    *param = 65535;
+}
 
-  if (count < max_params)
-    params[count++] = current;
-  return count;
+static void param_separator(struct ptyterm_screen_state *state) {
+  if (state->param_count < PTYTERM_SCREEN_MAX_PARAMS)
+    state->params[state->param_count] = -1;
+  if (state->param_count <= PTYTERM_SCREEN_MAX_PARAMS)
+    state->param_count += 1;
 }
 
 static void switch_alt_screen(struct ptyterm_screen_state *state, int enable) {
@@ -193,6 +307,7 @@ static void switch_alt_screen(struct ptyterm_screen_state *state, int enable) {
     alt_buffer->cursor_row = 0;
     alt_buffer->cursor_col = 0;
     fill_screen(alt_buffer->cells, state->rows, state->cols);
+    mark_all_rows(state, alt_buffer);
     return;
   }
 
@@ -221,20 +336,26 @@ static void apply_private_mode(struct ptyterm_screen_state *state,
 
 static void execute_csi(struct ptyterm_screen_state *state, int command) {
   struct ptyterm_screen_buffer *buffer;
-  int params[8];
-  int private_mode;
+  int *params;
   size_t count;
   int row;
   int col;
 
   buffer = selected_buffer(state, PTYTERM_SCREEN_SELECTOR_ACTIVE);
-  count = parse_csi_params(state->csi_buffer, state->csi_length, params,
-                           sizeof(params) / sizeof(params[0]), &private_mode);
+  params = state->params;
+  count = state->param_count;
+  if (count > PTYTERM_SCREEN_MAX_PARAMS)
+    count = PTYTERM_SCREEN_MAX_PARAMS;
 
-  if (private_mode) {
-    apply_private_mode(state, command, params, count);
+  if (state->intermediate != 0)
+    return;
+  if (state->private_marker == '?') {
+    if (command == 'h' || command == 'l')
+      apply_private_mode(state, command, params, count);
     return;
   }
+  if (state->private_marker != 0)
+    return;
 
   switch (command) {
   case 'A':
@@ -338,8 +459,8 @@ static void reset_state(struct ptyterm_screen_state *state) {
   fill_screen(state->alt_screen.cells, state->rows, state->cols);
   state->active_screen = PTYTERM_SCREEN_SELECTOR_MAIN;
   state->cursor_visible = 1;
-  state->parser_state = PTYTERM_SCREEN_PARSER_TEXT;
-  state->csi_length = 0;
+  state->parser_state = PTYTERM_VT_GROUND;
+  clear_sequence(state);
   memset(&state->main_screen.cursor_row, 0,
          sizeof(state->main_screen) - offsetof(struct ptyterm_screen_buffer,
                                                cursor_row));
@@ -350,23 +471,17 @@ static void reset_state(struct ptyterm_screen_state *state) {
 
 int ptyterm_screen_init(struct ptyterm_screen_state *state, uint16_t rows,
                         uint16_t cols) {
-  size_t count;
-
   memset(state, 0, sizeof(*state));
   if (rows == 0)
     rows = 24;
   if (cols == 0)
     cols = 80;
-  count = screen_cell_count(rows, cols);
   state->rows = rows;
   state->cols = cols;
-  state->main_screen.cells = malloc(count);
-  if (state->main_screen.cells == NULL)
+  if (alloc_buffer(&state->main_screen, rows, cols) == -1)
     return -1;
-  state->alt_screen.cells = malloc(count);
-  if (state->alt_screen.cells == NULL) {
-    free(state->main_screen.cells);
-    state->main_screen.cells = NULL;
+  if (alloc_buffer(&state->alt_screen, rows, cols) == -1) {
+    free_buffer(&state->main_screen);
     return -1;
   }
   reset_state(state);
@@ -374,19 +489,90 @@ int ptyterm_screen_init(struct ptyterm_screen_state *state, uint16_t rows,
 }
 
 void ptyterm_screen_free(struct ptyterm_screen_state *state) {
-  free(state->main_screen.cells);
-  free(state->alt_screen.cells);
+  free_buffer(&state->main_screen);
+  free_buffer(&state->alt_screen);
   memset(state, 0, sizeof(*state));
 }
 
-int ptyterm_screen_resize(struct ptyterm_screen_state *state, uint16_t rows,
-                          uint16_t cols) {
-  char *new_main;
-  char *new_alt;
+/* Copies from's contents and cursor into to, whose arrays have the same
+ * size and are kept. */
+static void copy_buffer(struct ptyterm_screen_buffer *to,
+                        const struct ptyterm_screen_buffer *from,
+                        uint16_t rows, uint16_t cols) {
+  char *cells;
+  uint64_t *row_generations;
+  uint64_t *dirty_rows;
+
+  cells = to->cells;
+  row_generations = to->row_generations;
+  dirty_rows = to->dirty_rows;
+  memcpy(cells, from->cells, screen_cell_count(rows, cols));
+  memcpy(row_generations, from->row_generations,
+         rows * sizeof(*row_generations));
+  memcpy(dirty_rows, from->dirty_rows,
+         dirty_word_count(rows) * sizeof(*dirty_rows));
+  *to = *from;
+  to->cells = cells;
+  to->row_generations = row_generations;
+  to->dirty_rows = dirty_rows;
+}
+
+/* Makes dst an exact copy of src, parser state included.  dst is zeroed
+ * or a screen of its own; its arrays are reused when the sizes match. */
+int ptyterm_screen_copy(struct ptyterm_screen_state *dst,
+                        const struct ptyterm_screen_state *src) {
+  struct ptyterm_screen_buffer main_screen;
+  struct ptyterm_screen_buffer alt_screen;
+
+  if (dst->main_screen.cells != NULL && dst->rows == src->rows &&
+      dst->cols == src->cols) {
+    main_screen = dst->main_screen;
+    alt_screen = dst->alt_screen;
+  } else {
+    if (alloc_buffer(&main_screen, src->rows, src->cols) == -1)
+      return -1;
+    if (alloc_buffer(&alt_screen, src->rows, src->cols) == -1) {
+      free_buffer(&main_screen);
+      return -1;
+    }
+    ptyterm_screen_free(dst);
+  }
+  copy_buffer(&main_screen, &src->main_screen, src->rows, src->cols);
+  copy_buffer(&alt_screen, &src->alt_screen, src->rows, src->cols);
+  *dst = *src;
+  dst->main_screen = main_screen;
+  dst->alt_screen = alt_screen;
+  return 0;
+}
+
+/* Copies the overlapping cells of buffer into next, which is resized to
+ * rows x cols, and replaces buffer's arrays with next's. */
+static void move_buffer(const struct ptyterm_screen_state *state,
+                        struct ptyterm_screen_buffer *buffer,
+                        struct ptyterm_screen_buffer *next, uint16_t rows,
+                        uint16_t cols) {
   uint16_t copy_rows;
   uint16_t copy_cols;
   uint16_t row;
 
+  fill_screen(next->cells, rows, cols);
+  copy_rows = rows < state->rows ? rows : state->rows;
+  copy_cols = cols < state->cols ? cols : state->cols;
+  for (row = 0; row < copy_rows; ++row)
+    memcpy(next->cells + (size_t)row * cols, row_cells(state, buffer, row),
+           copy_cols);
+  free_buffer(buffer);
+  buffer->top = 0;
+  buffer->cells = next->cells;
+  buffer->row_generations = next->row_generations;
+  buffer->dirty_rows = next->dirty_rows;
+}
+
+int ptyterm_screen_resize(struct ptyterm_screen_state *state, uint16_t rows,
+                          uint16_t cols) {
+  struct ptyterm_screen_buffer new_main;
+  struct ptyterm_screen_buffer new_alt;
+
   if (rows == 0)
     rows = 24;
   if (cols == 0)
@@ -394,38 +580,105 @@ int ptyterm_screen_resize(struct ptyterm_screen_state *state, uint16_t rows,
   if (rows == state->rows && cols == state->cols)
     return 0;
 
-  new_main = malloc(screen_cell_count(rows, cols));
-  if (new_main == NULL)
+  if (alloc_buffer(&new_main, rows, cols) == -1)
     return -1;
-  new_alt = malloc(screen_cell_count(rows, cols));
-  if (new_alt == NULL) {
-    free(new_main);
+  if (alloc_buffer(&new_alt, rows, cols) == -1) {
+    free_buffer(&new_main);
     return -1;
   }
 
-  fill_screen(new_main, rows, cols);
-  fill_screen(new_alt, rows, cols);
-  copy_rows = rows < state->rows ? rows : state->rows;
-  copy_cols = cols < state->cols ? cols : state->cols;
-  for (row = 0; row < copy_rows; ++row) {
-    memcpy(new_main + (size_t)row * cols,
-           state->main_screen.cells + (size_t)row * state->cols, copy_cols);
-    memcpy(new_alt + (size_t)row * cols,
-           state->alt_screen.cells + (size_t)row * state->cols, copy_cols);
-  }
-
-  free(state->main_screen.cells);
-  free(state->alt_screen.cells);
-  state->main_screen.cells = new_main;
-  state->alt_screen.cells = new_alt;
+  move_buffer(state, &state->main_screen, &new_main, rows, cols);
+  move_buffer(state, &state->alt_screen, &new_alt, rows, cols);
   state->rows = rows;
   state->cols = cols;
   clamp_cursor(state, &state->main_screen);
   clamp_cursor(state, &state->alt_screen);
+  mark_all_rows(state, &state->main_screen);
+  mark_all_rows(state, &state->alt_screen);
   state->generation += 1;
   return 0;
 }
 
+/* Runs a C0 control and returns whether it changed the screen. */
+static int execute_control(struct ptyterm_screen_state *state,
+                           unsigned char byte) {
+  struct ptyterm_screen_buffer *buffer;
+  uint16_t next_col;
+
+  buffer = selected_buffer(state, PTYTERM_SCREEN_SELECTOR_ACTIVE);
+  switch (byte) {
+  case '\r':
+    buffer->cursor_col = 0;
+    return 1;
+  case '\n':
+  case '\v':
+  case '\f':
+    line_feed(state, buffer);
+    return 1;
+  case '\b':
+    if (buffer->cursor_col > 0)
+      buffer->cursor_col -= 1;
+    return 1;
+  case '\t':
+    /* Counted rather than compared with the cursor, which wraps back to
+     * column 0 when the tab stop is past the last column. */
+    next_col = (uint16_t)(((buffer->cursor_col / 8) + 1) * 8);
+    if (next_col > state->cols)
+      next_col = state->cols;
+    for (next_col -= buffer->cursor_col; next_col > 0; --next_col)
+      put_char(state, buffer, ' ');
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/* Runs an ESC sequence and returns whether it changed the screen.
+ * Sequences with intermediates, such as charset designations, are
+ * consumed without effect. */
+static int execute_esc(struct ptyterm_screen_state *state,
+                       unsigned char byte) {
+  struct ptyterm_screen_buffer *buffer;
+
+  if (state->intermediate != 0)
+    return 0;
+  buffer = selected_buffer(state, PTYTERM_SCREEN_SELECTOR_ACTIVE);
+  switch (byte) {
+  case '7':
+    buffer->saved_row = buffer->cursor_row;
+    buffer->saved_col = buffer->cursor_col;
+    return 1;
+  case '8':
+    buffer->cursor_row = buffer->saved_row;
+    buffer->cursor_col = buffer->saved_col;
+    clamp_cursor(state, buffer);
+    return 1;
+  case 'D':
+    line_feed(state, buffer);
+    return 1;
+  case 'E':
+    line_feed(state, buffer);
+    buffer->cursor_col = 0;
+    return 1;
+  case 'M':
+    if (buffer->cursor_row == 0)
+      scroll_down(state, buffer);
+    else
+      buffer->cursor_row -= 1;
+    return 1;
+  case 'c':
+    reset_state(state);
+    mark_all_rows(state, &state->main_screen);
+    mark_all_rows(state, &state->alt_screen);
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/* Each byte is one lookup in ptyterm_vt_table for its action and the next
+ * parser state.  Runs of printable ASCII in the ground state skip the
+ * table and are copied into the cursor row at once. */
 void ptyterm_screen_feed(struct ptyterm_screen_state *state, const char *data,
                          size_t size) {
   size_t i;
@@ -434,112 +687,56 @@ void ptyterm_screen_feed(struct ptyterm_screen_state *state, const char *data,
   changed = 0;
   for (i = 0; i < size; ++i) {
     unsigned char byte;
-    struct ptyterm_screen_buffer *buffer;
+    unsigned char entry;
 
     byte = (unsigned char)data[i];
-    buffer = selected_buffer(state, PTYTERM_SCREEN_SELECTOR_ACTIVE);
-
-    if (state->parser_state == PTYTERM_SCREEN_PARSER_ESC_CHARSET) {
-      state->parser_state = PTYTERM_SCREEN_PARSER_TEXT;
-      continue;
-    }
-
-    if (state->parser_state == PTYTERM_SCREEN_PARSER_ESC) {
-      state->parser_state = PTYTERM_SCREEN_PARSER_TEXT;
-      if (byte == '[') {
-        state->parser_state = PTYTERM_SCREEN_PARSER_CSI;
-        state->csi_length = 0;
-        continue;
-      }
-      if (byte == '(' || byte == ')' || byte == '*' || byte == '+') {
-        state->parser_state = PTYTERM_SCREEN_PARSER_ESC_CHARSET;
-        continue;
-      }
-      if (byte == '7') {
-        buffer->saved_row = buffer->cursor_row;
-        buffer->saved_col = buffer->cursor_col;
-        changed = 1;
-        continue;
-      }
-      if (byte == '8') {
-        buffer->cursor_row = buffer->saved_row;
-        buffer->cursor_col = buffer->saved_col;
-        clamp_cursor(state, buffer);
-        changed = 1;
-        continue;
-      }
-      if (byte == 'D') {
-        line_feed(state, buffer);
-        changed = 1;
-        continue;
-      }
-      if (byte == 'E') {
-        line_feed(state, buffer);
-        buffer->cursor_col = 0;
-        changed = 1;
-        continue;
-      }
-      if (byte == 'M') {
-        if (buffer->cursor_row == 0) {
-          scroll_down(state, buffer);
-        } else {
-          buffer->cursor_row -= 1;
-        }
-        changed = 1;
-        continue;
-      }
-      if (byte == 'c') {
-        reset_state(state);
-        changed = 1;
-      }
-      continue;
-    }
-
-    if (state->parser_state == PTYTERM_SCREEN_PARSER_CSI) {
-      if (byte >= 0x40 && byte <= 0x7e) {
-        execute_csi(state, byte);
-        state->parser_state = PTYTERM_SCREEN_PARSER_TEXT;
-        state->csi_length = 0;
-        changed = 1;
-        continue;
-      }
-      if (state->csi_length + 1 < sizeof(state->csi_buffer))
-        state->csi_buffer[state->csi_length++] = (char)byte;
-      continue;
-    }
-
-    if (byte == 0x1b) {
-      state->parser_state = PTYTERM_SCREEN_PARSER_ESC;
-      continue;
-    }
-    if (byte == '\r') {
-      buffer->cursor_col = 0;
-      changed = 1;
-      continue;
-    }
-    if (byte == '\n') {
-      line_feed(state, buffer);
-      changed = 1;
-      continue;
-    }
-    if (byte == '\b') {
-      if (buffer->cursor_col > 0)
-        buffer->cursor_col -= 1;
+    if (state->parser_state == PTYTERM_VT_GROUND && byte >= 0x20 &&
+        byte <= 0x7e) {
+      struct ptyterm_screen_buffer *buffer;
+      size_t room;
+      size_t run;
+
+      buffer = selected_buffer(state, PTYTERM_SCREEN_SELECTOR_ACTIVE);
+      room = (size_t)(state->cols - buffer->cursor_col);
+      run = printable_run(data + i, size - i < room ? size - i : room);
+      put_run(state, buffer, data + i, run);
+      i += run - 1;
       changed = 1;
       continue;
     }
-    if (byte == '\t') {
-      uint16_t next_col;
 
-      next_col = (uint16_t)(((buffer->cursor_col / 8) + 1) * 8);
-      while (buffer->cursor_col < next_col)
-        put_char(state, buffer, ' ');
+    entry = ptyterm_vt_table[state->parser_state][byte];
+    state->parser_state = PTYTERM_VT_NEXT(entry);
+    switch (PTYTERM_VT_ACTION(entry)) {
+    case PTYTERM_VT_PRINT:
+      put_char(state, selected_buffer(state, PTYTERM_SCREEN_SELECTOR_ACTIVE),
+               byte <= 0x7e ? (char)byte : '?');
       changed = 1;
-      continue;
-    }
-    if (byte >= 0x20 && byte != 0x7f) {
-      put_char(state, buffer, byte <= 0x7e ? (char)byte : '?');
+      break;
+    case PTYTERM_VT_EXECUTE:
+      changed |= execute_control(state, byte);
+      break;
+    case PTYTERM_VT_CLEAR:
+      clear_sequence(state);
+      break;
+    case PTYTERM_VT_COLLECT:
+      collect_byte(state, byte);
+      break;
+    case PTYTERM_VT_PARAM:
+      param_digit(state, byte);
+      break;
+    case PTYTERM_VT_SEPARATE:
+      param_separator(state);
+      break;
+    case PTYTERM_VT_ESC_DISPATCH:
+      changed |= execute_esc(state, byte);
+      break;
+    case PTYTERM_VT_CSI_DISPATCH:
+      execute_csi(state, byte);
       changed = 1;
+      break;
+    default:
+      break;
     }
   }
 
@@ -547,6 +744,18 @@ void ptyterm_screen_feed(struct ptyterm_screen_state *state, const char *data,
     state->generation += 1;
 }
 
+/* Bytes held for the cells and row tracking of both screens. */
+size_t ptyterm_screen_memory(const struct ptyterm_screen_state *state) {
+  if (state->main_screen.cells == NULL)
+    return 0;
+  return ptyterm_screen_size_memory(state->rows, state->cols);
+}
+
+size_t ptyterm_screen_size_memory(uint16_t rows, uint16_t cols) {
+  return 2 * (screen_cell_count(rows, cols) + rows * sizeof(uint64_t) +
+              dirty_word_count(rows) * sizeof(uint64_t));
+}
+
 uint16_t ptyterm_screen_rows(const struct ptyterm_screen_state *state) {
   return state->rows;
 }
@@ -581,8 +790,48 @@ uint16_t ptyterm_screen_cursor_col(const struct ptyterm_screen_state *state,
   return buffer->cursor_col;
 }
 
-const char *ptyterm_screen_cells(const struct ptyterm_screen_state *state,
-                                 uint32_t selector,
-                                 uint32_t *selected_screen_out) {
-  return selected_buffer_const(state, selector, selected_screen_out)->cells;
+uint64_t ptyterm_screen_row_generation(const struct ptyterm_screen_state *state,
+                                       uint32_t selector, uint16_t row) {
+  const struct ptyterm_screen_buffer *buffer;
+
+  buffer = selected_buffer_const(state, selector, NULL);
+  return row < state->rows ? buffer->row_generations[row] : 0;
+}
+
+int ptyterm_screen_row_dirty(const struct ptyterm_screen_state *state,
+                             uint32_t selector, uint16_t row) {
+  const struct ptyterm_screen_buffer *buffer;
+
+  buffer = selected_buffer_const(state, selector, NULL);
+  if (row >= state->rows)
+    return 0;
+  return (buffer->dirty_rows[row / 64] >> (row % 64)) & 1;
+}
+
+void ptyterm_screen_clear_dirty(struct ptyterm_screen_state *state,
+                                uint32_t selector) {
+  struct ptyterm_screen_buffer *buffer;
+
+  buffer = selected_buffer(state, selector);
+  memset(buffer->dirty_rows, 0,
+         dirty_word_count(state->rows) * sizeof(*buffer->dirty_rows));
+}
+
+const char *ptyterm_screen_row(const struct ptyterm_screen_state *state,
+                               uint32_t selector, uint16_t row) {
+  return row_cells(state, selected_buffer_const(state, selector, NULL), row);
+}
+
+/* Copies the rows of the selected screen, top to bottom, into cells. */
+void ptyterm_screen_copy_cells(const struct ptyterm_screen_state *state,
+                               uint32_t selector, char *cells,
+                               uint32_t *selected_screen_out) {
+  const struct ptyterm_screen_buffer *buffer;
+  size_t first;
+
+  buffer = selected_buffer_const(state, selector, selected_screen_out);
+  first = screen_cell_count((uint16_t)(state->rows - buffer->top), state->cols);
+  memcpy(cells, row_cells(state, buffer, 0), first);
+  memcpy(cells + first, buffer->cells,
+         screen_cell_count(state->rows, state->cols) - first);
 }
\ No newline at end of file
@@ -6,14 +6,31 @@
 
 #include "ptyterm-control.h"
 
+/* cells holds the rows as a ring: row r is stored at row (top + r) % rows,
+ * so scrolling moves top and clears one row instead of moving the screen.
+ *
+ * row_generations[row] is the screen generation that last changed the row,
+ * so a consumer that saw generation G only needs the rows above G.
+ * dirty_rows is a bitmap of rows changed since ptyterm_screen_clear_dirty(),
+ * for a single consumer that tracks changes itself.  A scroll marks every
+ * row. */
 struct ptyterm_screen_buffer {
   char *cells;
+  uint64_t *row_generations;
+  uint64_t *dirty_rows;
   uint16_t cursor_row;
   uint16_t cursor_col;
   uint16_t saved_row;
   uint16_t saved_col;
+  uint16_t top;
 };
 
+#define PTYTERM_SCREEN_MAX_PARAMS 16
+
+/* The parser collects CSI parameters as their digits arrive; a missing
+ * parameter is -1.  intermediate keeps the last intermediate byte of an
+ * ESC or CSI sequence and private_marker the leading '<', '=', '>' or
+ * '?' of a CSI sequence. */
 struct ptyterm_screen_state {
   uint16_t rows;
   uint16_t cols;
@@ -21,8 +38,10 @@ struct ptyterm_screen_state {
   uint64_t generation;
   uint8_t cursor_visible;
   uint8_t parser_state;
-  size_t csi_length;
-  char csi_buffer[64];
+  char intermediate;
+  char private_marker;
+  size_t param_count;
+  int params[PTYTERM_SCREEN_MAX_PARAMS];
   struct ptyterm_screen_buffer main_screen;
   struct ptyterm_screen_buffer alt_screen;
 };
@@ -32,8 +51,12 @@ int ptyterm_screen_init(struct ptyterm_screen_state *state, uint16_t rows,
 void ptyterm_screen_free(struct ptyterm_screen_state *state);
 int ptyterm_screen_resize(struct ptyterm_screen_state *state, uint16_t rows,
                           uint16_t cols);
+int ptyterm_screen_copy(struct ptyterm_screen_state *dst,
+                        const struct ptyterm_screen_state *src);
 void ptyterm_screen_feed(struct ptyterm_screen_state *state, const char *data,
                          size_t size);
+size_t ptyterm_screen_memory(const struct ptyterm_screen_state *state);
+size_t ptyterm_screen_size_memory(uint16_t rows, uint16_t cols);
 uint16_t ptyterm_screen_rows(const struct ptyterm_screen_state *state);
 uint16_t ptyterm_screen_cols(const struct ptyterm_screen_state *state);
 uint64_t ptyterm_screen_generation(const struct ptyterm_screen_state *state);
@@ -44,8 +67,16 @@ uint16_t ptyterm_screen_cursor_row(const struct ptyterm_screen_state *state,
 uint16_t ptyterm_screen_cursor_col(const struct ptyterm_screen_state *state,
                                    uint32_t selector,
                                    uint32_t *selected_screen_out);
-const char *ptyterm_screen_cells(const struct ptyterm_screen_state *state,
-                                 uint32_t selector,
-                                 uint32_t *selected_screen_out);
+uint64_t ptyterm_screen_row_generation(const struct ptyterm_screen_state *state,
+                                       uint32_t selector, uint16_t row);
+int ptyterm_screen_row_dirty(const struct ptyterm_screen_state *state,
+                             uint32_t selector, uint16_t row);
+void ptyterm_screen_clear_dirty(struct ptyterm_screen_state *state,
+                                uint32_t selector);
+const char *ptyterm_screen_row(const struct ptyterm_screen_state *state,
+                               uint32_t selector, uint16_t row);
+void ptyterm_screen_copy_cells(const struct ptyterm_screen_state *state,
+                               uint32_t selector, char *cells,
+                               uint32_t *selected_screen_out);
 
 #endif
\ No newline at end of file
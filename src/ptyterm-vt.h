@@ -0,0 +1,37 @@
+#ifndef PTYTERM_VT_H
+#define PTYTERM_VT_H
+
+/* States and actions of the escape sequence parser, after the DEC VT500
+ * state machine.  ptyterm-vtgen writes ptyterm-vt-table.h, which maps
+ * every state and input byte to an action and the next state, packed as
+ * (action << 4) | state. */
+enum {
+  PTYTERM_VT_GROUND = 0,
+  PTYTERM_VT_ESCAPE = 1,
+  PTYTERM_VT_ESCAPE_INTERMEDIATE = 2,
+  PTYTERM_VT_CSI_ENTRY = 3,
+  PTYTERM_VT_CSI_PARAM = 4,
+  PTYTERM_VT_CSI_INTERMEDIATE = 5,
+  PTYTERM_VT_CSI_IGNORE = 6,
+  PTYTERM_VT_OSC_STRING = 7,
+  PTYTERM_VT_STRING_IGNORE = 8,
+  PTYTERM_VT_STATE_COUNT = 9,
+};
+
+enum {
+  PTYTERM_VT_IGNORE = 0,
+  PTYTERM_VT_PRINT = 1,
+  PTYTERM_VT_EXECUTE = 2,
+  PTYTERM_VT_CLEAR = 3,
+  PTYTERM_VT_COLLECT = 4,
+  PTYTERM_VT_PARAM = 5,
+  PTYTERM_VT_ESC_DISPATCH = 6,
+  PTYTERM_VT_CSI_DISPATCH = 7,
+  PTYTERM_VT_SEPARATE = 8,
+};
+
+#define PTYTERM_VT_ENTRY(action, state) ((unsigned)(action) << 4 | (state))
+#define PTYTERM_VT_ACTION(entry) ((entry) >> 4)
+#define PTYTERM_VT_NEXT(entry) ((entry) & 0x0f)
+
+#endif
@@ -0,0 +1,137 @@
+/* Writes ptyterm-vt-table.h, the transition table of the escape sequence
+ * parser in ptyterm-screen.c, to standard output. */
+#include "ptyterm-vt.h"
+
+#include <stdio.h>
+
+static unsigned char table[PTYTERM_VT_STATE_COUNT][256];
+
+static void set_range(int state, int first, int last, int action, int next) {
+  int byte;
+
+  for (byte = first; byte <= last; ++byte)
+    table[state][byte] = (unsigned char)PTYTERM_VT_ENTRY(action, next);
+}
+
+static void set_byte(int state, int byte, int action, int next) {
+  set_range(state, byte, byte, action, next);
+}
+
+/* C0 controls other than CAN, SUB and ESC run in place, as on a VT. */
+static void execute_controls(int state) {
+  set_range(state, 0x00, 0x17, PTYTERM_VT_EXECUTE, state);
+  set_byte(state, 0x19, PTYTERM_VT_EXECUTE, state);
+  set_range(state, 0x1c, 0x1f, PTYTERM_VT_EXECUTE, state);
+}
+
+static void build_table(void) {
+  int state;
+
+  /* Unlisted bytes are ignored without leaving the state, which covers
+   * DEL everywhere and 8-bit bytes inside sequences. */
+  for (state = 0; state < PTYTERM_VT_STATE_COUNT; ++state)
+    set_range(state, 0x00, 0xff, PTYTERM_VT_IGNORE, state);
+
+  execute_controls(PTYTERM_VT_GROUND);
+  set_range(PTYTERM_VT_GROUND, 0x20, 0x7e, PTYTERM_VT_PRINT,
+            PTYTERM_VT_GROUND);
+  set_range(PTYTERM_VT_GROUND, 0x80, 0xff, PTYTERM_VT_PRINT,
+            PTYTERM_VT_GROUND);
+
+  execute_controls(PTYTERM_VT_ESCAPE);
+  set_range(PTYTERM_VT_ESCAPE, 0x20, 0x2f, PTYTERM_VT_COLLECT,
+            PTYTERM_VT_ESCAPE_INTERMEDIATE);
+  set_range(PTYTERM_VT_ESCAPE, 0x30, 0x7e, PTYTERM_VT_ESC_DISPATCH,
+            PTYTERM_VT_GROUND);
+  set_byte(PTYTERM_VT_ESCAPE, '[', PTYTERM_VT_CLEAR, PTYTERM_VT_CSI_ENTRY);
+  set_byte(PTYTERM_VT_ESCAPE, ']', PTYTERM_VT_IGNORE, PTYTERM_VT_OSC_STRING);
+  set_byte(PTYTERM_VT_ESCAPE, 'P', PTYTERM_VT_IGNORE,
+           PTYTERM_VT_STRING_IGNORE);
+  set_byte(PTYTERM_VT_ESCAPE, 'X', PTYTERM_VT_IGNORE,
+           PTYTERM_VT_STRING_IGNORE);
+  set_byte(PTYTERM_VT_ESCAPE, '^', PTYTERM_VT_IGNORE,
+           PTYTERM_VT_STRING_IGNORE);
+  set_byte(PTYTERM_VT_ESCAPE, '_', PTYTERM_VT_IGNORE,
+           PTYTERM_VT_STRING_IGNORE);
+
+  execute_controls(PTYTERM_VT_ESCAPE_INTERMEDIATE);
+  set_range(PTYTERM_VT_ESCAPE_INTERMEDIATE, 0x20, 0x2f, PTYTERM_VT_COLLECT,
+            PTYTERM_VT_ESCAPE_INTERMEDIATE);
+  set_range(PTYTERM_VT_ESCAPE_INTERMEDIATE, 0x30, 0x7e,
+            PTYTERM_VT_ESC_DISPATCH, PTYTERM_VT_GROUND);
+
+  execute_controls(PTYTERM_VT_CSI_ENTRY);
+  set_range(PTYTERM_VT_CSI_ENTRY, 0x20, 0x2f, PTYTERM_VT_COLLECT,
+            PTYTERM_VT_CSI_INTERMEDIATE);
+  set_range(PTYTERM_VT_CSI_ENTRY, 0x30, 0x39, PTYTERM_VT_PARAM,
+            PTYTERM_VT_CSI_PARAM);
+  set_byte(PTYTERM_VT_CSI_ENTRY, ':', PTYTERM_VT_IGNORE,
+           PTYTERM_VT_CSI_IGNORE);
+  set_byte(PTYTERM_VT_CSI_ENTRY, ';', PTYTERM_VT_SEPARATE,
+           PTYTERM_VT_CSI_PARAM);
+  set_range(PTYTERM_VT_CSI_ENTRY, 0x3c, 0x3f, PTYTERM_VT_COLLECT,
+            PTYTERM_VT_CSI_PARAM);
+  set_range(PTYTERM_VT_CSI_ENTRY, 0x40, 0x7e, PTYTERM_VT_CSI_DISPATCH,
+            PTYTERM_VT_GROUND);
+
+  execute_controls(PTYTERM_VT_CSI_PARAM);
+  set_range(PTYTERM_VT_CSI_PARAM, 0x20, 0x2f, PTYTERM_VT_COLLECT,
+            PTYTERM_VT_CSI_INTERMEDIATE);
+  set_range(PTYTERM_VT_CSI_PARAM, 0x30, 0x39, PTYTERM_VT_PARAM,
+            PTYTERM_VT_CSI_PARAM);
+  set_byte(PTYTERM_VT_CSI_PARAM, ':', PTYTERM_VT_IGNORE,
+           PTYTERM_VT_CSI_IGNORE);
+  set_byte(PTYTERM_VT_CSI_PARAM, ';', PTYTERM_VT_SEPARATE,
+           PTYTERM_VT_CSI_PARAM);
+  set_range(PTYTERM_VT_CSI_PARAM, 0x3c, 0x3f, PTYTERM_VT_IGNORE,
+            PTYTERM_VT_CSI_IGNORE);
+  set_range(PTYTERM_VT_CSI_PARAM, 0x40, 0x7e, PTYTERM_VT_CSI_DISPATCH,
+            PTYTERM_VT_GROUND);
+
+  execute_controls(PTYTERM_VT_CSI_INTERMEDIATE);
+  set_range(PTYTERM_VT_CSI_INTERMEDIATE, 0x20, 0x2f, PTYTERM_VT_COLLECT,
+            PTYTERM_VT_CSI_INTERMEDIATE);
+  set_range(PTYTERM_VT_CSI_INTERMEDIATE, 0x30, 0x3f, PTYTERM_VT_IGNORE,
+            PTYTERM_VT_CSI_IGNORE);
+  set_range(PTYTERM_VT_CSI_INTERMEDIATE, 0x40, 0x7e, PTYTERM_VT_CSI_DISPATCH,
+            PTYTERM_VT_GROUND);
+
+  execute_controls(PTYTERM_VT_CSI_IGNORE);
+  set_range(PTYTERM_VT_CSI_IGNORE, 0x40, 0x7e, PTYTERM_VT_IGNORE,
+            PTYTERM_VT_GROUND);
+
+  /* Titles and other strings are dropped up to BEL or ST (ESC \). */
+  set_byte(PTYTERM_VT_OSC_STRING, 0x07, PTYTERM_VT_IGNORE, PTYTERM_VT_GROUND);
+
+  /* CAN and SUB cancel a sequence and ESC starts a new one from any
+   * state. */
+  for (state = 0; state < PTYTERM_VT_STATE_COUNT; ++state) {
+    set_byte(state, 0x18, PTYTERM_VT_EXECUTE, PTYTERM_VT_GROUND);
+    set_byte(state, 0x1a, PTYTERM_VT_EXECUTE, PTYTERM_VT_GROUND);
+    set_byte(state, 0x1b, PTYTERM_VT_CLEAR, PTYTERM_VT_ESCAPE);
+  }
+}
+
+int main(void) {
+  int state;
+  int byte;
+
+  build_table();
+  printf("/* Generated by ptyterm-vtgen; do not edit. */\n"
+         "static const unsigned char "
+         "ptyterm_vt_table[PTYTERM_VT_STATE_COUNT][256] = {\n");
+  for (state = 0; state < PTYTERM_VT_STATE_COUNT; ++state) {
+    printf("  {\n");
+    for (byte = 0; byte < 256; ++byte) {
+      printf("%s0x%02x,%s", byte % 12 == 0 ? "    " : " ",
+             table[state][byte], byte % 12 == 11 || byte == 255 ? "\n" : "");
+    }
+    printf("  },\n");
+  }
+  printf("};\n");
+  if (fflush(stdout) == EOF || ferror(stdout)) {
+    perror("ptyterm-vtgen");
+    return 1;
+  }
+  return 0;
+}
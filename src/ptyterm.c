@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/signalfd.h>
 #include <sys/stat.h>
@@ -58,6 +59,7 @@ static int parse_help_format(const char *value);
 static int parse_screen_selector(const char *value);
 static int parse_wait_predicate(const char *value);
 static int parse_duration_ms(const char *value, uint64_t *duration_ms_out);
+static int parse_buffer_size(const char *value, uint32_t *size_out);
 static int monotonic_time_ms(uint64_t *time_ms_out);
 static int run_view_client(const char *socket_path, int session_id,
                            uint32_t screen_selector);
@@ -82,7 +84,8 @@ static void print_daemon_stop_status(int stopping, int daemon_pid,
                    int status_format);
 static void print_recv_status_line(uint32_t returned_bytes, uint64_t start_offset,
                                    uint64_t end_offset, uint64_t next_recv_offset,
-                                   int truncated, const char *reason);
+                                   uint64_t lag_bytes, int truncated,
+                                   const char *reason);
 
 enum ptyterm_recv_format {
   PTYTERM_RECV_FORMAT_AUTO = 0,
@@ -218,6 +221,35 @@ static int parse_duration_ms(const char *value, uint64_t *duration_ms_out) {
   return 0;
 }
 
+/* Accepts a byte count with an optional K, M, or G suffix. */
+static int parse_buffer_size(const char *value, uint32_t *size_out) {
+  char *end;
+  unsigned long long number;
+  uint64_t multiplier;
+
+  errno = 0;
+  number = strtoull(value, &end, 0);
+  if (errno != 0 || value == end || number == 0 || *value == '-')
+    return -1;
+
+  if (*end == '\0')
+    multiplier = 1;
+  else if (strcmp(end, "K") == 0 || strcmp(end, "k") == 0)
+    multiplier = 1024;
+  else if (strcmp(end, "M") == 0 || strcmp(end, "m") == 0)
+    multiplier = 1024 * 1024;
+  else if (strcmp(end, "G") == 0 || strcmp(end, "g") == 0)
+    multiplier = 1024 * 1024 * 1024;
+  else
+    return -1;
+
+  if (number > UINT32_MAX / multiplier)
+    return -1;
+
+  *size_out = (uint32_t)(number * multiplier);
+  return 0;
+}
+
 static int monotonic_time_ms(uint64_t *time_ms_out) {
   struct timespec ts;
 
@@ -228,31 +260,16 @@ static int monotonic_time_ms(uint64_t *time_ms_out) {
   return 0;
 }
 
-static const char *find_bytes(const char *haystack, size_t haystack_size,
-                              const char *needle, size_t needle_size) {
-  size_t offset;
-
-  if (needle_size == 0)
-    return haystack;
-  if (needle_size > haystack_size)
-    return NULL;
-
-  for (offset = 0; offset + needle_size <= haystack_size; ++offset) {
-    if (memcmp(haystack + offset, needle, needle_size) == 0)
-      return haystack + offset;
-  }
-  return NULL;
-}
-
 static void print_recv_status_line(uint32_t returned_bytes, uint64_t start_offset,
                                    uint64_t end_offset, uint64_t next_recv_offset,
-                                   int truncated, const char *reason) {
+                                   uint64_t lag_bytes, int truncated,
+                                   const char *reason) {
   fprintf(stderr,
-          "recv %u bytes; offsets %llu..%llu; next-offset=%llu; truncated=%s; reason=%s\n",
+          "recv %u bytes; offsets %llu..%llu; next-offset=%llu; lag=%llu; truncated=%s; reason=%s\n",
           returned_bytes, (unsigned long long)start_offset,
           (unsigned long long)end_offset,
           (unsigned long long)next_recv_offset,
-          truncated ? "yes" : "no", reason);
+          (unsigned long long)lag_bytes, truncated ? "yes" : "no", reason);
 }
 
 static void print_help_discovery(FILE *out, const char *program_name) {
@@ -295,6 +312,7 @@ static void print_text_help(FILE *out, const char *program_name) {
   fprintf(out, "Management options:\n");
   fprintf(out, "  -A, --attach        : attach to one daemon-managed session\n");
   fprintf(out, "  -C, --create        : create a daemon-managed session\n");
+  fprintf(out, "      --buffer-size=SIZE : output ring size of the created session (K|M|G; default: the daemon's --output-buffer)\n");
   fprintf(out, "      --daemon-status : report whether the daemon is running\n");
   fprintf(out, "      --daemon-stop   : request graceful daemon shutdown\n");
   fprintf(out, "      --status-format=text|kv : select structured status output\n");
@@ -302,8 +320,10 @@ static void print_text_help(FILE *out, const char *program_name) {
   fprintf(out, "  -R, --resize        : resize one daemon-managed session\n");
   fprintf(out, "  -L, --list          : list daemon-managed sessions\n");
   fprintf(out, "  -B, --buffer-info   : show buffer state for one session\n");
+  fprintf(out, "      --resize-buffer=SIZE : resize one session's output ring, keeping its newest output\n");
   fprintf(out, "      --send=DATA     : send decoded bytes to one session\n");
   fprintf(out, "      --recv          : receive buffered output from one session\n");
+  fprintf(out, "      --follow        : map one session's output ring and copy it to stdout until the session closes\n");
   fprintf(out, "      --snapshot      : show a readable terminal snapshot for one session\n");
   fprintf(out, "      --view          : open a scrollable full-screen terminal snapshot viewer\n");
   fprintf(out, "      --wait-state=PREDICATE : wait for a state predicate and print the resolving snapshot\n");
@@ -315,6 +335,13 @@ static void print_text_help(FILE *out, const char *program_name) {
   fprintf(out, "      --recv-timeout=DURATION : wait up to DURATION (ms|s) for recv\n");
   fprintf(out, "      --recv-until=STRING : wait until unread output contains STRING\n");
   fprintf(out, "      --peek          : inspect buffered output without advancing recv\n");
+  fprintf(out, "      --recv-cursor=NAME : read through a named cursor kept by the daemon\n");
+  fprintf(out, "      --cursor-delete=NAME : remove a named recv cursor from one session\n");
+  fprintf(out, "      --since=DURATION : recv output produced within the last DURATION (ms|s)\n");
+  fprintf(out, "      --before=DURATION : stop recv, or replay --snapshot, at output older than DURATION\n");
+  fprintf(out, "      --since-generation=N : show only the --snapshot rows changed after screen generation N\n");
+  fprintf(out, "      --recv-lines=N  : recv at most N lines, or the last N lines when N is negative\n");
+  fprintf(out, "      --from-line=K   : recv from line K of the session output (1-based)\n");
   fprintf(out, "      --session=ID    : select one session for management operations\n");
   fprintf(out, "      --rows=N        : rows for --resize (alias: --lines)\n");
   fprintf(out, "      --cols=N        : cols for --resize\n");
@@ -399,6 +426,16 @@ static void print_yaml_help(FILE *out, const char *program_name) {
   fprintf(out, "      short: -C\n");
   fprintf(out, "      argument: none\n");
   fprintf(out, "      description: Create a daemon-managed session.\n");
+  fprintf(out, "    - long: --buffer-size\n");
+  fprintf(out, "      short: null\n");
+  fprintf(out, "      argument: SIZE\n");
+  fprintf(out, "      requires: [--create]\n");
+  fprintf(out, "      description: Output ring size of the created session, with an optional K, M, or G suffix.\n");
+  fprintf(out, "    - long: --resize-buffer\n");
+  fprintf(out, "      short: null\n");
+  fprintf(out, "      argument: SIZE\n");
+  fprintf(out, "      requires: [--session]\n");
+  fprintf(out, "      description: Resize one session's output ring, keeping its newest output and stream offsets.\n");
   fprintf(out, "    - long: --daemon-status\n");
   fprintf(out, "      short: null\n");
   fprintf(out, "      argument: none\n");
@@ -436,6 +473,11 @@ static void print_yaml_help(FILE *out, const char *program_name) {
   fprintf(out, "      argument: none\n");
   fprintf(out, "      requires: [--session]\n");
   fprintf(out, "      description: Receive buffered output from one session.\n");
+  fprintf(out, "    - long: --follow\n");
+  fprintf(out, "      short: null\n");
+  fprintf(out, "      argument: none\n");
+  fprintf(out, "      requires: [--session]\n");
+  fprintf(out, "      description: Map one session's output ring read-only and copy its output to stdout until the session closes.\n");
   fprintf(out, "    - long: --snapshot\n");
   fprintf(out, "      short: null\n");
   fprintf(out, "      argument: none\n");
@@ -488,6 +530,41 @@ static void print_yaml_help(FILE *out, const char *program_name) {
   fprintf(out, "      argument: none\n");
   fprintf(out, "      requires: [--recv]\n");
   fprintf(out, "      description: Read buffered output without advancing the recv cursor.\n");
+  fprintf(out, "    - long: --recv-cursor\n");
+  fprintf(out, "      short: null\n");
+  fprintf(out, "      argument: NAME\n");
+  fprintf(out, "      requires: [--recv]\n");
+  fprintf(out, "      description: Read through a named daemon-side cursor with its own offset instead of the default one.\n");
+  fprintf(out, "    - long: --cursor-delete\n");
+  fprintf(out, "      short: null\n");
+  fprintf(out, "      argument: NAME\n");
+  fprintf(out, "      requires: [--session]\n");
+  fprintf(out, "      description: Remove a named recv cursor so it no longer holds back a paused session.\n");
+  fprintf(out, "    - long: --since\n");
+  fprintf(out, "      short: null\n");
+  fprintf(out, "      argument: DURATION\n");
+  fprintf(out, "      requires: [--recv]\n");
+  fprintf(out, "      description: Read output produced within the last DURATION without moving the recv cursor.\n");
+  fprintf(out, "    - long: --before\n");
+  fprintf(out, "      short: null\n");
+  fprintf(out, "      argument: DURATION\n");
+  fprintf(out, "      requires: [--recv, --snapshot]\n");
+  fprintf(out, "      description: End recv at output older than DURATION, or show the screen as it was DURATION ago.\n");
+  fprintf(out, "    - long: --since-generation\n");
+  fprintf(out, "      short: null\n");
+  fprintf(out, "      argument: N\n");
+  fprintf(out, "      requires: [--snapshot]\n");
+  fprintf(out, "      description: Show only the rows changed after screen generation N, or the whole screen when they cannot be told apart.\n");
+  fprintf(out, "    - long: --recv-lines\n");
+  fprintf(out, "      short: null\n");
+  fprintf(out, "      argument: N\n");
+  fprintf(out, "      requires: [--recv]\n");
+  fprintf(out, "      description: Stop recv after N lines, or with a negative N read the last N lines without moving the recv cursor.\n");
+  fprintf(out, "    - long: --from-line\n");
+  fprintf(out, "      short: null\n");
+  fprintf(out, "      argument: K\n");
+  fprintf(out, "      requires: [--recv]\n");
+  fprintf(out, "      description: Read from line K of the session output, counting from 1, without moving the recv cursor.\n");
   fprintf(out, "    - long: --recv-size\n");
   fprintf(out, "      short: null\n");
   fprintf(out, "      argument: N\n");
@@ -645,6 +722,37 @@ static void print_daemon_status(int running, int daemon_pid,
   printf("daemon_pid=%d\n", daemon_pid);
 }
 
+static void print_daemon_memory_status(
+    const struct ptyterm_daemon_status_response *response, int status_format) {
+  if (status_format == PTYTERM_STATUS_FORMAT_TEXT) {
+    if (response->memory_limit != 0)
+      printf("memory limit: %llu\n",
+             (unsigned long long)response->memory_limit);
+    else
+      printf("memory limit: none\n");
+    printf("memory used: %llu\n", (unsigned long long)response->memory_used);
+    printf("ring bytes: %llu\n", (unsigned long long)response->ring_bytes);
+    printf("screen bytes: %llu\n", (unsigned long long)response->screen_bytes);
+    printf("index bytes: %llu\n", (unsigned long long)response->index_bytes);
+    printf("history bytes: %llu\n",
+           (unsigned long long)response->history_bytes);
+    printf("session bytes: %llu\n",
+           (unsigned long long)response->session_bytes);
+    printf("trimmed bytes: %llu\n",
+           (unsigned long long)response->trimmed_bytes);
+    return;
+  }
+
+  printf("memory_limit=%llu\n", (unsigned long long)response->memory_limit);
+  printf("memory_used=%llu\n", (unsigned long long)response->memory_used);
+  printf("ring_bytes=%llu\n", (unsigned long long)response->ring_bytes);
+  printf("screen_bytes=%llu\n", (unsigned long long)response->screen_bytes);
+  printf("index_bytes=%llu\n", (unsigned long long)response->index_bytes);
+  printf("history_bytes=%llu\n", (unsigned long long)response->history_bytes);
+  printf("session_bytes=%llu\n", (unsigned long long)response->session_bytes);
+  printf("trimmed_bytes=%llu\n", (unsigned long long)response->trimmed_bytes);
+}
+
 static void print_daemon_stop_status(int stopping, int daemon_pid,
                                      int status_format) {
   if (status_format == PTYTERM_STATUS_FORMAT_TEXT) {
@@ -768,6 +876,132 @@ static int connect_daemon_socket(const char *socket_path,
   return start_daemon_process(resolved_socket_path);
 }
 
+/* Requests from one process share a single daemon connection.  Each request
+ * carries a fresh id that the daemon echoes in its reply. */
+static int g_daemon_fd = -1;
+static uint32_t g_daemon_request_id = 0;
+static uint32_t g_daemon_request_count = 0;
+static char g_daemon_default_socket_path[PTYTERM_SOCKET_PATH_MAX];
+
+static void close_daemon_connection(void) {
+  if (g_daemon_fd != -1) {
+    close(g_daemon_fd);
+    g_daemon_fd = -1;
+  }
+}
+
+static int daemon_connection(const char *socket_path, int auto_start) {
+  if (g_daemon_fd != -1)
+    return g_daemon_fd;
+
+  g_daemon_fd = connect_daemon_socket(socket_path,
+                                      g_daemon_default_socket_path,
+                                      auto_start);
+  g_daemon_request_count = 0;
+  return g_daemon_fd;
+}
+
+static int daemon_connection_lost(int errnum) {
+  return errnum == ECONNRESET || errnum == EPIPE;
+}
+
+static ssize_t daemon_request_common(
+    const char *socket_path, uint16_t type, const void *request,
+    uint32_t request_size, struct ptyterm_message_header *header,
+    void *payload, size_t payload_capacity, void **payload_out, int *fd_out) {
+  for (;;) {
+    ssize_t payload_size;
+    uint32_t request_id;
+    int reused;
+    int fd;
+
+    fd = daemon_connection(socket_path, 1);
+    if (fd == -1) {
+      perror(socket_path != NULL ? socket_path
+                                 : g_daemon_default_socket_path);
+      return -1;
+    }
+
+    /* A reused connection may have been closed by a daemon that exited
+     * since the last request; reconnect once in that case. */
+    reused = g_daemon_request_count > 0;
+    ++g_daemon_request_count;
+    if (++g_daemon_request_id == 0)
+      g_daemon_request_id = 1;
+    request_id = g_daemon_request_id;
+
+    if (ptyterm_send_request(fd, request_id, type, request,
+                             request_size) == -1) {
+      close_daemon_connection();
+      if (reused && daemon_connection_lost(errno))
+        continue;
+      perror("send");
+      return -1;
+    }
+
+    /* Until a full header arrives the request buffer is untouched, so a
+     * retry cannot send a partially overwritten request. */
+    memset(header, 0, sizeof(*header));
+    if (payload_out != NULL)
+      payload_size = ptyterm_recv_message_alloc(fd, header, payload_out);
+    else if (fd_out != NULL)
+      payload_size = ptyterm_recv_message_fd(fd, header, payload,
+                                             payload_capacity, fd_out);
+    else
+      payload_size = ptyterm_recv_message(fd, header, payload,
+                                          payload_capacity);
+    if (payload_size == -1) {
+      close_daemon_connection();
+      if (reused && daemon_connection_lost(errno) &&
+          header->request_id != request_id)
+        continue;
+      perror("recv");
+      return -1;
+    }
+    if (header->request_id != request_id) {
+      close_daemon_connection();
+      if (payload_out != NULL) {
+        free(*payload_out);
+        *payload_out = NULL;
+      }
+      if (fd_out != NULL && *fd_out >= 0) {
+        close(*fd_out);
+        *fd_out = -1;
+      }
+      fprintf(stderr, "mismatched response id: %u\n", header->request_id);
+      return -1;
+    }
+    return payload_size;
+  }
+}
+
+static ssize_t daemon_request(const char *socket_path, uint16_t type,
+                              const void *request, uint32_t request_size,
+                              struct ptyterm_message_header *header,
+                              void *payload, size_t payload_capacity) {
+  return daemon_request_common(socket_path, type, request, request_size,
+                               header, payload, payload_capacity, NULL, NULL);
+}
+
+static ssize_t daemon_request_alloc(const char *socket_path, uint16_t type,
+                                    const void *request,
+                                    uint32_t request_size,
+                                    struct ptyterm_message_header *header,
+                                    void **payload_out) {
+  return daemon_request_common(socket_path, type, request, request_size,
+                               header, NULL, 0, payload_out, NULL);
+}
+
+/* Like daemon_request, for replies that may carry a descriptor. */
+static ssize_t daemon_request_fd(const char *socket_path, uint16_t type,
+                                 const void *request, uint32_t request_size,
+                                 struct ptyterm_message_header *header,
+                                 void *payload, size_t payload_capacity,
+                                 int *fd_out) {
+  return daemon_request_common(socket_path, type, request, request_size,
+                               header, payload, payload_capacity, NULL, fd_out);
+}
+
 static int print_list_response(const void *payload, size_t payload_size) {
   const struct ptyterm_list_response *response;
   const struct ptyterm_session_summary *summary;
@@ -803,87 +1037,59 @@ static int print_list_response(const void *payload, size_t payload_size) {
 }
 
 static int run_list_client(const char *socket_path, int session_id) {
-  char default_socket_path[PTYTERM_SOCKET_PATH_MAX];
-  char payload[4096];
+  void *payload;
   struct ptyterm_list_request request;
   struct ptyterm_message_header header;
   ssize_t payload_size;
-  int fd;
-
-  fd = connect_daemon_socket(socket_path, default_socket_path, 1);
-  if (fd == -1) {
-    perror(socket_path);
-    return EXIT_FAILURE;
-  }
+  int result;
 
   request.session_id = session_id;
-  if (ptyterm_send_message(fd, PTYTERM_MESSAGE_LIST_REQUEST, &request,
-                           sizeof(request)) == -1) {
-    perror("send");
-    close(fd);
-    return EXIT_FAILURE;
-  }
-
-  payload_size = ptyterm_recv_message(fd, &header, payload, sizeof(payload));
-  if (payload_size == -1) {
-    perror("recv");
-    close(fd);
+  payload_size = daemon_request_alloc(socket_path, PTYTERM_MESSAGE_LIST_REQUEST,
+                                      &request, sizeof(request), &header,
+                                      &payload);
+  if (payload_size == -1)
     return EXIT_FAILURE;
-  }
-
-  close(fd);
   switch (header.type) {
   case PTYTERM_MESSAGE_LIST_RESPONSE:
-    return print_list_response(payload, (size_t)payload_size);
+    result = print_list_response(payload, (size_t)payload_size);
+    break;
   case PTYTERM_MESSAGE_ERROR: {
     const struct ptyterm_error_response *response;
 
     if ((size_t)payload_size < sizeof(*response)) {
       fprintf(stderr, "short error response\n");
-      return EXIT_FAILURE;
+      result = EXIT_FAILURE;
+      break;
     }
     response = (const struct ptyterm_error_response *)payload;
     fprintf(stderr, "%s\n", response->message);
-    return EXIT_FAILURE;
+    result = EXIT_FAILURE;
+    break;
   }
   default:
     fprintf(stderr, "unexpected response type: %u\n", header.type);
-    return EXIT_FAILURE;
+    result = EXIT_FAILURE;
+    break;
   }
+  free(payload);
+  return result;
 }
 
 static int request_buffer_info_client(
   const char *socket_path, int session_id,
   struct ptyterm_buffer_info_response *response_out) {
-  char default_socket_path[PTYTERM_SOCKET_PATH_MAX];
   char payload[4096];
   struct ptyterm_buffer_info_request request;
   struct ptyterm_message_header header;
   ssize_t payload_size;
-  int fd;
-
-  fd = connect_daemon_socket(socket_path, default_socket_path, 1);
-  if (fd == -1) {
-    perror(socket_path);
-    return EXIT_FAILURE;
-  }
 
   request.session_id = session_id;
-  if (ptyterm_send_message(fd, PTYTERM_MESSAGE_BUFFER_INFO_REQUEST, &request,
-                           sizeof(request)) == -1) {
-    perror("send");
-    close(fd);
+  payload_size = daemon_request(socket_path,
+                                PTYTERM_MESSAGE_BUFFER_INFO_REQUEST, &request,
+                                sizeof(request), &header, payload,
+                                sizeof(payload));
+  if (payload_size == -1)
     return EXIT_FAILURE;
-  }
-
-  payload_size = ptyterm_recv_message(fd, &header, payload, sizeof(payload));
-  if (payload_size == -1) {
-    perror("recv");
-    close(fd);
-    return EXIT_FAILURE;
-  }
-
-  close(fd);
   switch (header.type) {
   case PTYTERM_MESSAGE_BUFFER_INFO_RESPONSE: {
     const struct ptyterm_buffer_info_response *response;
@@ -927,43 +1133,101 @@ static int run_buffer_info_client(const char *socket_path, int session_id,
   return EXIT_SUCCESS;
 }
 
+static int run_resize_buffer_client(const char *socket_path, int session_id,
+                                    uint32_t buffer_size, int status_format) {
+  char payload[4096];
+  struct ptyterm_resize_buffer_request request;
+  struct ptyterm_message_header header;
+  const struct ptyterm_buffer_info_response *response;
+  ssize_t payload_size;
+
+  request.session_id = session_id;
+  request.buffer_size = buffer_size;
+  payload_size = daemon_request(socket_path,
+                                PTYTERM_MESSAGE_RESIZE_BUFFER_REQUEST, &request,
+                                sizeof(request), &header, payload,
+                                sizeof(payload));
+  if (payload_size == -1)
+    return EXIT_FAILURE;
+  if (header.type == PTYTERM_MESSAGE_ERROR) {
+    const struct ptyterm_error_response *error_response;
+
+    error_response = (const struct ptyterm_error_response *)payload;
+    fprintf(stderr, "%s\n", error_response->message);
+    return EXIT_FAILURE;
+  }
+  if (header.type != PTYTERM_MESSAGE_RESIZE_BUFFER_RESPONSE ||
+      (size_t)payload_size != sizeof(*response)) {
+    fprintf(stderr, "invalid resize-buffer response\n");
+    return EXIT_FAILURE;
+  }
+
+  response = (const struct ptyterm_buffer_info_response *)payload;
+  print_buffer_info_status(response, status_format);
+  return EXIT_SUCCESS;
+}
+
+static int run_cursor_delete_client(const char *socket_path, int session_id,
+                                    const char *cursor, int status_format) {
+  char payload[4096];
+  struct ptyterm_cursor_delete_request request;
+  struct ptyterm_message_header header;
+  const struct ptyterm_buffer_info_response *response;
+  ssize_t payload_size;
+
+  memset(&request, 0, sizeof(request));
+  request.session_id = session_id;
+  snprintf(request.cursor, sizeof(request.cursor), "%s", cursor);
+  payload_size = daemon_request(socket_path,
+                                PTYTERM_MESSAGE_CURSOR_DELETE_REQUEST, &request,
+                                sizeof(request), &header, payload,
+                                sizeof(payload));
+  if (payload_size == -1)
+    return EXIT_FAILURE;
+  if (header.type == PTYTERM_MESSAGE_ERROR) {
+    const struct ptyterm_error_response *error_response;
+
+    error_response = (const struct ptyterm_error_response *)payload;
+    fprintf(stderr, "%s\n", error_response->message);
+    return EXIT_FAILURE;
+  }
+  if (header.type != PTYTERM_MESSAGE_CURSOR_DELETE_RESPONSE ||
+      (size_t)payload_size != sizeof(*response)) {
+    fprintf(stderr, "invalid cursor-delete response\n");
+    return EXIT_FAILURE;
+  }
+
+  response = (const struct ptyterm_buffer_info_response *)payload;
+  print_buffer_info_status(response, status_format);
+  return EXIT_SUCCESS;
+}
+
 static int request_screen_snapshot_client(
     const char *socket_path, int session_id, uint32_t screen_selector,
+    uint64_t before_ms,
     struct ptyterm_screen_snapshot_response *response_out, char **cells_out) {
-  char default_socket_path[PTYTERM_SOCKET_PATH_MAX];
   struct ptyterm_screen_snapshot_request request;
   struct ptyterm_message_header header;
   struct ptyterm_screen_snapshot_response *response;
   char *payload;
   ssize_t payload_size;
   size_t expected_size;
-  int fd;
 
   *cells_out = NULL;
-  fd = connect_daemon_socket(socket_path, default_socket_path, 1);
-  if (fd == -1) {
-    perror(socket_path);
-    return EXIT_FAILURE;
-  }
-
+  memset(&request, 0, sizeof(request));
   request.session_id = session_id;
   request.screen_selector = screen_selector;
-  if (ptyterm_send_message(fd, PTYTERM_MESSAGE_SCREEN_SNAPSHOT_REQUEST, &request,
-                           sizeof(request)) == -1) {
-    perror("send");
-    close(fd);
-    return EXIT_FAILURE;
+  if (before_ms != 0) {
+    request.flags = PTYTERM_SNAPSHOT_FLAG_BEFORE;
+    request.before_ms = before_ms;
   }
-
   payload = NULL;
-  payload_size = ptyterm_recv_message_alloc(fd, &header, (void **)&payload);
-  if (payload_size == -1) {
-    perror("recv");
-    close(fd);
+  payload_size = daemon_request_alloc(socket_path,
+                                      PTYTERM_MESSAGE_SCREEN_SNAPSHOT_REQUEST,
+                                      &request, sizeof(request), &header,
+                                      (void **)&payload);
+  if (payload_size == -1)
     return EXIT_FAILURE;
-  }
-
-  close(fd);
   switch (header.type) {
   case PTYTERM_MESSAGE_SCREEN_SNAPSHOT_RESPONSE:
     if ((size_t)payload_size < sizeof(*response_out)) {
@@ -1008,6 +1272,123 @@ static int request_screen_snapshot_client(
   }
 }
 
+/* Fetches the screen changes described by request.  The reply is checked
+ * for a consistent size and returned for the caller to free. */
+static int request_screen_delta_client(
+    const char *socket_path, const struct ptyterm_screen_delta_request *request,
+    struct ptyterm_screen_delta_response **response_out) {
+  struct ptyterm_message_header header;
+  struct ptyterm_screen_delta_response *response;
+  const uint16_t *row_numbers;
+  char *payload;
+  ssize_t payload_size;
+  size_t expected_size;
+  uint32_t i;
+
+  *response_out = NULL;
+  payload = NULL;
+  payload_size = daemon_request_alloc(socket_path,
+                                      PTYTERM_MESSAGE_SCREEN_DELTA_REQUEST,
+                                      request, sizeof(*request), &header,
+                                      (void **)&payload);
+  if (payload_size == -1)
+    return EXIT_FAILURE;
+  if (header.type == PTYTERM_MESSAGE_ERROR) {
+    const struct ptyterm_error_response *error_response;
+
+    if ((size_t)payload_size < sizeof(*error_response)) {
+      fprintf(stderr, "short error response\n");
+    } else {
+      error_response = (const struct ptyterm_error_response *)payload;
+      fprintf(stderr, "%s\n", error_response->message);
+    }
+    free(payload);
+    return EXIT_FAILURE;
+  }
+  if (header.type != PTYTERM_MESSAGE_SCREEN_DELTA_RESPONSE ||
+      (size_t)payload_size < sizeof(*response)) {
+    fprintf(stderr, "invalid screen delta response\n");
+    free(payload);
+    return EXIT_FAILURE;
+  }
+
+  response = (struct ptyterm_screen_delta_response *)payload;
+  row_numbers = (const uint16_t *)(response + 1);
+  if (response->full)
+    expected_size = sizeof(*response) +
+                    (size_t)response->screen.rows * response->screen.cols;
+  else
+    expected_size = sizeof(*response) +
+                    (size_t)response->row_count *
+                        (sizeof(*row_numbers) + response->screen.cols);
+  if ((size_t)payload_size != expected_size ||
+      response->row_count > response->screen.rows) {
+    fprintf(stderr, "invalid screen delta payload size\n");
+    free(payload);
+    return EXIT_FAILURE;
+  }
+  for (i = 0; !response->full && i < response->row_count; ++i) {
+    if (row_numbers[i] >= response->screen.rows ||
+        (i > 0 && row_numbers[i] <= row_numbers[i - 1])) {
+      fprintf(stderr, "invalid screen delta row\n");
+      free(payload);
+      return EXIT_FAILURE;
+    }
+  }
+  *response_out = response;
+  return EXIT_SUCCESS;
+}
+
+/* Brings a snapshot held by a polling client up to date, moving only the
+ * rows that changed since its generation unless the daemon sends a full
+ * frame. */
+static int update_screen_snapshot_client(
+    const char *socket_path, uint32_t screen_selector,
+    struct ptyterm_screen_snapshot_response *snapshot, char **cells) {
+  struct ptyterm_screen_delta_request request;
+  struct ptyterm_screen_delta_response *response;
+  const uint16_t *row_numbers;
+  const char *data;
+  size_t cell_count;
+  uint32_t i;
+
+  memset(&request, 0, sizeof(request));
+  request.session_id = (int32_t)snapshot->session_id;
+  request.screen_selector = screen_selector;
+  request.base_generation = snapshot->generation;
+  request.base_screen = snapshot->selected_screen;
+  request.base_rows = snapshot->rows;
+  request.base_cols = snapshot->cols;
+  if (request_screen_delta_client(socket_path, &request, &response) !=
+      EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  cell_count = (size_t)response->screen.rows * response->screen.cols;
+  if (response->full) {
+    char *resized;
+
+    resized = realloc(*cells, cell_count > 0 ? cell_count : 1);
+    if (resized == NULL) {
+      perror("realloc");
+      free(response);
+      return EXIT_FAILURE;
+    }
+    *cells = resized;
+    memcpy(*cells, response + 1, cell_count);
+  } else {
+    row_numbers = (const uint16_t *)(response + 1);
+    data = (const char *)(row_numbers + response->row_count);
+    for (i = 0; i < response->row_count; ++i) {
+      memcpy(*cells + (size_t)row_numbers[i] * response->screen.cols, data,
+             response->screen.cols);
+      data += response->screen.cols;
+    }
+  }
+  *snapshot = response->screen;
+  free(response);
+  return EXIT_SUCCESS;
+}
+
 static void print_snapshot_rows(const char *cells, uint16_t rows, uint16_t cols) {
   uint16_t row;
 
@@ -1165,13 +1546,15 @@ static int print_wait_snapshot_result(
 }
 
 static int run_snapshot_client(const char *socket_path, int session_id,
-                               uint32_t screen_selector, int status_format) {
+                               uint32_t screen_selector, uint64_t before_ms,
+                               int status_format) {
   struct ptyterm_screen_snapshot_response response;
   char *cells;
   int result;
 
   if (request_screen_snapshot_client(socket_path, session_id, screen_selector,
-                                     &response, &cells) != EXIT_SUCCESS) {
+                                     before_ms, &response,
+                                     &cells) != EXIT_SUCCESS) {
     return EXIT_FAILURE;
   }
 
@@ -1180,6 +1563,69 @@ static int run_snapshot_client(const char *socket_path, int session_id,
   return result;
 }
 
+/* Prints the summary of the current screen and the rows changed after
+ * base_generation.  The daemon sends every row when it cannot tell them
+ * apart, which is reported as delta=full. */
+static int run_snapshot_delta_client(const char *socket_path, int session_id,
+                                     uint32_t screen_selector,
+                                     uint64_t base_generation,
+                                     int status_format) {
+  struct ptyterm_screen_delta_request request;
+  struct ptyterm_screen_delta_response *response;
+  const uint16_t *row_numbers;
+  const char *data;
+  const char *fg_task;
+  uint16_t cols;
+  uint32_t i;
+  int result;
+
+  memset(&request, 0, sizeof(request));
+  request.session_id = session_id;
+  request.screen_selector = screen_selector;
+  request.base_generation = base_generation;
+  if (request_screen_delta_client(socket_path, &request, &response) !=
+      EXIT_SUCCESS)
+    return EXIT_FAILURE;
+
+  fg_task = response->screen.fg_task[0] != '\0' ? response->screen.fg_task
+                                                 : "-";
+  cols = response->screen.cols;
+  if (response->full) {
+    printf(status_format == PTYTERM_STATUS_FORMAT_TEXT ? "delta: full\n"
+                                                       : "delta=full\n");
+    result = print_snapshot_output(&response->screen,
+                                   (const char *)(response + 1),
+                                   status_format);
+    free(response);
+    return result;
+  }
+
+  row_numbers = (const uint16_t *)(response + 1);
+  data = (const char *)(row_numbers + response->row_count);
+  result = EXIT_SUCCESS;
+  if (status_format == PTYTERM_STATUS_FORMAT_TEXT) {
+    printf("delta: rows\n");
+    printf("changed rows: %u\n", response->row_count);
+    print_snapshot_text_summary(&response->screen, fg_task);
+    printf("\n");
+    for (i = 0; i < response->row_count; ++i) {
+      printf("%u: ", (unsigned int)row_numbers[i] + 1);
+      print_snapshot_rows(data + (size_t)i * cols, 1, cols);
+    }
+  } else {
+    printf("delta=rows\n");
+    printf("changed_rows=%u\n", response->row_count);
+    print_snapshot_kv_summary(&response->screen, fg_task);
+    for (i = 0; i < response->row_count && result == EXIT_SUCCESS; ++i) {
+      printf("row_%u=", (unsigned int)row_numbers[i] + 1);
+      result = write_snapshot_kv_escaped(data + (size_t)i * cols, cols);
+      fputc('\n', stdout);
+    }
+  }
+  free(response);
+  return result;
+}
+
 static int write_all_fd(int fd, const char *buffer, size_t size) {
   size_t offset;
 
@@ -1315,7 +1761,7 @@ static int run_view_client(const char *socket_path, int session_id,
   }
 
   if (request_screen_snapshot_client(socket_path, session_id, screen_selector,
-                                     &response, &cells) != EXIT_SUCCESS) {
+                                     0, &response, &cells) != EXIT_SUCCESS) {
     return EXIT_FAILURE;
   }
 
@@ -1440,9 +1886,8 @@ static int run_view_client(const char *socket_path, int session_id,
       needs_redraw = 1;
     }
 
-    free(cells);
-    if (request_screen_snapshot_client(socket_path, session_id, screen_selector,
-                                       &response, &cells) != EXIT_SUCCESS) {
+    if (update_screen_snapshot_client(socket_path, screen_selector, &response,
+                                      &cells) != EXIT_SUCCESS) {
       result = EXIT_FAILURE;
       break;
     }
@@ -1480,16 +1925,14 @@ static int run_wait_state_client(const char *socket_path, int session_id,
                                  uint64_t wait_timeout_ms, int status_format) {
   struct ptyterm_screen_snapshot_response baseline;
   struct ptyterm_screen_snapshot_response latest;
-  struct ptyterm_screen_snapshot_response current;
   char *baseline_cells;
   char *latest_cells;
-  char *current_cells;
   uint64_t start_ms;
   const char *predicate_name;
 
   predicate_name = wait_predicate_name(predicate);
   if (request_screen_snapshot_client(socket_path, session_id, screen_selector,
-                                     &baseline, &baseline_cells) != EXIT_SUCCESS) {
+                                     0, &baseline, &baseline_cells) != EXIT_SUCCESS) {
     return EXIT_FAILURE;
   }
 
@@ -1524,16 +1967,12 @@ static int run_wait_state_client(const char *socket_path, int session_id,
     }
 
     usleep(100000);
-    if (request_screen_snapshot_client(socket_path, session_id, screen_selector,
-                                       &current, &current_cells) != EXIT_SUCCESS) {
+    if (update_screen_snapshot_client(socket_path, screen_selector, &latest,
+                                      &latest_cells) != EXIT_SUCCESS) {
       free(latest_cells);
       return EXIT_FAILURE;
     }
 
-    free(latest_cells);
-    latest = current;
-    latest_cells = current_cells;
-
     if (snapshot_matches_wait_predicate(&baseline, &latest, predicate)) {
       int result;
 
@@ -1554,7 +1993,8 @@ static int run_wait_state_client(const char *socket_path, int session_id,
 }
 
 static int run_create_client(const char *socket_path, int cmd_argc,
-                             char *const cmd_argv[], int status_format) {
+                             char *const cmd_argv[], uint32_t buffer_size,
+                             int status_format) {
   char default_socket_path[PTYTERM_SOCKET_PATH_MAX];
   char payload[4096];
   struct ptyterm_create_request *request;
@@ -1562,11 +2002,11 @@ static int run_create_client(const char *socket_path, int cmd_argc,
   const char *resolved_socket_path;
   ssize_t payload_size;
   size_t offset;
-  int fd;
   int i;
 
   request = (struct ptyterm_create_request *)payload;
   request->argc = (uint32_t)cmd_argc;
+  request->buffer_size = buffer_size;
   offset = sizeof(*request);
   for (i = 0; i < cmd_argc; ++i) {
     size_t arg_size;
@@ -1586,27 +2026,12 @@ static int run_create_client(const char *socket_path, int cmd_argc,
     return EXIT_FAILURE;
   }
 
-  fd = connect_daemon_socket(resolved_socket_path, default_socket_path, 1);
-  if (fd == -1) {
-    perror(resolved_socket_path);
-    return EXIT_FAILURE;
-  }
-
-  if (ptyterm_send_message(fd, PTYTERM_MESSAGE_CREATE_REQUEST, payload,
-                           (uint32_t)offset) == -1) {
-    perror("send");
-    close(fd);
-    return EXIT_FAILURE;
-  }
-
-  payload_size = ptyterm_recv_message(fd, &header, payload, sizeof(payload));
-  if (payload_size == -1) {
-    perror("recv");
-    close(fd);
+  payload_size = daemon_request(resolved_socket_path,
+                                PTYTERM_MESSAGE_CREATE_REQUEST, payload,
+                                (uint32_t)offset, &header, payload,
+                                sizeof(payload));
+  if (payload_size == -1)
     return EXIT_FAILURE;
-  }
-
-  close(fd);
   switch (header.type) {
   case PTYTERM_MESSAGE_CREATE_RESPONSE: {
     const struct ptyterm_create_response *response;
@@ -1990,7 +2415,6 @@ static int run_unescape_filter(void) {
 
 static int run_send_client(const char *socket_path, int session_id,
                            const char *send_data) {
-  char default_socket_path[PTYTERM_SOCKET_PATH_MAX];
   char payload[4096];
   char decoded[2048];
   struct ptyterm_send_request *request;
@@ -1998,7 +2422,6 @@ static int run_send_client(const char *socket_path, int session_id,
   const struct ptyterm_send_response *response;
   size_t data_size;
   ssize_t payload_size;
-  int fd;
 
   data_size = decode_send_data(send_data, decoded, sizeof(decoded));
   if (sizeof(*request) + data_size > sizeof(payload)) {
@@ -2011,27 +2434,12 @@ static int run_send_client(const char *socket_path, int session_id,
   request->data_size = (uint32_t)data_size;
   memcpy(request + 1, decoded, data_size);
 
-  fd = connect_daemon_socket(socket_path, default_socket_path, 1);
-  if (fd == -1) {
-    perror(socket_path);
-    return EXIT_FAILURE;
-  }
-
-  if (ptyterm_send_message(fd, PTYTERM_MESSAGE_SEND_REQUEST, payload,
-                           (uint32_t)(sizeof(*request) + data_size)) == -1) {
-    perror("send");
-    close(fd);
-    return EXIT_FAILURE;
-  }
-
-  payload_size = ptyterm_recv_message(fd, &header, payload, sizeof(payload));
-  if (payload_size == -1) {
-    perror("recv");
-    close(fd);
+  payload_size = daemon_request(socket_path, PTYTERM_MESSAGE_SEND_REQUEST,
+                                payload,
+                                (uint32_t)(sizeof(*request) + data_size),
+                                &header, payload, sizeof(payload));
+  if (payload_size == -1)
     return EXIT_FAILURE;
-  }
-
-  close(fd);
   if (header.type == PTYTERM_MESSAGE_ERROR) {
     const struct ptyterm_error_response *error_response;
 
@@ -2053,41 +2461,28 @@ static int run_send_client(const char *socket_path, int session_id,
   return response->unsent_bytes == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-static int request_recv_client(const char *socket_path, int session_id,
+/* Sends base, which names the session, cursor, and range, with the size and
+ * peek flag of this one request. */
+static int request_recv_client(const char *socket_path,
+                               const struct ptyterm_recv_request *base,
                                uint32_t recv_size, int recv_peek,
                                char *payload, size_t payload_capacity,
                                const struct ptyterm_recv_response **response_out) {
-  char default_socket_path[PTYTERM_SOCKET_PATH_MAX];
   struct ptyterm_recv_request request;
   struct ptyterm_message_header header;
   const struct ptyterm_recv_response *response;
   ssize_t payload_size;
-  int fd;
-
-  request.session_id = session_id;
-  request.max_bytes = recv_size;
-  request.flags = recv_peek ? PTYTERM_RECV_FLAG_PEEK : 0;
-  fd = connect_daemon_socket(socket_path, default_socket_path, 1);
-  if (fd == -1) {
-    perror(socket_path);
-    return EXIT_FAILURE;
-  }
-
-  if (ptyterm_send_message(fd, PTYTERM_MESSAGE_RECV_REQUEST, &request,
-                           sizeof(request)) == -1) {
-    perror("send");
-    close(fd);
-    return EXIT_FAILURE;
-  }
 
-  payload_size = ptyterm_recv_message(fd, &header, payload, payload_capacity);
-  if (payload_size == -1) {
-    perror("recv");
-    close(fd);
+  request = *base;
+  request.max_bytes =
+      recv_size < PTYTERM_RECV_CHUNK_MAX ? recv_size : PTYTERM_RECV_CHUNK_MAX;
+  if (recv_peek)
+    request.flags |= PTYTERM_RECV_FLAG_PEEK;
+  payload_size = daemon_request(socket_path, PTYTERM_MESSAGE_RECV_REQUEST,
+                                &request, sizeof(request), &header, payload,
+                                payload_capacity);
+  if (payload_size == -1)
     return EXIT_FAILURE;
-  }
-
-  close(fd);
   if (header.type == PTYTERM_MESSAGE_ERROR) {
     const struct ptyterm_error_response *error_response;
 
@@ -2111,9 +2506,8 @@ static int request_recv_client(const char *socket_path, int session_id,
   return EXIT_SUCCESS;
 }
 
-static int print_recv_payload_and_status(
-  const struct ptyterm_recv_response *response, const char *reason_override,
-  int recv_format, int recv_control_mode) {
+static int print_recv_payload(const struct ptyterm_recv_response *response,
+                              int recv_format, int recv_control_mode) {
   const char *data;
   const char *output;
   char *filtered;
@@ -2150,140 +2544,163 @@ static int print_recv_payload_and_status(
   }
 
   free(filtered);
+  return EXIT_SUCCESS;
+}
 
+static int print_recv_payload_and_status(
+  const struct ptyterm_recv_response *response, const char *reason_override,
+  int recv_format, int recv_control_mode) {
+  if (print_recv_payload(response, recv_format, recv_control_mode) !=
+      EXIT_SUCCESS)
+    return EXIT_FAILURE;
   print_recv_status_line(response->returned_bytes, response->start_offset,
                          response->end_offset, response->next_recv_offset,
-                         response->truncated,
+                         response->lag_bytes, response->truncated,
                          reason_override != NULL ? reason_override
                                                  : response->reason);
   return EXIT_SUCCESS;
 }
 
+/* A recv larger than one response is read as successive chunks, each
+ * printed as it arrives, with one status line covering all of them.  Reads
+ * that leave the cursor in place, peeks and time or line ranges, continue
+ * from an explicit start offset, and a bounded range keeps the end the
+ * first chunk chose. */
+static int recv_stream_client(const char *socket_path,
+                              const struct ptyterm_recv_request *base,
+                              uint32_t recv_size, int recv_peek,
+                              char *payload, size_t payload_capacity,
+                              int recv_format, int recv_control_mode) {
+  const struct ptyterm_recv_response *response;
+  struct ptyterm_recv_request request;
+  uint64_t start_offset;
+  uint32_t returned_bytes;
+  uint32_t requested;
+  int truncated;
+
+  request = *base;
+  start_offset = 0;
+  returned_bytes = 0;
+  truncated = 0;
+  for (;;) {
+    requested = recv_size - returned_bytes;
+    if (requested > PTYTERM_RECV_CHUNK_MAX)
+      requested = PTYTERM_RECV_CHUNK_MAX;
+    if (request_recv_client(socket_path, &request, requested, recv_peek,
+                            payload, payload_capacity,
+                            &response) != EXIT_SUCCESS)
+      return EXIT_FAILURE;
+    if (returned_bytes == 0)
+      start_offset = response->start_offset;
+    /* Older output may be dropped between chunks, leaving a gap that only
+     * a later response reports. */
+    if (response->truncated != 0)
+      truncated = 1;
+    if (print_recv_payload(response, recv_format, recv_control_mode) !=
+        EXIT_SUCCESS)
+      return EXIT_FAILURE;
+    returned_bytes += response->returned_bytes;
+    if (returned_bytes == recv_size || response->returned_bytes < requested)
+      break;
+    if (recv_peek ||
+        (base->flags & (PTYTERM_RECV_FLAG_SINCE | PTYTERM_RECV_FLAG_LAST_LINES |
+                        PTYTERM_RECV_FLAG_FROM_LINE)) != 0) {
+      request.flags |= PTYTERM_RECV_FLAG_START;
+      request.start_offset = response->end_offset;
+    }
+    if ((base->flags &
+         (PTYTERM_RECV_FLAG_BEFORE | PTYTERM_RECV_FLAG_MAX_LINES)) != 0) {
+      request.flags |= PTYTERM_RECV_FLAG_END;
+      request.end_offset = response->range_end_offset;
+    }
+  }
+
+  print_recv_status_line(returned_bytes, start_offset, response->end_offset,
+                         response->next_recv_offset, response->lag_bytes,
+                         truncated,
+                         returned_bytes == recv_size ? "size_reached"
+                                                     : response->reason);
+  return EXIT_SUCCESS;
+}
+
 static int run_recv_client(const char *socket_path, int session_id,
+                           const char *recv_cursor,
                            uint32_t recv_size, int recv_peek,
+                           uint64_t recv_since_ms, uint64_t recv_before_ms,
+                           long recv_lines, uint64_t recv_from_line,
                            uint64_t recv_timeout_ms,
                            const char *recv_until, int recv_format,
                            int recv_control_mode) {
-  char payload[8192];
+  static char payload[sizeof(struct ptyterm_recv_response) +
+                     PTYTERM_RECV_CHUNK_MAX];
   const struct ptyterm_recv_response *response;
-  uint64_t deadline_ms = 0;
-  size_t until_size;
+  struct ptyterm_recv_request request;
 
   if (recv_format == PTYTERM_RECV_FORMAT_AUTO)
     recv_format = isatty(STDOUT_FILENO) ? PTYTERM_RECV_FORMAT_ESCAPED
                                         : PTYTERM_RECV_FORMAT_RAW;
 
-  if (recv_until == NULL && recv_timeout_ms == 0)
-    return request_recv_client(socket_path, session_id, recv_size, recv_peek,
-                   payload, sizeof(payload), &response) == EXIT_SUCCESS
-               ? print_recv_payload_and_status(response, NULL, recv_format,
-                                               recv_control_mode)
-               : EXIT_FAILURE;
-
-  until_size = recv_until == NULL ? 0 : strlen(recv_until);
-  if (recv_timeout_ms > 0) {
-    uint64_t start_ms;
-
-    if (monotonic_time_ms(&start_ms) == -1) {
-      perror("clock_gettime");
-      return EXIT_FAILURE;
-    }
-    deadline_ms = start_ms + recv_timeout_ms;
+  memset(&request, 0, sizeof(request));
+  request.session_id = session_id;
+  if (recv_cursor != NULL)
+    snprintf(request.cursor, sizeof(request.cursor), "%s", recv_cursor);
+  if (recv_since_ms != 0) {
+    request.flags |= PTYTERM_RECV_FLAG_SINCE;
+    request.since_ms = recv_since_ms;
   }
-
-  for (;;) {
-    const char *data;
-    const char *match;
-    uint32_t consume_size;
-    uint64_t now_ms;
-
-    if (request_recv_client(socket_path, session_id, recv_size, 1, payload,
-                sizeof(payload), &response) != EXIT_SUCCESS)
-      return EXIT_FAILURE;
-
-    data = (const char *)(response + 1);
-    match = recv_until == NULL
-                ? (response->returned_bytes > 0 ? data : NULL)
-                : find_bytes(data, response->returned_bytes, recv_until,
-                             until_size);
-
-    if (match != NULL) {
-      consume_size = recv_until == NULL
-                         ? response->returned_bytes
-                         : (uint32_t)((match - data) + until_size);
-      if (request_recv_client(socket_path, session_id, consume_size, recv_peek,
-                              payload, sizeof(payload), &response) !=
-          EXIT_SUCCESS)
-        return EXIT_FAILURE;
-      return print_recv_payload_and_status(
-          response, recv_until == NULL ? NULL : "match_reached", recv_format,
-          recv_control_mode);
-    }
-
-    if (recv_until != NULL && response->returned_bytes == recv_size) {
-      print_recv_status_line(response->returned_bytes, response->start_offset,
-                             response->end_offset, response->next_recv_offset,
-                             response->truncated, "size_reached");
-      return EXIT_FAILURE;
-    }
-
-    if (strcmp(response->reason, "session_exited") == 0) {
-      print_recv_status_line(response->returned_bytes, response->start_offset,
-                             response->end_offset, response->next_recv_offset,
-                             response->truncated, "session_exited");
-      return EXIT_FAILURE;
-    }
-
-    if (recv_timeout_ms > 0) {
-      if (monotonic_time_ms(&now_ms) == -1) {
-        perror("clock_gettime");
-        return EXIT_FAILURE;
-      }
-      if (now_ms >= deadline_ms) {
-        print_recv_status_line(response->returned_bytes, response->start_offset,
-                               response->end_offset,
-                               response->next_recv_offset,
-                               response->truncated, "timeout");
-        return EXIT_FAILURE;
-      }
-    }
-
-    usleep(100000);
+  if (recv_before_ms != 0) {
+    request.flags |= PTYTERM_RECV_FLAG_BEFORE;
+    request.before_ms = recv_before_ms;
+  }
+  if (recv_lines > 0) {
+    request.flags |= PTYTERM_RECV_FLAG_MAX_LINES;
+    request.lines = (uint32_t)recv_lines;
+  } else if (recv_lines < 0) {
+    request.flags |= PTYTERM_RECV_FLAG_LAST_LINES;
+    request.lines = (uint32_t)-recv_lines;
   }
+  if (recv_from_line != 0) {
+    request.flags |= PTYTERM_RECV_FLAG_FROM_LINE;
+    request.from_line = recv_from_line - 1;
+  }
+
+  if (recv_until == NULL && recv_timeout_ms == 0)
+    return recv_stream_client(socket_path, &request, recv_size, recv_peek,
+                              payload, sizeof(payload), recv_format,
+                              recv_control_mode);
+
+  /* The daemon holds a waiting recv until the pattern, or any output when
+   * there is none, shows up within one chunk, the session ends, or the
+   * timeout passes. */
+  request.flags |= PTYTERM_RECV_FLAG_WAIT;
+  request.timeout_ms = recv_timeout_ms;
+  if (recv_until != NULL) {
+    request.until_size = (uint32_t)strlen(recv_until);
+    memcpy(request.until, recv_until, request.until_size);
+  }
+  if (request_recv_client(socket_path, &request, recv_size, recv_peek, payload,
+                          sizeof(payload), &response) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  if (print_recv_payload_and_status(response, NULL, recv_format,
+                                    recv_control_mode) != EXIT_SUCCESS)
+    return EXIT_FAILURE;
+  return response->returned_bytes > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 static int run_detach_client(const char *socket_path, int session_id,
                              int status_format) {
-  char default_socket_path[PTYTERM_SOCKET_PATH_MAX];
   char payload[4096];
   struct ptyterm_detach_request request;
   struct ptyterm_message_header header;
   const struct ptyterm_detach_response *response;
   ssize_t payload_size;
-  int fd;
 
   request.session_id = session_id;
-  fd = connect_daemon_socket(socket_path, default_socket_path, 1);
-  if (fd == -1) {
-    perror(socket_path);
-    return EXIT_FAILURE;
-  }
-
-  if (ptyterm_send_message(fd, PTYTERM_MESSAGE_DETACH_REQUEST, &request,
-                           sizeof(request)) == -1) {
-    perror("send");
-    close(fd);
-    return EXIT_FAILURE;
-  }
-
-  payload_size = ptyterm_recv_message(fd, &header, payload, sizeof(payload));
-  if (payload_size == -1) {
-    perror("recv");
-    close(fd);
+  payload_size = daemon_request(socket_path, PTYTERM_MESSAGE_DETACH_REQUEST,
+                                &request, sizeof(request), &header, payload,
+                                sizeof(payload));
+  if (payload_size == -1)
     return EXIT_FAILURE;
-  }
-
-  close(fd);
   if (header.type == PTYTERM_MESSAGE_ERROR) {
     const struct ptyterm_error_response *error_response;
 
@@ -2302,39 +2719,124 @@ static int run_detach_client(const char *socket_path, int session_id,
   return EXIT_SUCCESS;
 }
 
+/* Maps the session ring read-only and copies output to stdout as the
+ * daemon publishes it, starting from the oldest byte the ring holds.  No
+ * request is made after the mapping, so a follower never slows the daemon;
+ * output it falls too far behind on is reported as skipped. */
+static int run_follow_client(const char *socket_path, int session_id) {
+  char payload[4096];
+  char buffer[PTYTERM_RECV_CHUNK_MAX];
+  struct ptyterm_map_output_request request;
+  struct ptyterm_message_header header;
+  struct ptyterm_map_output_response response;
+  struct ptyterm_shared_ring_state state;
+  const struct ptyterm_shared_ring_header *ring;
+  const char *data;
+  uint64_t offset;
+  ssize_t payload_size;
+  ssize_t size;
+  void *base;
+  int result;
+  int fd;
+
+  request.session_id = session_id;
+  payload_size = daemon_request_fd(socket_path,
+                                   PTYTERM_MESSAGE_MAP_OUTPUT_REQUEST, &request,
+                                   sizeof(request), &header, payload,
+                                   sizeof(payload), &fd);
+  if (payload_size == -1)
+    return EXIT_FAILURE;
+  if (header.type == PTYTERM_MESSAGE_ERROR) {
+    const struct ptyterm_error_response *error_response;
+
+    error_response = (const struct ptyterm_error_response *)payload;
+    fprintf(stderr, "%s\n", error_response->message);
+    if (fd >= 0)
+      close(fd);
+    return EXIT_FAILURE;
+  }
+  if (header.type != PTYTERM_MESSAGE_MAP_OUTPUT_RESPONSE ||
+      (size_t)payload_size != sizeof(response) || fd < 0) {
+    fprintf(stderr, "invalid map-output response\n");
+    if (fd >= 0)
+      close(fd);
+    return EXIT_FAILURE;
+  }
+  memcpy(&response, payload, sizeof(response));
+  close_daemon_connection();
+
+  base = mmap(NULL, (size_t)response.map_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    perror("mmap");
+    return EXIT_FAILURE;
+  }
+  ring = (const struct ptyterm_shared_ring_header *)base;
+  data = (const char *)base + response.data_offset;
+
+  ptyterm_shared_ring_read_state(ring, &state);
+  offset = state.total_output_bytes - state.ring_len;
+  result = EXIT_SUCCESS;
+  for (;;) {
+    size = ptyterm_shared_ring_copy(ring, data, offset, buffer, sizeof(buffer));
+    if (size == -1 && errno == ERANGE) {
+      uint64_t oldest;
+
+      ptyterm_shared_ring_read_state(ring, &state);
+      oldest = state.write_limit > response.capacity
+                   ? state.write_limit - response.capacity
+                   : 0;
+      if (oldest < state.total_output_bytes - state.ring_len)
+        oldest = state.total_output_bytes - state.ring_len;
+      fprintf(stderr, "skipped %llu bytes\n",
+              (unsigned long long)(oldest - offset));
+      offset = oldest;
+      continue;
+    }
+    if (size == -1) {
+      perror("follow");
+      result = EXIT_FAILURE;
+      break;
+    }
+    if (size > 0) {
+      if (write_all(STDOUT_FILENO, buffer, (size_t)size) == -1) {
+        perror("write");
+        result = EXIT_FAILURE;
+        break;
+      }
+      offset += (uint64_t)size;
+      continue;
+    }
+    ptyterm_shared_ring_read_state(ring, &state);
+    if (offset < state.total_output_bytes)
+      continue;
+    if (state.closed)
+      break;
+    usleep(10000);
+  }
+  munmap(base, (size_t)response.map_size);
+  return result;
+}
+
 static int request_resize_client(const char *socket_path, int session_id,
                                  uint16_t rows, uint16_t cols,
                                  struct ptyterm_resize_response *response_out) {
-  char default_socket_path[PTYTERM_SOCKET_PATH_MAX];
   char payload[4096];
   struct ptyterm_resize_request request;
   struct ptyterm_message_header header;
   const struct ptyterm_resize_response *response;
   ssize_t payload_size;
-  int fd;
 
   memset(&request, 0, sizeof(request));
   request.session_id = session_id;
   request.rows = rows;
   request.cols = cols;
 
-  fd = connect_daemon_socket(socket_path, default_socket_path, 1);
-  if (fd == -1)
-    return -1;
-
-  if (ptyterm_send_message(fd, PTYTERM_MESSAGE_RESIZE_REQUEST, &request,
-                           sizeof(request)) == -1) {
-    close(fd);
-    return -1;
-  }
-
-  payload_size = ptyterm_recv_message(fd, &header, payload, sizeof(payload));
-  if (payload_size == -1) {
-    close(fd);
+  payload_size = daemon_request(socket_path, PTYTERM_MESSAGE_RESIZE_REQUEST,
+                                &request, sizeof(request), &header, payload,
+                                sizeof(payload));
+  if (payload_size == -1)
     return -1;
-  }
-
-  close(fd);
   if (header.type == PTYTERM_MESSAGE_ERROR) {
     const struct ptyterm_error_response *error_response;
 
@@ -2393,15 +2895,12 @@ static void attach_size_changed(int sig) {
 
 static int run_daemon_status_client(const char *socket_path,
                                     int status_format) {
-  char default_socket_path[PTYTERM_SOCKET_PATH_MAX];
   char payload[4096];
   struct ptyterm_message_header header;
   const struct ptyterm_daemon_status_response *response;
   ssize_t payload_size;
-  int fd;
 
-  fd = connect_daemon_socket(socket_path, default_socket_path, 0);
-  if (fd == -1) {
+  if (daemon_connection(socket_path, 0) == -1) {
     if (can_autostart_daemon(errno)) {
       print_daemon_status(0, 0, status_format);
       return EXIT_SUCCESS;
@@ -2410,19 +2909,10 @@ static int run_daemon_status_client(const char *socket_path,
     return EXIT_FAILURE;
   }
 
-  if (ptyterm_send_message(fd, PTYTERM_MESSAGE_DAEMON_STATUS_REQUEST, NULL, 0) == -1) {
-    perror("send");
-    close(fd);
-    return EXIT_FAILURE;
-  }
-
-  payload_size = ptyterm_recv_message(fd, &header, payload, sizeof(payload));
-  if (payload_size == -1) {
-    perror("recv");
-    close(fd);
+  payload_size = daemon_request(socket_path, PTYTERM_MESSAGE_DAEMON_STATUS_REQUEST,
+                                NULL, 0, &header, payload, sizeof(payload));
+  if (payload_size == -1)
     return EXIT_FAILURE;
-  }
-  close(fd);
 
   if (header.type != PTYTERM_MESSAGE_DAEMON_STATUS_RESPONSE ||
       (size_t)payload_size != sizeof(*response)) {
@@ -2432,19 +2922,17 @@ static int run_daemon_status_client(const char *socket_path,
 
   response = (const struct ptyterm_daemon_status_response *)payload;
   print_daemon_status(response->running, response->daemon_pid, status_format);
+  print_daemon_memory_status(response, status_format);
   return EXIT_SUCCESS;
 }
 
 static int run_daemon_stop_client(const char *socket_path, int status_format) {
-  char default_socket_path[PTYTERM_SOCKET_PATH_MAX];
   char payload[4096];
   struct ptyterm_message_header header;
   const struct ptyterm_daemon_shutdown_response *response;
   ssize_t payload_size;
-  int fd;
 
-  fd = connect_daemon_socket(socket_path, default_socket_path, 0);
-  if (fd == -1) {
+  if (daemon_connection(socket_path, 0) == -1) {
     if (can_autostart_daemon(errno)) {
       print_daemon_stop_status(0, 0, status_format);
       return EXIT_SUCCESS;
@@ -2453,19 +2941,10 @@ static int run_daemon_stop_client(const char *socket_path, int status_format) {
     return EXIT_FAILURE;
   }
 
-  if (ptyterm_send_message(fd, PTYTERM_MESSAGE_DAEMON_SHUTDOWN_REQUEST, NULL, 0) == -1) {
-    perror("send");
-    close(fd);
-    return EXIT_FAILURE;
-  }
-
-  payload_size = ptyterm_recv_message(fd, &header, payload, sizeof(payload));
-  if (payload_size == -1) {
-    perror("recv");
-    close(fd);
+  payload_size = daemon_request(socket_path, PTYTERM_MESSAGE_DAEMON_SHUTDOWN_REQUEST,
+                                NULL, 0, &header, payload, sizeof(payload));
+  if (payload_size == -1)
     return EXIT_FAILURE;
-  }
-  close(fd);
 
   if (header.type != PTYTERM_MESSAGE_DAEMON_SHUTDOWN_RESPONSE ||
       (size_t)payload_size != sizeof(*response)) {
@@ -2858,6 +3337,9 @@ int main(int argc, char *const argv[]) {
   int daemon_status_requested = 0;
   int daemon_stop_requested = 0;
   int detach_requested = 0;
+  int follow_requested = 0;
+  uint32_t buffer_size = 0;
+  uint32_t resize_buffer_size = 0;
   int help_requested = 0;
   int help_format = PTYTERM_HELP_FORMAT_TEXT;
   int list_requested = 0;
@@ -2869,7 +3351,15 @@ int main(int argc, char *const argv[]) {
   int recv_control_mode = PTYTERM_RECV_CONTROL_WITHOUT;
   int filter_mode = PTYTERM_FILTER_MODE_NONE;
   const char *recv_until = NULL;
+  const char *recv_cursor = NULL;
+  const char *delete_cursor = NULL;
   uint64_t recv_timeout_ms = 0;
+  uint64_t since_ms = 0;
+  uint64_t before_ms = 0;
+  uint64_t since_generation = 0;
+  int since_generation_requested = 0;
+  long recv_lines = 0;
+  uint64_t recv_from_line = 0;
   uint64_t wait_timeout_ms = 0;
   int resize_requested = 0;
   int recv_requested = 0;
@@ -2896,9 +3386,19 @@ int main(int argc, char *const argv[]) {
       OPT_RECV_FORMAT,
       OPT_RECV_CONTROL,
       OPT_RECV_SIZE,
+      OPT_RECV_CURSOR,
+      OPT_CURSOR_DELETE,
+      OPT_SINCE,
+      OPT_BEFORE,
+      OPT_SINCE_GENERATION,
+      OPT_RECV_LINES,
+      OPT_FROM_LINE,
       OPT_RECV_TIMEOUT,
       OPT_RECV_UNTIL,
       OPT_PEEK,
+      OPT_FOLLOW,
+      OPT_BUFFER_SIZE,
+      OPT_RESIZE_BUFFER,
       OPT_SNAPSHOT,
       OPT_VIEW,
       OPT_WAIT_STATE,
@@ -2929,9 +3429,20 @@ int main(int argc, char *const argv[]) {
                        {"recv-format", required_argument, NULL, OPT_RECV_FORMAT},
                        {"recv-control", required_argument, NULL, OPT_RECV_CONTROL},
                        {"recv-size", required_argument, NULL, OPT_RECV_SIZE},
+                       {"recv-cursor", required_argument, NULL, OPT_RECV_CURSOR},
+                       {"cursor-delete", required_argument, NULL, OPT_CURSOR_DELETE},
+                       {"since", required_argument, NULL, OPT_SINCE},
+                       {"before", required_argument, NULL, OPT_BEFORE},
+                       {"since-generation", required_argument, NULL,
+                        OPT_SINCE_GENERATION},
+                       {"recv-lines", required_argument, NULL, OPT_RECV_LINES},
+                       {"from-line", required_argument, NULL, OPT_FROM_LINE},
                        {"recv-timeout", required_argument, NULL, OPT_RECV_TIMEOUT},
                        {"recv-until", required_argument, NULL, OPT_RECV_UNTIL},
                        {"peek", no_argument, NULL, OPT_PEEK},
+                       {"follow", no_argument, NULL, OPT_FOLLOW},
+                       {"buffer-size", required_argument, NULL, OPT_BUFFER_SIZE},
+                       {"resize-buffer", required_argument, NULL, OPT_RESIZE_BUFFER},
                        {"snapshot", no_argument, NULL, OPT_SNAPSHOT},
                        {"view", no_argument, NULL, OPT_VIEW},
                        {"wait-state", required_argument, NULL, OPT_WAIT_STATE},
@@ -3020,6 +3531,17 @@ int main(int argc, char *const argv[]) {
     case OPT_PEEK:
       recv_peek = 1;
       break;
+    case OPT_FOLLOW:
+      follow_requested = 1;
+      break;
+    case OPT_BUFFER_SIZE:
+      if (parse_buffer_size(optarg, &buffer_size) == -1)
+        return usage_error(argv[0], "invalid buffer-size: %s", optarg);
+      break;
+    case OPT_RESIZE_BUFFER:
+      if (parse_buffer_size(optarg, &resize_buffer_size) == -1)
+        return usage_error(argv[0], "invalid resize-buffer: %s", optarg);
+      break;
     case OPT_SNAPSHOT:
       snapshot_requested = 1;
       break;
@@ -3045,6 +3567,45 @@ int main(int argc, char *const argv[]) {
       if (optarg == p || *p != '\0' || recv_size == 0)
         return usage_error(argv[0], "invalid recv-size: %s", optarg);
       break;
+    case OPT_RECV_CURSOR:
+      if (*optarg == '\0' || strlen(optarg) >= PTYTERM_CURSOR_NAME_MAX)
+        return usage_error(argv[0], "invalid recv-cursor: %s", optarg);
+      recv_cursor = optarg;
+      break;
+    case OPT_CURSOR_DELETE:
+      if (*optarg == '\0' || strlen(optarg) >= PTYTERM_CURSOR_NAME_MAX)
+        return usage_error(argv[0], "invalid cursor-delete: %s", optarg);
+      delete_cursor = optarg;
+      break;
+    case OPT_SINCE:
+      if (parse_duration_ms(optarg, &since_ms) == -1)
+        return usage_error(argv[0], "invalid since: %s", optarg);
+      break;
+    case OPT_BEFORE:
+      if (parse_duration_ms(optarg, &before_ms) == -1)
+        return usage_error(argv[0], "invalid before: %s", optarg);
+      break;
+    case OPT_SINCE_GENERATION:
+      errno = 0;
+      since_generation = strtoull(optarg, &p, 0);
+      if (errno != 0 || optarg == p || *p != '\0' || *optarg == '-')
+        return usage_error(argv[0], "invalid since-generation: %s", optarg);
+      since_generation_requested = 1;
+      break;
+    case OPT_RECV_LINES:
+      errno = 0;
+      recv_lines = strtol(optarg, &p, 0);
+      if (errno != 0 || optarg == p || *p != '\0' || recv_lines == 0 ||
+          recv_lines > (long)UINT32_MAX || recv_lines < -(long)UINT32_MAX)
+        return usage_error(argv[0], "invalid recv-lines: %s", optarg);
+      break;
+    case OPT_FROM_LINE:
+      errno = 0;
+      recv_from_line = strtoull(optarg, &p, 0);
+      if (errno != 0 || optarg == p || *p != '\0' || *optarg == '-' ||
+          recv_from_line == 0)
+        return usage_error(argv[0], "invalid from-line: %s", optarg);
+      break;
     case OPT_RECV_TIMEOUT:
       if (parse_duration_ms(optarg, &recv_timeout_ms) == -1)
         return usage_error(argv[0], "invalid recv-timeout: %s", optarg);
@@ -3052,6 +3613,9 @@ int main(int argc, char *const argv[]) {
     case OPT_RECV_UNTIL:
       if (*optarg == '\0')
         return usage_error(argv[0], "recv-until must not be empty");
+      if (strlen(optarg) > PTYTERM_RECV_UNTIL_MAX)
+        return usage_error(argv[0], "recv-until is longer than %d bytes",
+                           PTYTERM_RECV_UNTIL_MAX);
       recv_until = optarg;
       break;
     case 's':
@@ -3109,6 +3673,8 @@ int main(int argc, char *const argv[]) {
 
   if (recv_peek && !recv_requested)
     return usage_error(argv[0], "--peek requires --recv");
+  if (buffer_size != 0 && !create_requested)
+    return usage_error(argv[0], "--buffer-size requires --create");
   if (screen_selector != PTYTERM_SCREEN_SELECTOR_ACTIVE &&
       !snapshot_requested && !view_requested &&
       wait_predicate == PTYTERM_WAIT_PREDICATE_NONE)
@@ -3123,6 +3689,27 @@ int main(int argc, char *const argv[]) {
     return usage_error(argv[0], "--recv-control requires --recv");
   if ((recv_timeout_ms != 0 || recv_until != NULL) && !recv_requested)
     return usage_error(argv[0], "recv wait options require --recv");
+  if (recv_cursor != NULL && !recv_requested)
+    return usage_error(argv[0], "--recv-cursor requires --recv");
+  if (since_ms != 0 && !recv_requested)
+    return usage_error(argv[0], "--since requires --recv");
+  if (before_ms != 0 && !recv_requested && !snapshot_requested)
+    return usage_error(argv[0], "--before requires --recv or --snapshot");
+  if (since_generation_requested && !snapshot_requested)
+    return usage_error(argv[0], "--since-generation requires --snapshot");
+  if (since_generation_requested && before_ms != 0)
+    return usage_error(argv[0], "--since-generation does not support --before");
+  if (since_ms != 0 && before_ms != 0 && before_ms >= since_ms)
+    return usage_error(argv[0], "--before must be shorter than --since");
+  if ((recv_lines != 0 || recv_from_line != 0) && !recv_requested)
+    return usage_error(argv[0], "line ranges require --recv");
+  if ((since_ms != 0) + (recv_lines < 0) + (recv_from_line != 0) > 1)
+    return usage_error(argv[0],
+                       "select only one of --since, --recv-lines=-N, and --from-line");
+  if ((since_ms != 0 || before_ms != 0 || recv_lines != 0 ||
+       recv_from_line != 0) &&
+      (recv_timeout_ms != 0 || recv_until != NULL))
+    return usage_error(argv[0], "recv ranges do not support recv wait options");
   if (filter_mode != PTYTERM_FILTER_MODE_NONE && (ifile || ofile || afile))
     return usage_error(argv[0],
                        "filter operations do not support file redirection options");
@@ -3136,7 +3723,8 @@ int main(int argc, char *const argv[]) {
       (detach_requested != 0) + (list_requested != 0) +
       (resize_requested != 0) +
         (buffer_info_requested != 0) + (recv_requested != 0) +
-        (snapshot_requested != 0) +
+        (follow_requested != 0) + (resize_buffer_size != 0) +
+        (delete_cursor != NULL) + (snapshot_requested != 0) +
         (view_requested != 0) +
         (wait_predicate != PTYTERM_WAIT_PREDICATE_NONE) +
           (send_data != NULL) >
@@ -3148,8 +3736,9 @@ int main(int argc, char *const argv[]) {
        (daemon_status_requested != 0) + (daemon_stop_requested != 0) +
        (detach_requested != 0) + (list_requested != 0) +
       (resize_requested != 0) + (buffer_info_requested != 0) +
-      (recv_requested != 0) + (snapshot_requested != 0) +
-      (view_requested != 0) +
+      (recv_requested != 0) + (follow_requested != 0) +
+      (resize_buffer_size != 0) + (delete_cursor != NULL) +
+      (snapshot_requested != 0) + (view_requested != 0) +
       (wait_predicate != PTYTERM_WAIT_PREDICATE_NONE) +
       (send_data != NULL) +
        (filter_mode != PTYTERM_FILTER_MODE_NONE)) > 1) {
@@ -3161,6 +3750,7 @@ int main(int argc, char *const argv[]) {
       !attach_requested && !create_requested && !daemon_status_requested &&
       !daemon_stop_requested && !detach_requested && !list_requested &&
       !resize_requested && !buffer_info_requested && !recv_requested &&
+      !follow_requested && resize_buffer_size == 0 && delete_cursor == NULL &&
       !snapshot_requested && !view_requested &&
       wait_predicate == PTYTERM_WAIT_PREDICATE_NONE && send_data == NULL &&
       (session_id != PTYTERM_SESSION_ALL || socket_path != NULL ||
@@ -3189,7 +3779,9 @@ int main(int argc, char *const argv[]) {
       daemon_stop_requested || detach_requested ||
       resize_requested ||
       list_requested || buffer_info_requested ||
-      recv_requested || snapshot_requested || view_requested ||
+      recv_requested || follow_requested || resize_buffer_size != 0 ||
+      delete_cursor != NULL || snapshot_requested ||
+      view_requested ||
       wait_predicate != PTYTERM_WAIT_PREDICATE_NONE || send_data != NULL) {
     if ((ifile || ofile || afile ||
          ((opt_cols > 0 || opt_lines > 0) && !resize_requested)) &&
@@ -3208,7 +3800,7 @@ int main(int argc, char *const argv[]) {
         return usage_error(argv[0], "--create does not accept --session");
       }
       return run_create_client(socket_path, argc - optind, argv + optind,
-                               status_format);
+                               buffer_size, status_format);
     }
     if (daemon_status_requested)
       return run_daemon_status_client(socket_path, status_format);
@@ -3234,9 +3826,21 @@ int main(int argc, char *const argv[]) {
     }
     if (send_data != NULL)
       return run_send_client(socket_path, session_id, send_data);
+    if (follow_requested)
+      return run_follow_client(socket_path, session_id);
+    if (resize_buffer_size != 0)
+      return run_resize_buffer_client(socket_path, session_id,
+                                      resize_buffer_size, status_format);
+    if (delete_cursor != NULL)
+      return run_cursor_delete_client(socket_path, session_id, delete_cursor,
+                                      status_format);
+    if (snapshot_requested && since_generation_requested)
+      return run_snapshot_delta_client(
+          socket_path, session_id, (uint32_t)screen_selector, since_generation,
+          status_format_explicit ? status_format : PTYTERM_STATUS_FORMAT_TEXT);
     if (snapshot_requested)
       return run_snapshot_client(socket_path, session_id,
-                                 (uint32_t)screen_selector,
+                                 (uint32_t)screen_selector, before_ms,
                                  status_format_explicit ? status_format
                                                         : PTYTERM_STATUS_FORMAT_TEXT);
     if (view_requested)
@@ -3249,7 +3853,9 @@ int main(int argc, char *const argv[]) {
                                    status_format_explicit ? status_format
                                                           : PTYTERM_STATUS_FORMAT_TEXT);
     if (recv_requested)
-      return run_recv_client(socket_path, session_id, recv_size, recv_peek,
+      return run_recv_client(socket_path, session_id, recv_cursor, recv_size,
+                             recv_peek, since_ms, before_ms, recv_lines,
+                             recv_from_line,
                              recv_timeout_ms, recv_until, recv_format,
                              recv_control_mode);
     return run_buffer_info_client(socket_path, session_id, status_format);
@@ -5,6 +5,7 @@
 #endif
 
 #include "ptyterm-control.h"
+#include "ptyterm-history.h"
 #include "ptyterm-screen.h"
 
 #include <dirent.h>
@@ -13,23 +14,166 @@
 #include <getopt.h>
 #include <limits.h>
 #include <locale.h>
+#include <pthread.h>
 #include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
-#include <sys/select.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+enum ptyterm_event_kind {
+  PTYTERM_EVENT_SERVER = 1,
+  PTYTERM_EVENT_MASTER = 2,
+  PTYTERM_EVENT_CLIENT = 3,
+  PTYTERM_EVENT_CONNECTION = 4,
+  PTYTERM_EVENT_WAKE = 5,
+  PTYTERM_EVENT_CHILD = 6,
+};
+
+enum ptyterm_overflow_policy {
+  PTYTERM_OVERFLOW_DROP = 0,
+  PTYTERM_OVERFLOW_PAUSE = 1,
+};
+
+#define PTYTERM_REQUEST_PAYLOAD_MAX 4096
+#define PTYTERM_CONNECTION_READ_SIZE 4096
+#define PTYTERM_CONNECTION_OUTPUT_MAX 65536
+#define PTYTERM_SESSION_READ_SIZE 65536
+#define PTYTERM_SESSION_DRAIN_BUDGET (1024 * 1024)
+#define PTYTERM_HISTORY_SEGMENT_SIZE (1024 * 1024)
+#define PTYTERM_HISTORY_BLOCK_SIZE (64 * 1024)
+/* The default cap on one session's compressed history blocks. */
+#define PTYTERM_COMPRESSED_HISTORY_LIMIT (64 * 1024 * 1024)
+#define PTYTERM_PROGRESS_FRAME_MAX 4096
+#define PTYTERM_OUTPUT_SEGMENTS_MAX 4
+#define PTYTERM_CURSORS_MAX 32
+/* How long a named cursor may go unread before pause stops waiting on it. */
+#define PTYTERM_CURSOR_IDLE_MS (300 * 1000)
+/* The longest the main loop sleeps under pause before resuming sessions
+ * that only an idle cursor held back. */
+#define PTYTERM_CURSOR_CHECK_MS 1000
+#define PTYTERM_TIME_INDEX_RESOLUTION_MS 10
+#define PTYTERM_TIME_INDEX_MAX 4096
+#define PTYTERM_SCREEN_CHECKPOINTS_MAX 16
+#define PTYTERM_SCREEN_CHECKPOINT_MIN_BYTES 1024
+#define PTYTERM_SCREEN_CHECKPOINT_MAX_BYTES (1024 * 1024)
+/* Line starts indexed per session; older lines are found by scanning. */
+#define PTYTERM_LINE_INDEX_MAX 32768
+#define PTYTERM_LINE_SCAN_SIZE 65536
+#define PTYTERM_THREADS_MAX 256
+/* The budget never trims a ring below this. */
+#define PTYTERM_MEMORY_MIN_RING 4096
+
+struct ptyterm_session;
+struct ptyterm_connection;
+
+struct ptyterm_event_loop {
+  int epoll_fd;
+};
+
+/* One epoll registration.  registered_fd is -1 while the source is not in
+ * the interest set; registered_events caches the last interest mask so
+ * interest changes only cost an epoll_ctl() when they actually differ. */
+struct ptyterm_event_source {
+  uint32_t kind;
+  uint32_t registered_events;
+  int registered_fd;
+  struct ptyterm_session *session;
+  struct ptyterm_connection *connection;
+};
+
+/* A control connection that has not been handed over to a session.
+ * Requests are reassembled in input and replies are queued in output, so
+ * a client that stalls mid-frame or stops reading never blocks the loop.
+ * A connection carries any number of requests; they are answered in order
+ * and each reply echoes the request_id of the request being served.
+ * Unparsed input is input[input_start, input_size); discard_size counts
+ * payload bytes of an oversized frame still to skip.  A waiting recv is
+ * parked in recv_wait_request until its session produces a match, and
+ * later requests stay queued behind it.  A recv on a worker's session is
+ * first parked until the worker completes drain number recv_wait_drain.
+ * Parked connections are linked on their session's recv_waiting list and,
+ * when they have a deadline, on the daemon's recv_deadlines list. */
+struct ptyterm_connection {
+  int fd;
+  int input_closed;
+  int close_after_flush;
+  uint32_t request_id;
+  size_t input_start;
+  size_t input_size;
+  size_t input_capacity;
+  char *input;
+  size_t output_size;
+  size_t output_capacity;
+  char *output;
+  size_t discard_size;
+  struct ptyterm_session *recv_wait_session;
+  struct ptyterm_recv_request recv_wait_request;
+  uint64_t recv_wait_deadline_ms;
+  uint64_t recv_wait_scan_offset;
+  uint64_t recv_wait_drain;
+  struct ptyterm_connection *recv_wait_next;
+  struct ptyterm_connection **recv_wait_pprev;
+  struct ptyterm_connection *recv_deadline_next;
+  struct ptyterm_connection **recv_deadline_pprev;
+  struct ptyterm_connection *recv_served_next;
+  struct ptyterm_event_source source;
+  struct ptyterm_connection *prev;
+  struct ptyterm_connection *next;
+};
+
+/* Output read at time_ms or later starts at stream offset offset, and
+ * the screen was rows x cols from then on.  A resize adds a checkpoint of
+ * its own. */
+struct ptyterm_time_checkpoint {
+  uint64_t time_ms;
+  uint64_t offset;
+  uint16_t rows;
+  uint16_t cols;
+};
+
+/* The screen as it stood at time_ms, once the output before offset had
+ * been fed to it. */
+struct ptyterm_screen_checkpoint {
+  uint64_t time_ms;
+  uint64_t offset;
+  struct ptyterm_screen_state screen;
+};
+
+struct ptyterm_recv_cursor {
+  char name[PTYTERM_CURSOR_NAME_MAX];
+  uint64_t offset;
+  uint64_t used_ms;
+};
+
+/* Session fields are guarded by lock.  The loop that owns the session's
+ * fds holds it while servicing them, and control requests hold it while
+ * they read or change the session.  worker is the owner of loop, or NULL
+ * for the main loop; drains up to drain_requested have been asked of it
+ * and those up to drain_completed are done. */
 struct ptyterm_session {
   uint32_t id;
+  size_t table_index;
+  struct ptyterm_session *hash_next;
+  struct ptyterm_session *pid_next;
+  int pid_linked;
+  pthread_mutex_t lock;
   uint32_t state;
   int32_t child_pid;
   int32_t exit_status;
   int master_fd;
   int client_fd;
+  int child_fd;
   size_t pending_input_size;
   size_t pending_input_capacity;
   char *pending_input;
@@ -37,26 +181,147 @@ struct ptyterm_session {
   size_t pending_output_capacity;
   char *pending_output;
   uint64_t recv_offset;
+  struct ptyterm_recv_cursor *cursors;
+  size_t cursor_count;
+  uint64_t cursor_idle_ms;
   uint64_t send_stream_offset;
   uint64_t total_output_bytes;
   uint32_t buffer_capacity;
   uint32_t buffer_used;
   uint32_t dropped_bytes;
   uint32_t paused_on_full;
+  uint32_t overflow_policy;
   size_t ring_start;
   size_t ring_len;
   char *output_ring;
+  struct ptyterm_shared_ring_header *shared_ring;
+  int shared_ring_fd;
+  int history_enabled;
+  struct ptyterm_history history;
+  int coalesce_progress;
+  int progress_cr;
+  int progress_holding;
+  char *progress_frame;
+  size_t progress_frame_len;
+  struct ptyterm_time_checkpoint *checkpoints;
+  size_t checkpoint_start;
+  size_t checkpoint_count;
+  size_t checkpoint_capacity;
+  struct ptyterm_screen_checkpoint *screen_checkpoints;
+  size_t screen_checkpoint_count;
+  uint64_t screen_checkpoint_interval;
+  uint64_t *line_starts;
+  size_t line_start_first;
+  size_t line_start_count;
+  size_t line_start_capacity;
+  uint64_t line_base;
+  struct ptyterm_connection *recv_waiting;
+  struct ptyterm_recv_ready *recv_ready;
+  struct ptyterm_session *recv_ready_next;
+  int recv_ready_queued;
+  uint64_t last_active_ms;
+  struct ptyterm_memory_budget *memory_budget;
+  uint64_t memory_charged;
+  struct ptyterm_event_loop *loop;
+  struct ptyterm_worker *worker;
+  struct ptyterm_session *drain_next;
+  uint64_t drain_requested;
+  uint64_t drain_completed;
+  struct ptyterm_event_source master_source;
+  struct ptyterm_event_source client_source;
+  struct ptyterm_event_source child_source;
   struct ptyterm_screen_state screen;
   char tty_name[PTYTERM_TTY_NAME_MAX];
   char command[PTYTERM_COMMAND_MAX];
 };
 
+/* Live sessions are heap allocated so their addresses stay valid while the
+ * table grows.  slots keeps creation order for listing, except that a
+ * removal moves the last session into the freed slot.  buckets index the
+ * same sessions by id and pid_buckets by child pid, for the SIGCHLD
+ * fallback; a session leaves pid_buckets once its child is reaped.
+ * free_ids is a min-heap of released ids so the smallest unused id is
+ * always handed out first. */
+struct ptyterm_session_table {
+  struct ptyterm_session **slots;
+  size_t count;
+  size_t capacity;
+  struct ptyterm_session **buckets;
+  struct ptyterm_session **pid_buckets;
+  size_t bucket_count;
+  uint32_t *free_ids;
+  size_t free_count;
+  size_t free_capacity;
+  uint32_t next_id;
+};
+
+/* With --threads=N (N > 1) sessions are sharded across N workers, each
+ * running its own epoll loop for the PTY masters and attached clients of
+ * the sessions it owns.  wake_fd is an eventfd that interrupts the loop at
+ * shutdown and when the main thread queues a session on drain_queue.
+ * drain_lock guards only the queue and is taken inside session locks. */
+struct ptyterm_worker {
+  pthread_t thread;
+  struct ptyterm_event_loop loop;
+  int wake_fd;
+  struct ptyterm_event_source wake_source;
+  pthread_mutex_t drain_lock;
+  struct ptyterm_session *drain_queue;
+  struct ptyterm_daemon_state *state;
+};
+
+/* Sessions whose parked recv requests should be checked again, queued by
+ * whichever thread changed them.  lock guards sessions and the
+ * recv_ready_next and recv_ready_queued fields of each session, and is
+ * taken inside session locks; wake_fd wakes the main loop. */
+struct ptyterm_recv_ready {
+  pthread_mutex_t lock;
+  struct ptyterm_session *sessions;
+  int wake_fd;
+};
+
+/* The tally --memory-limit is held to on the output path.  used is the sum
+ * of each session's memory_charged, the memory it had when last charged;
+ * over asks the main loop, through wake_fd, to make room in other
+ * sessions.  lock guards used and over and is taken inside session locks. */
+struct ptyterm_memory_budget {
+  pthread_mutex_t lock;
+  uint64_t limit;
+  uint64_t used;
+  int over;
+  int wake_fd;
+};
+
+/* The main thread accepts control connections and serves requests.
+ * table_lock guards the session table; it is never held while waiting for
+ * a session lock, so the lock order is session before table. */
 struct ptyterm_daemon_state {
   int server_fd;
+  struct ptyterm_event_loop loop;
+  struct ptyterm_event_source server_source;
   char socket_path[PTYTERM_SOCKET_PATH_MAX];
   uint32_t output_buffer;
-  struct ptyterm_session sessions[32];
-  size_t session_count;
+  uint32_t overflow_policy;
+  uint64_t cursor_idle_ms;
+  uint64_t next_cursor_check_ms;
+  const char *history_dir;
+  int compressed_history;
+  size_t history_limit;
+  int coalesce_progress;
+  struct ptyterm_memory_budget memory_budget;
+  uint64_t memory_trimmed;
+  struct ptyterm_session_table sessions;
+  pthread_mutex_t table_lock;
+  int use_pidfd;
+  int child_signal_fd;
+  struct ptyterm_event_source child_signal_source;
+  struct ptyterm_connection *connections;
+  struct ptyterm_recv_ready recv_ready;
+  struct ptyterm_event_source recv_wake_source;
+  struct ptyterm_connection *recv_deadlines;
+  size_t worker_count;
+  size_t next_worker;
+  struct ptyterm_worker *workers;
 };
 
 struct ptyterm_foreground_task_info {
@@ -80,6 +345,66 @@ static int set_nonblocking(int fd) {
   return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+  return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+  (void)pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+static void init_event_source(struct ptyterm_event_source *source,
+                              uint32_t kind, struct ptyterm_session *session) {
+  source->kind = kind;
+  source->registered_events = 0;
+  source->registered_fd = -1;
+  source->session = session;
+  source->connection = NULL;
+}
+
+static int watch_fd(struct ptyterm_event_loop *loop,
+                    struct ptyterm_event_source *source, int fd,
+                    uint32_t events) {
+  struct epoll_event event;
+  int op;
+
+  if (source->registered_fd >= 0 && source->registered_fd != fd) {
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->registered_fd, NULL);
+    source->registered_fd = -1;
+    source->registered_events = 0;
+  }
+
+  /* EPOLLHUP and EPOLLERR are reported even for an empty mask, so an fd
+   * with no interest is removed instead of being left registered. */
+  if (fd < 0 || events == 0) {
+    if (source->registered_fd >= 0)
+      epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->registered_fd, NULL);
+    source->registered_fd = -1;
+    source->registered_events = 0;
+    return 0;
+  }
+
+  if (source->registered_fd == fd && source->registered_events == events)
+    return 0;
+
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.ptr = source;
+  op = source->registered_fd == fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+  if (epoll_ctl(loop->epoll_fd, op, fd, &event) == -1)
+    return -1;
+  source->registered_fd = fd;
+  source->registered_events = events;
+  return 0;
+}
+
+static void unwatch_fd(struct ptyterm_event_loop *loop,
+                       struct ptyterm_event_source *source) {
+  watch_fd(loop, source, -1, 0);
+}
+
 static unsigned long parse_size(const char *arg, const char *optname) {
   char *end;
   unsigned long value;
@@ -106,6 +431,10 @@ static unsigned long parse_size(const char *arg, const char *optname) {
     case 'M':
       scale = 1024UL * 1024UL;
       break;
+    case 'g':
+    case 'G':
+      scale = 1024UL * 1024UL * 1024UL;
+      break;
     default:
       fprintf(stderr, "invalid %s: %s\n", optname, arg);
       exit(EXIT_FAILURE);
@@ -120,6 +449,33 @@ static unsigned long parse_size(const char *arg, const char *optname) {
   return value * scale;
 }
 
+/* Accepts a duration with an ms or s suffix. */
+static uint64_t parse_duration(const char *arg, const char *optname) {
+  char *end;
+  unsigned long long value;
+  uint64_t scale;
+
+  errno = 0;
+  value = strtoull(arg, &end, 0);
+  if (errno != 0 || arg == end || value == 0 || *arg == '-') {
+    fprintf(stderr, "invalid %s: %s\n", optname, arg);
+    exit(EXIT_FAILURE);
+  }
+  if (strcmp(end, "ms") == 0) {
+    scale = 1;
+  } else if (strcmp(end, "s") == 0) {
+    scale = 1000;
+  } else {
+    fprintf(stderr, "invalid %s: %s\n", optname, arg);
+    exit(EXIT_FAILURE);
+  }
+  if (value > UINT64_MAX / scale) {
+    fprintf(stderr, "%s too large: %s\n", optname, arg);
+    exit(EXIT_FAILURE);
+  }
+  return (uint64_t)value * scale;
+}
+
 static void request_stop(int sig) {
   (void)sig;
   stop_requested = 1;
@@ -130,29 +486,255 @@ static void cleanup_socket(void) {
     unlink(cleanup_socket_path);
 }
 
-static void append_output(struct ptyterm_session *session, const char *buffer,
-                          size_t size) {
+/* Describes size bytes of the ring starting at array index position as at
+ * most two iovecs, splitting where the ring wraps. */
+static int ring_segments(const struct ptyterm_session *session,
+                         size_t position, size_t size, struct iovec iov[2]) {
+  size_t first;
+
+  first = session->buffer_capacity - position;
+  if (first > size)
+    first = size;
+  iov[0].iov_base = session->output_ring + position;
+  iov[0].iov_len = first;
+  if (first == size)
+    return 1;
+  iov[1].iov_base = session->output_ring;
+  iov[1].iov_len = size - first;
+  return 2;
+}
+
+static uint64_t monotonic_ms(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/* The offset of the cursor furthest behind, default cursor included.  A
+ * named cursor left unused for cursor_idle_ms no longer holds output back;
+ * it reads on from the oldest retained byte when it is used again. */
+static uint64_t slowest_cursor_offset(const struct ptyterm_session *session) {
+  uint64_t offset;
+  uint64_t now;
   size_t i;
 
-  if (session->output_ring == NULL || session->buffer_capacity == 0)
-    return;
+  offset = session->recv_offset;
+  now = session->cursor_count > 0 ? monotonic_ms() : 0;
+  for (i = 0; i < session->cursor_count; ++i) {
+    if (now - session->cursors[i].used_ms >= session->cursor_idle_ms)
+      continue;
+    if (session->cursors[i].offset < offset)
+      offset = session->cursors[i].offset;
+  }
+  return offset;
+}
 
-  for (i = 0; i < size; ++i) {
-    if (session->ring_len == session->buffer_capacity) {
-      session->ring_start = (session->ring_start + 1) % session->buffer_capacity;
-      session->ring_len -= 1;
-      session->dropped_bytes += 1;
+/* Accounts for size bytes just read into the ring after its newest byte;
+ * anything that ran over the oldest bytes pushes the ring start forward.
+ * Under pause the ring only runs over while a client is attached, and
+ * then only bytes some cursor had not received yet count as dropped. */
+static void commit_output(struct ptyterm_session *session, size_t size) {
+  uint64_t oldest;
+  uint64_t unread;
+  size_t overrun;
+
+  session->ring_len += size;
+  if (session->ring_len > session->buffer_capacity) {
+    overrun = session->ring_len - session->buffer_capacity;
+    session->ring_start = (session->ring_start + overrun) % session->buffer_capacity;
+    session->ring_len = session->buffer_capacity;
+    if (session->overflow_policy == PTYTERM_OVERFLOW_PAUSE) {
+      oldest = session->total_output_bytes + size - session->ring_len;
+      unread = slowest_cursor_offset(session);
+      if (unread < oldest - overrun)
+        unread = oldest - overrun;
+      overrun = unread < oldest ? (size_t)(oldest - unread) : 0;
     }
-    session->output_ring[(session->ring_start + session->ring_len) %
-                         session->buffer_capacity] = buffer[i];
-    session->ring_len += 1;
-    session->total_output_bytes += 1;
+    if (!session->history_enabled)
+      session->dropped_bytes += overrun;
   }
+  session->total_output_bytes += size;
   session->buffer_used = (uint32_t)session->ring_len;
 }
 
+/* Publishes the ring position to clients that mapped the ring.  write_limit
+ * is the stream offset up to which the ring may be written before the next
+ * publish; readers treat anything within capacity of it as overwritten. */
+static void publish_shared_ring(struct ptyterm_session *session,
+                                uint64_t write_limit) {
+  struct ptyterm_shared_ring_header *header;
+  uint64_t sequence;
+
+  header = session->shared_ring;
+  if (header == NULL)
+    return;
+  sequence = header->sequence;
+  __atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&header->total_output_bytes, session->total_output_bytes,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&header->write_limit, write_limit, __ATOMIC_RELAXED);
+  __atomic_store_n(&header->ring_start, (uint64_t)session->ring_start,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&header->ring_len, (uint64_t)session->ring_len,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&header->closed, session->master_fd < 0 ? 1u : 0u,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&header->sequence, sequence + 2, __ATOMIC_RELEASE);
+  /* Ring writes that follow must not become visible before the new
+   * write_limit does. */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/* Moves the ring into a sealed memfd the first time a client asks to map
+ * it.  The ring keeps its layout; only its storage changes. */
+static int share_output_ring(struct ptyterm_session *session) {
+  struct ptyterm_shared_ring_header *header;
+  size_t map_size;
+  char *base;
+  int fd;
+
+  if (session->shared_ring != NULL)
+    return 0;
+  map_size = PTYTERM_SHARED_RING_DATA_OFFSET + session->buffer_capacity;
+  fd = memfd_create("ptyterm-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1)
+    return -1;
+  if (ftruncate(fd, (off_t)map_size) == -1) {
+    close(fd);
+    return -1;
+  }
+  base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+    munmap(base, map_size);
+    close(fd);
+    return -1;
+  }
+
+  header = (struct ptyterm_shared_ring_header *)base;
+  header->magic = PTYTERM_SHARED_RING_MAGIC;
+  header->capacity = session->buffer_capacity;
+  memcpy(base + PTYTERM_SHARED_RING_DATA_OFFSET, session->output_ring,
+         session->buffer_capacity);
+  free(session->output_ring);
+  session->output_ring = base + PTYTERM_SHARED_RING_DATA_OFFSET;
+  session->shared_ring = header;
+  session->shared_ring_fd = fd;
+  publish_shared_ring(session, session->total_output_bytes);
+  return 0;
+}
+
+static void free_output_ring(struct ptyterm_session *session) {
+  if (session->shared_ring == NULL) {
+    free(session->output_ring);
+  } else {
+    /* Mappings outlive the daemon's; tell followers no more is coming. */
+    __atomic_store_n(&session->shared_ring->closed, 1u, __ATOMIC_RELEASE);
+    munmap(session->shared_ring,
+           PTYTERM_SHARED_RING_DATA_OFFSET + session->buffer_capacity);
+    close(session->shared_ring_fd);
+    session->shared_ring = NULL;
+    session->shared_ring_fd = -1;
+  }
+  session->output_ring = NULL;
+}
+
+/* Returns how many more bytes the ring can take before output that some
+ * cursor has not received would be overwritten, or SIZE_MAX when nothing
+ * limits it: under the drop policy, and while an attached client consumes
+ * the output (its own pending buffer already throttles the master, and
+ * commit_output counts what the cursors miss as dropped). */
+static size_t output_room(const struct ptyterm_session *session) {
+  uint64_t unread;
+
+  if (session->overflow_policy != PTYTERM_OVERFLOW_PAUSE ||
+      session->client_fd >= 0)
+    return SIZE_MAX;
+  unread = session->total_output_bytes - slowest_cursor_offset(session);
+  if (unread >= session->buffer_capacity)
+    return 0;
+  return session->buffer_capacity - (size_t)unread;
+}
+
+static void update_session_events(struct ptyterm_session *session) {
+  uint32_t master_events;
+  uint32_t client_events;
+
+  master_events = 0;
+  client_events = 0;
+  /* A paused master is left out of the loop entirely, so the kernel's pty
+   * buffer fills and throttles the writer until recv frees ring space. */
+  session->paused_on_full =
+      session->master_fd >= 0 && output_room(session) == 0;
+  if (session->master_fd >= 0 && !session->paused_on_full) {
+    if (session->pending_output_size == 0)
+      master_events |= EPOLLIN;
+    if (session->pending_input_size > 0)
+      master_events |= EPOLLOUT;
+  }
+  if (session->client_fd >= 0) {
+    if (session->pending_input_size == 0)
+      client_events |= EPOLLIN;
+    if (session->pending_output_size > 0)
+      client_events |= EPOLLOUT;
+  }
+
+  if (watch_fd(session->loop, &session->master_source, session->master_fd,
+               master_events) == -1) {
+    perror("epoll_ctl(master)");
+    exit(EXIT_FAILURE);
+  }
+  if (watch_fd(session->loop, &session->client_source, session->client_fd,
+               client_events) == -1) {
+    perror("epoll_ctl(client)");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Tells the main loop that a session with parked recv requests has new
+ * output or has ended, so they are checked again.  The loop is only woken
+ * when the session joins the ready list; it is still there otherwise. */
+static void wake_recv_waiters(struct ptyterm_session *session) {
+  struct ptyterm_recv_ready *ready;
+  uint64_t value;
+  int queued;
+
+  if (session->recv_waiting == NULL)
+    return;
+  ready = session->recv_ready;
+  queued = 0;
+  pthread_mutex_lock(&ready->lock);
+  if (!session->recv_ready_queued) {
+    session->recv_ready_queued = 1;
+    session->recv_ready_next = ready->sessions;
+    ready->sessions = session;
+    queued = 1;
+  }
+  pthread_mutex_unlock(&ready->lock);
+  value = 1;
+  if (queued && write(ready->wake_fd, &value, sizeof(value)) == -1 &&
+      errno != EAGAIN)
+    perror("write(eventfd)");
+}
+
+static void close_master(struct ptyterm_session *session) {
+  if (session->master_fd < 0)
+    return;
+  unwatch_fd(session->loop, &session->master_source);
+  close(session->master_fd);
+  session->master_fd = -1;
+  publish_shared_ring(session, session->total_output_bytes);
+  wake_recv_waiters(session);
+}
+
 static void close_attached_client(struct ptyterm_session *session) {
   if (session->client_fd >= 0) {
+    unwatch_fd(session->loop, &session->client_source);
     close(session->client_fd);
     session->client_fd = -1;
   }
@@ -160,6 +742,7 @@ static void close_attached_client(struct ptyterm_session *session) {
   session->pending_output_size = 0;
   if (session->state == PTYTERM_SESSION_ATTACHED)
     session->state = PTYTERM_SESSION_DETACHED;
+  update_session_events(session);
 }
 
 static int append_pending_data(char **buffer, size_t *size, size_t *capacity,
@@ -248,1168 +831,4246 @@ static int apply_session_winsize(struct ptyterm_session *session,
   return 0;
 }
 
-static uint64_t oldest_available_offset(const struct ptyterm_session *session) {
+static uint64_t ring_oldest_offset(const struct ptyterm_session *session) {
   return session->total_output_bytes - session->ring_len;
 }
 
-static size_t copy_output_from_offset(const struct ptyterm_session *session,
-                                      uint64_t offset, char *buffer,
-                                      size_t max_bytes) {
-  size_t available;
-  size_t copied;
-  size_t ring_offset;
-
-  if (offset < oldest_available_offset(session) || offset > session->total_output_bytes)
-    return 0;
+/* With a history tier output stays readable back to its oldest stored
+ * segment; otherwise only what the ring still holds is. */
+static uint64_t oldest_available_offset(const struct ptyterm_session *session) {
+  uint64_t oldest;
 
-  available = (size_t)(session->total_output_bytes - offset);
-  if (available > max_bytes)
-    available = max_bytes;
+  oldest = ring_oldest_offset(session);
+  if (session->history_enabled &&
+      ptyterm_history_oldest(&session->history) < oldest)
+    oldest = ptyterm_history_oldest(&session->history);
+  return oldest;
+}
 
-  ring_offset = (size_t)(offset - oldest_available_offset(session));
-  copied = 0;
-  while (copied < available) {
-    size_t chunk;
-    size_t start;
+/* Copies ring bytes that are about to be overwritten into the history
+ * tier.  A read of up to incoming bytes lands right after the newest byte,
+ * so everything it could run over is saved before the read. */
+static void spill_output(struct ptyterm_session *session, size_t incoming) {
+  uint64_t spill_end;
+  uint64_t offset;
+  struct iovec iov[2];
+  int iovcnt;
+  int i;
+
+  if (!session->history_enabled || session->buffer_capacity == 0)
+    return;
+  spill_end = ring_oldest_offset(session);
+  if (session->ring_len + incoming > session->buffer_capacity)
+    spill_end += session->ring_len + incoming - session->buffer_capacity;
+  if (spill_end > session->total_output_bytes)
+    spill_end = session->total_output_bytes;
+  offset = ptyterm_history_size(&session->history);
+  if (offset >= spill_end)
+    return;
 
-    start = (session->ring_start + ring_offset + copied) % session->buffer_capacity;
-    chunk = available - copied;
-    if (start + chunk > session->buffer_capacity)
-      chunk = session->buffer_capacity - start;
-    memcpy(buffer + copied, session->output_ring + start, chunk);
-    copied += chunk;
+  iovcnt = ring_segments(
+      session,
+      (session->ring_start + (size_t)(offset - ring_oldest_offset(session))) %
+          session->buffer_capacity,
+      (size_t)(spill_end - offset), iov);
+  for (i = 0; i < iovcnt; ++i) {
+    if (ptyterm_history_append(&session->history, iov[i].iov_base,
+                               iov[i].iov_len) == -1) {
+      perror("history");
+      ptyterm_history_free(&session->history);
+      session->history_enabled = 0;
+      return;
+    }
   }
-
-  return copied;
 }
 
-static int next_session_id(const struct ptyterm_daemon_state *state) {
-  uint32_t candidate;
+/* Moves the ring to a buffer of capacity bytes, keeping its newest bytes
+ * at their stream offsets.  A shrink first saves what it cuts off to the
+ * history tier, if there is one.  A shared ring is closed to its followers
+ * and the session goes back to a private ring until it is mapped again. */
+static int resize_output_ring(struct ptyterm_session *session,
+                              uint32_t capacity) {
+  struct iovec iov[2];
+  size_t discard;
+  size_t copied;
+  char *ring;
+  int iovcnt;
+  int i;
 
-  for (candidate = 1; candidate < UINT32_MAX; ++candidate) {
-    size_t i;
-    int used;
+  if (capacity == session->buffer_capacity)
+    return 0;
+  ring = calloc(1, capacity);
+  if (ring == NULL)
+    return -1;
 
-    used = 0;
-    for (i = 0; i < state->session_count; ++i) {
-      if (state->sessions[i].id == candidate) {
-        used = 1;
-        break;
-      }
+  discard = 0;
+  if (session->ring_len > capacity) {
+    discard = session->ring_len - capacity;
+    spill_output(session, session->buffer_capacity - capacity);
+  }
+  copied = 0;
+  if (session->ring_len > discard) {
+    iovcnt = ring_segments(session,
+                           (session->ring_start + discard) %
+                               session->buffer_capacity,
+                           session->ring_len - discard, iov);
+    for (i = 0; i < iovcnt; ++i) {
+      memcpy(ring + copied, iov[i].iov_base, iov[i].iov_len);
+      copied += iov[i].iov_len;
     }
-    if (!used)
-      return (int)candidate;
   }
-  errno = ENOSPC;
-  return -1;
+
+  free_output_ring(session);
+  session->output_ring = ring;
+  session->buffer_capacity = capacity;
+  session->ring_start = 0;
+  session->ring_len = copied;
+  session->buffer_used = (uint32_t)copied;
+  if (!session->history_enabled)
+    session->dropped_bytes += (uint32_t)discard;
+  /* A paused ring may have room again. */
+  update_session_events(session);
+  return 0;
 }
 
-static int open_session_pty(char **slave_name_out) {
-  int master_fd;
-  char *slave_name;
+/* Drops every other checkpoint from the older half of the time index,
+ * except those that record a size change, so older moments resolve more
+ * coarsely each time the index fills.  If none can go, the oldest does. */
+static void thin_checkpoints(struct ptyterm_session *session) {
+  struct ptyterm_time_checkpoint *checkpoints;
+  size_t half;
+  size_t kept;
+  size_t i;
 
-  master_fd = open("/dev/ptmx", O_RDWR);
-  if (master_fd == -1)
-    return -1;
-  if (set_nonblocking(master_fd) == -1) {
-    close(master_fd);
-    return -1;
+  checkpoints = session->checkpoints + session->checkpoint_start;
+  half = session->checkpoint_count / 2;
+  kept = 1;
+  for (i = 1; i < session->checkpoint_count; ++i) {
+    if (i < half && i % 2 == 1 &&
+        checkpoints[i].rows == checkpoints[kept - 1].rows &&
+        checkpoints[i].cols == checkpoints[kept - 1].cols)
+      continue;
+    checkpoints[kept] = checkpoints[i];
+    kept += 1;
   }
-  if (grantpt(master_fd) == -1) {
-    close(master_fd);
-    return -1;
+  if (kept < session->checkpoint_count) {
+    session->checkpoint_count = kept;
+  } else {
+    session->checkpoint_start += 1;
+    session->checkpoint_count -= 1;
   }
-  if (unlockpt(master_fd) == -1) {
-    close(master_fd);
-    return -1;
+}
+
+/* Notes that output read now starts at offset, on a screen of the
+ * current size.  Checkpoints are kept at PTYTERM_TIME_INDEX_RESOLUTION_MS
+ * granularity, except that a size change is always recorded, and those
+ * that only cover output no longer retained are dropped from the front.
+ * At most PTYTERM_TIME_INDEX_MAX are kept; older ones are thinned out. */
+static void record_checkpoint(struct ptyterm_session *session, uint64_t offset) {
+  struct ptyterm_time_checkpoint *checkpoints;
+  const struct ptyterm_time_checkpoint *last;
+  uint64_t now;
+  size_t capacity;
+  uint16_t rows;
+  uint16_t cols;
+
+  now = monotonic_ms();
+  rows = ptyterm_screen_rows(&session->screen);
+  cols = ptyterm_screen_cols(&session->screen);
+  if (session->checkpoint_count > 0) {
+    last = &session->checkpoints[session->checkpoint_start +
+                                 session->checkpoint_count - 1];
+    if (now - last->time_ms < PTYTERM_TIME_INDEX_RESOLUTION_MS &&
+        last->rows == rows && last->cols == cols)
+      return;
   }
-  slave_name = ptsname(master_fd);
-  if (slave_name == NULL) {
-    close(master_fd);
-    return -1;
+
+  while (session->checkpoint_count > 1 &&
+         session->checkpoints[session->checkpoint_start + 1].offset <=
+             oldest_available_offset(session)) {
+    session->checkpoint_start += 1;
+    session->checkpoint_count -= 1;
   }
-  *slave_name_out = slave_name;
-  return master_fd;
+  if (session->checkpoint_count == PTYTERM_TIME_INDEX_MAX)
+    thin_checkpoints(session);
+  if (session->checkpoint_start + session->checkpoint_count ==
+      session->checkpoint_capacity) {
+    if (session->checkpoint_start > 0 &&
+        (session->checkpoint_start >= session->checkpoint_capacity / 2 ||
+         session->checkpoint_capacity == PTYTERM_TIME_INDEX_MAX)) {
+      memmove(session->checkpoints,
+              session->checkpoints + session->checkpoint_start,
+              session->checkpoint_count * sizeof(*checkpoints));
+      session->checkpoint_start = 0;
+    } else {
+      capacity = session->checkpoint_capacity == 0
+                     ? 64
+                     : session->checkpoint_capacity * 2;
+      checkpoints = realloc(session->checkpoints, capacity * sizeof(*checkpoints));
+      if (checkpoints == NULL)
+        return;
+      session->checkpoints = checkpoints;
+      session->checkpoint_capacity = capacity;
+    }
+  }
+  checkpoints = session->checkpoints + session->checkpoint_start;
+  checkpoints[session->checkpoint_count].time_ms = now;
+  checkpoints[session->checkpoint_count].offset = offset;
+  checkpoints[session->checkpoint_count].rows = rows;
+  checkpoints[session->checkpoint_count].cols = cols;
+  session->checkpoint_count += 1;
 }
 
-static int open_slave_fd(const char *slave_name) {
-  return open(slave_name, O_RDWR);
-}
+static uint64_t time_at_age(uint64_t age_ms) {
+  uint64_t now;
 
-static void default_screen_size(int fd, uint16_t *rows_out, uint16_t *cols_out) {
-  struct winsize winsize;
+  now = monotonic_ms();
+  return age_ms < now ? now - age_ms : 0;
+}
 
-  *rows_out = 24;
-  *cols_out = 80;
-  if (ioctl(fd, TIOCGWINSZ, &winsize) == -1)
-    return;
-  if (winsize.ws_row > 0)
-    *rows_out = winsize.ws_row;
-  if (winsize.ws_col > 0)
-    *cols_out = winsize.ws_col;
+/* Finds the first checkpoint at or after time_ms by binary search, or
+ * checkpoint_count when there is none. */
+static size_t checkpoint_at_time(const struct ptyterm_session *session,
+                                 uint64_t time_ms) {
+  const struct ptyterm_time_checkpoint *checkpoints;
+  size_t low;
+  size_t high;
+
+  checkpoints = session->checkpoints + session->checkpoint_start;
+  low = 0;
+  high = session->checkpoint_count;
+  while (low < high) {
+    size_t middle;
+
+    middle = low + (high - low) / 2;
+    if (checkpoints[middle].time_ms < time_ms)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return low;
 }
 
-static int32_t current_foreground_pgid(const struct ptyterm_session *session) {
-  pid_t fg_pgid;
+/* The offset of the first output read at or after time_ms. */
+static uint64_t offset_at_time(const struct ptyterm_session *session,
+                               uint64_t time_ms) {
+  size_t index;
 
-  if (session->master_fd < 0)
-    return -1;
+  index = checkpoint_at_time(session, time_ms);
+  return index == session->checkpoint_count
+             ? session->total_output_bytes
+             : session->checkpoints[session->checkpoint_start + index].offset;
+}
 
-  fg_pgid = tcgetpgrp(session->master_fd);
-  if (fg_pgid == -1)
-    return -1;
+/* Resolves an age to the offset of the first output read at or after
+ * that moment. */
+static uint64_t offset_at_age(const struct ptyterm_session *session,
+                              uint64_t age_ms) {
+  return offset_at_time(session, time_at_age(age_ms));
+}
 
-  return (int32_t)fg_pgid;
+/* Moves screen checkpoint index to the end of the array, past the live
+ * ones, where its arrays wait to be reused. */
+static void retire_screen_checkpoint(struct ptyterm_session *session,
+                                     size_t index) {
+  struct ptyterm_screen_checkpoint retired;
+
+  retired = session->screen_checkpoints[index];
+  memmove(session->screen_checkpoints + index,
+          session->screen_checkpoints + index + 1,
+          (PTYTERM_SCREEN_CHECKPOINTS_MAX - index - 1) *
+              sizeof(*session->screen_checkpoints));
+  session->screen_checkpoints[PTYTERM_SCREEN_CHECKPOINTS_MAX - 1] = retired;
+  session->screen_checkpoint_count -= 1;
 }
 
-static int is_decimal_name(const char *value) {
-  const unsigned char *cursor;
+/* Copies the screen as of time_ms, once the output before offset has been
+ * fed to it, when screen_checkpoint_interval bytes have gone by since the
+ * last copy.  A past screen is then rebuilt from the nearest copy instead
+ * of from the start.  The interval is a quarter of the ring so a few
+ * copies fall within it.  Copies of output no longer retained are
+ * dropped, and when all PTYTERM_SCREEN_CHECKPOINTS_MAX are in use every
+ * other one in the older half is, so recent moments stay close to a copy
+ * and older ones are spaced further apart as they age. */
+static void record_screen_checkpoint(struct ptyterm_session *session,
+                                     uint64_t offset, uint64_t time_ms) {
+  struct ptyterm_screen_checkpoint *checkpoint;
+  uint64_t interval;
+  size_t half;
+  size_t i;
 
-  if (value == NULL || *value == '\0')
-    return 0;
+  if (session->output_ring == NULL && !session->history_enabled)
+    return;
+  if (session->screen_checkpoint_count > 0 &&
+      offset - session->screen_checkpoints[session->screen_checkpoint_count -
+                                           1]
+                   .offset <
+          session->screen_checkpoint_interval)
+    return;
+  if (session->screen_checkpoints == NULL) {
+    session->screen_checkpoints =
+        calloc(PTYTERM_SCREEN_CHECKPOINTS_MAX,
+               sizeof(*session->screen_checkpoints));
+    if (session->screen_checkpoints == NULL)
+      return;
+  }
 
-  for (cursor = (const unsigned char *)value; *cursor != '\0'; ++cursor) {
-    if (*cursor < '0' || *cursor > '9')
-      return 0;
+  while (session->screen_checkpoint_count > 0 &&
+         session->screen_checkpoints[0].offset <
+             oldest_available_offset(session))
+    retire_screen_checkpoint(session, 0);
+  if (session->screen_checkpoint_count == 0) {
+    interval = session->buffer_capacity / 4;
+    if (interval < PTYTERM_SCREEN_CHECKPOINT_MIN_BYTES)
+      interval = PTYTERM_SCREEN_CHECKPOINT_MIN_BYTES;
+    if (interval > PTYTERM_SCREEN_CHECKPOINT_MAX_BYTES)
+      interval = PTYTERM_SCREEN_CHECKPOINT_MAX_BYTES;
+    session->screen_checkpoint_interval = interval;
+  } else if (session->screen_checkpoint_count ==
+             PTYTERM_SCREEN_CHECKPOINTS_MAX) {
+    half = session->screen_checkpoint_count / 2;
+    for (i = 1; i < half; ++i) {
+      retire_screen_checkpoint(session, i);
+      half -= 1;
+    }
   }
 
-  return 1;
+  checkpoint = &session->screen_checkpoints[session->screen_checkpoint_count];
+  if (ptyterm_screen_copy(&checkpoint->screen, &session->screen) == -1)
+    return;
+  checkpoint->time_ms = time_ms;
+  checkpoint->offset = offset;
+  session->screen_checkpoint_count += 1;
 }
 
-static int read_proc_stat(pid_t pid, int32_t *pgrp_out,
-                          unsigned long long *start_time_out, char *state_out) {
-  char path[64];
-  char buffer[512];
-  char *tail;
-  FILE *stream;
-  int pgrp;
-  unsigned long long start_time;
-  char state;
+static void free_screen_checkpoints(struct ptyterm_session *session) {
+  size_t i;
 
-  snprintf(path, sizeof(path), "/proc/%ld/stat", (long)pid);
-  stream = fopen(path, "r");
-  if (stream == NULL)
-    return -1;
+  if (session->screen_checkpoints == NULL)
+    return;
+  for (i = 0; i < PTYTERM_SCREEN_CHECKPOINTS_MAX; ++i)
+    ptyterm_screen_free(&session->screen_checkpoints[i].screen);
+  free(session->screen_checkpoints);
+  session->screen_checkpoints = NULL;
+  session->screen_checkpoint_count = 0;
+}
 
-  if (fgets(buffer, sizeof(buffer), stream) == NULL) {
-    fclose(stream);
-    return -1;
-  }
-  fclose(stream);
+static size_t screen_checkpoint_memory(
+    const struct ptyterm_session *session) {
+  size_t memory;
+  size_t i;
 
-  tail = strrchr(buffer, ')');
-  if (tail == NULL || tail[1] != ' ')
-    return -1;
+  if (session->screen_checkpoints == NULL)
+    return 0;
+  memory = PTYTERM_SCREEN_CHECKPOINTS_MAX *
+           sizeof(*session->screen_checkpoints);
+  for (i = 0; i < PTYTERM_SCREEN_CHECKPOINTS_MAX; ++i)
+    memory += ptyterm_screen_memory(&session->screen_checkpoints[i].screen);
+  return memory;
+}
 
-  if (sscanf(tail + 2,
-             "%c %*d %d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %llu",
-             &state, &pgrp, &start_time) != 3) {
-    return -1;
-  }
+struct ptyterm_memory_usage {
+  uint64_t ring_bytes;
+  uint64_t screen_bytes;
+  uint64_t index_bytes;
+  uint64_t history_bytes;
+  uint64_t session_bytes;
+};
 
-  *pgrp_out = (int32_t)pgrp;
-  *start_time_out = start_time;
-  *state_out = state;
-  return 0;
+static void add_session_memory(const struct ptyterm_session *session,
+                               struct ptyterm_memory_usage *usage) {
+  usage->ring_bytes += session->output_ring != NULL ? session->buffer_capacity : 0;
+  usage->screen_bytes += ptyterm_screen_memory(&session->screen) +
+                         screen_checkpoint_memory(session);
+  usage->index_bytes +=
+      session->checkpoint_capacity * sizeof(*session->checkpoints) +
+      session->line_start_capacity * sizeof(*session->line_starts) +
+      session->cursor_count * sizeof(*session->cursors);
+  if (session->history_enabled)
+    usage->history_bytes += ptyterm_history_memory(&session->history);
+  usage->session_bytes += sizeof(*session) + session->pending_input_capacity +
+                          session->pending_output_capacity +
+                          (session->progress_frame != NULL
+                               ? PTYTERM_PROGRESS_FRAME_MAX
+                               : 0);
 }
 
-static int read_proc_comm(pid_t pid, char *buffer, size_t buffer_size) {
-  char path[64];
-  FILE *stream;
-
-  if (buffer_size == 0)
-    return -1;
+static uint64_t memory_used(const struct ptyterm_memory_usage *usage) {
+  return usage->ring_bytes + usage->screen_bytes + usage->index_bytes +
+         usage->history_bytes + usage->session_bytes;
+}
 
-  snprintf(path, sizeof(path), "/proc/%ld/comm", (long)pid);
-  stream = fopen(path, "r");
-  if (stream == NULL)
-    return -1;
+/* Brings the session's share of the memory tally up to date and returns
+ * whether the daemon is over --memory-limit. */
+static int account_session_memory(struct ptyterm_session *session) {
+  struct ptyterm_memory_budget *budget;
+  struct ptyterm_memory_usage usage;
+  uint64_t charged;
+  int over;
+
+  budget = session->memory_budget;
+  memset(&usage, 0, sizeof(usage));
+  add_session_memory(session, &usage);
+  charged = memory_used(&usage);
+  pthread_mutex_lock(&budget->lock);
+  budget->used = budget->used - session->memory_charged + charged;
+  session->memory_charged = charged;
+  over = budget->limit != 0 && budget->used > budget->limit;
+  pthread_mutex_unlock(&budget->lock);
+  return over;
+}
 
-  if (fgets(buffer, buffer_size, stream) == NULL) {
-    fclose(stream);
-    buffer[0] = '\0';
-    return -1;
+/* Charges what the session has grown by.  Over --memory-limit, it gives up
+ * its own oldest history blocks first; if that is not enough, the main
+ * loop is woken to take the rest from other sessions. */
+static void charge_session_memory(struct ptyterm_session *session) {
+  struct ptyterm_memory_budget *budget;
+  uint64_t value;
+  int wake;
+
+  while (account_session_memory(session)) {
+    if (session->history_enabled &&
+        ptyterm_history_drop_oldest(&session->history) == 0)
+      continue;
+    budget = session->memory_budget;
+    pthread_mutex_lock(&budget->lock);
+    wake = !budget->over;
+    budget->over = 1;
+    pthread_mutex_unlock(&budget->lock);
+    value = 1;
+    if (wake && write(budget->wake_fd, &value, sizeof(value)) == -1 &&
+        errno != EAGAIN)
+      perror("write(eventfd)");
+    break;
   }
-  fclose(stream);
+}
 
-  buffer[strcspn(buffer, "\n")] = '\0';
-  return buffer[0] == '\0' ? -1 : 0;
+/* Appends the stream offset where a line starts, first dropping lines that
+ * end before the oldest retained byte, and the oldest line once
+ * PTYTERM_LINE_INDEX_MAX are indexed.  line_base counts the dropped lines,
+ * so line numbers stay absolute. */
+static int push_line_start(struct ptyterm_session *session, uint64_t offset) {
+  uint64_t *line_starts;
+  size_t capacity;
+
+  while (session->line_start_count > 1 &&
+         (session->line_start_count >= PTYTERM_LINE_INDEX_MAX ||
+          session->line_starts[session->line_start_first + 1] <=
+              oldest_available_offset(session))) {
+    session->line_start_first += 1;
+    session->line_start_count -= 1;
+    session->line_base += 1;
+  }
+  if (session->line_start_first + session->line_start_count ==
+      session->line_start_capacity) {
+    if (session->line_start_first > 0 &&
+        session->line_start_first >= session->line_start_capacity / 2) {
+      memmove(session->line_starts,
+              session->line_starts + session->line_start_first,
+              session->line_start_count * sizeof(*line_starts));
+      session->line_start_first = 0;
+    } else {
+      capacity = session->line_start_capacity == 0
+                     ? 256
+                     : session->line_start_capacity * 2;
+      line_starts = realloc(session->line_starts, capacity * sizeof(*line_starts));
+      if (line_starts == NULL)
+        return -1;
+      session->line_starts = line_starts;
+      session->line_start_capacity = capacity;
+    }
+  }
+  session->line_starts[session->line_start_first + session->line_start_count] =
+      offset;
+  session->line_start_count += 1;
+  return 0;
 }
 
-static void resolve_foreground_task_info(const struct ptyterm_session *session,
-                                         struct ptyterm_foreground_task_info *info) {
-  DIR *proc_dir;
-  struct dirent *entry;
-  pid_t best_pid;
-  pid_t leader_pid;
-  unsigned long long best_start_time;
-  unsigned long long leader_start_time;
+/* Indexes the newlines in output that was just stored at offset.  Line 0
+ * starts at offset 0; every newline starts the next one. */
+static void index_lines(struct ptyterm_session *session, uint64_t offset,
+                        const char *data, size_t size) {
+  const char *newline;
+  const char *end;
 
-  memset(info, 0, sizeof(*info));
-  info->pgid = current_foreground_pgid(session);
-  info->representative_pid = -1;
-  if (sizeof(info->task_name) == 0)
+  if (session->line_base + session->line_start_count == 0 &&
+      push_line_start(session, 0) == -1) {
+    perror("line index");
     return;
+  }
+  end = data + size;
+  while (data < end && (newline = memchr(data, '\n', (size_t)(end - data))) != NULL) {
+    if (push_line_start(session, offset + (uint64_t)(newline + 1 - data)) == -1) {
+      perror("line index");
+      return;
+    }
+    offset += (uint64_t)(newline + 1 - data);
+    data = newline + 1;
+  }
+}
 
-  info->task_name[0] = '\0';
-  if (info->pgid <= 0)
-    return;
+/* Returns the number of lines output so far, counting a final line that
+ * has not ended yet. */
+static uint64_t line_total(const struct ptyterm_session *session) {
+  uint64_t count;
+
+  count = session->line_base + session->line_start_count;
+  if (session->line_start_count > 0 &&
+      session->line_starts[session->line_start_first +
+                           session->line_start_count - 1] ==
+          session->total_output_bytes)
+    count -= 1;
+  return count;
+}
 
-  proc_dir = opendir("/proc");
-  if (proc_dir == NULL)
-    return;
+/* Describes up to max_bytes of retained output starting at stream offset
+ * as history and ring segments and returns how many bytes they cover.
+ * Offsets the ring no longer holds are served from the history tier. */
+static size_t output_segments(struct ptyterm_session *session,
+                              uint64_t offset, size_t max_bytes,
+                              struct iovec iov[PTYTERM_OUTPUT_SEGMENTS_MAX],
+                              int *iovcnt) {
+  size_t available;
+  size_t position;
+  size_t size;
+  const char *data;
 
-  best_pid = -1;
-  leader_pid = -1;
-  best_start_time = 0;
-  leader_start_time = 0;
-  while ((entry = readdir(proc_dir)) != NULL) {
-    unsigned long long start_time;
-    int32_t pgrp;
-    pid_t pid;
-    char state;
-    char *end;
+  *iovcnt = 0;
+  if (offset < oldest_available_offset(session) ||
+      offset >= session->total_output_bytes)
+    return 0;
 
-    if (!is_decimal_name(entry->d_name))
-      continue;
+  available = (size_t)(session->total_output_bytes - offset);
+  if (available > max_bytes)
+    available = max_bytes;
 
-    errno = 0;
-    pid = (pid_t)strtol(entry->d_name, &end, 10);
-    if (errno != 0 || end == entry->d_name || *end != '\0')
-      continue;
+  size = 0;
+  while (size < available && offset + size < ring_oldest_offset(session) &&
+         *iovcnt < PTYTERM_OUTPUT_SEGMENTS_MAX - 2) {
+    size_t limit;
+    size_t chunk;
 
-    if (read_proc_stat(pid, &pgrp, &start_time, &state) == -1 || pgrp != info->pgid)
-      continue;
+    limit = available - size;
+    if (limit > ring_oldest_offset(session) - (offset + size))
+      limit = (size_t)(ring_oldest_offset(session) - (offset + size));
+    chunk = ptyterm_history_read(&session->history, offset + size, limit, &data);
+    if (chunk == 0)
+      break;
+    iov[*iovcnt].iov_base = (void *)data;
+    iov[*iovcnt].iov_len = chunk;
+    *iovcnt += 1;
+    size += chunk;
+  }
+  if (size == available || offset + size < ring_oldest_offset(session))
+    return size;
+
+  position = (session->ring_start +
+              (size_t)(offset + size - ring_oldest_offset(session))) %
+             session->buffer_capacity;
+  *iovcnt += ring_segments(session, position, available - size, iov + *iovcnt);
+  return available;
+}
 
-    if (pid == (pid_t)info->pgid) {
-      leader_pid = pid;
-      leader_start_time = start_time;
+/* Counts the newlines in the retained output [from, to). */
+static uint64_t count_newlines(struct ptyterm_session *session, uint64_t from,
+                               uint64_t to) {
+  struct iovec iov[PTYTERM_OUTPUT_SEGMENTS_MAX];
+  const char *data;
+  const char *end;
+  uint64_t count;
+  size_t size;
+  int iovcnt;
+  int i;
+
+  count = 0;
+  while (from < to) {
+    size = output_segments(session, from, (size_t)(to - from), iov, &iovcnt);
+    if (size == 0)
+      break;
+    for (i = 0; i < iovcnt; ++i) {
+      data = iov[i].iov_base;
+      end = data + iov[i].iov_len;
+      while ((data = memchr(data, '\n', (size_t)(end - data))) != NULL) {
+        count += 1;
+        data += 1;
+      }
     }
+    from += size;
+  }
+  return count;
+}
 
-    if (state == 'Z' || pid == (pid_t)info->pgid)
+/* Finds the start of the line count lines before the one starting at
+ * offset, scanning back through retained output PTYTERM_LINE_SCAN_SIZE
+ * bytes at a time, or returns 0 when it starts before the oldest retained
+ * byte. */
+static uint64_t scan_line_back(struct ptyterm_session *session,
+                               uint64_t offset, uint64_t count) {
+  struct iovec iov[PTYTERM_OUTPUT_SEGMENTS_MAX];
+  const char *data;
+  const char *end;
+  uint64_t oldest;
+  uint64_t from;
+  uint64_t found;
+  uint64_t skip;
+  size_t size;
+  int iovcnt;
+  int i;
+
+  /* The newline just before offset ends the line before it. */
+  oldest = oldest_available_offset(session);
+  if (offset == 0)
+    return 0;
+  offset -= 1;
+  while (offset > oldest) {
+    from = offset - oldest > PTYTERM_LINE_SCAN_SIZE
+               ? offset - PTYTERM_LINE_SCAN_SIZE
+               : oldest;
+    found = count_newlines(session, from, offset);
+    if (found < count) {
+      count -= found;
+      offset = from;
       continue;
-
-    if (best_pid == -1 || start_time >= best_start_time) {
-      best_pid = pid;
-      best_start_time = start_time;
     }
+    /* The line starts after newline number found - count + 1 of this
+     * window. */
+    skip = found - count;
+    while (from < offset) {
+      size = output_segments(session, from, (size_t)(offset - from), iov,
+                             &iovcnt);
+      if (size == 0)
+        break;
+      for (i = 0; i < iovcnt; ++i) {
+        data = iov[i].iov_base;
+        end = data + iov[i].iov_len;
+        while ((data = memchr(data, '\n', (size_t)(end - data))) != NULL) {
+          data += 1;
+          if (skip-- == 0)
+            return from + (uint64_t)(data - (const char *)iov[i].iov_base);
+        }
+        from += iov[i].iov_len;
+      }
+    }
+    break;
   }
-  closedir(proc_dir);
-
-  if (best_pid == -1)
-    best_pid = leader_pid;
-  if (best_pid == -1)
-    return;
-
-  info->representative_pid = best_pid;
-  info->representative_start_time =
-      best_pid == leader_pid ? leader_start_time : best_start_time;
-  if (read_proc_comm(best_pid, info->task_name, sizeof(info->task_name)) == -1)
-    info->task_name[0] = '\0';
+  /* Only line 0 starts where no newline precedes it; any other line
+   * found nowhere is no longer retained. */
+  return 0;
 }
 
-static void join_command(char *buffer, size_t buffer_size, uint32_t argc,
-                         char *const argv[]) {
-  size_t offset;
-  uint32_t i;
-
-  if (argc == 0) {
-    const char *shell;
+/* Returns the offset where line starts, or the end of the output for lines
+ * not yet begun.  Lines older than the index are found by scanning back
+ * from its first entry; lines no longer retained resolve to offset 0, so a
+ * read from them is clamped and reported as truncated. */
+static uint64_t line_offset(struct ptyterm_session *session, uint64_t line) {
+  if (session->line_start_count == 0)
+    return line == 0 ? 0 : session->total_output_bytes;
+  if (line < session->line_base)
+    return scan_line_back(session,
+                          session->line_starts[session->line_start_first],
+                          session->line_base - line);
+  if (line - session->line_base >= session->line_start_count)
+    return session->total_output_bytes;
+  return session->line_starts[session->line_start_first +
+                              (size_t)(line - session->line_base)];
+}
 
-    shell = getenv("SHELL");
-    if (shell == NULL || *shell == '\0')
-      shell = "/bin/sh";
-    snprintf(buffer, buffer_size, "%s", shell);
-    return;
+/* Returns the number of the line holding offset, by binary search, or for
+ * an offset older than the index by counting the newlines after it. */
+static uint64_t line_at_offset(struct ptyterm_session *session,
+                               uint64_t offset) {
+  const uint64_t *line_starts;
+  size_t low;
+  size_t high;
+
+  line_starts = session->line_starts + session->line_start_first;
+  if (session->line_start_count > 0 && offset < line_starts[0]) {
+    low = (size_t)count_newlines(session, offset, line_starts[0]);
+    return session->line_base > low ? session->line_base - low : 0;
   }
+  low = 0;
+  high = session->line_start_count;
+  while (low < high) {
+    size_t middle;
+
+    middle = low + (high - low) / 2;
+    if (line_starts[middle] <= offset)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+  return session->line_base + (low > 0 ? low - 1 : 0);
+}
 
-  offset = 0;
-  buffer[0] = '\0';
-  for (i = 0; i < argc; ++i) {
-    int written;
-
-    written = snprintf(buffer + offset, buffer_size - offset, "%s%s",
-                       i == 0 ? "" : " ", argv[i]);
-    if (written < 0)
-      break;
-    if ((size_t)written >= buffer_size - offset) {
-      offset = buffer_size - 1;
+/* Looks for pattern in the retained output [from, to) and sets match_end
+ * just past its first occurrence.  Each segment is searched with memmem;
+ * the last size - 1 bytes before it are carried over so that a match that
+ * spans two segments is found as well. */
+static int find_output_pattern(struct ptyterm_session *session,
+                               uint64_t from, uint64_t to,
+                               const char *pattern, size_t size,
+                               uint64_t *match_end) {
+  struct iovec iov[PTYTERM_OUTPUT_SEGMENTS_MAX];
+  char stitch[2 * PTYTERM_RECV_UNTIL_MAX];
+  const char *found;
+  uint64_t offset;
+  size_t carry;
+  size_t head;
+  int iovcnt;
+  int i;
+
+  offset = from;
+  carry = 0;
+  while (offset < to) {
+    if (output_segments(session, offset, (size_t)(to - offset), iov,
+                        &iovcnt) == 0)
       break;
+    for (i = 0; i < iovcnt; ++i) {
+      const char *data;
+      size_t length;
+
+      data = iov[i].iov_base;
+      length = iov[i].iov_len;
+      head = length < size - 1 ? length : size - 1;
+      memcpy(stitch + carry, data, head);
+      if (carry > 0 &&
+          (found = memmem(stitch, carry + head, pattern, size)) != NULL) {
+        *match_end = offset - carry + (uint64_t)(found - stitch) + size;
+        return 1;
+      }
+      found = memmem(data, length, pattern, size);
+      if (found != NULL) {
+        *match_end = offset + (uint64_t)(found - data) + size;
+        return 1;
+      }
+      if (length >= size - 1) {
+        carry = size - 1;
+        memcpy(stitch, data + length - carry, carry);
+      } else {
+        head = carry + length > size - 1 ? size - 1 : carry + length;
+        memmove(stitch, stitch + carry + length - head, head);
+        carry = head;
+      }
+      offset += length;
     }
-    offset += (size_t)written;
   }
-  buffer[offset] = '\0';
+  return 0;
 }
 
-static int spawn_session(struct ptyterm_daemon_state *state, uint32_t argc,
-                         char *const argv[], struct ptyterm_create_response *response) {
+static size_t session_bucket(const struct ptyterm_session_table *table,
+                             uint32_t id) {
+  return (size_t)(id * 2654435761u) & (table->bucket_count - 1);
+}
+
+static struct ptyterm_session *table_find(
+    const struct ptyterm_session_table *table, uint32_t id) {
   struct ptyterm_session *session;
-  char *slave_name;
-  int master_fd;
-  pid_t child_pid;
-  int session_id;
-  uint16_t rows;
-  uint16_t cols;
 
-  if (state->session_count >= sizeof(state->sessions) / sizeof(state->sessions[0])) {
-    errno = ENOSPC;
-    return -1;
+  if (table->bucket_count == 0)
+    return NULL;
+  for (session = table->buckets[session_bucket(table, id)]; session != NULL;
+       session = session->hash_next) {
+    if (session->id == id)
+      return session;
   }
+  return NULL;
+}
 
-  session_id = next_session_id(state);
-  if (session_id == -1)
-    return -1;
-
-  master_fd = open_session_pty(&slave_name);
-  if (master_fd == -1)
-    return -1;
+static struct ptyterm_session *table_find_pid(
+    const struct ptyterm_session_table *table, pid_t pid) {
+  struct ptyterm_session *session;
 
-  child_pid = fork();
-  if (child_pid == -1) {
-    close(master_fd);
-    return -1;
+  if (table->bucket_count == 0)
+    return NULL;
+  for (session = table->pid_buckets[session_bucket(table, (uint32_t)pid)];
+       session != NULL; session = session->pid_next) {
+    if (session->child_pid == pid)
+      return session;
   }
+  return NULL;
+}
 
-  if (child_pid == 0) {
-    int slave_fd;
-
-    close(master_fd);
-    if (setsid() == -1) {
-      perror("setsid");
-      _exit(127);
-    }
-
-    slave_fd = open_slave_fd(slave_name);
-    if (slave_fd == -1) {
-      perror("open slave");
-      _exit(127);
-    }
+static void table_link_pid(struct ptyterm_session_table *table,
+                           struct ptyterm_session *session) {
+  size_t bucket;
 
-    if (dup2(slave_fd, STDIN_FILENO) == -1 || dup2(slave_fd, STDOUT_FILENO) == -1 ||
-        dup2(slave_fd, STDERR_FILENO) == -1) {
-      perror("dup2");
-      _exit(127);
-    }
-    if (slave_fd > STDERR_FILENO)
-      close(slave_fd);
+  bucket = session_bucket(table, (uint32_t)session->child_pid);
+  session->pid_next = table->pid_buckets[bucket];
+  table->pid_buckets[bucket] = session;
+  session->pid_linked = 1;
+}
 
-    if (argc == 0) {
-      char *const shell_argv[] = {(char *)(getenv("SHELL") ?: "/bin/sh"), NULL};
+static void table_unlink_pid(struct ptyterm_session_table *table,
+                             struct ptyterm_session *session) {
+  struct ptyterm_session **link;
 
-      execvp(shell_argv[0], shell_argv);
-      perror(shell_argv[0]);
-      _exit(127);
-    }
+  if (!session->pid_linked)
+    return;
+  link = &table->pid_buckets[session_bucket(table,
+                                            (uint32_t)session->child_pid)];
+  while (*link != NULL && *link != session)
+    link = &(*link)->pid_next;
+  if (*link != NULL)
+    *link = session->pid_next;
+  session->pid_linked = 0;
+}
 
-    execvp(argv[0], argv);
-    perror(argv[0]);
-    _exit(127);
-  }
+static int table_grow_buckets(struct ptyterm_session_table *table) {
+  struct ptyterm_session **buckets;
+  struct ptyterm_session **pid_buckets;
+  size_t bucket_count;
+  size_t i;
 
-  session = &state->sessions[state->session_count++];
-  memset(session, 0, sizeof(*session));
-  session->id = (uint32_t)session_id;
-  session->state = PTYTERM_SESSION_DETACHED;
-  session->child_pid = child_pid;
-  session->exit_status = -1;
-  session->master_fd = master_fd;
-  session->client_fd = -1;
-  session->pending_input_size = 0;
-  session->pending_input_capacity = 0;
-  session->pending_input = NULL;
-  session->pending_output_size = 0;
-  session->pending_output_capacity = 0;
-  session->pending_output = NULL;
-  session->buffer_capacity = state->output_buffer;
-  session->output_ring = calloc(1, session->buffer_capacity);
-  if (session->output_ring == NULL) {
-    close(master_fd);
-    kill(child_pid, SIGTERM);
-    waitpid(child_pid, NULL, 0);
-    state->session_count -= 1;
-    return -1;
-  }
-  default_screen_size(master_fd, &rows, &cols);
-  if (ptyterm_screen_init(&session->screen, rows, cols) == -1) {
-    free(session->output_ring);
-    session->output_ring = NULL;
-    close(master_fd);
-    kill(child_pid, SIGTERM);
-    waitpid(child_pid, NULL, 0);
-    state->session_count -= 1;
+  bucket_count = table->bucket_count == 0 ? 64 : table->bucket_count * 2;
+  buckets = calloc(bucket_count, sizeof(*buckets));
+  pid_buckets = calloc(bucket_count, sizeof(*pid_buckets));
+  if (buckets == NULL || pid_buckets == NULL) {
+    free(buckets);
+    free(pid_buckets);
     return -1;
   }
-  snprintf(session->tty_name, sizeof(session->tty_name), "%s", slave_name);
-  join_command(session->command, sizeof(session->command), argc, argv);
 
-  response->session_id = session->id;
-  response->state = session->state;
-  response->child_pid = session->child_pid;
+  free(table->buckets);
+  free(table->pid_buckets);
+  table->buckets = buckets;
+  table->pid_buckets = pid_buckets;
+  table->bucket_count = bucket_count;
+  for (i = 0; i < table->count; ++i) {
+    struct ptyterm_session *session;
+    size_t bucket;
+
+    session = table->slots[i];
+    bucket = session_bucket(table, session->id);
+    session->hash_next = table->buckets[bucket];
+    table->buckets[bucket] = session;
+    if (session->pid_linked)
+      table_link_pid(table, session);
+  }
   return 0;
 }
 
-static void reap_children(struct ptyterm_daemon_state *state) {
-  int status;
-  pid_t pid;
-
-  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-    size_t i;
+static int table_reserve(struct ptyterm_session_table *table) {
+  if (table->count == table->capacity) {
+    struct ptyterm_session **slots;
+    size_t capacity;
 
-    for (i = 0; i < state->session_count; ++i) {
-      if (state->sessions[i].child_pid != pid)
-        continue;
-      state->sessions[i].state = PTYTERM_SESSION_EXITED;
-      close_attached_client(&state->sessions[i]);
-      state->sessions[i].state = PTYTERM_SESSION_EXITED;
-      if (WIFEXITED(status)) {
-        state->sessions[i].exit_status = WEXITSTATUS(status);
-      } else if (WIFSIGNALED(status)) {
-        state->sessions[i].exit_status = 128 + WTERMSIG(status);
-      } else {
-        state->sessions[i].exit_status = status;
-      }
-      break;
+    capacity = table->capacity == 0 ? 64 : table->capacity * 2;
+    if (capacity > SIZE_MAX / sizeof(*slots)) {
+      errno = ENOMEM;
+      return -1;
     }
+    slots = realloc(table->slots, capacity * sizeof(*slots));
+    if (slots == NULL)
+      return -1;
+    table->slots = slots;
+    table->capacity = capacity;
   }
+  if (table->count >= table->bucket_count && table_grow_buckets(table) == -1)
+    return -1;
+  return 0;
 }
 
-static void drain_session_output(struct ptyterm_session *session) {
-  char buffer[1024];
-  ssize_t size;
+static void free_id_push(struct ptyterm_session_table *table, uint32_t id) {
+  size_t child;
 
-  if (session->master_fd < 0)
-    return;
+  if (table->free_count == table->free_capacity) {
+    uint32_t *free_ids;
+    size_t capacity;
 
-  size = read(session->master_fd, buffer, sizeof(buffer));
-  if (size > 0) {
-    append_output(session, buffer, (size_t)size);
-    ptyterm_screen_feed(&session->screen, buffer, (size_t)size);
-    if (session->client_fd >= 0) {
-      if (append_pending_output(session, buffer, (size_t)size) == -1 ||
-          flush_pending_data(session->client_fd, session->pending_output,
-                             &session->pending_output_size) == -1) {
-        close_attached_client(session);
-      }
-    }
-    return;
+    capacity = table->free_capacity == 0 ? 64 : table->free_capacity * 2;
+    free_ids = realloc(table->free_ids, capacity * sizeof(*free_ids));
+    if (free_ids == NULL)
+      return; /* the id is simply not reused */
+    table->free_ids = free_ids;
+    table->free_capacity = capacity;
   }
 
-  if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
-    return;
+  child = table->free_count++;
+  while (child > 0) {
+    size_t parent;
 
-  if (size == 0 || errno == EIO) {
-    close(session->master_fd);
-    session->master_fd = -1;
-    close_attached_client(session);
-    return;
+    parent = (child - 1) / 2;
+    if (table->free_ids[parent] <= id)
+      break;
+    table->free_ids[child] = table->free_ids[parent];
+    child = parent;
   }
+  table->free_ids[child] = id;
 }
 
-static void drain_attached_input(struct ptyterm_session *session) {
-  char buffer[1024];
-  ssize_t size;
+static uint32_t free_id_pop(struct ptyterm_session_table *table) {
+  uint32_t min_id;
+  uint32_t last;
+  size_t parent;
 
-  if (session->client_fd < 0)
-    return;
+  min_id = table->free_ids[0];
+  last = table->free_ids[--table->free_count];
+  parent = 0;
+  for (;;) {
+    size_t child;
 
-  if (session->pending_input_size > 0) {
-    if (session->master_fd < 0 ||
-        flush_pending_data(session->master_fd, session->pending_input,
-                           &session->pending_input_size) == -1) {
-      close_attached_client(session);
-    }
-    if (session->pending_input_size > 0)
-      return;
+    child = parent * 2 + 1;
+    if (child >= table->free_count)
+      break;
+    if (child + 1 < table->free_count &&
+        table->free_ids[child + 1] < table->free_ids[child])
+      child += 1;
+    if (last <= table->free_ids[child])
+      break;
+    table->free_ids[parent] = table->free_ids[child];
+    parent = child;
   }
+  if (table->free_count > 0)
+    table->free_ids[parent] = last;
+  return min_id;
+}
 
-  size = read(session->client_fd, buffer, sizeof(buffer));
-  if (size > 0) {
-    if (session->master_fd < 0 ||
-        append_pending_data(&session->pending_input, &session->pending_input_size,
-                            &session->pending_input_capacity, buffer,
-                            (size_t)size) == -1 ||
-        flush_pending_data(session->master_fd, session->pending_input,
-                           &session->pending_input_size) == -1) {
-      close_attached_client(session);
-    }
-    return;
+/* Gives session the next id and publishes it to lookups. */
+static int table_insert(struct ptyterm_session_table *table,
+                        struct ptyterm_session *session) {
+  size_t bucket;
+  uint32_t id;
+
+  if (table->free_count == 0 && table->next_id == UINT32_MAX) {
+    errno = ENOSPC;
+    return -1;
   }
+  if (table_reserve(table) == -1)
+    return -1;
 
-  if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
-    return;
+  if (table->free_count > 0) {
+    id = free_id_pop(table);
+  } else {
+    if (table->next_id == 0)
+      table->next_id = 1;
+    id = table->next_id++;
+  }
 
-  if (size == 0 || errno != EINTR)
-    close_attached_client(session);
+  session->id = id;
+  session->table_index = table->count;
+  table->slots[table->count++] = session;
+  bucket = session_bucket(table, id);
+  session->hash_next = table->buckets[bucket];
+  table->buckets[bucket] = session;
+  return 0;
 }
 
-static void cleanup_state(struct ptyterm_daemon_state *state) {
-  size_t i;
+static void table_remove(struct ptyterm_session_table *table,
+                         struct ptyterm_session *session) {
+  struct ptyterm_session **link;
+  size_t index;
 
-  for (i = 0; i < state->session_count; ++i) {
-    if (state->sessions[i].master_fd >= 0)
-      close(state->sessions[i].master_fd);
-    if (state->sessions[i].client_fd >= 0)
-      close(state->sessions[i].client_fd);
-    free(state->sessions[i].pending_input);
-    free(state->sessions[i].pending_output);
-    if (state->sessions[i].state != PTYTERM_SESSION_EXITED &&
-        state->sessions[i].child_pid > 0) {
-      kill(state->sessions[i].child_pid, SIGTERM);
-      waitpid(state->sessions[i].child_pid, NULL, 0);
-    }
-    free(state->sessions[i].output_ring);
-    state->sessions[i].output_ring = NULL;
-    ptyterm_screen_free(&state->sessions[i].screen);
+  link = &table->buckets[session_bucket(table, session->id)];
+  while (*link != NULL && *link != session)
+    link = &(*link)->hash_next;
+  if (*link != NULL)
+    *link = session->hash_next;
+
+  table_unlink_pid(table, session);
+
+  index = session->table_index;
+  table->count -= 1;
+  if (index < table->count) {
+    table->slots[index] = table->slots[table->count];
+    table->slots[index]->table_index = index;
   }
+
+  free_id_push(table, session->id);
 }
 
-static void install_signal_handlers(void) {
-  struct sigaction sa;
+static void table_free(struct ptyterm_session_table *table) {
+  free(table->slots);
+  free(table->buckets);
+  free(table->pid_buckets);
+  free(table->free_ids);
+  memset(table, 0, sizeof(*table));
+}
 
-  memset(&sa, 0, sizeof(sa));
-  sa.sa_handler = request_stop;
-  sigemptyset(&sa.sa_mask);
+static int open_session_pty(char **slave_name_out) {
+  int master_fd;
+  char *slave_name;
 
-  if (sigaction(SIGINT, &sa, NULL) == -1) {
-    perror("sigaction(SIGINT)");
-    exit(EXIT_FAILURE);
+  master_fd = open("/dev/ptmx", O_RDWR | O_CLOEXEC);
+  if (master_fd == -1)
+    return -1;
+  if (set_nonblocking(master_fd) == -1) {
+    close(master_fd);
+    return -1;
   }
-  if (sigaction(SIGTERM, &sa, NULL) == -1) {
-    perror("sigaction(SIGTERM)");
-    exit(EXIT_FAILURE);
+  if (grantpt(master_fd) == -1) {
+    close(master_fd);
+    return -1;
   }
+  if (unlockpt(master_fd) == -1) {
+    close(master_fd);
+    return -1;
+  }
+  slave_name = ptsname(master_fd);
+  if (slave_name == NULL) {
+    close(master_fd);
+    return -1;
+  }
+  *slave_name_out = slave_name;
+  return master_fd;
 }
 
-static int send_error_response(int client_fd, int error_code,
-                               const char *message) {
-  struct ptyterm_error_response response;
-
-  memset(&response, 0, sizeof(response));
-  response.error_code = error_code;
-  snprintf(response.message, sizeof(response.message), "%s", message);
-  return ptyterm_send_message(client_fd, PTYTERM_MESSAGE_ERROR, &response,
-                              sizeof(response));
+static int open_slave_fd(const char *slave_name) {
+  return open(slave_name, O_RDWR);
 }
 
-static int send_list_response(int client_fd,
-                              const struct ptyterm_daemon_state *state,
-                              int requested_session_id) {
-  struct ptyterm_list_response *response;
-  struct ptyterm_foreground_task_info foreground_task;
-  struct ptyterm_session_summary *summary;
-  size_t i;
-  size_t match_count;
-  size_t payload_size;
+static void default_screen_size(int fd, uint16_t *rows_out, uint16_t *cols_out) {
+  struct winsize winsize;
 
-  match_count = 0;
-  for (i = 0; i < state->session_count; ++i) {
-    if (requested_session_id == PTYTERM_SESSION_ALL ||
-        state->sessions[i].id == (uint32_t)requested_session_id) {
-      ++match_count;
-    }
-  }
+  *rows_out = 24;
+  *cols_out = 80;
+  if (ioctl(fd, TIOCGWINSZ, &winsize) == -1)
+    return;
+  if (winsize.ws_row > 0)
+    *rows_out = winsize.ws_row;
+  if (winsize.ws_col > 0)
+    *cols_out = winsize.ws_col;
+}
 
-  payload_size = sizeof(*response) +
-                 match_count * sizeof(struct ptyterm_session_summary);
-  response = calloc(1, payload_size);
-  if (response == NULL)
+static int32_t current_foreground_pgid(const struct ptyterm_session *session) {
+  pid_t fg_pgid;
+
+  if (session->master_fd < 0)
     return -1;
 
-  response->session_count = (uint32_t)match_count;
-  summary = (struct ptyterm_session_summary *)(response + 1);
-  for (i = 0; i < state->session_count; ++i) {
-    if (requested_session_id != PTYTERM_SESSION_ALL &&
-        state->sessions[i].id != (uint32_t)requested_session_id) {
-      continue;
-    }
-    summary->id = state->sessions[i].id;
-    summary->state = state->sessions[i].state;
-    summary->child_pid = state->sessions[i].child_pid;
-    resolve_foreground_task_info(&state->sessions[i], &foreground_task);
-    summary->fg_pgid = foreground_task.pgid;
-    summary->exit_status = state->sessions[i].exit_status;
-    snprintf(summary->fg_task, sizeof(summary->fg_task), "%s",
-         foreground_task.task_name);
-    snprintf(summary->tty_name, sizeof(summary->tty_name), "%s",
-             state->sessions[i].tty_name);
-    snprintf(summary->command, sizeof(summary->command), "%s",
-             state->sessions[i].command);
-    ++summary;
-  }
+  fg_pgid = tcgetpgrp(session->master_fd);
+  if (fg_pgid == -1)
+    return -1;
 
-  i = ptyterm_send_message(client_fd, PTYTERM_MESSAGE_LIST_RESPONSE, response,
-                           (uint32_t)payload_size);
-  free(response);
-  return (int)i;
+  return (int32_t)fg_pgid;
 }
 
-static const struct ptyterm_session *find_session(
-    const struct ptyterm_daemon_state *state, int requested_session_id) {
-  size_t i;
-
-  for (i = 0; i < state->session_count; ++i) {
-    if (state->sessions[i].id == (uint32_t)requested_session_id)
-      return &state->sessions[i];
-  }
-  return NULL;
-}
+static int is_decimal_name(const char *value) {
+  const unsigned char *cursor;
 
-static int send_buffer_info_response(
-    int client_fd, const struct ptyterm_daemon_state *state,
-    int requested_session_id) {
-  const struct ptyterm_session *session;
-  struct ptyterm_buffer_info_response response;
+  if (value == NULL || *value == '\0')
+    return 0;
 
-  session = find_session(state, requested_session_id);
-  if (session == NULL) {
-    errno = ENOENT;
-    return -1;
+  for (cursor = (const unsigned char *)value; *cursor != '\0'; ++cursor) {
+    if (*cursor < '0' || *cursor > '9')
+      return 0;
   }
 
-  memset(&response, 0, sizeof(response));
-  response.id = session->id;
-  response.state = session->state;
-  response.buffer_capacity = session->buffer_capacity;
-  response.buffer_used = session->buffer_used;
-  response.dropped_bytes = session->dropped_bytes;
-  response.paused_on_full = session->paused_on_full;
-  return ptyterm_send_message(client_fd, PTYTERM_MESSAGE_BUFFER_INFO_RESPONSE,
-                              &response, sizeof(response));
+  return 1;
 }
 
-static int send_screen_snapshot_response(
-    int client_fd, const struct ptyterm_daemon_state *state,
-    int requested_session_id, uint32_t screen_selector) {
-  const struct ptyterm_session *session;
-  struct ptyterm_screen_snapshot_response *response;
-  struct ptyterm_foreground_task_info foreground_task;
-  size_t payload_size;
-  size_t cell_count;
-  uint32_t selected_screen;
-  const char *cells;
-  int sent;
+static int read_proc_stat(pid_t pid, int32_t *pgrp_out,
+                          unsigned long long *start_time_out, char *state_out) {
+  char path[64];
+  char buffer[512];
+  char *tail;
+  FILE *stream;
+  int pgrp;
+  unsigned long long start_time;
+  char state;
 
-  session = find_session(state, requested_session_id);
-  if (session == NULL) {
-    errno = ENOENT;
+  snprintf(path, sizeof(path), "/proc/%ld/stat", (long)pid);
+  stream = fopen(path, "r");
+  if (stream == NULL)
     return -1;
-  }
-  if (screen_selector != PTYTERM_SCREEN_SELECTOR_ACTIVE &&
-      screen_selector != PTYTERM_SCREEN_SELECTOR_MAIN &&
-      screen_selector != PTYTERM_SCREEN_SELECTOR_ALT) {
-    errno = EINVAL;
+
+  if (fgets(buffer, sizeof(buffer), stream) == NULL) {
+    fclose(stream);
     return -1;
   }
+  fclose(stream);
 
-  cell_count = (size_t)ptyterm_screen_rows(&session->screen) *
-               ptyterm_screen_cols(&session->screen);
-  payload_size = sizeof(*response) + cell_count;
-  response = calloc(1, payload_size);
-  if (response == NULL)
+  tail = strrchr(buffer, ')');
+  if (tail == NULL || tail[1] != ' ')
     return -1;
 
-  resolve_foreground_task_info(session, &foreground_task);
-  cells = ptyterm_screen_cells(&session->screen, screen_selector,
-                               &selected_screen);
-  response->session_id = session->id;
-  response->selected_screen = selected_screen;
-  response->state = session->state;
-  response->shell_returned =
-      foreground_task.pgid > 0 && foreground_task.pgid == session->child_pid;
-  response->generation = ptyterm_screen_generation(&session->screen);
-  response->child_pid = session->child_pid;
-  response->fg_pgid = foreground_task.pgid;
-  response->rows = ptyterm_screen_rows(&session->screen);
-  response->cols = ptyterm_screen_cols(&session->screen);
-  response->cursor_row = ptyterm_screen_cursor_row(&session->screen,
-                                                   screen_selector, NULL);
-  response->cursor_col = ptyterm_screen_cursor_col(&session->screen,
-                                                   screen_selector, NULL);
-  response->cursor_visible =
-      (uint8_t)ptyterm_screen_cursor_visible(&session->screen);
-  snprintf(response->fg_task, sizeof(response->fg_task), "%s",
-           foreground_task.task_name);
-  memcpy(response + 1, cells, cell_count);
-  sent = ptyterm_send_message(client_fd, PTYTERM_MESSAGE_SCREEN_SNAPSHOT_RESPONSE,
-                              response, (uint32_t)payload_size);
-  free(response);
-  return sent;
-}
-
-static int send_send_response(int client_fd, struct ptyterm_session *session,
-                              uint32_t requested_bytes, uint32_t sent_bytes,
-                              uint32_t blocked, const char *reason,
-                              uint64_t queue_offset) {
-  struct ptyterm_send_response response;
+  if (sscanf(tail + 2,
+             "%c %*d %d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %llu",
+             &state, &pgrp, &start_time) != 3) {
+    return -1;
+  }
 
-  memset(&response, 0, sizeof(response));
-  response.queue_offset = queue_offset;
-  response.requested_bytes = requested_bytes;
-  response.sent_bytes = sent_bytes;
-  response.unsent_bytes = requested_bytes - sent_bytes;
-  response.resume_offset = sent_bytes;
-  response.blocked = blocked;
-  snprintf(response.reason, sizeof(response.reason), "%s", reason);
-  session->send_stream_offset += sent_bytes;
-  return ptyterm_send_message(client_fd, PTYTERM_MESSAGE_SEND_RESPONSE,
-                              &response, sizeof(response));
+  *pgrp_out = (int32_t)pgrp;
+  *start_time_out = start_time;
+  *state_out = state;
+  return 0;
 }
 
-static int handle_send_request(int client_fd, struct ptyterm_daemon_state *state,
-                               const void *payload, size_t payload_size) {
-  const struct ptyterm_send_request *request;
-  struct ptyterm_session *session;
-  const char *data;
-  ssize_t sent_bytes;
-  uint64_t queue_offset;
+static int read_proc_comm(pid_t pid, char *buffer, size_t buffer_size) {
+  char path[64];
+  FILE *stream;
 
-  if (payload_size < sizeof(*request)) {
-    errno = EPROTO;
+  if (buffer_size == 0)
     return -1;
-  }
 
-  request = (const struct ptyterm_send_request *)payload;
-  if (payload_size != sizeof(*request) + request->data_size) {
-    errno = EPROTO;
+  snprintf(path, sizeof(path), "/proc/%ld/comm", (long)pid);
+  stream = fopen(path, "r");
+  if (stream == NULL)
     return -1;
-  }
 
-  session = (struct ptyterm_session *)find_session(state, request->session_id);
-  if (session == NULL) {
-    errno = ENOENT;
-    return -1;
-  }
-  if (session->master_fd < 0 || session->state == PTYTERM_SESSION_EXITED) {
-    errno = EPIPE;
+  if (fgets(buffer, buffer_size, stream) == NULL) {
+    fclose(stream);
+    buffer[0] = '\0';
     return -1;
   }
+  fclose(stream);
 
-  data = (const char *)(request + 1);
-  queue_offset = session->send_stream_offset;
+  buffer[strcspn(buffer, "\n")] = '\0';
+  return buffer[0] == '\0' ? -1 : 0;
+}
+
+static void resolve_foreground_task_info(const struct ptyterm_session *session,
+                                         struct ptyterm_foreground_task_info *info) {
+  DIR *proc_dir;
+  struct dirent *entry;
+  pid_t best_pid;
+  pid_t leader_pid;
+  unsigned long long best_start_time;
+  unsigned long long leader_start_time;
+
+  memset(info, 0, sizeof(*info));
+  info->pgid = current_foreground_pgid(session);
+  info->representative_pid = -1;
+  if (sizeof(info->task_name) == 0)
+    return;
+
+  info->task_name[0] = '\0';
+  if (info->pgid <= 0)
+    return;
+
+  proc_dir = opendir("/proc");
+  if (proc_dir == NULL)
+    return;
+
+  best_pid = -1;
+  leader_pid = -1;
+  best_start_time = 0;
+  leader_start_time = 0;
+  while ((entry = readdir(proc_dir)) != NULL) {
+    unsigned long long start_time;
+    int32_t pgrp;
+    pid_t pid;
+    char state;
+    char *end;
+
+    if (!is_decimal_name(entry->d_name))
+      continue;
+
+    errno = 0;
+    pid = (pid_t)strtol(entry->d_name, &end, 10);
+    if (errno != 0 || end == entry->d_name || *end != '\0')
+      continue;
+
+    if (read_proc_stat(pid, &pgrp, &start_time, &state) == -1 || pgrp != info->pgid)
+      continue;
+
+    if (pid == (pid_t)info->pgid) {
+      leader_pid = pid;
+      leader_start_time = start_time;
+    }
+
+    if (state == 'Z' || pid == (pid_t)info->pgid)
+      continue;
+
+    if (best_pid == -1 || start_time >= best_start_time) {
+      best_pid = pid;
+      best_start_time = start_time;
+    }
+  }
+  closedir(proc_dir);
+
+  if (best_pid == -1)
+    best_pid = leader_pid;
+  if (best_pid == -1)
+    return;
+
+  info->representative_pid = best_pid;
+  info->representative_start_time =
+      best_pid == leader_pid ? leader_start_time : best_start_time;
+  if (read_proc_comm(best_pid, info->task_name, sizeof(info->task_name)) == -1)
+    info->task_name[0] = '\0';
+}
+
+static void join_command(char *buffer, size_t buffer_size, uint32_t argc,
+                         char *const argv[]) {
+  size_t offset;
+  uint32_t i;
+
+  if (argc == 0) {
+    const char *shell;
+
+    shell = getenv("SHELL");
+    if (shell == NULL || *shell == '\0')
+      shell = "/bin/sh";
+    snprintf(buffer, buffer_size, "%s", shell);
+    return;
+  }
+
+  offset = 0;
+  buffer[0] = '\0';
+  for (i = 0; i < argc; ++i) {
+    int written;
+
+    written = snprintf(buffer + offset, buffer_size - offset, "%s%s",
+                       i == 0 ? "" : " ", argv[i]);
+    if (written < 0)
+      break;
+    if ((size_t)written >= buffer_size - offset) {
+      offset = buffer_size - 1;
+      break;
+    }
+    offset += (size_t)written;
+  }
+  buffer[offset] = '\0';
+}
+
+/* Undoes the setup of a session that was never published. */
+static void discard_session(struct ptyterm_session *session) {
+  if (session->child_fd >= 0)
+    close(session->child_fd);
+  if (session->history_enabled)
+    ptyterm_history_free(&session->history);
+  ptyterm_screen_free(&session->screen);
+  free(session->output_ring);
+  if (session->master_fd >= 0)
+    close(session->master_fd);
+  if (session->child_pid > 0) {
+    kill(session->child_pid, SIGTERM);
+    waitpid(session->child_pid, NULL, 0);
+  }
+  pthread_mutex_unlock(&session->lock);
+  pthread_mutex_destroy(&session->lock);
+  free(session);
+}
+
+static int init_session_history(struct ptyterm_daemon_state *state,
+                                struct ptyterm_session *session) {
+  if (state->history_dir != NULL) {
+    char name[64];
+    struct timespec now;
+
+    /* The creation time in milliseconds keeps a reused session id, or a
+     * later daemon with a reused pid, from meeting these files. */
+    clock_gettime(CLOCK_REALTIME, &now);
+    snprintf(name, sizeof(name), "ptytermd-%ld-%u-%lld", (long)getpid(),
+             session->id,
+             (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000);
+    if (ptyterm_history_init(&session->history, state->history_dir, name,
+                             PTYTERM_HISTORY_SEGMENT_SIZE) == -1)
+      return -1;
+    session->history_enabled = 1;
+  } else if (state->compressed_history) {
+    if (ptyterm_history_init_compressed(&session->history,
+                                        PTYTERM_HISTORY_BLOCK_SIZE) == -1)
+      return -1;
+    session->history_enabled = 1;
+  }
+  if (session->history_enabled)
+    ptyterm_history_set_limit(&session->history, state->history_limit);
+  return 0;
+}
+
+/* The child is forked and the session built before the table lock is
+ * taken.  The session lock is held from before the session is published
+ * until its fds are watched, so neither a lookup nor the owning loop sees
+ * it half set up.  Only the main thread reaps through the SIGCHLD
+ * fallback, so an early exit is still matched to the session. */
+static int spawn_session(struct ptyterm_daemon_state *state, uint32_t argc,
+                         char *const argv[], uint32_t buffer_size,
+                         struct ptyterm_create_response *response) {
+  struct ptyterm_session *session;
+  char *slave_name;
+  int master_fd;
+  pid_t child_pid;
+  uint16_t rows;
+  uint16_t cols;
+
+  session = calloc(1, sizeof(*session));
+  if (session == NULL)
+    return -1;
+  pthread_mutex_init(&session->lock, NULL);
+  pthread_mutex_lock(&session->lock);
+  session->master_fd = -1;
+  session->client_fd = -1;
+  session->child_fd = -1;
+
+  master_fd = open_session_pty(&slave_name);
+  if (master_fd == -1) {
+    discard_session(session);
+    return -1;
+  }
+  session->master_fd = master_fd;
+
+  child_pid = fork();
+  if (child_pid == -1) {
+    discard_session(session);
+    return -1;
+  }
+
+  if (child_pid == 0) {
+    int slave_fd;
+
+    sigset_t unblocked;
+
+    close(master_fd);
+    signal(SIGPIPE, SIG_DFL);
+    sigemptyset(&unblocked);
+    sigaddset(&unblocked, SIGCHLD);
+    sigprocmask(SIG_UNBLOCK, &unblocked, NULL);
+    if (setsid() == -1) {
+      perror("setsid");
+      _exit(127);
+    }
+
+    slave_fd = open_slave_fd(slave_name);
+    if (slave_fd == -1) {
+      perror("open slave");
+      _exit(127);
+    }
+
+    if (dup2(slave_fd, STDIN_FILENO) == -1 || dup2(slave_fd, STDOUT_FILENO) == -1 ||
+        dup2(slave_fd, STDERR_FILENO) == -1) {
+      perror("dup2");
+      _exit(127);
+    }
+    if (slave_fd > STDERR_FILENO)
+      close(slave_fd);
+
+    if (argc == 0) {
+      char *const shell_argv[] = {(char *)(getenv("SHELL") ?: "/bin/sh"), NULL};
+
+      execvp(shell_argv[0], shell_argv);
+      perror(shell_argv[0]);
+      _exit(127);
+    }
+
+    execvp(argv[0], argv);
+    perror(argv[0]);
+    _exit(127);
+  }
+
+  session->state = PTYTERM_SESSION_DETACHED;
+  session->child_pid = child_pid;
+  session->exit_status = -1;
+  session->pending_input_size = 0;
+  session->pending_input_capacity = 0;
+  session->pending_input = NULL;
+  session->pending_output_size = 0;
+  session->pending_output_capacity = 0;
+  session->pending_output = NULL;
+  session->recv_ready = &state->recv_ready;
+  session->memory_budget = &state->memory_budget;
+  session->shared_ring_fd = -1;
+  session->last_active_ms = monotonic_ms();
+  if (state->worker_count > 0) {
+    session->worker = &state->workers[state->next_worker];
+    session->loop = &session->worker->loop;
+    state->next_worker = (state->next_worker + 1) % state->worker_count;
+  } else {
+    session->loop = &state->loop;
+  }
+  init_event_source(&session->master_source, PTYTERM_EVENT_MASTER, session);
+  init_event_source(&session->client_source, PTYTERM_EVENT_CLIENT, session);
+  init_event_source(&session->child_source, PTYTERM_EVENT_CHILD, session);
+  session->buffer_capacity = buffer_size != 0 ? buffer_size : state->output_buffer;
+  session->overflow_policy = state->overflow_policy;
+  session->cursor_idle_ms = state->cursor_idle_ms;
+  session->coalesce_progress = state->coalesce_progress;
+  session->output_ring = calloc(1, session->buffer_capacity);
+  default_screen_size(master_fd, &rows, &cols);
+  if (session->output_ring == NULL ||
+      ptyterm_screen_init(&session->screen, rows, cols) == -1) {
+    discard_session(session);
+    return -1;
+  }
+  snprintf(session->tty_name, sizeof(session->tty_name), "%s", slave_name);
+  join_command(session->command, sizeof(session->command), argc, argv);
+  /* The pidfd becomes readable when the child exits, so the owning loop
+   * reaps it right away even if the pty stays open. */
+  if (state->use_pidfd) {
+    session->child_fd = open_pidfd(child_pid);
+    if (session->child_fd == -1) {
+      discard_session(session);
+      return -1;
+    }
+  }
+
+  /* Nothing else can find the session before it is published, so taking
+   * the table lock while holding its lock never waits on another thread
+   * and keeps the session before table order. */
+  pthread_mutex_lock(&state->table_lock);
+  if (table_insert(&state->sessions, session) == -1) {
+    pthread_mutex_unlock(&state->table_lock);
+    discard_session(session);
+    return -1;
+  }
+  if (init_session_history(state, session) == -1) {
+    table_remove(&state->sessions, session);
+    pthread_mutex_unlock(&state->table_lock);
+    discard_session(session);
+    return -1;
+  }
+  if (!state->use_pidfd)
+    table_link_pid(&state->sessions, session);
+  pthread_mutex_unlock(&state->table_lock);
+
+  if (session->child_fd >= 0 &&
+      watch_fd(session->loop, &session->child_source, session->child_fd,
+               EPOLLIN) == -1) {
+    perror("epoll_ctl(pidfd)");
+    exit(EXIT_FAILURE);
+  }
+  update_session_events(session);
+  account_session_memory(session);
+
+  response->session_id = session->id;
+  response->state = session->state;
+  response->child_pid = session->child_pid;
+  pthread_mutex_unlock(&session->lock);
+  return 0;
+}
+
+static void record_child_exit(struct ptyterm_session *session, int status) {
+  close_attached_client(session);
+  session->state = PTYTERM_SESSION_EXITED;
+  if (WIFEXITED(status)) {
+    session->exit_status = WEXITSTATUS(status);
+  } else if (WIFSIGNALED(status)) {
+    session->exit_status = 128 + WTERMSIG(status);
+  } else {
+    session->exit_status = status;
+  }
+  wake_recv_waiters(session);
+}
+
+static void close_child_fd(struct ptyterm_session *session) {
+  if (session->child_fd < 0)
+    return;
+  unwatch_fd(session->loop, &session->child_source);
+  close(session->child_fd);
+  session->child_fd = -1;
+}
+
+/* Called when a session's pidfd turns readable. */
+static void reap_session_child(struct ptyterm_session *session) {
+  int status;
+  pid_t pid;
+
+  pid = waitpid(session->child_pid, &status, WNOHANG);
+  if (pid == 0)
+    return;
+  if (pid == session->child_pid)
+    record_child_exit(session, status);
+  close_child_fd(session);
+}
+
+/* Fallback for kernels without pidfds: the SIGCHLD signalfd woke the main
+ * loop, so collect every exited child and match it to its session. */
+static void reap_children(struct ptyterm_daemon_state *state) {
+  int status;
+  pid_t pid;
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    struct ptyterm_session *session;
+
+    /* The pid index is guarded by the table lock alone.  A reaped pid can
+     * be reused, so its session leaves the index right away. */
+    pthread_mutex_lock(&state->table_lock);
+    session = table_find_pid(&state->sessions, pid);
+    if (session != NULL)
+      table_unlink_pid(&state->sessions, session);
+    pthread_mutex_unlock(&state->table_lock);
+    if (session == NULL)
+      continue;
+
+    pthread_mutex_lock(&session->lock);
+    record_child_exit(session, status);
+    pthread_mutex_unlock(&session->lock);
+  }
+}
+
+/* Sends fresh output to the attached client straight from where it was
+ * read, keeping only what the socket does not take in pending_output. */
+static int forward_output(struct ptyterm_session *session, struct iovec *iov,
+                          int iovcnt) {
+  ssize_t written;
+  int i;
+
+  if (session->pending_output_size == 0) {
+    written = writev(session->client_fd, iov, iovcnt);
+    if (written == -1) {
+      if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+        return -1;
+      written = 0;
+    }
+    for (i = 0; i < iovcnt; ++i) {
+      if ((size_t)written < iov[i].iov_len) {
+        iov[i].iov_base = (char *)iov[i].iov_base + written;
+        iov[i].iov_len -= (size_t)written;
+        break;
+      }
+      written -= (ssize_t)iov[i].iov_len;
+      iov[i].iov_len = 0;
+    }
+  }
+  for (i = 0; i < iovcnt; ++i) {
+    if (iov[i].iov_len > 0 &&
+        append_pending_output(session, iov[i].iov_base, iov[i].iov_len) == -1)
+      return -1;
+  }
+  return flush_pending_data(session->client_fd, session->pending_output,
+                            &session->pending_output_size);
+}
+
+/* Copies size bytes after the newest byte of the ring, saving what they
+ * run over to the history tier first, and indexes their lines. */
+static void store_output(struct ptyterm_session *session, const char *data,
+                         size_t size) {
+  struct iovec iov[2];
+  uint64_t offset;
+  size_t copied;
+  size_t chunk;
+  int iovcnt;
+  int i;
+
+  while (size > 0) {
+    chunk = size < session->buffer_capacity ? size : session->buffer_capacity;
+    spill_output(session, chunk);
+    iovcnt = ring_segments(session,
+                           (session->ring_start + session->ring_len) %
+                               session->buffer_capacity,
+                           chunk, iov);
+    publish_shared_ring(session, session->total_output_bytes + chunk);
+    copied = 0;
+    for (i = 0; i < iovcnt; ++i) {
+      memcpy(iov[i].iov_base, data + copied, iov[i].iov_len);
+      copied += iov[i].iov_len;
+    }
+    offset = session->total_output_bytes;
+    commit_output(session, chunk);
+    publish_shared_ring(session, session->total_output_bytes);
+    index_lines(session, offset, data, chunk);
+    data += chunk;
+    size -= chunk;
+  }
+}
+
+static void store_progress_frame(struct ptyterm_session *session) {
+  store_output(session, session->progress_frame, session->progress_frame_len);
+  session->progress_frame_len = 0;
+  session->progress_holding = 0;
+}
+
+/* Stores output with progress lines coalesced.  A carriage return that does
+ * not end a line starts a frame that redraws it; the frame is held back
+ * until the next one replaces it or the line ends, so only the first and
+ * the last state of a progress line reach the ring.  Frames longer than
+ * PTYTERM_PROGRESS_FRAME_MAX, or half the ring, are stored as they are. */
+static void store_progress_output(struct ptyterm_session *session,
+                                  const char *data, size_t size) {
+  size_t limit;
+  size_t start;
+  size_t i;
+
+  limit = session->buffer_capacity / 2;
+  if (limit > PTYTERM_PROGRESS_FRAME_MAX)
+    limit = PTYTERM_PROGRESS_FRAME_MAX;
+  start = 0;
+  for (i = 0; i < size; ++i) {
+    int redraw;
+
+    redraw = session->progress_cr && data[i] != '\r' && data[i] != '\n';
+    session->progress_cr = data[i] == '\r';
+    if (!session->progress_holding) {
+      if (!redraw)
+        continue;
+      if (session->progress_frame == NULL) {
+        session->progress_frame = malloc(PTYTERM_PROGRESS_FRAME_MAX);
+        if (session->progress_frame == NULL)
+          continue;
+      }
+      store_output(session, data + start, i - start);
+      session->progress_holding = 1;
+    } else if (redraw) {
+      session->progress_frame_len = 0;
+    }
+    if (session->progress_frame_len >= limit) {
+      store_progress_frame(session);
+      start = i;
+      continue;
+    }
+    session->progress_frame[session->progress_frame_len++] = data[i];
+    if (data[i] == '\n') {
+      store_progress_frame(session);
+      start = i + 1;
+    }
+  }
+  if (!session->progress_holding)
+    store_output(session, data + start, size - start);
+}
+
+/* Performs one read from the master and returns the number of bytes taken,
+ * or 0 when nothing was read. */
+static size_t drain_session_output(struct ptyterm_session *session) {
+  char buffer[4096];
+  struct iovec iov[2];
+  uint64_t offset;
+  size_t position;
+  size_t room;
+  ssize_t size;
+  int coalescing;
+  int iovcnt;
+  int i;
+
+  if (session->master_fd < 0)
+    return 0;
+
+  coalescing = session->coalesce_progress && session->output_ring != NULL &&
+               session->buffer_capacity > 0;
+  room = output_room(session);
+  if (coalescing && room != SIZE_MAX && session->progress_frame_len > 0) {
+    /* A held frame is stored ahead of what this read brings.  One that no
+     * longer fits the ring is stored once nothing in it is unread. */
+    if (session->progress_frame_len >= session->buffer_capacity &&
+        room == session->buffer_capacity) {
+      store_progress_frame(session);
+      room = output_room(session);
+    }
+    room = room > session->progress_frame_len
+               ? room - session->progress_frame_len
+               : 0;
+  }
+  if (room == 0)
+    return 0;
+  if (room > PTYTERM_SESSION_READ_SIZE)
+    room = PTYTERM_SESSION_READ_SIZE;
+
+  /* Output lands directly after the newest byte of the ring; the screen and
+   * the attached client are then fed from those same ring segments.  Output
+   * that is coalesced is read aside first, since it is stored filtered. */
+  position = 0;
+  if (session->output_ring != NULL && session->buffer_capacity > 0 &&
+      !coalescing) {
+    if (room > session->buffer_capacity)
+      room = session->buffer_capacity;
+    spill_output(session, room);
+    position = (session->ring_start + session->ring_len) % session->buffer_capacity;
+    iovcnt = ring_segments(session, position, room, iov);
+    publish_shared_ring(session, session->total_output_bytes + room);
+  } else {
+    if (room > sizeof(buffer))
+      room = sizeof(buffer);
+    iov[0].iov_base = buffer;
+    iov[0].iov_len = room;
+    iovcnt = 1;
+  }
+
+  size = readv(session->master_fd, iov, iovcnt);
+  if (size > 0) {
+    offset = session->total_output_bytes;
+    record_checkpoint(session, offset);
+    /* The blank screen the session started with stands for any moment
+     * before its first output. */
+    if (offset == 0)
+      record_screen_checkpoint(session, 0, 0);
+    if (iov[0].iov_base == buffer) {
+      iov[0].iov_len = (size_t)size;
+      /* Without a ring, output goes to the history tier right away. */
+      if (coalescing) {
+        store_progress_output(session, buffer, (size_t)size);
+      } else if (session->history_enabled) {
+        if (ptyterm_history_append(&session->history, buffer, (size_t)size) == -1) {
+          perror("history");
+          ptyterm_history_free(&session->history);
+          session->history_enabled = 0;
+        } else {
+          session->total_output_bytes += (size_t)size;
+        }
+      }
+    } else {
+      commit_output(session, (size_t)size);
+      publish_shared_ring(session, session->total_output_bytes);
+      iovcnt = ring_segments(session, position, (size_t)size, iov);
+    }
+    /* Output that went nowhere, with neither a ring nor history, is not
+     * part of the stream and gets no line numbers. */
+    if (!coalescing && session->total_output_bytes != offset) {
+      for (i = 0; i < iovcnt; ++i) {
+        index_lines(session, offset, iov[i].iov_base, iov[i].iov_len);
+        offset += iov[i].iov_len;
+      }
+    }
+    for (i = 0; i < iovcnt; ++i)
+      ptyterm_screen_feed(&session->screen, iov[i].iov_base, iov[i].iov_len);
+    /* While a progress frame is held back the screen is ahead of the
+     * stored stream, and a copy would be replayed from before bytes it has
+     * already seen; it waits until the frame is stored. */
+    if (!session->progress_holding)
+      record_screen_checkpoint(session, session->total_output_bytes,
+                               monotonic_ms());
+    if (session->client_fd >= 0 && forward_output(session, iov, iovcnt) == -1)
+      close_attached_client(session);
+    return (size_t)size;
+  }
+
+  /* Nothing was written; withdraw the room announced for the read. */
+  publish_shared_ring(session, session->total_output_bytes);
+  if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return 0;
+
+  if (size == 0 || errno == EIO) {
+    if (session->progress_holding)
+      store_progress_frame(session);
+    close_master(session);
+    close_attached_client(session);
+  }
+  return 0;
+}
+
+/* Reads until the master would block, the ring pauses, the attached client
+ * falls behind, or the per-round budget is spent. Output left over is picked
+ * up on the next wakeup, after other sessions have had their turn. */
+static void drain_session(struct ptyterm_session *session) {
+  size_t drained;
+  size_t size;
+
+  drained = 0;
+  while (drained < PTYTERM_SESSION_DRAIN_BUDGET) {
+    size = drain_session_output(session);
+    if (size == 0)
+      break;
+    drained += size;
+    if (session->client_fd >= 0 && session->pending_output_size > 0)
+      break;
+  }
+  if (drained > 0) {
+    session->last_active_ms = monotonic_ms();
+    charge_session_memory(session);
+    wake_recv_waiters(session);
+  }
+}
+
+static void drain_attached_input(struct ptyterm_session *session) {
+  char buffer[1024];
+  ssize_t size;
+
+  if (session->client_fd < 0)
+    return;
+
+  if (session->pending_input_size > 0) {
+    if (session->master_fd < 0 ||
+        flush_pending_data(session->master_fd, session->pending_input,
+                           &session->pending_input_size) == -1) {
+      close_attached_client(session);
+    }
+    if (session->pending_input_size > 0)
+      return;
+  }
+
+  size = read(session->client_fd, buffer, sizeof(buffer));
+  if (size > 0) {
+    if (session->master_fd < 0 ||
+        append_pending_data(&session->pending_input, &session->pending_input_size,
+                            &session->pending_input_capacity, buffer,
+                            (size_t)size) == -1 ||
+        flush_pending_data(session->master_fd, session->pending_input,
+                           &session->pending_input_size) == -1) {
+      close_attached_client(session);
+    }
+    return;
+  }
+
+  if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return;
+
+  if (size == 0 || errno != EINTR)
+    close_attached_client(session);
+}
+
+static void cleanup_state(struct ptyterm_daemon_state *state) {
+  size_t i;
+
+  for (i = 0; i < state->sessions.count; ++i) {
+    struct ptyterm_session *session;
+
+    session = state->sessions.slots[i];
+    if (session->progress_holding)
+      store_progress_frame(session);
+    close_master(session);
+    close_child_fd(session);
+    if (session->client_fd >= 0) {
+      unwatch_fd(session->loop, &session->client_source);
+      close(session->client_fd);
+    }
+    free(session->pending_input);
+    free(session->pending_output);
+    free(session->cursors);
+    free(session->checkpoints);
+    free(session->line_starts);
+    free(session->progress_frame);
+    if (session->state != PTYTERM_SESSION_EXITED && session->child_pid > 0) {
+      kill(session->child_pid, SIGTERM);
+      waitpid(session->child_pid, NULL, 0);
+    }
+    if (session->history_enabled) {
+      /* Leaves the complete stream in the segment files for later review. */
+      spill_output(session, session->buffer_capacity);
+      ptyterm_history_free(&session->history);
+    }
+    free_output_ring(session);
+    ptyterm_screen_free(&session->screen);
+    free_screen_checkpoints(session);
+    pthread_mutex_destroy(&session->lock);
+    free(session);
+  }
+  table_free(&state->sessions);
+}
+
+static void install_signal_handlers(void) {
+  struct sigaction sa;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = request_stop;
+  sigemptyset(&sa.sa_mask);
+
+  if (sigaction(SIGINT, &sa, NULL) == -1) {
+    perror("sigaction(SIGINT)");
+    exit(EXIT_FAILURE);
+  }
+  if (sigaction(SIGTERM, &sa, NULL) == -1) {
+    perror("sigaction(SIGTERM)");
+    exit(EXIT_FAILURE);
+  }
+
+  /* Clients may close a connection with replies still queued. */
+  sa.sa_handler = SIG_IGN;
+  if (sigaction(SIGPIPE, &sa, NULL) == -1) {
+    perror("sigaction(SIGPIPE)");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static int queue_message(struct ptyterm_connection *connection, uint16_t type,
+                         const void *payload, uint32_t payload_size) {
+  struct ptyterm_message_header header;
+  size_t saved_size;
+
+  saved_size = connection->output_size;
+  ptyterm_message_header_init(&header, type, payload_size);
+  header.request_id = connection->request_id;
+  if (append_pending_data(&connection->output, &connection->output_size,
+                          &connection->output_capacity, (const char *)&header,
+                          sizeof(header)) == -1 ||
+      append_pending_data(&connection->output, &connection->output_size,
+                          &connection->output_capacity, payload,
+                          payload_size) == -1) {
+    connection->output_size = saved_size;
+    return -1;
+  }
+  return 0;
+}
+
+/* Queues a reply whose payload is a fixed part followed by data segments,
+ * such as ranges of a session ring. When nothing is queued ahead of it the
+ * reply is written from those segments directly, and only what the socket
+ * does not take is copied into the output buffer. */
+static int queue_message_segments(struct ptyterm_connection *connection,
+                                  uint16_t type, const void *payload,
+                                  uint32_t payload_size,
+                                  const struct iovec *data, int data_count) {
+  struct ptyterm_message_header header;
+  struct iovec iov[2 + PTYTERM_OUTPUT_SEGMENTS_MAX];
+  size_t saved_size;
+  size_t size;
+  ssize_t written;
+  int count;
+  int i;
+
+  size = payload_size;
+  for (i = 0; i < data_count; ++i)
+    size += data[i].iov_len;
+  ptyterm_message_header_init(&header, type, (uint32_t)size);
+  header.request_id = connection->request_id;
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = (void *)payload;
+  iov[1].iov_len = payload_size;
+  count = 2;
+  for (i = 0; i < data_count && count < (int)(sizeof(iov) / sizeof(iov[0])); ++i)
+    iov[count++] = data[i];
+
+  written = 0;
+  if (connection->output_size == 0) {
+    written = writev(connection->fd, iov, count);
+    /* Errors other than a full socket surface on the next flush. */
+    if (written == -1)
+      written = 0;
+  }
+
+  saved_size = connection->output_size;
+  for (i = 0; i < count; ++i) {
+    if ((size_t)written >= iov[i].iov_len) {
+      written -= (ssize_t)iov[i].iov_len;
+      continue;
+    }
+    if (append_pending_data(&connection->output, &connection->output_size,
+                            &connection->output_capacity,
+                            (const char *)iov[i].iov_base + written,
+                            iov[i].iov_len - (size_t)written) == -1) {
+      connection->output_size = saved_size;
+      if (saved_size == 0 && (i > 0 || written > 0)) {
+        /* Part of the reply already left; the stream cannot be resynced. */
+        connection->close_after_flush = 1;
+        return 0;
+      }
+      return -1;
+    }
+    written = 0;
+  }
+  return 0;
+}
+
+/* Sends a reply with fd attached.  The descriptor travels with the first
+ * byte of the reply, so that byte must go out now: with other replies
+ * still queued ahead of it the request fails with EBUSY. */
+static int queue_message_fd(struct ptyterm_connection *connection,
+                            uint16_t type, const void *payload,
+                            uint32_t payload_size, int fd) {
+  union {
+    struct cmsghdr header;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct ptyterm_message_header header;
+  struct cmsghdr *cmsg;
+  struct msghdr message;
+  struct iovec iov[2];
+  ssize_t written;
+  int i;
+
+  if (connection->output_size > 0) {
+    errno = EBUSY;
+    return -1;
+  }
+  ptyterm_message_header_init(&header, type, payload_size);
+  header.request_id = connection->request_id;
+  iov[0].iov_base = &header;
+  iov[0].iov_len = sizeof(header);
+  iov[1].iov_base = (void *)payload;
+  iov[1].iov_len = payload_size;
+
+  memset(&message, 0, sizeof(message));
+  memset(&control, 0, sizeof(control));
+  message.msg_iov = iov;
+  message.msg_iovlen = 2;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+  cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+
+  do {
+    written = sendmsg(connection->fd, &message, MSG_NOSIGNAL);
+  } while (written == -1 && errno == EINTR);
+  if (written == -1)
+    return -1;
+
+  for (i = 0; i < 2; ++i) {
+    if ((size_t)written >= iov[i].iov_len) {
+      written -= (ssize_t)iov[i].iov_len;
+      continue;
+    }
+    if (append_pending_data(&connection->output, &connection->output_size,
+                            &connection->output_capacity,
+                            (const char *)iov[i].iov_base + written,
+                            iov[i].iov_len - (size_t)written) == -1) {
+      /* Part of the reply already left; the stream cannot be resynced. */
+      connection->close_after_flush = 1;
+      return 0;
+    }
+    written = 0;
+  }
+  return 0;
+}
+
+static int send_error_response(struct ptyterm_connection *connection,
+                               int error_code, const char *message) {
+  struct ptyterm_error_response response;
+
+  memset(&response, 0, sizeof(response));
+  response.error_code = error_code;
+  snprintf(response.message, sizeof(response.message), "%s", message);
+  return queue_message(connection, PTYTERM_MESSAGE_ERROR, &response,
+                       sizeof(response));
+}
+
+/* Sessions are only freed at shutdown, so the result stays valid after the
+ * table lock is released. */
+static struct ptyterm_session *find_session(
+    struct ptyterm_daemon_state *state, int requested_session_id) {
+  struct ptyterm_session *session;
+
+  if (requested_session_id <= 0)
+    return NULL;
+  pthread_mutex_lock(&state->table_lock);
+  session = table_find(&state->sessions, (uint32_t)requested_session_id);
+  pthread_mutex_unlock(&state->table_lock);
+  return session;
+}
+
+static int send_list_response(struct ptyterm_connection *connection,
+                              struct ptyterm_daemon_state *state,
+                              int requested_session_id) {
+  struct ptyterm_list_response *response;
+  struct ptyterm_foreground_task_info foreground_task;
+  struct ptyterm_session_summary *summary;
+  struct ptyterm_session *single;
+  struct ptyterm_session **matches;
+  size_t i;
+  size_t match_count;
+  size_t payload_size;
+
+  /* A single session is already locked by dispatch_request; for a full
+   * listing each session is locked while its summary is copied. */
+  matches = &single;
+  if (requested_session_id == PTYTERM_SESSION_ALL) {
+    pthread_mutex_lock(&state->table_lock);
+    match_count = state->sessions.count;
+    matches = malloc((match_count > 0 ? match_count : 1) * sizeof(*matches));
+    if (matches == NULL) {
+      pthread_mutex_unlock(&state->table_lock);
+      return -1;
+    }
+    memcpy(matches, state->sessions.slots, match_count * sizeof(*matches));
+    pthread_mutex_unlock(&state->table_lock);
+  } else {
+    single = find_session(state, requested_session_id);
+    match_count = single != NULL ? 1 : 0;
+  }
+
+  payload_size = sizeof(*response) +
+                 match_count * sizeof(struct ptyterm_session_summary);
+  response = calloc(1, payload_size);
+  if (response == NULL) {
+    if (matches != &single)
+      free(matches);
+    return -1;
+  }
+
+  response->session_count = (uint32_t)match_count;
+  summary = (struct ptyterm_session_summary *)(response + 1);
+  for (i = 0; i < match_count; ++i) {
+    struct ptyterm_session *session;
+
+    session = matches[i];
+    if (matches != &single)
+      pthread_mutex_lock(&session->lock);
+    summary->id = session->id;
+    summary->state = session->state;
+    summary->child_pid = session->child_pid;
+    resolve_foreground_task_info(session, &foreground_task);
+    summary->fg_pgid = foreground_task.pgid;
+    summary->exit_status = session->exit_status;
+    snprintf(summary->fg_task, sizeof(summary->fg_task), "%s",
+             foreground_task.task_name);
+    snprintf(summary->tty_name, sizeof(summary->tty_name), "%s",
+             session->tty_name);
+    snprintf(summary->command, sizeof(summary->command), "%s",
+             session->command);
+    if (matches != &single)
+      pthread_mutex_unlock(&session->lock);
+    ++summary;
+  }
+  if (matches != &single)
+    free(matches);
+
+  i = queue_message(connection, PTYTERM_MESSAGE_LIST_RESPONSE, response,
+                    (uint32_t)payload_size);
+  free(response);
+  return (int)i;
+}
+
+static int send_buffer_info_response(
+    struct ptyterm_connection *connection,
+    struct ptyterm_daemon_state *state, int requested_session_id,
+    uint16_t type) {
+  struct ptyterm_session *session;
+  struct ptyterm_buffer_info_response response;
+
+  session = find_session(state, requested_session_id);
+  if (session == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  memset(&response, 0, sizeof(response));
+  response.id = session->id;
+  response.state = session->state;
+  response.buffer_capacity = session->buffer_capacity;
+  response.buffer_used = session->buffer_used;
+  response.dropped_bytes = session->dropped_bytes;
+  response.paused_on_full = session->paused_on_full;
+  return queue_message(connection, type, &response, sizeof(response));
+}
+
+/* Feeds the stored output in [offset, limit_offset) to screen. */
+static void replay_output(struct ptyterm_session *session, uint64_t offset,
+                          uint64_t limit_offset,
+                          struct ptyterm_screen_state *screen) {
+  struct iovec iov[PTYTERM_OUTPUT_SEGMENTS_MAX];
+  size_t returned;
+  int iovcnt;
+  int i;
+
+  for (; offset < limit_offset; offset += returned) {
+    returned = output_segments(session, offset,
+                               (size_t)(limit_offset - offset) <
+                                       PTYTERM_RECV_CHUNK_MAX
+                                   ? (size_t)(limit_offset - offset)
+                                   : PTYTERM_RECV_CHUNK_MAX,
+                               iov, &iovcnt);
+    if (returned == 0)
+      break;
+    for (i = 0; i < iovcnt; ++i)
+      ptyterm_screen_feed(screen, iov[i].iov_base, iov[i].iov_len);
+  }
+}
+
+/* Rebuilds the screen as it stood age_ms ago.  The newest screen
+ * checkpoint from before then is copied, and the output after it is
+ * replayed with the resizes the time index recorded on the way, so the
+ * cost is bounded by the checkpoint interval.  Fails with ERANGE when the
+ * output since the nearest checkpoint is no longer retained. */
+static int replay_screen(struct ptyterm_session *session, uint64_t age_ms,
+                         struct ptyterm_screen_state *screen) {
+  const struct ptyterm_time_checkpoint *checkpoints;
+  const struct ptyterm_screen_checkpoint *base;
+  uint64_t limit_offset;
+  uint64_t time_ms;
+  uint64_t offset;
+  size_t index;
+  size_t i;
+
+  time_ms = time_at_age(age_ms);
+  index = checkpoint_at_time(session, time_ms);
+  limit_offset = offset_at_time(session, time_ms);
+  base = NULL;
+  for (i = session->screen_checkpoint_count; i > 0; --i) {
+    if (session->screen_checkpoints[i - 1].offset <= limit_offset &&
+        session->screen_checkpoints[i - 1].time_ms < time_ms) {
+      base = &session->screen_checkpoints[i - 1];
+      break;
+    }
+  }
+  if (base == NULL || base->offset < oldest_available_offset(session)) {
+    errno = ERANGE;
+    return -1;
+  }
+
+  memset(screen, 0, sizeof(*screen));
+  if (ptyterm_screen_copy(screen, &base->screen) == -1)
+    return -1;
+  /* Copies are taken as a read ends, so a resize at the copy's own offset
+   * came after it.  Only the copy of the starting screen precedes resizes
+   * at its offset, and those met nothing to resize but a blank screen. */
+  checkpoints = session->checkpoints + session->checkpoint_start;
+  offset = base->offset;
+  for (i = 0; i < index; ++i) {
+    if (checkpoints[i].offset < base->offset)
+      continue;
+    replay_output(session, offset, checkpoints[i].offset, screen);
+    offset = checkpoints[i].offset;
+    if (ptyterm_screen_resize(screen, checkpoints[i].rows,
+                              checkpoints[i].cols) == -1) {
+      ptyterm_screen_free(screen);
+      return -1;
+    }
+  }
+  replay_output(session, offset, limit_offset, screen);
+  return 0;
+}
+
+/* Fills in the snapshot header for screen, which belongs to session. */
+static void describe_screen(struct ptyterm_session *session,
+                            const struct ptyterm_screen_state *screen,
+                            uint32_t screen_selector,
+                            struct ptyterm_screen_snapshot_response *response) {
+  struct ptyterm_foreground_task_info foreground_task;
+
+  resolve_foreground_task_info(session, &foreground_task);
+  response->session_id = session->id;
+  response->state = session->state;
+  response->shell_returned =
+      foreground_task.pgid > 0 && foreground_task.pgid == session->child_pid;
+  response->generation = ptyterm_screen_generation(screen);
+  response->child_pid = session->child_pid;
+  response->fg_pgid = foreground_task.pgid;
+  response->rows = ptyterm_screen_rows(screen);
+  response->cols = ptyterm_screen_cols(screen);
+  response->cursor_row = ptyterm_screen_cursor_row(
+      screen, screen_selector, &response->selected_screen);
+  response->cursor_col = ptyterm_screen_cursor_col(screen,
+                                                   screen_selector, NULL);
+  response->cursor_visible =
+      (uint8_t)ptyterm_screen_cursor_visible(screen);
+  snprintf(response->fg_task, sizeof(response->fg_task), "%s",
+           foreground_task.task_name);
+}
+
+static int send_screen_snapshot_response(
+    struct ptyterm_connection *connection,
+    struct ptyterm_daemon_state *state, int requested_session_id,
+    uint32_t screen_selector, uint32_t flags, uint64_t before_ms) {
+  struct ptyterm_session *session;
+  const struct ptyterm_screen_state *screen;
+  struct ptyterm_screen_state replayed;
+  struct ptyterm_screen_snapshot_response *response;
+  size_t payload_size;
+  size_t cell_count;
+  int sent;
+
+  session = find_session(state, requested_session_id);
+  if (session == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (screen_selector != PTYTERM_SCREEN_SELECTOR_ACTIVE &&
+      screen_selector != PTYTERM_SCREEN_SELECTOR_MAIN &&
+      screen_selector != PTYTERM_SCREEN_SELECTOR_ALT) {
+    errno = EINVAL;
+    return -1;
+  }
+  screen = &session->screen;
+  if ((flags & PTYTERM_SNAPSHOT_FLAG_BEFORE) != 0) {
+    if (replay_screen(session, before_ms, &replayed) == -1)
+      return -1;
+    screen = &replayed;
+  }
+
+  cell_count = (size_t)ptyterm_screen_rows(screen) * ptyterm_screen_cols(screen);
+  payload_size = sizeof(*response) + cell_count;
+  response = calloc(1, payload_size);
+  if (response == NULL) {
+    if (screen == &replayed)
+      ptyterm_screen_free(&replayed);
+    return -1;
+  }
+
+  describe_screen(session, screen, screen_selector, response);
+  ptyterm_screen_copy_cells(screen, screen_selector, (char *)(response + 1),
+                            NULL);
+  sent = queue_message(connection, PTYTERM_MESSAGE_SCREEN_SNAPSHOT_RESPONSE,
+                       response, (uint32_t)payload_size);
+  free(response);
+  if (screen == &replayed)
+    ptyterm_screen_free(&replayed);
+  return sent;
+}
+
+/* Sends the rows changed after the client's base generation, found from
+ * the per-row generations.  A base the rows cannot be patched onto, one of
+ * another size or screen or from no known generation, gets every row. */
+static int send_screen_delta_response(
+    struct ptyterm_connection *connection,
+    struct ptyterm_daemon_state *state,
+    const struct ptyterm_screen_delta_request *request) {
+  struct ptyterm_session *session;
+  const struct ptyterm_screen_state *screen;
+  struct ptyterm_screen_delta_response *response;
+  uint16_t *row_numbers;
+  size_t payload_size;
+  uint16_t rows;
+  uint16_t cols;
+  uint16_t row;
+  uint32_t count;
+  char *out;
+  int sent;
+
+  session = find_session(state, request->session_id);
+  if (session == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (request->screen_selector != PTYTERM_SCREEN_SELECTOR_ACTIVE &&
+      request->screen_selector != PTYTERM_SCREEN_SELECTOR_MAIN &&
+      request->screen_selector != PTYTERM_SCREEN_SELECTOR_ALT) {
+    errno = EINVAL;
+    return -1;
+  }
+  screen = &session->screen;
+  rows = ptyterm_screen_rows(screen);
+  cols = ptyterm_screen_cols(screen);
+
+  /* Sized for the worst case: every row with its number. */
+  payload_size = sizeof(*response) +
+                 (size_t)rows * (sizeof(*row_numbers) + cols);
+  response = calloc(1, payload_size);
+  if (response == NULL)
+    return -1;
+  describe_screen(session, screen, request->screen_selector, &response->screen);
+  response->base_generation = request->base_generation;
+
+  response->full =
+      request->base_generation == 0 ||
+      request->base_generation > response->screen.generation ||
+      (request->base_screen != 0 &&
+       request->base_screen != response->screen.selected_screen) ||
+      (request->base_rows != 0 &&
+       (request->base_rows != rows || request->base_cols != cols));
+  count = 0;
+  if (!response->full) {
+    row_numbers = (uint16_t *)(response + 1);
+    for (row = 0; row < rows; ++row) {
+      if (ptyterm_screen_row_generation(screen, request->screen_selector,
+                                        row) > request->base_generation)
+        row_numbers[count++] = row;
+    }
+    out = (char *)(row_numbers + count);
+    for (row = 0; row < count; ++row) {
+      memcpy(out,
+             ptyterm_screen_row(screen, request->screen_selector,
+                                row_numbers[row]),
+             cols);
+      out += cols;
+    }
+  } else {
+    count = rows;
+    out = (char *)(response + 1);
+    ptyterm_screen_copy_cells(screen, request->screen_selector, out, NULL);
+    out += (size_t)rows * cols;
+  }
+  response->row_count = count;
+  payload_size = (size_t)(out - (char *)response);
+  sent = queue_message(connection, PTYTERM_MESSAGE_SCREEN_DELTA_RESPONSE,
+                       response, (uint32_t)payload_size);
+  free(response);
+  return sent;
+}
+
+static int send_send_response(struct ptyterm_connection *connection,
+                              struct ptyterm_session *session, uint32_t requested_bytes, uint32_t sent_bytes,
+                              uint32_t blocked, const char *reason,
+                              uint64_t queue_offset) {
+  struct ptyterm_send_response response;
+
+  memset(&response, 0, sizeof(response));
+  response.queue_offset = queue_offset;
+  response.requested_bytes = requested_bytes;
+  response.sent_bytes = sent_bytes;
+  response.unsent_bytes = requested_bytes - sent_bytes;
+  response.resume_offset = sent_bytes;
+  response.blocked = blocked;
+  snprintf(response.reason, sizeof(response.reason), "%s", reason);
+  session->send_stream_offset += sent_bytes;
+  return queue_message(connection, PTYTERM_MESSAGE_SEND_RESPONSE,
+                       &response, sizeof(response));
+}
+
+static int handle_send_request(struct ptyterm_connection *connection,
+                               struct ptyterm_daemon_state *state,
+                               const void *payload, size_t payload_size) {
+  const struct ptyterm_send_request *request;
+  struct ptyterm_session *session;
+  const char *data;
+  ssize_t sent_bytes;
+  uint64_t queue_offset;
+
+  if (payload_size < sizeof(*request)) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  request = (const struct ptyterm_send_request *)payload;
+  if (payload_size != sizeof(*request) + request->data_size) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  session = find_session(state, request->session_id);
+  if (session == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (session->master_fd < 0 || session->state == PTYTERM_SESSION_EXITED) {
+    errno = EPIPE;
+    return -1;
+  }
+
+  data = (const char *)(request + 1);
+  queue_offset = session->send_stream_offset;
   sent_bytes = write(session->master_fd, data, request->data_size);
   if (sent_bytes == -1) {
     if (errno == EAGAIN || errno == EWOULDBLOCK) {
-      return send_send_response(client_fd, session, request->data_size, 0, 1,
+      return send_send_response(connection, session, request->data_size, 0, 1,
                                 "would_block", queue_offset);
     }
     return -1;
   }
 
-  return send_send_response(client_fd, session, request->data_size,
-                            (uint32_t)sent_bytes,
-                            sent_bytes < (ssize_t)request->data_size, 
-                            sent_bytes < (ssize_t)request->data_size ?
-                                "would_block" : "ok",
-                            queue_offset);
+  return send_send_response(connection, session, request->data_size,
+                            (uint32_t)sent_bytes,
+                            sent_bytes < (ssize_t)request->data_size, 
+                            sent_bytes < (ssize_t)request->data_size ?
+                                "would_block" : "ok",
+                            queue_offset);
+}
+
+/* Finds the named cursor, creating it at the oldest retained byte on first
+ * use; an empty name selects the default cursor.  Once PTYTERM_CURSORS_MAX
+ * exist, a new one takes the place of the one unused longest, if that one
+ * has been idle for cursor_idle_ms. */
+static uint64_t *session_cursor(struct ptyterm_session *session,
+                                const char *name) {
+  struct ptyterm_recv_cursor *cursors;
+  struct ptyterm_recv_cursor *cursor;
+  uint64_t now;
+  size_t i;
+
+  if (name[0] == '\0')
+    return &session->recv_offset;
+  now = monotonic_ms();
+  for (i = 0; i < session->cursor_count; ++i) {
+    if (strcmp(session->cursors[i].name, name) == 0) {
+      session->cursors[i].used_ms = now;
+      return &session->cursors[i].offset;
+    }
+  }
+  if (session->cursor_count == PTYTERM_CURSORS_MAX) {
+    cursor = &session->cursors[0];
+    for (i = 1; i < session->cursor_count; ++i) {
+      if (session->cursors[i].used_ms < cursor->used_ms)
+        cursor = &session->cursors[i];
+    }
+    if (now - cursor->used_ms < session->cursor_idle_ms) {
+      errno = ENOSPC;
+      return NULL;
+    }
+  } else {
+    cursors = realloc(session->cursors,
+                      (session->cursor_count + 1) * sizeof(*cursors));
+    if (cursors == NULL)
+      return NULL;
+    session->cursors = cursors;
+    cursor = &cursors[session->cursor_count++];
+  }
+  snprintf(cursor->name, sizeof(cursor->name), "%s", name);
+  cursor->offset = oldest_available_offset(session);
+  cursor->used_ms = now;
+  return &cursor->offset;
+}
+
+/* Removes the named cursor, so it no longer holds back a paused session. */
+static int delete_session_cursor(struct ptyterm_session *session,
+                                 const char *name) {
+  size_t i;
+
+  for (i = 0; i < session->cursor_count; ++i) {
+    if (strcmp(session->cursors[i].name, name) == 0)
+      break;
+  }
+  if (i == session->cursor_count) {
+    errno = ESRCH;
+    return -1;
+  }
+  session->cursor_count -= 1;
+  memmove(session->cursors + i, session->cursors + i + 1,
+          (session->cursor_count - i) * sizeof(*session->cursors));
+  update_session_events(session);
+  return 0;
+}
+
+/* Parks the connection's recv on the session.  The caller fills in the
+ * deadline and links the connection on recv_deadlines when there is one. */
+static void start_recv_wait(struct ptyterm_connection *connection,
+                            struct ptyterm_session *session,
+                            const struct ptyterm_recv_request *request) {
+  connection->recv_wait_session = session;
+  connection->recv_wait_request = *request;
+  connection->recv_wait_next = session->recv_waiting;
+  connection->recv_wait_pprev = &session->recv_waiting;
+  if (session->recv_waiting != NULL)
+    session->recv_waiting->recv_wait_pprev = &connection->recv_wait_next;
+  session->recv_waiting = connection;
+}
+
+static void end_recv_wait(struct ptyterm_connection *connection) {
+  if (connection->recv_wait_session == NULL)
+    return;
+  *connection->recv_wait_pprev = connection->recv_wait_next;
+  if (connection->recv_wait_next != NULL)
+    connection->recv_wait_next->recv_wait_pprev = connection->recv_wait_pprev;
+  if (connection->recv_deadline_pprev != NULL) {
+    *connection->recv_deadline_pprev = connection->recv_deadline_next;
+    if (connection->recv_deadline_next != NULL)
+      connection->recv_deadline_next->recv_deadline_pprev =
+          connection->recv_deadline_pprev;
+    connection->recv_deadline_pprev = NULL;
+  }
+  connection->recv_wait_session = NULL;
+  connection->recv_wait_drain = 0;
+}
+
+/* Asks the worker that owns the session to drain its master, so a recv
+ * that follows a send observes the echo even when the worker has not got
+ * to it yet.  Returns 1 while the recv is parked waiting for that drain.
+ * A drain still queued has not started, so a later recv joins it. */
+static int request_worker_drain(struct ptyterm_connection *connection,
+                                struct ptyterm_session *session,
+                                const struct ptyterm_recv_request *request) {
+  struct ptyterm_worker *worker;
+  uint64_t value;
+
+  if (connection->recv_wait_drain != 0) {
+    if (session->drain_completed < connection->recv_wait_drain)
+      return 1;
+    end_recv_wait(connection);
+    return 0;
+  }
+  /* A waiting recv parked on output is served as the worker drains. */
+  if (connection->recv_wait_session != NULL)
+    return 0;
+
+  worker = session->worker;
+  if (session->drain_requested == session->drain_completed) {
+    pthread_mutex_lock(&worker->drain_lock);
+    session->drain_next = worker->drain_queue;
+    worker->drain_queue = session;
+    pthread_mutex_unlock(&worker->drain_lock);
+    value = 1;
+    if (write(worker->wake_fd, &value, sizeof(value)) == -1 &&
+        errno != EAGAIN)
+      perror("write(eventfd)");
+  }
+  session->drain_requested += 1;
+  start_recv_wait(connection, session, request);
+  connection->recv_wait_deadline_ms = 0;
+  connection->recv_wait_drain = session->drain_requested;
+  return 1;
+}
+
+/* Decides a recv that waits for output.  Returns 1 when the request is
+ * parked on the connection until the session changes.  Otherwise the wait
+ * is over: limit_offset is narrowed to the bytes to return, and reason is
+ * set when it overrides the usual one.  Only output not yet searched is
+ * scanned again, less the pattern size so a match may straddle it. */
+static int check_recv_wait(struct ptyterm_connection *connection,
+                           struct ptyterm_daemon_state *state,
+                           struct ptyterm_session *session,
+                           const struct ptyterm_recv_request *request,
+                           uint64_t start_offset, size_t window,
+                           uint64_t *limit_offset, const char **reason) {
+  uint64_t window_end;
+  uint64_t match_end;
+  uint64_t from;
+
+  if (connection->recv_wait_session == NULL) {
+    connection->recv_wait_scan_offset = start_offset;
+    connection->recv_wait_deadline_ms =
+        request->timeout_ms == 0 ? 0 : monotonic_ms() + request->timeout_ms;
+  }
+  window_end = start_offset + window;
+  if (window_end > *limit_offset)
+    window_end = *limit_offset;
+
+  if (request->until_size == 0) {
+    if (window_end > start_offset) {
+      end_recv_wait(connection);
+      return 0;
+    }
+  } else {
+    from = connection->recv_wait_scan_offset > start_offset
+               ? connection->recv_wait_scan_offset
+               : start_offset;
+    if (find_output_pattern(session, from, window_end, request->until,
+                            request->until_size, &match_end)) {
+      *limit_offset = match_end;
+      *reason = "match_reached";
+      end_recv_wait(connection);
+      return 0;
+    }
+    if (window_end - start_offset == window) {
+      *limit_offset = start_offset;
+      *reason = "size_reached";
+      end_recv_wait(connection);
+      return 0;
+    }
+    connection->recv_wait_scan_offset =
+        window_end - from < request->until_size - 1
+            ? from
+            : window_end - (request->until_size - 1);
+  }
+
+  if (session->state == PTYTERM_SESSION_EXITED || session->master_fd < 0) {
+    *limit_offset = start_offset;
+    *reason = "session_exited";
+    end_recv_wait(connection);
+    return 0;
+  }
+  if (connection->recv_wait_deadline_ms != 0 &&
+      monotonic_ms() >= connection->recv_wait_deadline_ms) {
+    *limit_offset = start_offset;
+    *reason = "timeout";
+    end_recv_wait(connection);
+    return 0;
+  }
+  if (connection->recv_wait_session == NULL) {
+    start_recv_wait(connection, session, request);
+    if (connection->recv_wait_deadline_ms != 0) {
+      connection->recv_deadline_next = state->recv_deadlines;
+      connection->recv_deadline_pprev = &state->recv_deadlines;
+      if (state->recv_deadlines != NULL)
+        state->recv_deadlines->recv_deadline_pprev =
+            &connection->recv_deadline_next;
+      state->recv_deadlines = connection;
+    }
+  }
+  return 1;
+}
+
+static int handle_recv_request(struct ptyterm_connection *connection,
+                               struct ptyterm_daemon_state *state,
+                               const void *payload, size_t payload_size) {
+  const struct ptyterm_recv_request *request;
+  struct ptyterm_session *session;
+  struct ptyterm_recv_response response;
+  struct iovec data[PTYTERM_OUTPUT_SEGMENTS_MAX];
+  size_t returned_bytes;
+  size_t max_bytes;
+  const char *reason;
+  uint64_t start_offset;
+  uint64_t limit_offset;
+  uint64_t oldest_offset;
+  uint64_t bound;
+  uint64_t *cursor;
+  int positional;
+  int data_count;
+
+  if (payload_size != sizeof(*request)) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  request = (const struct ptyterm_recv_request *)payload;
+  if (memchr(request->cursor, '\0', sizeof(request->cursor)) == NULL ||
+      request->until_size > sizeof(request->until)) {
+    errno = EPROTO;
+    return -1;
+  }
+  session = find_session(state, request->session_id);
+  if (session == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  cursor = session_cursor(session, request->cursor);
+  if (cursor == NULL)
+    return -1;
+  memset(&response, 0, sizeof(response));
+
+  /* Pick up output the pty produced after this batch was polled, so a recv
+   * that follows a send observes the echo even when both are ready at once.
+   * Only the owning loop reads the master; a worker is asked to. */
+  if (session->worker == NULL) {
+    drain_session(session);
+    update_session_events(session);
+  } else if (request_worker_drain(connection, session, request)) {
+    return 0;
+  }
+
+  /* The range starts at the cursor unless an offset, a time, or a line is
+   * given, and ends at the newest output unless bounded the same way. */
+  oldest_offset = oldest_available_offset(session);
+  positional = (request->flags &
+                (PTYTERM_RECV_FLAG_START | PTYTERM_RECV_FLAG_SINCE |
+                 PTYTERM_RECV_FLAG_LAST_LINES |
+                 PTYTERM_RECV_FLAG_FROM_LINE)) != 0;
+  if ((request->flags & PTYTERM_RECV_FLAG_START) != 0)
+    start_offset = request->start_offset;
+  else if ((request->flags & PTYTERM_RECV_FLAG_SINCE) != 0)
+    start_offset = offset_at_age(session, request->since_ms);
+  else if ((request->flags & PTYTERM_RECV_FLAG_LAST_LINES) != 0)
+    start_offset = line_offset(session, line_total(session) > request->lines
+                                            ? line_total(session) -
+                                                  request->lines
+                                            : 0);
+  else if ((request->flags & PTYTERM_RECV_FLAG_FROM_LINE) != 0)
+    start_offset = line_offset(session, request->from_line);
+  else
+    start_offset = *cursor;
+  response.truncated = start_offset < oldest_offset;
+  if (start_offset < oldest_offset)
+    start_offset = oldest_offset;
+  if (start_offset > session->total_output_bytes)
+    start_offset = session->total_output_bytes;
+  limit_offset = session->total_output_bytes;
+  if ((request->flags & PTYTERM_RECV_FLAG_END) != 0 &&
+      request->end_offset < limit_offset)
+    limit_offset = request->end_offset;
+  if ((request->flags & PTYTERM_RECV_FLAG_BEFORE) != 0) {
+    bound = offset_at_age(session, request->before_ms);
+    if (bound < limit_offset)
+      limit_offset = bound;
+  }
+  if ((request->flags & PTYTERM_RECV_FLAG_MAX_LINES) != 0) {
+    bound = line_offset(session,
+                        line_at_offset(session, start_offset) + request->lines);
+    if (bound < limit_offset)
+      limit_offset = bound;
+  }
+  if (limit_offset < start_offset)
+    limit_offset = start_offset;
+
+  /* The payload is sent from the ring itself, and one response carries at
+   * most PTYTERM_RECV_CHUNK_MAX bytes whatever the client asked for. */
+  max_bytes = request->max_bytes < PTYTERM_RECV_CHUNK_MAX
+                  ? request->max_bytes
+                  : PTYTERM_RECV_CHUNK_MAX;
+  reason = NULL;
+  if ((request->flags & PTYTERM_RECV_FLAG_WAIT) != 0 &&
+      check_recv_wait(connection, state, session, request, start_offset,
+                      max_bytes, &limit_offset, &reason))
+    return 0;
+  if (max_bytes > limit_offset - start_offset)
+    max_bytes = (size_t)(limit_offset - start_offset);
+  returned_bytes = output_segments(session, start_offset, max_bytes, data,
+                                   &data_count);
+  response.start_offset = start_offset;
+  response.oldest_available_offset = oldest_offset;
+  response.range_end_offset = limit_offset;
+  response.returned_bytes = (uint32_t)returned_bytes;
+  response.end_offset = start_offset + returned_bytes;
+  response.next_recv_offset =
+      positional || (request->flags & PTYTERM_RECV_FLAG_PEEK) != 0
+          ? *cursor
+          : response.end_offset;
+  response.lag_bytes = session->total_output_bytes - response.next_recv_offset;
+  snprintf(response.reason, sizeof(response.reason), "%s",
+           reason != NULL ? reason :
+           returned_bytes == request->max_bytes ? "size_reached" :
+           returned_bytes == PTYTERM_RECV_CHUNK_MAX ? "chunk_limit" :
+           limit_offset < session->total_output_bytes &&
+                   response.end_offset == limit_offset
+               ? ((request->flags & PTYTERM_RECV_FLAG_MAX_LINES) != 0
+                      ? "lines_reached"
+                      : "range_end") :
+           (session->state == PTYTERM_SESSION_EXITED ? "session_exited" :
+                                                     (response.truncated ? "truncated_gap" : "ok")));
+  if (queue_message_segments(connection, PTYTERM_MESSAGE_RECV_RESPONSE,
+                             &response, sizeof(response), data,
+                             data_count) == -1)
+    return -1;
+  if (!positional && (request->flags & PTYTERM_RECV_FLAG_PEEK) == 0) {
+    *cursor = response.next_recv_offset;
+    /* Resumes a master paused on a full ring. */
+    update_session_events(session);
+  }
+  return 0;
+}
+
+static int handle_attach_request(struct ptyterm_connection *connection,
+                                 struct ptyterm_daemon_state *state,
+                                 const void *payload, size_t payload_size) {
+  const struct ptyterm_attach_request *request;
+  struct ptyterm_session *session;
+  struct ptyterm_attach_response response;
+
+  if (payload_size != sizeof(*request)) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  request = (const struct ptyterm_attach_request *)payload;
+  session = find_session(state, request->session_id);
+  if (session == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (session->state == PTYTERM_SESSION_EXITED || session->master_fd < 0) {
+    errno = EPIPE;
+    return -1;
+  }
+  if (session->client_fd >= 0 || session->state == PTYTERM_SESSION_ATTACHED) {
+    errno = EBUSY;
+    return -1;
+  }
+
+  memset(&response, 0, sizeof(response));
+  response.session_id = session->id;
+  response.state = PTYTERM_SESSION_ATTACHED;
+  response.child_pid = session->child_pid;
+  if (queue_message(connection, PTYTERM_MESSAGE_ATTACH_RESPONSE, &response,
+                    sizeof(response)) == -1) {
+    return -1;
+  }
+
+  /* The connection becomes the attached client stream: the queued reply
+   * and any bytes the client already sent move into the session buffers. */
+  if (append_pending_data(&session->pending_output,
+                          &session->pending_output_size,
+                          &session->pending_output_capacity, connection->output,
+                          connection->output_size) == -1 ||
+      append_pending_data(&session->pending_input, &session->pending_input_size,
+                          &session->pending_input_capacity,
+                          connection->input + connection->input_start,
+                          connection->input_size -
+                              connection->input_start) == -1) {
+    session->pending_input_size = 0;
+    session->pending_output_size = 0;
+    connection->output_size = 0;
+    return -1;
+  }
+  connection->output_size = 0;
+  connection->input_start = 0;
+  connection->input_size = 0;
+
+  unwatch_fd(&state->loop, &connection->source);
+  session->client_fd = connection->fd;
+  session->state = PTYTERM_SESSION_ATTACHED;
+  update_session_events(session);
+  return 1;
+}
+
+static int handle_detach_request(struct ptyterm_connection *connection,
+                                 struct ptyterm_daemon_state *state,
+                                 const void *payload, size_t payload_size) {
+  const struct ptyterm_detach_request *request;
+  struct ptyterm_session *session;
+  struct ptyterm_detach_response response;
+
+  if (payload_size != sizeof(*request)) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  request = (const struct ptyterm_detach_request *)payload;
+  session = find_session(state, request->session_id);
+  if (session == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (session->client_fd < 0 || session->state != PTYTERM_SESSION_ATTACHED) {
+    errno = ENOTCONN;
+    return -1;
+  }
+
+  close_attached_client(session);
+  memset(&response, 0, sizeof(response));
+  response.session_id = session->id;
+  response.state = session->state;
+  return queue_message(connection, PTYTERM_MESSAGE_DETACH_RESPONSE,
+                       &response, sizeof(response));
+}
+
+struct ptyterm_memory_entry {
+  struct ptyterm_session *session;
+  uint64_t last_active_ms;
+  uint64_t trimmable;
+};
+
+/* Ring bytes the memory budget may take from a session. */
+static uint64_t trimmable_ring(const struct ptyterm_session *session) {
+  if (session->state == PTYTERM_SESSION_ATTACHED ||
+      session->output_ring == NULL ||
+      session->buffer_capacity <= PTYTERM_MEMORY_MIN_RING)
+    return 0;
+  return session->buffer_capacity - PTYTERM_MEMORY_MIN_RING;
+}
+
+/* History bytes the memory budget may take from a session. */
+static uint64_t trimmable_history(struct ptyterm_session *session) {
+  if (!session->history_enabled)
+    return 0;
+  return ptyterm_history_droppable(&session->history);
+}
+
+/* Adds up the memory of every session, locking each in turn after the
+ * session list has been copied out from under the table lock.  held is a
+ * session the caller already locked.  The copy is returned with each
+ * session's last activity time, for the caller to free. */
+static struct ptyterm_memory_entry *memory_sessions(
+    struct ptyterm_daemon_state *state, struct ptyterm_session *held,
+    size_t *count_out, struct ptyterm_memory_usage *usage) {
+  struct ptyterm_memory_entry *entries;
+  size_t count;
+  size_t i;
+
+  pthread_mutex_lock(&state->table_lock);
+  count = state->sessions.count;
+  entries = malloc((count > 0 ? count : 1) * sizeof(*entries));
+  if (entries == NULL) {
+    pthread_mutex_unlock(&state->table_lock);
+    return NULL;
+  }
+  for (i = 0; i < count; ++i)
+    entries[i].session = state->sessions.slots[i];
+  pthread_mutex_unlock(&state->table_lock);
+
+  memset(usage, 0, sizeof(*usage));
+  for (i = 0; i < count; ++i) {
+    struct ptyterm_session *session;
+
+    session = entries[i].session;
+    if (session != held)
+      pthread_mutex_lock(&session->lock);
+    add_session_memory(session, usage);
+    entries[i].last_active_ms = session->last_active_ms;
+    entries[i].trimmable =
+        session != held ? trimmable_history(session) + trimmable_ring(session)
+                        : 0;
+    if (session != held)
+      pthread_mutex_unlock(&session->lock);
+  }
+  *count_out = count;
+  return entries;
+}
+
+static int compare_last_active(const void *a, const void *b) {
+  const struct ptyterm_memory_entry *left;
+  const struct ptyterm_memory_entry *right;
+
+  left = (const struct ptyterm_memory_entry *)a;
+  right = (const struct ptyterm_memory_entry *)b;
+  if (left->last_active_ms != right->last_active_ms)
+    return left->last_active_ms < right->last_active_ms ? -1 : 1;
+  return left->session->id < right->session->id ? -1
+         : left->session->id > right->session->id;
+}
+
+/* Makes room for needed more bytes under --memory-limit, least recently
+ * active sessions first: their oldest history blocks go before any ring
+ * capacity, and only rings without an attached client are trimmed, down
+ * to PTYTERM_MEMORY_MIN_RING.  Fails with ENOMEM when that is not enough;
+ * a request that would fail anyway trims nothing, while the pass the
+ * output path asks for with needed 0 takes what it can.  Only the main
+ * thread calls this; held is a session it has already locked, which is
+ * never trimmed. */
+static int enforce_memory_limit(struct ptyterm_daemon_state *state,
+                                struct ptyterm_session *held,
+                                uint64_t needed) {
+  struct ptyterm_memory_usage usage;
+  struct ptyterm_memory_entry *entries;
+  uint64_t trimmable;
+  uint64_t excess;
+  size_t count;
+  size_t pass;
+  size_t i;
+
+  if (state->memory_budget.limit == 0)
+    return 0;
+  entries = memory_sessions(state, held, &count, &usage);
+  if (entries == NULL)
+    return -1;
+  if (memory_used(&usage) + needed <= state->memory_budget.limit) {
+    free(entries);
+    return 0;
+  }
+  excess = memory_used(&usage) + needed - state->memory_budget.limit;
+  trimmable = 0;
+  for (i = 0; i < count; ++i)
+    trimmable += entries[i].trimmable;
+  if (needed > 0 && trimmable < excess) {
+    free(entries);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  qsort(entries, count, sizeof(*entries), compare_last_active);
+  for (pass = 0; pass < 2; ++pass) {
+    for (i = 0; i < count && excess > 0; ++i) {
+      struct ptyterm_session *session;
+      uint64_t before;
+      uint64_t after;
+      uint32_t capacity;
+      uint32_t freed;
+
+      session = entries[i].session;
+      if (session == held)
+        continue;
+      pthread_mutex_lock(&session->lock);
+      if (pass == 0) {
+        while (excess > 0 && trimmable_history(session) > 0) {
+          before = ptyterm_history_memory(&session->history);
+          if (ptyterm_history_drop_oldest(&session->history) == -1)
+            break;
+          after = ptyterm_history_memory(&session->history);
+          excess = before - after < excess ? excess - (before - after) : 0;
+        }
+      } else if (trimmable_ring(session) > 0) {
+        capacity = PTYTERM_MEMORY_MIN_RING;
+        if (trimmable_ring(session) > excess)
+          capacity = session->buffer_capacity - (uint32_t)excess;
+        freed = session->buffer_capacity - capacity;
+        if (resize_output_ring(session, capacity) == 0) {
+          excess -= freed;
+          state->memory_trimmed += freed;
+        } else {
+          perror("memory-limit");
+        }
+      }
+      account_session_memory(session);
+      pthread_mutex_unlock(&session->lock);
+    }
+  }
+  free(entries);
+  if (excess > 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+/* Serves the output path's request to get back under --memory-limit.  over
+ * is cleared only afterwards, so the sessions charged here do not ask
+ * again for what this pass could not free. */
+static void serve_memory_over(struct ptyterm_daemon_state *state) {
+  int over;
+
+  pthread_mutex_lock(&state->memory_budget.lock);
+  over = state->memory_budget.over;
+  pthread_mutex_unlock(&state->memory_budget.lock);
+  if (!over)
+    return;
+  if (enforce_memory_limit(state, NULL, 0) == -1 && errno != ENOMEM)
+    perror("memory-limit");
+  pthread_mutex_lock(&state->memory_budget.lock);
+  state->memory_budget.over = 0;
+  pthread_mutex_unlock(&state->memory_budget.lock);
+}
+
+static int handle_resize_request(struct ptyterm_connection *connection,
+                                 struct ptyterm_daemon_state *state,
+                                 const void *payload, size_t payload_size) {
+  const struct ptyterm_resize_request *request;
+  struct ptyterm_session *session;
+  struct ptyterm_resize_response response;
+
+  if (payload_size != sizeof(*request)) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  request = (const struct ptyterm_resize_request *)payload;
+  if (request->rows == 0 || request->cols == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  session = find_session(state, request->session_id);
+  if (session == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (apply_session_winsize(session, request->rows, request->cols) == -1)
+    return -1;
+  /* Replays of earlier screens resize where this one did. */
+  record_checkpoint(session, session->total_output_bytes);
+  /* A screen has to follow its terminal, so a larger one is not refused;
+   * other sessions make room for it instead. */
+  if (enforce_memory_limit(state, session, 0) == -1 && errno != ENOMEM)
+    perror("memory-limit");
+
+  memset(&response, 0, sizeof(response));
+  response.session_id = session->id;
+  response.rows = request->rows;
+  response.cols = request->cols;
+  return queue_message(connection, PTYTERM_MESSAGE_RESIZE_RESPONSE,
+                       &response, sizeof(response));
+}
+
+static int handle_resize_buffer_request(struct ptyterm_connection *connection,
+                                        struct ptyterm_daemon_state *state,
+                                        const void *payload,
+                                        size_t payload_size) {
+  const struct ptyterm_resize_buffer_request *request;
+  struct ptyterm_session *session;
+
+  if (payload_size != sizeof(*request)) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  request = (const struct ptyterm_resize_buffer_request *)payload;
+  if (request->buffer_size == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  session = find_session(state, request->session_id);
+  if (session == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (request->buffer_size > session->buffer_capacity &&
+      enforce_memory_limit(state, session,
+                           request->buffer_size - session->buffer_capacity) == -1)
+    return -1;
+  if (resize_output_ring(session, request->buffer_size) == -1)
+    return -1;
+  return send_buffer_info_response(connection, state, request->session_id,
+                                   PTYTERM_MESSAGE_RESIZE_BUFFER_RESPONSE);
+}
+
+static int handle_cursor_delete_request(struct ptyterm_connection *connection,
+                                        struct ptyterm_daemon_state *state,
+                                        const void *payload,
+                                        size_t payload_size) {
+  const struct ptyterm_cursor_delete_request *request;
+  struct ptyterm_session *session;
+
+  if (payload_size != sizeof(*request)) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  request = (const struct ptyterm_cursor_delete_request *)payload;
+  if (request->cursor[0] == '\0' ||
+      memchr(request->cursor, '\0', sizeof(request->cursor)) == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  session = find_session(state, request->session_id);
+  if (session == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (delete_session_cursor(session, request->cursor) == -1)
+    return -1;
+  return send_buffer_info_response(connection, state, request->session_id,
+                                   PTYTERM_MESSAGE_CURSOR_DELETE_RESPONSE);
+}
+
+/* Hands the client a read-only descriptor of the session ring, moving the
+ * ring into shared memory first if needed.  Only the daemon's own user may
+ * map it, as anyone mapping it sees all output the ring still holds. */
+static int handle_map_output_request(struct ptyterm_connection *connection,
+                                     struct ptyterm_daemon_state *state,
+                                     const void *payload, size_t payload_size) {
+  const struct ptyterm_map_output_request *request;
+  struct ptyterm_map_output_response response;
+  struct ptyterm_session *session;
+  struct ucred peer;
+  socklen_t peer_size;
+  char path[64];
+  int fd;
+  int result;
+
+  if (payload_size != sizeof(*request)) {
+    errno = EPROTO;
+    return -1;
+  }
+  request = (const struct ptyterm_map_output_request *)payload;
+
+  peer_size = sizeof(peer);
+  if (getsockopt(connection->fd, SOL_SOCKET, SO_PEERCRED, &peer,
+                 &peer_size) == -1)
+    return -1;
+  if (peer.uid != geteuid()) {
+    errno = EACCES;
+    return -1;
+  }
+
+  session = find_session(state, request->session_id);
+  if (session == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  if (session->output_ring == NULL || session->buffer_capacity == 0) {
+    errno = ENODATA;
+    return -1;
+  }
+  if (share_output_ring(session) == -1)
+    return -1;
+
+  /* Reopening through /proc yields a descriptor that cannot be mapped
+   * writable, whatever the client does with it. */
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", session->shared_ring_fd);
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+
+  memset(&response, 0, sizeof(response));
+  response.session_id = session->id;
+  response.capacity = session->buffer_capacity;
+  response.data_offset = PTYTERM_SHARED_RING_DATA_OFFSET;
+  response.map_size = PTYTERM_SHARED_RING_DATA_OFFSET + session->buffer_capacity;
+  result = queue_message_fd(connection, PTYTERM_MESSAGE_MAP_OUTPUT_RESPONSE,
+                            &response, sizeof(response), fd);
+  close(fd);
+  return result;
+}
+
+static int handle_daemon_status_request(
+    struct ptyterm_connection *connection, struct ptyterm_daemon_state *state,
+    const void *payload, size_t payload_size) {
+  struct ptyterm_daemon_status_response response;
+  struct ptyterm_memory_usage usage;
+  struct ptyterm_memory_entry *entries;
+  size_t count;
+
+  (void)payload;
+  if (payload_size != 0) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  memset(&response, 0, sizeof(response));
+  response.running = 1;
+  response.daemon_pid = (int32_t)getpid();
+  entries = memory_sessions(state, NULL, &count, &usage);
+  if (entries == NULL)
+    return -1;
+  free(entries);
+  response.memory_limit = state->memory_budget.limit;
+  response.memory_used = memory_used(&usage);
+  response.ring_bytes = usage.ring_bytes;
+  response.screen_bytes = usage.screen_bytes;
+  response.index_bytes = usage.index_bytes;
+  response.history_bytes = usage.history_bytes;
+  response.session_bytes = usage.session_bytes;
+  response.trimmed_bytes = state->memory_trimmed;
+  return queue_message(connection, PTYTERM_MESSAGE_DAEMON_STATUS_RESPONSE,
+                       &response, sizeof(response));
+}
+
+static int handle_daemon_shutdown_request(
+    struct ptyterm_connection *connection, const void *payload, size_t payload_size) {
+  struct ptyterm_daemon_shutdown_response response;
+
+  (void)payload;
+  if (payload_size != 0) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  memset(&response, 0, sizeof(response));
+  response.stopping = 1;
+  response.daemon_pid = (int32_t)getpid();
+  if (queue_message(connection, PTYTERM_MESSAGE_DAEMON_SHUTDOWN_RESPONSE,
+                    &response, sizeof(response)) == -1) {
+    return -1;
+  }
+
+  stop_requested = 1;
+  return 0;
+}
+
+static int handle_screen_snapshot_request(
+    struct ptyterm_connection *connection, struct ptyterm_daemon_state *state,
+    const void *payload, size_t payload_size) {
+  const struct ptyterm_screen_snapshot_request *request;
+
+  if (payload_size != sizeof(*request)) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  request = (const struct ptyterm_screen_snapshot_request *)payload;
+  return send_screen_snapshot_response(connection, state, request->session_id,
+                                       request->screen_selector, request->flags,
+                                       request->before_ms);
+}
+
+static int handle_screen_delta_request(struct ptyterm_connection *connection,
+                                       struct ptyterm_daemon_state *state,
+                                       const void *payload,
+                                       size_t payload_size) {
+  if (payload_size != sizeof(struct ptyterm_screen_delta_request)) {
+    errno = EPROTO;
+    return -1;
+  }
+  return send_screen_delta_response(
+      connection, state, (const struct ptyterm_screen_delta_request *)payload);
+}
+
+static int handle_create_request(struct ptyterm_connection *connection,
+                                 struct ptyterm_daemon_state *state,
+                                 const void *payload, size_t payload_size) {
+  const struct ptyterm_create_request *request;
+  char **argv;
+  char *strings;
+  size_t strings_size;
+  size_t offset;
+  uint32_t i;
+  struct ptyterm_create_response response;
+
+  if (payload_size < sizeof(*request)) {
+    errno = EPROTO;
+    return -1;
+  }
+
+  request = (const struct ptyterm_create_request *)payload;
+  strings = (char *)(request + 1);
+  strings_size = payload_size - sizeof(*request);
+  argv = calloc(request->argc + 1, sizeof(*argv));
+  if (argv == NULL)
+    return -1;
+
+  offset = 0;
+  for (i = 0; i < request->argc; ++i) {
+    size_t len;
+
+    if (offset >= strings_size) {
+      free(argv);
+      errno = EPROTO;
+      return -1;
+    }
+    len = strnlen(strings + offset, strings_size - offset);
+    if (offset + len >= strings_size) {
+      free(argv);
+      errno = EPROTO;
+      return -1;
+    }
+    argv[i] = strings + offset;
+    offset += len + 1;
+  }
+  argv[request->argc] = NULL;
+
+  /* The screens are counted at the usual 24x80 until the PTY reports its
+   * size. */
+  if (enforce_memory_limit(state, NULL,
+                           (uint64_t)(request->buffer_size != 0
+                                          ? request->buffer_size
+                                          : state->output_buffer) +
+                               ptyterm_screen_size_memory(24, 80) +
+                               sizeof(struct ptyterm_session)) == -1) {
+    free(argv);
+    return -1;
+  }
+
+  if (spawn_session(state, request->argc, argv, request->buffer_size,
+                    &response) == -1) {
+    free(argv);
+    return -1;
+  }
+  free(argv);
+
+  return queue_message(connection, PTYTERM_MESSAGE_CREATE_RESPONSE,
+                       &response, sizeof(response));
 }
 
-static int handle_recv_request(int client_fd, struct ptyterm_daemon_state *state,
-                               const void *payload, size_t payload_size) {
-  const struct ptyterm_recv_request *request;
-  struct ptyterm_session *session;
-  struct ptyterm_recv_response *response;
-  size_t response_size;
-  size_t returned_bytes;
-  uint64_t start_offset;
-  uint64_t oldest_offset;
-  char *data;
+static int serve_request(struct ptyterm_connection *connection,
+                         struct ptyterm_daemon_state *state,
+                         const struct ptyterm_message_header *header,
+                         const char *payload, size_t payload_size) {
+  switch (header->type) {
+  case PTYTERM_MESSAGE_LIST_REQUEST: {
+    struct ptyterm_list_request request;
 
-  if (payload_size != sizeof(*request)) {
-    errno = EPROTO;
-    return -1;
+    if (payload_size != sizeof(request)) {
+      send_error_response(connection, EPROTO, "invalid list request size");
+      return 0;
+    }
+    memcpy(&request, payload, sizeof(request));
+    if (send_list_response(connection, state, request.session_id) == -1) {
+      send_error_response(connection, errno, strerror(errno));
+    }
+    return 0;
   }
+  case PTYTERM_MESSAGE_BUFFER_INFO_REQUEST: {
+    struct ptyterm_buffer_info_request request;
 
-  request = (const struct ptyterm_recv_request *)payload;
-  session = (struct ptyterm_session *)find_session(state, request->session_id);
-  if (session == NULL) {
-    errno = ENOENT;
-    return -1;
+    if (payload_size != sizeof(request)) {
+      send_error_response(connection, EPROTO,
+                          "invalid buffer-info request size");
+      return 0;
+    }
+    memcpy(&request, payload, sizeof(request));
+    if (request.session_id <= 0) {
+      send_error_response(connection, EINVAL, "invalid session id");
+      return 0;
+    }
+    if (send_buffer_info_response(connection, state, request.session_id,
+                                  PTYTERM_MESSAGE_BUFFER_INFO_RESPONSE) == -1) {
+      if (errno == ENOENT) {
+        send_error_response(connection, errno, "session not found");
+      } else {
+        send_error_response(connection, errno, strerror(errno));
+      }
+    }
+    return 0;
   }
+  case PTYTERM_MESSAGE_CREATE_REQUEST:
+    if (handle_create_request(connection, state, payload, payload_size) == -1) {
+      if (errno == ENOMEM && state->memory_budget.limit != 0) {
+        send_error_response(connection, errno, "memory limit reached");
+      } else {
+        send_error_response(connection, errno, strerror(errno));
+      }
+    }
+    return 0;
+  case PTYTERM_MESSAGE_SEND_REQUEST:
+    if (handle_send_request(connection, state, payload, payload_size) == -1) {
+      if (errno == ENOENT) {
+        send_error_response(connection, errno, "session not found");
+      } else {
+        send_error_response(connection, errno, strerror(errno));
+      }
+    }
+    return 0;
+  case PTYTERM_MESSAGE_RECV_REQUEST:
+    if (handle_recv_request(connection, state, payload, payload_size) == -1) {
+      if (errno == ENOENT) {
+        send_error_response(connection, errno, "session not found");
+      } else {
+        send_error_response(connection, errno, strerror(errno));
+      }
+    }
+    return 0;
+  case PTYTERM_MESSAGE_ATTACH_REQUEST: {
+    int attached;
 
-  oldest_offset = oldest_available_offset(session);
-  start_offset = session->recv_offset;
-  if (start_offset < oldest_offset)
-    start_offset = oldest_offset;
+    attached = handle_attach_request(connection, state, payload, payload_size);
+    if (attached == -1) {
+      if (errno == ENOENT) {
+        send_error_response(connection, errno, "session not found");
+      } else {
+        send_error_response(connection, errno, strerror(errno));
+      }
+      return 0;
+    }
+    return attached;
+  }
+  case PTYTERM_MESSAGE_DETACH_REQUEST:
+    if (handle_detach_request(connection, state, payload, payload_size) == -1) {
+      if (errno == ENOENT) {
+        send_error_response(connection, errno, "session not found");
+      } else {
+        send_error_response(connection, errno, strerror(errno));
+      }
+    }
+    return 0;
+  case PTYTERM_MESSAGE_RESIZE_REQUEST:
+    if (handle_resize_request(connection, state, payload, payload_size) == -1) {
+      if (errno == ENOENT) {
+        send_error_response(connection, errno, "session not found");
+      } else {
+        send_error_response(connection, errno, strerror(errno));
+      }
+    }
+    return 0;
+  case PTYTERM_MESSAGE_DAEMON_STATUS_REQUEST:
+    if (handle_daemon_status_request(connection, state, payload,
+                                     payload_size) == -1) {
+      send_error_response(connection, errno, strerror(errno));
+    }
+    return 0;
+  case PTYTERM_MESSAGE_DAEMON_SHUTDOWN_REQUEST:
+    if (handle_daemon_shutdown_request(connection, payload,
+                                       payload_size) == -1) {
+      send_error_response(connection, errno, strerror(errno));
+    }
+    return 0;
+  case PTYTERM_MESSAGE_SCREEN_SNAPSHOT_REQUEST:
+    if (handle_screen_snapshot_request(connection, state, payload,
+                                       payload_size) == -1) {
+      if (errno == ENOENT) {
+        send_error_response(connection, errno, "session not found");
+      } else if (errno == EINVAL) {
+        send_error_response(connection, errno, "invalid screen selector");
+      } else {
+        send_error_response(connection, errno, strerror(errno));
+      }
+    }
+    return 0;
+  case PTYTERM_MESSAGE_SCREEN_DELTA_REQUEST:
+    if (handle_screen_delta_request(connection, state, payload,
+                                    payload_size) == -1) {
+      if (errno == ENOENT) {
+        send_error_response(connection, errno, "session not found");
+      } else if (errno == EINVAL) {
+        send_error_response(connection, errno, "invalid screen selector");
+      } else {
+        send_error_response(connection, errno, strerror(errno));
+      }
+    }
+    return 0;
+  case PTYTERM_MESSAGE_RESIZE_BUFFER_REQUEST:
+    if (handle_resize_buffer_request(connection, state, payload,
+                                     payload_size) == -1) {
+      if (errno == ENOENT) {
+        send_error_response(connection, errno, "session not found");
+      } else if (errno == EINVAL) {
+        send_error_response(connection, errno, "invalid buffer size");
+      } else if (errno == ENOMEM && state->memory_budget.limit != 0) {
+        send_error_response(connection, errno, "memory limit reached");
+      } else {
+        send_error_response(connection, errno, strerror(errno));
+      }
+    }
+    return 0;
+  case PTYTERM_MESSAGE_CURSOR_DELETE_REQUEST:
+    if (handle_cursor_delete_request(connection, state, payload,
+                                     payload_size) == -1) {
+      if (errno == ENOENT) {
+        send_error_response(connection, errno, "session not found");
+      } else if (errno == ESRCH) {
+        send_error_response(connection, errno, "cursor not found");
+      } else if (errno == EINVAL) {
+        send_error_response(connection, errno, "invalid cursor name");
+      } else {
+        send_error_response(connection, errno, strerror(errno));
+      }
+    }
+    return 0;
+  case PTYTERM_MESSAGE_MAP_OUTPUT_REQUEST:
+    if (handle_map_output_request(connection, state, payload,
+                                  payload_size) == -1) {
+      if (errno == ENOENT) {
+        send_error_response(connection, errno, "session not found");
+      } else if (errno == ENODATA) {
+        send_error_response(connection, errno, "session has no output ring");
+      } else {
+        send_error_response(connection, errno, strerror(errno));
+      }
+    }
+    return 0;
+  default:
+    send_error_response(connection, ENOTSUP, "unsupported request type");
+    return 0;
+  }
+}
 
-  response_size = sizeof(*response) + request->max_bytes;
-  response = calloc(1, response_size);
-  if (response == NULL)
-    return -1;
+/* Returns the session a request targets; every per-session request starts
+ * with its int32 session id. */
+static struct ptyterm_session *request_session(
+    struct ptyterm_daemon_state *state,
+    const struct ptyterm_message_header *header, const char *payload,
+    size_t payload_size) {
+  int32_t session_id;
 
-  data = (char *)(response + 1);
-  returned_bytes = copy_output_from_offset(session, start_offset, data,
-                                           request->max_bytes);
-  response->start_offset = start_offset;
-  response->oldest_available_offset = oldest_offset;
-  response->returned_bytes = (uint32_t)returned_bytes;
-  response->end_offset = start_offset + returned_bytes;
-  response->next_recv_offset =
-      (request->flags & PTYTERM_RECV_FLAG_PEEK) != 0 ? session->recv_offset
-                                                     : response->end_offset;
-  response->truncated = session->recv_offset < oldest_offset;
-  snprintf(response->reason, sizeof(response->reason), "%s",
-           returned_bytes == request->max_bytes ? "size_reached" :
-           (session->state == PTYTERM_SESSION_EXITED ? "session_exited" :
-                                                     (response->truncated ? "truncated_gap" : "ok")));
-  if ((request->flags & PTYTERM_RECV_FLAG_PEEK) == 0)
-    session->recv_offset = response->next_recv_offset;
-
-  returned_bytes = ptyterm_send_message(client_fd, PTYTERM_MESSAGE_RECV_RESPONSE,
-                                        response,
-                                        (uint32_t)(sizeof(*response) +
-                                                   response->returned_bytes));
-  free(response);
-  return (int)returned_bytes;
+  switch (header->type) {
+  case PTYTERM_MESSAGE_LIST_REQUEST:
+  case PTYTERM_MESSAGE_BUFFER_INFO_REQUEST:
+  case PTYTERM_MESSAGE_SEND_REQUEST:
+  case PTYTERM_MESSAGE_RECV_REQUEST:
+  case PTYTERM_MESSAGE_ATTACH_REQUEST:
+  case PTYTERM_MESSAGE_DETACH_REQUEST:
+  case PTYTERM_MESSAGE_RESIZE_REQUEST:
+  case PTYTERM_MESSAGE_SCREEN_SNAPSHOT_REQUEST:
+  case PTYTERM_MESSAGE_SCREEN_DELTA_REQUEST:
+  case PTYTERM_MESSAGE_MAP_OUTPUT_REQUEST:
+  case PTYTERM_MESSAGE_RESIZE_BUFFER_REQUEST:
+  case PTYTERM_MESSAGE_CURSOR_DELETE_REQUEST:
+    break;
+  default:
+    return NULL;
+  }
+  if (payload_size < sizeof(session_id))
+    return NULL;
+  memcpy(&session_id, payload, sizeof(session_id));
+  return find_session(state, session_id);
 }
 
-static int handle_attach_request(int client_fd, struct ptyterm_daemon_state *state,
-                                 const void *payload, size_t payload_size) {
-  const struct ptyterm_attach_request *request;
+/* Serves one request while holding the lock of the session it targets, so
+ * it is serialized with the worker that owns that session. */
+static int dispatch_request(struct ptyterm_connection *connection,
+                            struct ptyterm_daemon_state *state,
+                            const struct ptyterm_message_header *header,
+                            const char *payload, size_t payload_size) {
   struct ptyterm_session *session;
-  struct ptyterm_attach_response response;
-
-  if (payload_size != sizeof(*request)) {
-    errno = EPROTO;
-    return -1;
-  }
+  int result;
 
-  request = (const struct ptyterm_attach_request *)payload;
-  session = (struct ptyterm_session *)find_session(state, request->session_id);
-  if (session == NULL) {
-    errno = ENOENT;
-    return -1;
-  }
-  if (session->state == PTYTERM_SESSION_EXITED || session->master_fd < 0) {
-    errno = EPIPE;
-    return -1;
+  session = request_session(state, header, payload, payload_size);
+  if (session != NULL) {
+    pthread_mutex_lock(&session->lock);
+    session->last_active_ms = monotonic_ms();
   }
-  if (session->client_fd >= 0 || session->state == PTYTERM_SESSION_ATTACHED) {
-    errno = EBUSY;
-    return -1;
+  result = serve_request(connection, state, header, payload, payload_size);
+  if (session != NULL) {
+    charge_session_memory(session);
+    pthread_mutex_unlock(&session->lock);
   }
+  return result;
+}
 
-  memset(&response, 0, sizeof(response));
-  response.session_id = session->id;
-  response.state = PTYTERM_SESSION_ATTACHED;
-  response.child_pid = session->child_pid;
-  if (ptyterm_send_message(client_fd, PTYTERM_MESSAGE_ATTACH_RESPONSE,
-                           &response, sizeof(response)) == -1) {
-    return -1;
+static void connection_free(struct ptyterm_daemon_state *state,
+                            struct ptyterm_connection *connection,
+                            int close_fd) {
+  struct ptyterm_session *session;
+
+  session = connection->recv_wait_session;
+  if (session != NULL) {
+    pthread_mutex_lock(&session->lock);
+    end_recv_wait(connection);
+    pthread_mutex_unlock(&session->lock);
   }
-  if (set_nonblocking(client_fd) == -1)
-    return -1;
+  unwatch_fd(&state->loop, &connection->source);
+  if (close_fd && connection->fd >= 0)
+    close(connection->fd);
+  if (connection->prev != NULL)
+    connection->prev->next = connection->next;
+  else
+    state->connections = connection->next;
+  if (connection->next != NULL)
+    connection->next->prev = connection->prev;
+  free(connection->input);
+  free(connection->output);
+  free(connection);
+}
 
-  session->client_fd = client_fd;
-  session->state = PTYTERM_SESSION_ATTACHED;
-  return 1;
+/* Replies are only generated while the output queue is below its limit,
+ * so a client that pipelines requests without reading is throttled. */
+static int connection_accepts_requests(
+    const struct ptyterm_connection *connection) {
+  return !connection->close_after_flush &&
+         connection->recv_wait_session == NULL &&
+         connection->output_size < PTYTERM_CONNECTION_OUTPUT_MAX;
 }
 
-static int handle_detach_request(int client_fd, struct ptyterm_daemon_state *state,
-                                 const void *payload, size_t payload_size) {
-  const struct ptyterm_detach_request *request;
-  struct ptyterm_session *session;
-  struct ptyterm_detach_response response;
+/* Returns 0 when the connection is still open after the update. */
+static int update_connection_events(struct ptyterm_daemon_state *state,
+                                    struct ptyterm_connection *connection) {
+  uint32_t events;
 
-  if (payload_size != sizeof(*request)) {
-    errno = EPROTO;
+  if (connection->output_size == 0 && connection->recv_wait_session == NULL &&
+      (connection->close_after_flush || connection->input_closed)) {
+    connection_free(state, connection, 1);
     return -1;
   }
 
-  request = (const struct ptyterm_detach_request *)payload;
-  session = (struct ptyterm_session *)find_session(state, request->session_id);
-  if (session == NULL) {
-    errno = ENOENT;
-    return -1;
-  }
-  if (session->client_fd < 0 || session->state != PTYTERM_SESSION_ATTACHED) {
-    errno = ENOTCONN;
+  events = 0;
+  if (!connection->input_closed && connection_accepts_requests(connection))
+    events |= EPOLLIN;
+  if (connection->output_size > 0)
+    events |= EPOLLOUT;
+  if (watch_fd(&state->loop, &connection->source, connection->fd,
+               events) == -1) {
+    connection_free(state, connection, 1);
     return -1;
   }
+  return 0;
+}
 
-  close_attached_client(session);
-  memset(&response, 0, sizeof(response));
-  response.session_id = session->id;
-  response.state = session->state;
-  return ptyterm_send_message(client_fd, PTYTERM_MESSAGE_DETACH_RESPONSE,
-                              &response, sizeof(response));
+static void consume_connection_input(struct ptyterm_connection *connection,
+                                     size_t size) {
+  connection->input_start += size;
+  if (connection->input_start == connection->input_size) {
+    connection->input_start = 0;
+    connection->input_size = 0;
+  }
 }
 
-static int handle_resize_request(int client_fd, struct ptyterm_daemon_state *state,
-                                 const void *payload, size_t payload_size) {
-  const struct ptyterm_resize_request *request;
-  struct ptyterm_session *session;
-  struct ptyterm_resize_response response;
+/* Dispatches the complete frames in the input buffer.  Returns 1 when the
+ * connection was handed over to a session by an attach request. */
+static int process_connection_input(struct ptyterm_daemon_state *state,
+                                    struct ptyterm_connection *connection) {
+  while (connection_accepts_requests(connection)) {
+    struct ptyterm_message_header header;
+    const char *payload;
+    size_t frame_size;
+
+    if (connection->discard_size > 0) {
+      size_t size;
+
+      size = connection->input_size - connection->input_start;
+      if (size > connection->discard_size)
+        size = connection->discard_size;
+      consume_connection_input(connection, size);
+      connection->discard_size -= size;
+      if (connection->discard_size > 0)
+        return 0;
+    }
 
-  if (payload_size != sizeof(*request)) {
-    errno = EPROTO;
-    return -1;
+    if (connection->input_size - connection->input_start < sizeof(header))
+      return 0;
+    memcpy(&header, connection->input + connection->input_start,
+           sizeof(header));
+    connection->request_id = header.request_id;
+    if (ptyterm_message_header_check(&header) == -1) {
+      /* The stream cannot be resynchronized after a bad header. */
+      connection->request_id = 0;
+      send_error_response(connection, errno, "invalid message header");
+      connection->input_start = 0;
+      connection->input_size = 0;
+      connection->close_after_flush = 1;
+      return 0;
+    }
+    if (header.size > PTYTERM_REQUEST_PAYLOAD_MAX) {
+      send_error_response(connection, EMSGSIZE, strerror(EMSGSIZE));
+      consume_connection_input(connection, sizeof(header));
+      connection->discard_size = header.size;
+      continue;
+    }
+
+    frame_size = sizeof(header) + header.size;
+    if (connection->input_size - connection->input_start < frame_size)
+      return 0;
+
+    /* The frame is consumed first so an attach hands over only the bytes
+     * that follow it; the payload stays in place until the next read. */
+    payload = connection->input + connection->input_start + sizeof(header);
+    consume_connection_input(connection, frame_size);
+    if (dispatch_request(connection, state, &header, payload, header.size))
+      return 1;
   }
+  return 0;
+}
 
-  request = (const struct ptyterm_resize_request *)payload;
-  if (request->rows == 0 || request->cols == 0) {
-    errno = EINVAL;
-    return -1;
+/* Reads, dispatches and flushes until the socket would block.  Returns -1
+ * when the connection was closed or handed over to a session. */
+static int read_connection(struct ptyterm_daemon_state *state,
+                           struct ptyterm_connection *connection) {
+  while (!connection->input_closed &&
+         connection_accepts_requests(connection)) {
+    ssize_t nread;
+
+    if (connection->input_start > 0) {
+      memmove(connection->input, connection->input + connection->input_start,
+              connection->input_size - connection->input_start);
+      connection->input_size -= connection->input_start;
+      connection->input_start = 0;
+    }
+    if (connection->input_capacity - connection->input_size <
+        PTYTERM_CONNECTION_READ_SIZE) {
+      char *new_input;
+      size_t new_capacity;
+
+      new_capacity = connection->input_size + PTYTERM_CONNECTION_READ_SIZE;
+      new_input = realloc(connection->input, new_capacity);
+      if (new_input == NULL) {
+        connection_free(state, connection, 1);
+        return -1;
+      }
+      connection->input = new_input;
+      connection->input_capacity = new_capacity;
+    }
+
+    nread = read(connection->fd, connection->input + connection->input_size,
+                 PTYTERM_CONNECTION_READ_SIZE);
+    if (nread == -1) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      connection_free(state, connection, 1);
+      return -1;
+    }
+    if (nread == 0) {
+      /* Requests already received are still answered; a truncated
+       * trailing frame gets no reply, matching a short recv. */
+      connection->input_closed = 1;
+      break;
+    }
+    connection->input_size += (size_t)nread;
+
+    if (process_connection_input(state, connection)) {
+      connection_free(state, connection, 0);
+      return -1;
+    }
+    if (flush_pending_data(connection->fd, connection->output,
+                           &connection->output_size) == -1) {
+      connection_free(state, connection, 1);
+      return -1;
+    }
   }
+  return 0;
+}
 
-  session = (struct ptyterm_session *)find_session(state, request->session_id);
-  if (session == NULL) {
-    errno = ENOENT;
-    return -1;
+static void handle_connection_event(struct ptyterm_daemon_state *state,
+                                    struct ptyterm_connection *connection,
+                                    uint32_t revents) {
+  /* Nothing is read while a recv waits, so a client that gave up is only
+   * noticed by the hangup. */
+  if (connection->recv_wait_session != NULL &&
+      (revents & (EPOLLHUP | EPOLLERR)) != 0) {
+    connection_free(state, connection, 1);
+    return;
+  }
+  if ((revents & EPOLLOUT) != 0 &&
+      flush_pending_data(connection->fd, connection->output,
+                         &connection->output_size) == -1) {
+    connection_free(state, connection, 1);
+    return;
+  }
+  if ((revents & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0 &&
+      read_connection(state, connection) == -1) {
+    return;
   }
-  if (apply_session_winsize(session, request->rows, request->cols) == -1)
-    return -1;
 
-  memset(&response, 0, sizeof(response));
-  response.session_id = session->id;
-  response.rows = request->rows;
-  response.cols = request->cols;
-  return ptyterm_send_message(client_fd, PTYTERM_MESSAGE_RESIZE_RESPONSE,
-                              &response, sizeof(response));
+  /* Frames held back while the output queue was full. */
+  if (process_connection_input(state, connection)) {
+    connection_free(state, connection, 0);
+    return;
+  }
+  if (flush_pending_data(connection->fd, connection->output,
+                         &connection->output_size) == -1) {
+    connection_free(state, connection, 1);
+    return;
+  }
+  update_connection_events(state, connection);
 }
 
-static int handle_daemon_status_request(int client_fd, const void *payload,
-                                        size_t payload_size) {
-  struct ptyterm_daemon_status_response response;
+static void accept_connections(struct ptyterm_daemon_state *state) {
+  for (;;) {
+    struct ptyterm_connection *connection;
+    int client_fd;
+
+    client_fd = accept4(state->server_fd, NULL, NULL,
+                        SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (client_fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+          errno == ENOMEM) {
+        perror("accept");
+        return;
+      }
+      perror("accept");
+      exit(EXIT_FAILURE);
+    }
 
-  (void)payload;
-  if (payload_size != 0) {
-    errno = EPROTO;
-    return -1;
+    connection = calloc(1, sizeof(*connection));
+    if (connection == NULL) {
+      close(client_fd);
+      continue;
+    }
+    connection->fd = client_fd;
+    init_event_source(&connection->source, PTYTERM_EVENT_CONNECTION, NULL);
+    connection->source.connection = connection;
+    connection->next = state->connections;
+    if (state->connections != NULL)
+      state->connections->prev = connection;
+    state->connections = connection;
+
+    /* Clients write the request right after connecting, so try it now. */
+    if (read_connection(state, connection) == 0)
+      update_connection_events(state, connection);
   }
+}
 
-  memset(&response, 0, sizeof(response));
-  response.running = 1;
-  response.daemon_pid = (int32_t)getpid();
-  return ptyterm_send_message(client_fd, PTYTERM_MESSAGE_DAEMON_STATUS_RESPONSE,
-                              &response, sizeof(response));
+/* Checks a parked recv again; its session lock is held.  A connection
+ * whose wait is over is pushed on served. */
+static void check_parked_recv(struct ptyterm_daemon_state *state,
+                              struct ptyterm_connection *connection,
+                              struct ptyterm_connection **served) {
+  if (handle_recv_request(connection, state, &connection->recv_wait_request,
+                          sizeof(connection->recv_wait_request)) == -1) {
+    end_recv_wait(connection);
+    send_error_response(connection, errno, strerror(errno));
+  }
+  if (connection->recv_wait_session != NULL)
+    return;
+  connection->recv_served_next = *served;
+  *served = connection;
 }
 
-static int handle_daemon_shutdown_request(int client_fd, const void *payload,
-                                          size_t payload_size) {
-  struct ptyterm_daemon_shutdown_response response;
+/* Checks parked recv requests again on the sessions that reported output,
+ * an exit, or a finished drain, and those whose deadline has passed, then
+ * goes on with the requests queued behind those whose wait has ended. */
+static void serve_recv_waits(struct ptyterm_daemon_state *state) {
+  struct ptyterm_connection *connection;
+  struct ptyterm_connection *served;
+  struct ptyterm_connection *next;
+  struct ptyterm_session *session;
+  struct ptyterm_session *ready;
+  uint64_t now;
+
+  served = NULL;
+  pthread_mutex_lock(&state->recv_ready.lock);
+  ready = state->recv_ready.sessions;
+  state->recv_ready.sessions = NULL;
+  pthread_mutex_unlock(&state->recv_ready.lock);
+  /* A session stays marked queued until it is taken off this list, so it
+   * cannot be linked anew before its successor is read.  A wake after that
+   * queues it for the next pass. */
+  while (ready != NULL) {
+    session = ready;
+    pthread_mutex_lock(&state->recv_ready.lock);
+    ready = session->recv_ready_next;
+    session->recv_ready_queued = 0;
+    pthread_mutex_unlock(&state->recv_ready.lock);
+    pthread_mutex_lock(&session->lock);
+    for (connection = session->recv_waiting; connection != NULL;
+         connection = next) {
+      next = connection->recv_wait_next;
+      check_parked_recv(state, connection, &served);
+    }
+    pthread_mutex_unlock(&session->lock);
+  }
 
-  (void)payload;
-  if (payload_size != 0) {
-    errno = EPROTO;
-    return -1;
+  now = monotonic_ms();
+  for (connection = state->recv_deadlines; connection != NULL;
+       connection = next) {
+    next = connection->recv_deadline_next;
+    if (connection->recv_wait_deadline_ms > now)
+      continue;
+    session = connection->recv_wait_session;
+    pthread_mutex_lock(&session->lock);
+    check_parked_recv(state, connection, &served);
+    pthread_mutex_unlock(&session->lock);
   }
 
-  memset(&response, 0, sizeof(response));
-  response.stopping = 1;
-  response.daemon_pid = (int32_t)getpid();
-  if (ptyterm_send_message(client_fd, PTYTERM_MESSAGE_DAEMON_SHUTDOWN_RESPONSE,
-                           &response, sizeof(response)) == -1) {
-    return -1;
+  for (connection = served; connection != NULL; connection = next) {
+    next = connection->recv_served_next;
+    if (process_connection_input(state, connection)) {
+      connection_free(state, connection, 0);
+      continue;
+    }
+    if (flush_pending_data(connection->fd, connection->output,
+                           &connection->output_size) == -1) {
+      connection_free(state, connection, 1);
+      continue;
+    }
+    update_connection_events(state, connection);
   }
+}
 
-  stop_requested = 1;
-  return 0;
+/* Returns the epoll timeout that wakes the main loop at the earliest
+ * deadline of a parked recv, or -1 when there is none. */
+static int recv_wait_timeout(const struct ptyterm_daemon_state *state) {
+  const struct ptyterm_connection *connection;
+  uint64_t remaining;
+  uint64_t now;
+  int timeout;
+
+  timeout = -1;
+  now = monotonic_ms();
+  for (connection = state->recv_deadlines; connection != NULL;
+       connection = connection->recv_deadline_next) {
+    remaining = connection->recv_wait_deadline_ms > now
+                    ? connection->recv_wait_deadline_ms - now
+                    : 0;
+    if (remaining > INT_MAX)
+      remaining = INT_MAX;
+    if (timeout < 0 || remaining < (uint64_t)timeout)
+      timeout = (int)remaining;
+  }
+  return timeout;
 }
 
-static int handle_screen_snapshot_request(
-    int client_fd, struct ptyterm_daemon_state *state, const void *payload,
-    size_t payload_size) {
-  const struct ptyterm_screen_snapshot_request *request;
+/* Under pause, caps the main loop's sleep so that sessions held back only by
+ * a cursor that has since gone idle are resumed in time. */
+static int cursor_check_timeout(const struct ptyterm_daemon_state *state,
+                                int timeout) {
+  uint64_t now;
+  uint64_t remaining;
+
+  if (state->overflow_policy != PTYTERM_OVERFLOW_PAUSE)
+    return timeout;
+  now = monotonic_ms();
+  remaining = state->next_cursor_check_ms > now
+                  ? state->next_cursor_check_ms - now
+                  : 0;
+  if (timeout < 0 || remaining < (uint64_t)timeout)
+    timeout = (int)remaining;
+  return timeout;
+}
 
-  if (payload_size != sizeof(*request)) {
-    errno = EPROTO;
-    return -1;
+/* Looks again at each paused session: a cursor that went idle since the
+ * pause no longer holds it back.  Worker sessions are updated from here as
+ * resize_output_ring does, under the session lock. */
+static void resume_idle_paused(struct ptyterm_daemon_state *state) {
+  struct ptyterm_session **sessions;
+  size_t count;
+  size_t i;
+  uint64_t interval;
+
+  interval = state->cursor_idle_ms < PTYTERM_CURSOR_CHECK_MS
+                 ? state->cursor_idle_ms
+                 : PTYTERM_CURSOR_CHECK_MS;
+  state->next_cursor_check_ms = monotonic_ms() + interval;
+
+  pthread_mutex_lock(&state->table_lock);
+  count = state->sessions.count;
+  sessions = malloc((count > 0 ? count : 1) * sizeof(*sessions));
+  if (sessions == NULL) {
+    pthread_mutex_unlock(&state->table_lock);
+    return;
+  }
+  memcpy(sessions, state->sessions.slots, count * sizeof(*sessions));
+  pthread_mutex_unlock(&state->table_lock);
+
+  for (i = 0; i < count; ++i) {
+    pthread_mutex_lock(&sessions[i]->lock);
+    if (sessions[i]->paused_on_full)
+      update_session_events(sessions[i]);
+    pthread_mutex_unlock(&sessions[i]->lock);
   }
+  free(sessions);
+}
 
-  request = (const struct ptyterm_screen_snapshot_request *)payload;
-  return send_screen_snapshot_response(client_fd, state, request->session_id,
-                                       request->screen_selector);
+/* Delivers queued replies (the shutdown response in particular) before the
+ * daemon exits. */
+static void flush_connections(struct ptyterm_daemon_state *state) {
+  while (state->connections != NULL) {
+    struct ptyterm_connection *connection;
+    int flags;
+
+    connection = state->connections;
+    flags = fcntl(connection->fd, F_GETFL);
+    if (flags != -1)
+      fcntl(connection->fd, F_SETFL, flags & ~O_NONBLOCK);
+    while (connection->output_size > 0 &&
+           flush_pending_data(connection->fd, connection->output,
+                              &connection->output_size) == 0)
+      ;
+    connection_free(state, connection, 1);
+  }
 }
 
-static int handle_create_request(int client_fd, struct ptyterm_daemon_state *state,
-                                 const void *payload, size_t payload_size) {
-  const struct ptyterm_create_request *request;
-  char **argv;
-  char *strings;
-  size_t strings_size;
-  size_t offset;
-  uint32_t i;
-  struct ptyterm_create_response response;
+/* Handles one master or client event. With interactive_only set, master
+ * events of sessions without an attached client are left alone and 1 is
+ * returned so the caller can handle them after the interactive ones. */
+static int handle_session_event(struct ptyterm_event_source *source,
+                                uint32_t revents, int interactive_only) {
+  struct ptyterm_session *session;
+  int deferred;
+
+  session = source->session;
+  deferred = 0;
+  pthread_mutex_lock(&session->lock);
+  if (source->kind == PTYTERM_EVENT_CHILD) {
+    reap_session_child(session);
+  } else if (source->kind == PTYTERM_EVENT_MASTER) {
+    /* The fd may have been closed by an earlier event in this batch. */
+    if (session->master_fd < 0)
+      goto out;
+    if (interactive_only && session->client_fd < 0) {
+      deferred = 1;
+      goto out;
+    }
+    if ((revents & EPOLLOUT) != 0 && session->pending_input_size > 0 &&
+        flush_pending_data(session->master_fd, session->pending_input,
+                           &session->pending_input_size) == -1) {
+      close_attached_client(session);
+    }
+    if ((revents & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0)
+      drain_session(session);
+  } else {
+    if (session->client_fd < 0)
+      goto out;
+    if ((revents & EPOLLOUT) != 0 && session->pending_output_size > 0 &&
+        flush_pending_data(session->client_fd, session->pending_output,
+                           &session->pending_output_size) == -1) {
+      close_attached_client(session);
+    }
+    if (session->client_fd >= 0 &&
+        (revents & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0)
+      drain_attached_input(session);
+  }
+  update_session_events(session);
+out:
+  pthread_mutex_unlock(&session->lock);
+  return deferred;
+}
 
-  if (payload_size < sizeof(*request)) {
-    errno = EPROTO;
-    return -1;
+/* Serves the master and client events of one epoll batch. Sessions with an
+ * attached client go first so keystroke echo is not queued behind bulk
+ * producers; each of those then drains within its own budget. */
+static void handle_session_events(struct epoll_event *events, int ready) {
+  int deferred[64];
+  int count;
+  int i;
+
+  count = 0;
+  for (i = 0; i < ready; ++i) {
+    struct ptyterm_event_source *source;
+
+    source = events[i].data.ptr;
+    if (source->session == NULL)
+      continue;
+    if (handle_session_event(source, events[i].events, 1) &&
+        count < (int)(sizeof(deferred) / sizeof(deferred[0])))
+      deferred[count++] = i;
   }
+  for (i = 0; i < count; ++i)
+    handle_session_event(events[deferred[i]].data.ptr,
+                         events[deferred[i]].events, 0);
+}
 
-  request = (const struct ptyterm_create_request *)payload;
-  strings = (char *)(request + 1);
-  strings_size = payload_size - sizeof(*request);
-  argv = calloc(request->argc + 1, sizeof(*argv));
-  if (argv == NULL)
-    return -1;
+/* Drains the sessions the main thread queued for recv requests, then
+ * lets it serve the recvs parked on them. */
+static void serve_drain_requests(struct ptyterm_worker *worker) {
+  struct ptyterm_session *session;
+  struct ptyterm_session *next;
+
+  pthread_mutex_lock(&worker->drain_lock);
+  session = worker->drain_queue;
+  worker->drain_queue = NULL;
+  pthread_mutex_unlock(&worker->drain_lock);
+  for (; session != NULL; session = next) {
+    pthread_mutex_lock(&session->lock);
+    next = session->drain_next;
+    session->drain_next = NULL;
+    drain_session(session);
+    update_session_events(session);
+    session->drain_completed = session->drain_requested;
+    wake_recv_waiters(session);
+    pthread_mutex_unlock(&session->lock);
+  }
+}
 
-  offset = 0;
-  for (i = 0; i < request->argc; ++i) {
-    size_t len;
+static void *run_worker(void *arg) {
+  struct ptyterm_worker *worker;
 
-    if (offset >= strings_size) {
-      free(argv);
-      errno = EPROTO;
-      return -1;
+  worker = arg;
+  while (!stop_requested) {
+    struct epoll_event events[64];
+    int woken;
+    int ready;
+    int i;
+
+    ready = epoll_wait(worker->loop.epoll_fd, events,
+                       (int)(sizeof(events) / sizeof(events[0])), -1);
+    if (ready == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      exit(EXIT_FAILURE);
     }
-    len = strnlen(strings + offset, strings_size - offset);
-    if (offset + len >= strings_size) {
-      free(argv);
-      errno = EPROTO;
-      return -1;
+
+    woken = 0;
+    for (i = 0; i < ready; ++i) {
+      struct ptyterm_event_source *source;
+      uint64_t value;
+
+      source = events[i].data.ptr;
+      if (source->kind != PTYTERM_EVENT_WAKE)
+        continue;
+      woken = 1;
+      if (read(worker->wake_fd, &value, sizeof(value)) == -1 &&
+          errno != EAGAIN)
+        perror("read(eventfd)");
     }
-    argv[i] = strings + offset;
-    offset += len + 1;
+    handle_session_events(events, ready);
+    if (woken)
+      serve_drain_requests(worker);
   }
-  argv[request->argc] = NULL;
+  return NULL;
+}
 
-  if (spawn_session(state, request->argc, argv, &response) == -1) {
-    free(argv);
-    return -1;
+/* Child exits are reported by a pidfd per session where the kernel has
+ * them. Otherwise SIGCHLD is blocked in every thread and delivered to the
+ * main loop through a signalfd; this must run before workers start so they
+ * inherit the mask. */
+static void start_child_tracking(struct ptyterm_daemon_state *state) {
+  sigset_t mask;
+  int fd;
+
+  state->child_signal_fd = -1;
+  fd = open_pidfd(getpid());
+  if (fd >= 0) {
+    close(fd);
+    state->use_pidfd = 1;
+    return;
   }
-  free(argv);
 
-  return ptyterm_send_message(client_fd, PTYTERM_MESSAGE_CREATE_RESPONSE,
-                              &response, sizeof(response));
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+    perror("sigprocmask(SIGCHLD)");
+    exit(EXIT_FAILURE);
+  }
+  state->child_signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (state->child_signal_fd == -1) {
+    perror("signalfd");
+    exit(EXIT_FAILURE);
+  }
+  init_event_source(&state->child_signal_source, PTYTERM_EVENT_CHILD, NULL);
+  if (watch_fd(&state->loop, &state->child_signal_source,
+               state->child_signal_fd, EPOLLIN) == -1) {
+    perror("epoll_ctl(signalfd)");
+    exit(EXIT_FAILURE);
+  }
 }
 
-static int handle_client(int client_fd, struct ptyterm_daemon_state *state) {
-  char payload[4096];
-  struct ptyterm_message_header header;
-  ssize_t payload_size;
-
-  payload_size = ptyterm_recv_message(client_fd, &header, payload, sizeof(payload));
-  if (payload_size == -1) {
-    send_error_response(client_fd, errno, strerror(errno));
-    return 0;
-  }
+static void stop_child_tracking(struct ptyterm_daemon_state *state) {
+  if (state->child_signal_fd < 0)
+    return;
+  unwatch_fd(&state->loop, &state->child_signal_source);
+  close(state->child_signal_fd);
+  state->child_signal_fd = -1;
+}
 
-  switch (header.type) {
-  case PTYTERM_MESSAGE_LIST_REQUEST: {
-    struct ptyterm_list_request request;
+/* Workers never handle SIGINT/SIGTERM so the main thread's epoll_wait is
+ * the one interrupted by a stop request. */
+static void start_workers(struct ptyterm_daemon_state *state, size_t count) {
+  sigset_t blocked;
+  sigset_t saved;
+  size_t i;
 
-    if ((size_t)payload_size != sizeof(request)) {
-      send_error_response(client_fd, EPROTO, "invalid list request size");
-      return 0;
-    }
-    memcpy(&request, payload, sizeof(request));
-    if (send_list_response(client_fd, state, request.session_id) == -1) {
-      send_error_response(client_fd, errno, strerror(errno));
-    }
-    return 0;
+  state->workers = calloc(count, sizeof(*state->workers));
+  if (state->workers == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
   }
-  case PTYTERM_MESSAGE_BUFFER_INFO_REQUEST: {
-    struct ptyterm_buffer_info_request request;
 
-    if ((size_t)payload_size != sizeof(request)) {
-      send_error_response(client_fd, EPROTO,
-                          "invalid buffer-info request size");
-      return 0;
-    }
-    memcpy(&request, payload, sizeof(request));
-    if (request.session_id <= 0) {
-      send_error_response(client_fd, EINVAL, "invalid session id");
-      return 0;
-    }
-    if (send_buffer_info_response(client_fd, state, request.session_id) == -1) {
-      if (errno == ENOENT) {
-        send_error_response(client_fd, errno, "session not found");
-      } else {
-        send_error_response(client_fd, errno, strerror(errno));
-      }
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGINT);
+  sigaddset(&blocked, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &blocked, &saved);
+  for (i = 0; i < count; ++i) {
+    struct ptyterm_worker *worker;
+    int error;
+
+    worker = &state->workers[i];
+    worker->state = state;
+    worker->loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (worker->loop.epoll_fd == -1) {
+      perror("epoll_create1");
+      exit(EXIT_FAILURE);
     }
-    return 0;
-  }
-  case PTYTERM_MESSAGE_CREATE_REQUEST:
-    if (handle_create_request(client_fd, state, payload, (size_t)payload_size) == -1) {
-      send_error_response(client_fd, errno, strerror(errno));
+    worker->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (worker->wake_fd == -1) {
+      perror("eventfd");
+      exit(EXIT_FAILURE);
     }
-    return 0;
-  case PTYTERM_MESSAGE_SEND_REQUEST:
-    if (handle_send_request(client_fd, state, payload, (size_t)payload_size) == -1) {
-      if (errno == ENOENT) {
-        send_error_response(client_fd, errno, "session not found");
-      } else {
-        send_error_response(client_fd, errno, strerror(errno));
-      }
+    pthread_mutex_init(&worker->drain_lock, NULL);
+    init_event_source(&worker->wake_source, PTYTERM_EVENT_WAKE, NULL);
+    if (watch_fd(&worker->loop, &worker->wake_source, worker->wake_fd,
+                 EPOLLIN) == -1) {
+      perror("epoll_ctl(eventfd)");
+      exit(EXIT_FAILURE);
     }
-    return 0;
-  case PTYTERM_MESSAGE_RECV_REQUEST:
-    if (handle_recv_request(client_fd, state, payload, (size_t)payload_size) == -1) {
-      if (errno == ENOENT) {
-        send_error_response(client_fd, errno, "session not found");
-      } else {
-        send_error_response(client_fd, errno, strerror(errno));
-      }
+    error = pthread_create(&worker->thread, NULL, run_worker, worker);
+    if (error != 0) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(error));
+      exit(EXIT_FAILURE);
     }
-    return 0;
-  case PTYTERM_MESSAGE_ATTACH_REQUEST: {
-    int attached;
+    state->worker_count = i + 1;
+  }
+  pthread_sigmask(SIG_SETMASK, &saved, NULL);
+}
 
-    attached = handle_attach_request(client_fd, state, payload, (size_t)payload_size);
-    if (attached == -1) {
-      if (errno == ENOENT) {
-        send_error_response(client_fd, errno, "session not found");
-      } else {
-        send_error_response(client_fd, errno, strerror(errno));
-      }
-      return 0;
-    }
-    return attached;
+static void stop_workers(struct ptyterm_daemon_state *state) {
+  size_t i;
+
+  for (i = 0; i < state->worker_count; ++i) {
+    uint64_t value;
+
+    value = 1;
+    if (write(state->workers[i].wake_fd, &value, sizeof(value)) == -1)
+      perror("write(eventfd)");
   }
-  case PTYTERM_MESSAGE_DETACH_REQUEST:
-    if (handle_detach_request(client_fd, state, payload, (size_t)payload_size) == -1) {
-      if (errno == ENOENT) {
-        send_error_response(client_fd, errno, "session not found");
-      } else {
-        send_error_response(client_fd, errno, strerror(errno));
-      }
-    }
-    return 0;
-  case PTYTERM_MESSAGE_RESIZE_REQUEST:
-    if (handle_resize_request(client_fd, state, payload, (size_t)payload_size) == -1) {
-      if (errno == ENOENT) {
-        send_error_response(client_fd, errno, "session not found");
-      } else {
-        send_error_response(client_fd, errno, strerror(errno));
-      }
-    }
-    return 0;
-  case PTYTERM_MESSAGE_DAEMON_STATUS_REQUEST:
-    if (handle_daemon_status_request(client_fd, payload,
-                                     (size_t)payload_size) == -1) {
-      send_error_response(client_fd, errno, strerror(errno));
-    }
-    return 0;
-  case PTYTERM_MESSAGE_DAEMON_SHUTDOWN_REQUEST:
-    if (handle_daemon_shutdown_request(client_fd, payload,
-                                       (size_t)payload_size) == -1) {
-      send_error_response(client_fd, errno, strerror(errno));
-    }
-    return 0;
-  case PTYTERM_MESSAGE_SCREEN_SNAPSHOT_REQUEST:
-    if (handle_screen_snapshot_request(client_fd, state, payload,
-                                       (size_t)payload_size) == -1) {
-      if (errno == ENOENT) {
-        send_error_response(client_fd, errno, "session not found");
-      } else if (errno == EINVAL) {
-        send_error_response(client_fd, errno, "invalid screen selector");
-      } else {
-        send_error_response(client_fd, errno, strerror(errno));
-      }
-    }
-    return 0;
-  default:
-    send_error_response(client_fd, ENOTSUP, "unsupported request type");
-    return 0;
+  for (i = 0; i < state->worker_count; ++i) {
+    struct ptyterm_worker *worker;
+
+    worker = &state->workers[i];
+    pthread_join(worker->thread, NULL);
+    unwatch_fd(&worker->loop, &worker->wake_source);
+    close(worker->wake_fd);
+    pthread_mutex_destroy(&worker->drain_lock);
   }
 }
 
+static void close_workers(struct ptyterm_daemon_state *state) {
+  size_t i;
+
+  for (i = 0; i < state->worker_count; ++i)
+    close(state->workers[i].loop.epoll_fd);
+  free(state->workers);
+  state->workers = NULL;
+  state->worker_count = 0;
+}
+
 int main(int argc, char *const argv[]) {
   struct ptyterm_daemon_state state;
   const char *socket_path = NULL;
   const char *overflow = "drop";
   unsigned long output_buffer = 4096UL;
+  unsigned long threads = 1UL;
   char default_socket_path[PTYTERM_SOCKET_PATH_MAX];
 
   memset(&state, 0, sizeof(state));
@@ -1422,9 +5083,16 @@ int main(int argc, char *const argv[]) {
         {"socket", required_argument, NULL, 's'},
         {"output-buffer", required_argument, NULL, 'b'},
         {"overflow", required_argument, NULL, 'o'},
+        {"threads", required_argument, NULL, 't'},
+        {"history-dir", required_argument, NULL, 'H'},
+        {"memory-limit", required_argument, NULL, 'm'},
+        {"compressed-history", no_argument, NULL, 'z'},
+        {"history-limit", required_argument, NULL, 'L'},
+        {"coalesce-progress", no_argument, NULL, 'c'},
+        {"cursor-idle", required_argument, NULL, 'I'},
         {NULL, 0, NULL, 0}};
 
-    c = getopt_long(argc, argv, "hVs:b:o:", longopts, &optindex);
+    c = getopt_long(argc, argv, "hVs:b:o:t:H:m:zL:cI:", longopts, &optindex);
     if (c == -1)
       break;
 
@@ -1444,6 +5112,25 @@ int main(int argc, char *const argv[]) {
              "(default: 4096)\n");
       printf("  -o, --overflow=drop|pause  output buffer overflow policy "
              "(default: drop)\n");
+      printf("  -I, --cursor-idle=DURATION stop holding back pause for named "
+             "cursors unread for\n"
+             "                             DURATION, in ms or s "
+             "(default: 300s)\n");
+      printf("  -t, --threads=N            session I/O worker threads "
+             "(default: 1)\n");
+      printf("  -H, --history-dir=DIR      keep output evicted from the buffer "
+             "in DIR\n");
+      printf("  -z, --compressed-history   keep output evicted from the buffer "
+             "compressed in memory\n");
+      printf("  -L, --history-limit=SIZE   keep at most SIZE of history per "
+             "session, dropping the\n"
+             "                             oldest first (default: 64M with "
+             "--compressed-history)\n");
+      printf("  -c, --coalesce-progress    store only the first and last state "
+             "of lines redrawn with \\r\n");
+      printf("  -m, --memory-limit=SIZE    drop old history and trim idle "
+             "sessions' buffers to keep\n"
+             "                             the daemon within SIZE\n");
       printf("  -V, --version              print version and exit\n");
       printf("  -h, --help                 print this usage and exit\n");
       printf("\n");
@@ -1461,6 +5148,31 @@ int main(int argc, char *const argv[]) {
       }
       overflow = optarg;
       break;
+    case 'H':
+      state.history_dir = optarg;
+      break;
+    case 'z':
+      state.compressed_history = 1;
+      break;
+    case 'L':
+      state.history_limit = parse_size(optarg, "history-limit");
+      break;
+    case 'c':
+      state.coalesce_progress = 1;
+      break;
+    case 'I':
+      state.cursor_idle_ms = parse_duration(optarg, "cursor-idle");
+      break;
+    case 'm':
+      state.memory_budget.limit = parse_size(optarg, "memory-limit");
+      break;
+    case 't':
+      threads = parse_size(optarg, "threads");
+      if (threads == 0 || threads > PTYTERM_THREADS_MAX) {
+        fprintf(stderr, "invalid threads: %s\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
     default:
       exit(EXIT_FAILURE);
     }
@@ -1471,13 +5183,31 @@ int main(int argc, char *const argv[]) {
     exit(EXIT_FAILURE);
   }
 
-  (void)overflow;
+  state.overflow_policy = strcmp(overflow, "pause") == 0
+                              ? PTYTERM_OVERFLOW_PAUSE
+                              : PTYTERM_OVERFLOW_DROP;
 
   if (output_buffer > UINT32_MAX) {
     fprintf(stderr, "output-buffer too large: %lu\n", output_buffer);
     exit(EXIT_FAILURE);
   }
   state.output_buffer = (uint32_t)output_buffer;
+  if (state.overflow_policy == PTYTERM_OVERFLOW_PAUSE && output_buffer == 0) {
+    fprintf(stderr, "output-buffer must be non-zero with --overflow=pause\n");
+    exit(EXIT_FAILURE);
+  }
+  if (state.history_dir != NULL && state.compressed_history) {
+    fprintf(stderr, "--history-dir and --compressed-history are exclusive\n");
+    exit(EXIT_FAILURE);
+  }
+  if (state.cursor_idle_ms == 0)
+    state.cursor_idle_ms = PTYTERM_CURSOR_IDLE_MS;
+  if (state.history_limit == 0 && state.compressed_history)
+    state.history_limit = PTYTERM_COMPRESSED_HISTORY_LIMIT;
+  if (state.history_dir != NULL && access(state.history_dir, W_OK | X_OK) == -1) {
+    perror(state.history_dir);
+    exit(EXIT_FAILURE);
+  }
 
   if (socket_path == NULL) {
     if (ptyterm_default_socket_path(default_socket_path,
@@ -1498,92 +5228,119 @@ int main(int argc, char *const argv[]) {
     perror(socket_path);
     exit(EXIT_FAILURE);
   }
+  if (set_nonblocking(state.server_fd) == -1) {
+    perror("fcntl(server)");
+    exit(EXIT_FAILURE);
+  }
 
-  while (!stop_requested) {
-    fd_set rfds;
-    fd_set wfds;
-    int maxfd;
-    size_t i;
-    int client_fd;
-
-    FD_ZERO(&rfds);
-    FD_ZERO(&wfds);
-    FD_SET(state.server_fd, &rfds);
-    maxfd = state.server_fd;
-    for (i = 0; i < state.session_count; ++i) {
-      if (state.sessions[i].master_fd < 0)
-        ;
-      else {
-        if (state.sessions[i].pending_output_size == 0)
-          FD_SET(state.sessions[i].master_fd, &rfds);
-        if (state.sessions[i].pending_input_size > 0)
-          FD_SET(state.sessions[i].master_fd, &wfds);
-        if (maxfd < state.sessions[i].master_fd)
-          maxfd = state.sessions[i].master_fd;
-      }
-      if (state.sessions[i].client_fd >= 0) {
-        if (state.sessions[i].pending_input_size == 0)
-          FD_SET(state.sessions[i].client_fd, &rfds);
-        if (state.sessions[i].pending_output_size > 0)
-          FD_SET(state.sessions[i].client_fd, &wfds);
-        if (maxfd < state.sessions[i].client_fd)
-          maxfd = state.sessions[i].client_fd;
-      }
-    }
+  state.loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (state.loop.epoll_fd == -1) {
+    perror("epoll_create1");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&state.table_lock, NULL);
+  pthread_mutex_init(&state.recv_ready.lock, NULL);
+  state.recv_ready.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (state.recv_ready.wake_fd == -1) {
+    perror("eventfd");
+    exit(EXIT_FAILURE);
+  }
+  init_event_source(&state.recv_wake_source, PTYTERM_EVENT_WAKE, NULL);
+  if (watch_fd(&state.loop, &state.recv_wake_source,
+               state.recv_ready.wake_fd, EPOLLIN) == -1) {
+    perror("epoll_ctl(eventfd)");
+    exit(EXIT_FAILURE);
+  }
+  /* The output path wakes the main loop the same way parked recvs do. */
+  pthread_mutex_init(&state.memory_budget.lock, NULL);
+  state.memory_budget.wake_fd = state.recv_ready.wake_fd;
+  start_child_tracking(&state);
+  if (threads > 1)
+    start_workers(&state, threads);
+  init_event_source(&state.server_source, PTYTERM_EVENT_SERVER, NULL);
+  if (watch_fd(&state.loop, &state.server_source, state.server_fd,
+               EPOLLIN) == -1) {
+    perror("epoll_ctl(server)");
+    exit(EXIT_FAILURE);
+  }
 
-    if (select(maxfd + 1, &rfds, &wfds, NULL, NULL) == -1) {
+  while (!stop_requested) {
+    struct epoll_event events[64];
+    int accept_ready;
+    int child_ready;
+    int ready;
+    int i;
+
+    ready = epoll_wait(state.loop.epoll_fd, events,
+                       (int)(sizeof(events) / sizeof(events[0])),
+                       cursor_check_timeout(&state,
+                                            recv_wait_timeout(&state)));
+    if (ready == -1) {
       if (errno == EINTR)
         continue;
-      perror("select");
+      perror("epoll_wait");
       exit(EXIT_FAILURE);
     }
 
-    for (i = 0; i < state.session_count; ++i) {
-      if (state.sessions[i].master_fd >= 0 && state.sessions[i].pending_input_size > 0 &&
-          FD_ISSET(state.sessions[i].master_fd, &wfds)) {
-        if (flush_pending_data(state.sessions[i].master_fd,
-                               state.sessions[i].pending_input,
-                               &state.sessions[i].pending_input_size) == -1) {
-          close_attached_client(&state.sessions[i]);
-        }
-      }
-      if (state.sessions[i].client_fd >= 0 && state.sessions[i].pending_output_size > 0 &&
-          FD_ISSET(state.sessions[i].client_fd, &wfds)) {
-        if (flush_pending_data(state.sessions[i].client_fd,
-                               state.sessions[i].pending_output,
-                               &state.sessions[i].pending_output_size) == -1) {
-          close_attached_client(&state.sessions[i]);
-        }
-      }
-      if (state.sessions[i].client_fd >= 0 &&
-          FD_ISSET(state.sessions[i].client_fd, &rfds)) {
-        drain_attached_input(&state.sessions[i]);
-      }
-      if (state.sessions[i].master_fd >= 0 &&
-          FD_ISSET(state.sessions[i].master_fd, &rfds)) {
-        drain_session_output(&state.sessions[i]);
-      }
+    accept_ready = 0;
+    child_ready = 0;
+    for (i = 0; i < ready; ++i) {
+      struct ptyterm_event_source *source;
+      uint64_t value;
+
+      source = events[i].data.ptr;
+      if (source->kind == PTYTERM_EVENT_SERVER)
+        accept_ready = 1;
+      else if (source->kind == PTYTERM_EVENT_CHILD && source->session == NULL)
+        child_ready = 1;
+      else if (source->kind == PTYTERM_EVENT_WAKE &&
+               read(state.recv_ready.wake_fd, &value, sizeof(value)) == -1 &&
+               errno != EAGAIN)
+        perror("read(eventfd)");
     }
-    reap_children(&state);
-
-    if (!FD_ISSET(state.server_fd, &rfds))
-      continue;
+    /* Requests are served after session output in a later pass. */
+    handle_session_events(events, ready);
+    if (child_ready) {
+      struct signalfd_siginfo info;
 
-    client_fd = accept(state.server_fd, NULL, NULL);
-    if (client_fd == -1) {
-      if (errno == EINTR)
-        continue;
-      perror("accept");
-      exit(EXIT_FAILURE);
+      while (read(state.child_signal_fd, &info, sizeof(info)) > 0)
+        ;
+      reap_children(&state);
     }
 
-    if (!handle_client(client_fd, &state))
-      close(client_fd);
+    /* Session output that arrived in this batch is drained before new
+     * requests are served, so a recv issued right after a send sees it. */
+    for (i = 0; i < ready; ++i) {
+      struct ptyterm_event_source *source;
+
+      source = events[i].data.ptr;
+      if (source->kind == PTYTERM_EVENT_CONNECTION)
+        handle_connection_event(&state, source->connection, events[i].events);
+    }
+    if (accept_ready)
+      accept_connections(&state);
+    if (state.overflow_policy == PTYTERM_OVERFLOW_PAUSE &&
+        monotonic_ms() >= state.next_cursor_check_ms)
+      resume_idle_paused(&state);
+    serve_memory_over(&state);
+    /* Last, since it may free connections the events above refer to. */
+    serve_recv_waits(&state);
   }
 
+  flush_connections(&state);
+  stop_workers(&state);
+  unwatch_fd(&state.loop, &state.server_source);
   close(state.server_fd);
   state.server_fd = -1;
   cleanup_state(&state);
+  close_workers(&state);
+  stop_child_tracking(&state);
+  unwatch_fd(&state.loop, &state.recv_wake_source);
+  close(state.recv_ready.wake_fd);
+  pthread_mutex_destroy(&state.recv_ready.lock);
+  pthread_mutex_destroy(&state.memory_budget.lock);
+  close(state.loop.epoll_fd);
+  pthread_mutex_destroy(&state.table_lock);
   cleanup_socket();
   cleanup_socket_path[0] = '\0';
   return EXIT_SUCCESS;
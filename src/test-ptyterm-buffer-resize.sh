@@ -0,0 +1,143 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-buffer-resize.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" --output-buffer=4096 >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+if ./ptyterm --buffer-size=100 --list --socket="$sock" >/dev/null 2>&1; then
+  echo "ptyterm --buffer-size without --create: expected failure" >&2
+  exit 1
+fi
+
+if ./ptyterm --create --buffer-size=0 --socket="$sock" /bin/true >/dev/null 2>&1; then
+  echo "ptyterm --create --buffer-size=0: expected failure" >&2
+  exit 1
+fi
+
+# 20 lines of 10 bytes each leave the last 10 in the 100-byte ring.
+./ptyterm --create --buffer-size=100 --socket="$sock" /bin/sh -c 'stty -onlcr; i=1000; while [ $i -lt 1020 ]; do echo "line-$i"; i=$((i + 1)); done; sleep 30' >/dev/null 2>&1 || {
+  echo "ptyterm --create --buffer-size=100: expected success" >&2
+  exit 1
+}
+./ptyterm --create --socket="$sock" /bin/sh -c 'sleep 30' >/dev/null 2>&1 || {
+  echo "ptyterm --create: expected success" >&2
+  exit 1
+}
+
+i=0
+while :; do
+  ./ptyterm --buffer-info --session=1 --socket="$sock" --status-format=kv >"$tmpdir/info.out" 2>&1 || {
+    echo "ptyterm --buffer-info: expected success" >&2
+    cat "$tmpdir/info.out" >&2
+    exit 1
+  }
+  grep -q '^dropped_bytes=100$' "$tmpdir/info.out" && break
+  i=$((i + 1))
+  if [ "$i" -ge 50 ]; then
+    echo "ptyterm --buffer-info: expected dropped_bytes=100" >&2
+    cat "$tmpdir/info.out" >&2
+    exit 1
+  fi
+  sleep 0.2
+done
+grep -q '^buffer_capacity=100$' "$tmpdir/info.out" || {
+  echo "ptyterm --create --buffer-size=100: expected buffer_capacity=100" >&2
+  cat "$tmpdir/info.out" >&2
+  exit 1
+}
+./ptyterm --buffer-info --session=2 --socket="$sock" --status-format=kv >"$tmpdir/info2.out"
+grep -q '^buffer_capacity=4096$' "$tmpdir/info2.out" || {
+  echo "ptyterm --create: expected the daemon's buffer_capacity=4096" >&2
+  cat "$tmpdir/info2.out" >&2
+  exit 1
+}
+
+# expect_resize SIZE PATTERN...: resizes session 1 and checks the status.
+expect_resize() {
+  size=$1
+  shift
+  ./ptyterm --resize-buffer="$size" --session=1 --socket="$sock" --status-format=kv >"$tmpdir/resize.out" 2>&1 || {
+    echo "ptyterm --resize-buffer=$size: expected success" >&2
+    cat "$tmpdir/resize.out" >&2
+    exit 1
+  }
+  for pattern in "$@"; do
+    grep -q "^$pattern\$" "$tmpdir/resize.out" || {
+      echo "ptyterm --resize-buffer=$size: expected $pattern" >&2
+      cat "$tmpdir/resize.out" >&2
+      exit 1
+    }
+  done
+}
+
+# expect_peek PAYLOAD STATUS: checks what the ring holds now.
+expect_peek() {
+  ./ptyterm --recv --peek --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/peek.out" 2>"$tmpdir/peek.err" || {
+    echo "ptyterm --recv --peek: expected success" >&2
+    cat "$tmpdir/peek.err" >&2
+    exit 1
+  }
+  printf "$1" >"$tmpdir/expected"
+  cmp "$tmpdir/expected" "$tmpdir/peek.out" || {
+    echo "ptyterm --recv --peek: unexpected payload" >&2
+    cat "$tmpdir/peek.out" >&2
+    exit 1
+  }
+  grep -q "$2" "$tmpdir/peek.err" || {
+    echo "ptyterm --recv --peek: expected status $2" >&2
+    cat "$tmpdir/peek.err" >&2
+    exit 1
+  }
+}
+
+# Growing keeps every retained byte at its offset.
+expect_resize 1K buffer_capacity=1024 buffer_used=100 dropped_bytes=100
+expect_peek 'line-1010\nline-1011\nline-1012\nline-1013\nline-1014\nline-1015\nline-1016\nline-1017\nline-1018\nline-1019\n' 'offsets 100..200;'
+
+# Shrinking keeps the newest bytes and counts the rest as dropped.
+expect_resize 30 buffer_capacity=30 buffer_used=30 dropped_bytes=170
+expect_peek 'line-1017\nline-1018\nline-1019\n' 'offsets 170..200;'
+
+# Growing again cannot bring dropped output back.
+expect_resize 64 buffer_capacity=64 buffer_used=30 dropped_bytes=170
+expect_peek 'line-1017\nline-1018\nline-1019\n' 'offsets 170..200;'
+
+if ./ptyterm --resize-buffer=0 --session=1 --socket="$sock" >/dev/null 2>&1; then
+  echo "ptyterm --resize-buffer=0: expected failure" >&2
+  exit 1
+fi
+
+if ./ptyterm --resize-buffer=1K --session=9 --socket="$sock" >/dev/null 2>"$tmpdir/missing.err"; then
+  echo "ptyterm --resize-buffer for a missing session: expected failure" >&2
+  exit 1
+fi
+grep -q 'session not found' "$tmpdir/missing.err" || {
+  echo "ptyterm --resize-buffer for a missing session: expected session not found" >&2
+  cat "$tmpdir/missing.err" >&2
+  exit 1
+}
@@ -0,0 +1,83 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-bulk-fairness.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+# Two sessions flood output without pause while a third answers one line at
+# a time; the flood must not hold up the interactive session.
+n=1
+while [ "$n" -le 2 ]; do
+  create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'while :; do echo bulk-output-bulk-output-bulk-output; done' 2>&1) || {
+    echo "ptyterm --create for bulk session $n: expected success" >&2
+    printf '%s\n' "$create_out" >&2
+    exit 1
+  }
+  n=$((n + 1))
+done
+
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'while read line; do echo "got-$line"; done' 2>&1) || {
+  echo "ptyterm --create for interactive session: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+printf '%s\n' "$create_out" | grep -q '^session_id=3$' || {
+  echo "ptyterm --create for interactive session: expected session id 3" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+n=1
+while [ "$n" -le 5 ]; do
+  ./ptyterm --send="line$n\\n" --session=3 --socket="$sock" >/dev/null 2>&1 || {
+    echo "ptyterm --send #$n beside bulk output: expected success" >&2
+    exit 1
+  }
+  recv_out=$(./ptyterm --recv --recv-until="got-line$n" --recv-timeout=5s --session=3 --socket="$sock" 2>&1) || {
+    echo "ptyterm --recv #$n beside bulk output: expected success" >&2
+    printf '%s\n' "$recv_out" >&2
+    exit 1
+  }
+  printf '%s\n' "$recv_out" | grep -q "got-line$n" || {
+    echo "ptyterm --recv #$n beside bulk output: expected echoed line" >&2
+    printf '%s\n' "$recv_out" >&2
+    exit 1
+  }
+  n=$((n + 1))
+done
+
+info_out=$(./ptyterm --buffer-info --session=1 --socket="$sock" --status-format=kv 2>&1) || {
+  echo "ptyterm --buffer-info for bulk session: expected success" >&2
+  printf '%s\n' "$info_out" >&2
+  exit 1
+}
+printf '%s\n' "$info_out" | grep -q '^state=detached$' || {
+  echo "ptyterm --buffer-info for bulk session: expected the flood still running" >&2
+  printf '%s\n' "$info_out" >&2
+  exit 1
+}
@@ -0,0 +1,67 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-child-exit.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+# The background sleep keeps the pty open after the session's own child
+# exits, so only child tracking can notice the exit.
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'sleep 30 & exit 4' 2>&1) || {
+  echo "ptyterm --create for child exit: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+i=0
+while :; do
+  list_out=$(./ptyterm --list --socket="$sock" 2>&1) || {
+    echo "ptyterm --list for child exit: expected success" >&2
+    printf '%s\n' "$list_out" >&2
+    exit 1
+  }
+  printf '%s\n' "$list_out" | grep -q "^1	exited	" && break
+  i=$((i + 1))
+  if [ "$i" -ge 50 ]; then
+    echo "ptyterm --list for child exit: expected session 1 exited" >&2
+    printf '%s\n' "$list_out" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'echo still-served; sleep 30' 2>&1) || {
+  echo "ptyterm --create after child exit: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+recv_out=$(./ptyterm --recv --recv-until=still-served --recv-timeout=5s --session=2 --socket="$sock" 2>&1) || {
+  echo "ptyterm --recv after child exit: expected success" >&2
+  printf '%s\n' "$recv_out" >&2
+  exit 1
+}
@@ -0,0 +1,97 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-follow.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" --output-buffer=4096 >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+if ./ptyterm --follow --recv --session=1 --socket="$sock" >/dev/null 2>&1; then
+  echo "ptyterm --follow --recv: expected failure" >&2
+  exit 1
+fi
+
+if ./ptyterm --follow --session=9 --socket="$sock" >/dev/null 2>"$tmpdir/missing.err"; then
+  echo "ptyterm --follow for a missing session: expected failure" >&2
+  exit 1
+fi
+grep -q 'session not found' "$tmpdir/missing.err" || {
+  echo "ptyterm --follow for a missing session: expected session not found" >&2
+  cat "$tmpdir/missing.err" >&2
+  exit 1
+}
+
+# Output that fits the ring arrives complete, and the follower stops once
+# the session has exited and everything has been copied.
+./ptyterm --create --socket="$sock" /bin/sh -c 'stty -onlcr; echo ready; sleep 1; i=1000; while [ $i -lt 1100 ]; do echo "line-$i"; i=$((i + 1)); done' >/dev/null 2>&1
+i=1000
+{
+  echo ready
+  while [ $i -lt 1100 ]; do echo "line-$i"; i=$((i + 1)); done
+} >"$tmpdir/expected"
+timeout 10 ./ptyterm --follow --session=1 --socket="$sock" >"$tmpdir/small.out" 2>"$tmpdir/small.err" || {
+  echo "ptyterm --follow: expected success" >&2
+  cat "$tmpdir/small.err" >&2
+  exit 1
+}
+cmp "$tmpdir/expected" "$tmpdir/small.out" || {
+  echo "ptyterm --follow: unexpected output" >&2
+  cat "$tmpdir/small.out" >&2
+  exit 1
+}
+
+# Output that outruns the ring is either copied in full or reported as
+# skipped; the newest bytes are never lost.
+./ptyterm --create --socket="$sock" /bin/sh -c 'stty -onlcr; sleep 1; i=1000; while [ $i -lt 3000 ]; do echo "line-$i"; i=$((i + 1)); done' >/dev/null 2>&1
+i=1000
+while [ $i -lt 3000 ]; do echo "line-$i"; i=$((i + 1)); done >"$tmpdir/expected"
+timeout 10 ./ptyterm --follow --session=2 --socket="$sock" >"$tmpdir/large.out" 2>"$tmpdir/large.err" || {
+  echo "ptyterm --follow (overrun): expected success" >&2
+  cat "$tmpdir/large.err" >&2
+  exit 1
+}
+[ "$(tail -n 1 "$tmpdir/large.out")" = line-2999 ] || {
+  echo "ptyterm --follow (overrun): expected the last line" >&2
+  tail -n 3 "$tmpdir/large.out" >&2
+  exit 1
+}
+if ! grep -q '^skipped [0-9]* bytes$' "$tmpdir/large.err"; then
+  cmp "$tmpdir/expected" "$tmpdir/large.out" || {
+    echo "ptyterm --follow (overrun): output lost without a skip report" >&2
+    exit 1
+  }
+fi
+
+# Sharing the ring leaves recv working on the same bytes.
+./ptyterm --recv --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/recv.out" 2>/dev/null || {
+  echo "ptyterm --recv after --follow: expected success" >&2
+  exit 1
+}
+cmp "$tmpdir/small.out" "$tmpdir/recv.out" || {
+  echo "ptyterm --recv after --follow: unexpected output" >&2
+  cat "$tmpdir/recv.out" >&2
+  exit 1
+}
@@ -0,0 +1,170 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-history-compressed.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir/history"
+
+if ./ptytermd --socket="$sock" --history-dir="$tmpdir/history" --compressed-history >"$tmpdir/exclusive.out" 2>&1; then
+  echo "ptytermd --history-dir with --compressed-history: expected failure" >&2
+  exit 1
+fi
+
+./ptytermd --socket="$sock" --output-buffer=4096 --compressed-history >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+# 100000 lines of log-like output, 3.4 MB in all, run through the 4 KiB
+# ring into the compressed history.
+awk 'BEGIN { for (i = 100000; i < 200000; i++) print "build step " i " ok" }' >"$tmpdir/expected"
+
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'stty -onlcr; awk "BEGIN { for (i = 100000; i < 200000; i++) print \"build step \" i \" ok\" }"; sleep 30' 2>&1) || {
+  echo "ptyterm --create for compressed history: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+i=0
+while :; do
+  ./ptyterm --recv --peek --recv-size=4000000 --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/received" 2>"$tmpdir/recv.err" || {
+    echo "ptyterm --recv for compressed history: expected success" >&2
+    cat "$tmpdir/recv.err" >&2
+    exit 1
+  }
+  grep -q '^build step 199999 ok$' "$tmpdir/received" && break
+  i=$((i + 1))
+  if [ "$i" -ge 100 ]; then
+    echo "ptyterm --recv for compressed history: expected the last line" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+cmp "$tmpdir/expected" "$tmpdir/received" || {
+  echo "ptyterm --recv for compressed history: expected the whole stream" >&2
+  exit 1
+}
+
+# A read from the middle decompresses only the blocks it needs.
+./ptyterm --recv --peek --from-line=50001 --recv-lines=3 --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/middle" 2>"$tmpdir/middle.err" || {
+  echo "ptyterm --recv --from-line for compressed history: expected success" >&2
+  cat "$tmpdir/middle.err" >&2
+  exit 1
+}
+printf 'build step 150000 ok\nbuild step 150001 ok\nbuild step 150002 ok\n' >"$tmpdir/middle.expected"
+cmp "$tmpdir/middle.expected" "$tmpdir/middle" || {
+  echo "ptyterm --recv --from-line for compressed history: expected lines 50001-50003" >&2
+  cat "$tmpdir/middle" >&2
+  exit 1
+}
+
+# Only the newest lines are indexed; older ones are found by scanning.
+./ptyterm --recv --peek --from-line=1 --recv-lines=2 --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/first" 2>"$tmpdir/first.err" || {
+  echo "ptyterm --recv --from-line=1 for compressed history: expected success" >&2
+  cat "$tmpdir/first.err" >&2
+  exit 1
+}
+printf 'build step 100000 ok\nbuild step 100001 ok\n' >"$tmpdir/first.expected"
+cmp "$tmpdir/first.expected" "$tmpdir/first" || {
+  echo "ptyterm --recv --from-line=1 for compressed history: expected lines 1-2" >&2
+  cat "$tmpdir/first" >&2
+  exit 1
+}
+
+index_bytes=$(./ptyterm --daemon-status --status-format=kv --socket="$sock" | sed -n 's/^index_bytes=//p')
+[ -n "$index_bytes" ] && [ "$index_bytes" -le 655360 ] || {
+  echo "ptyterm --daemon-status: expected the line index capped, got index_bytes='$index_bytes'" >&2
+  exit 1
+}
+
+history_bytes=$(./ptyterm --daemon-status --status-format=kv --socket="$sock" | sed -n 's/^history_bytes=//p')
+[ -n "$history_bytes" ] && [ "$history_bytes" -gt 0 ] && [ "$history_bytes" -lt 1000000 ] || {
+  echo "ptyterm --daemon-status: expected compressed history_bytes well under 3.4 MB, got '$history_bytes'" >&2
+  exit 1
+}
+
+# With --history-limit the oldest blocks are dropped, and a read from the
+# start reports the gap.
+kill "$daemon_pid"
+wait "$daemon_pid" 2>/dev/null || true
+daemon_pid=
+rm -f "$sock"
+./ptytermd --socket="$sock" --output-buffer=4096 --compressed-history --history-limit=256K >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd --history-limit did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'stty -onlcr; awk "BEGIN { for (i = 100000; i < 200000; i++) print \"build step \" i \" ok\" }"; sleep 30' 2>&1) || {
+  echo "ptyterm --create for limited history: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+i=0
+while :; do
+  ./ptyterm --recv --peek --recv-size=4000000 --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/limited" 2>"$tmpdir/limited.err" || {
+    echo "ptyterm --recv for limited history: expected success" >&2
+    cat "$tmpdir/limited.err" >&2
+    exit 1
+  }
+  tail -n 1 "$tmpdir/limited" | grep -q '^build step 199999 ok$' && break
+  i=$((i + 1))
+  if [ "$i" -ge 100 ]; then
+    echo "ptyterm --recv for limited history: expected the last line" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+# Blocks are dropped while the output is still coming in; read again once
+# it has all arrived, so the tail is not checked across a drop.
+./ptyterm --recv --peek --recv-size=4000000 --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/limited" 2>"$tmpdir/limited.err" || {
+  echo "ptyterm --recv for limited history: expected success" >&2
+  cat "$tmpdir/limited.err" >&2
+  exit 1
+}
+grep -q 'truncated=yes' "$tmpdir/limited.err" || {
+  echo "ptyterm --recv for limited history: expected truncated=yes" >&2
+  cat "$tmpdir/limited.err" >&2
+  exit 1
+}
+tail -c +"$(($(wc -c <"$tmpdir/expected") - $(wc -c <"$tmpdir/limited") + 1))" "$tmpdir/expected" | cmp - "$tmpdir/limited" || {
+  echo "ptyterm --recv for limited history: expected an unbroken tail of the stream" >&2
+  exit 1
+}
+
+history_bytes=$(./ptyterm --daemon-status --status-format=kv --socket="$sock" | sed -n 's/^history_bytes=//p')
+[ -n "$history_bytes" ] && [ "$history_bytes" -le $((256 * 1024 + 3 * 65536)) ] || {
+  echo "ptyterm --daemon-status: expected history_bytes within --history-limit, got '$history_bytes'" >&2
+  exit 1
+}
@@ -0,0 +1,135 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-history.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir/history"
+
+if ./ptytermd --socket="$sock" --history-dir="$tmpdir/missing" >"$tmpdir/missing.out" 2>&1; then
+  echo "ptytermd --history-dir with a missing directory: expected failure" >&2
+  exit 1
+fi
+
+./ptytermd --socket="$sock" --output-buffer=100 --history-dir="$tmpdir/history" >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+# 100000 lines of 12 bytes run through the 100-byte ring and fill more than
+# one history segment.
+awk 'BEGIN { for (i = 100000; i < 200000; i++) print "line-" i }' >"$tmpdir/expected"
+
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'stty -onlcr; awk "BEGIN { for (i = 100000; i < 200000; i++) print \"line-\" i }"; sleep 30' 2>&1) || {
+  echo "ptyterm --create for history: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+i=0
+while :; do
+  info_out=$(./ptyterm --buffer-info --session=1 --socket="$sock" --status-format=kv 2>&1) || {
+    echo "ptyterm --buffer-info for history: expected success" >&2
+    printf '%s\n' "$info_out" >&2
+    exit 1
+  }
+  ./ptyterm --recv --peek --recv-size=12 --recv-format=raw --recv-control=with --session=1 --socket="$sock" 2>/dev/null | grep -q '^line-100000$' || {
+    echo "ptyterm --recv --peek for history: expected the first line" >&2
+    exit 1
+  }
+  i=$((i + 1))
+  set -- "$tmpdir/history/ptytermd-$daemon_pid-1-"*.000001
+  [ -s "$1" ] && break
+  if [ "$i" -ge 100 ]; then
+    echo "ptytermd --history-dir: expected a second history segment" >&2
+    ls -l "$tmpdir/history" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+printf '%s\n' "$info_out" | grep -q '^dropped_bytes=0$' || {
+  echo "ptyterm --buffer-info for history: expected no dropped bytes" >&2
+  printf '%s\n' "$info_out" >&2
+  exit 1
+}
+
+i=0
+while :; do
+  ./ptyterm --recv --recv-size=2000000 --recv-format=raw --recv-control=with --session=1 --socket="$sock" >>"$tmpdir/received" 2>"$tmpdir/recv.err" || {
+    echo "ptyterm --recv for history: expected success" >&2
+    cat "$tmpdir/recv.err" >&2
+    exit 1
+  }
+  grep -q '^line-199999$' "$tmpdir/received" && break
+  i=$((i + 1))
+  if [ "$i" -ge 50 ]; then
+    echo "ptyterm --recv for history: expected the last line" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+cmp "$tmpdir/expected" "$tmpdir/received" || {
+  echo "ptyterm --recv for history: expected the whole stream from offset 0" >&2
+  exit 1
+}
+
+if grep -q 'truncated=yes' "$tmpdir/recv.err"; then
+  echo "ptyterm --recv for history: unexpected truncation" >&2
+  cat "$tmpdir/recv.err" >&2
+  exit 1
+fi
+
+# Only the segment being filled stays mapped; full ones are read back
+# with pread().
+mapped=$(grep -c "ptytermd-$daemon_pid-1-" "/proc/$daemon_pid/maps" || true)
+[ "$mapped" -le 1 ] || {
+  echo "ptytermd --history-dir: expected at most one mapped segment, got $mapped" >&2
+  exit 1
+}
+
+stop_out=$(./ptyterm --daemon-stop --socket="$sock" 2>&1) || {
+  echo "ptyterm --daemon-stop for history: expected success" >&2
+  printf '%s\n' "$stop_out" >&2
+  exit 1
+}
+
+i=0
+while kill -0 "$daemon_pid" 2>/dev/null; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd --history-dir: expected daemon to exit after stop" >&2
+    exit 1
+  fi
+  sleep 1
+done
+history_pid=$daemon_pid
+daemon_pid=
+
+# At shutdown the ring is flushed too, so the segments hold the full stream.
+cat "$tmpdir/history/ptytermd-$history_pid-1-"*.* >"$tmpdir/history.out"
+cmp "$tmpdir/expected" "$tmpdir/history.out" || {
+  echo "ptytermd --history-dir: expected segment files to hold the stream" >&2
+  ls -l "$tmpdir/history" >&2
+  exit 1
+}
@@ -0,0 +1,82 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-many-sessions.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+n=0
+while [ "$n" -lt 40 ]; do
+  n=$((n + 1))
+  create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'sleep 30' 2>&1) || {
+    echo "ptyterm --create #$n: expected success beyond the old 32-session limit" >&2
+    printf '%s\n' "$create_out" >&2
+    exit 1
+  }
+  printf '%s\n' "$create_out" | grep -q "^session_id=$n\$" || {
+    echo "ptyterm --create #$n: expected sequential session id" >&2
+    printf '%s\n' "$create_out" >&2
+    exit 1
+  }
+done
+
+list_out=$(./ptyterm --list --socket="$sock" 2>&1) || {
+  echo "ptyterm --list with many sessions: expected success" >&2
+  printf '%s\n' "$list_out" >&2
+  exit 1
+}
+
+count=$(printf '%s\n' "$list_out" | grep -c '	detached	' || true)
+[ "$count" -eq 40 ] || {
+  echo "ptyterm --list with many sessions: expected 40 entries, got $count" >&2
+  printf '%s\n' "$list_out" >&2
+  exit 1
+}
+
+list_out=$(./ptyterm --list --session=37 --socket="$sock" 2>&1) || {
+  echo "ptyterm --list --session=37: expected success" >&2
+  printf '%s\n' "$list_out" >&2
+  exit 1
+}
+
+printf '%s\n' "$list_out" | grep -q '^37	detached	' || {
+  echo "ptyterm --list --session=37: expected single session entry" >&2
+  printf '%s\n' "$list_out" >&2
+  exit 1
+}
+
+buffer_out=$(./ptyterm --buffer-info --session=40 --socket="$sock" 2>&1) || {
+  echo "ptyterm --buffer-info --session=40: expected success" >&2
+  printf '%s\n' "$buffer_out" >&2
+  exit 1
+}
+
+printf '%s\n' "$buffer_out" | grep -q '^id=40$' || {
+  echo "ptyterm --buffer-info --session=40: expected session id" >&2
+  printf '%s\n' "$buffer_out" >&2
+  exit 1
+}
@@ -0,0 +1,183 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-memory-limit.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" --output-buffer=64K --memory-limit=200K >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+# status_value KEY: prints KEY from --daemon-status.
+status_value() {
+  ./ptyterm --daemon-status --status-format=kv --socket="$sock" | sed -n "s/^$1=//p"
+}
+
+# capacity ID: prints the ring capacity of session ID.
+capacity() {
+  ./ptyterm --buffer-info --session="$1" --status-format=kv --socket="$sock" | sed -n 's/^buffer_capacity=//p'
+}
+
+[ "$(status_value memory_limit)" = 204800 ] || {
+  echo "ptyterm --daemon-status: expected memory_limit=204800" >&2
+  exit 1
+}
+[ "$(status_value memory_used)" = 0 ] || {
+  echo "ptyterm --daemon-status: expected memory_used=0 without sessions" >&2
+  exit 1
+}
+
+# Silent sessions keep their creation order as their activity order.
+for n in 1 2; do
+  ./ptyterm --create --socket="$sock" /bin/sh -c 'sleep 30' >/dev/null 2>&1 || {
+    echo "ptyterm --create $n: expected success" >&2
+    exit 1
+  }
+  sleep 0.1
+done
+[ "$(status_value ring_bytes)" = 131072 ] || {
+  echo "ptyterm --daemon-status: expected ring_bytes=131072" >&2
+  exit 1
+}
+[ "$(status_value trimmed_bytes)" = 0 ] || {
+  echo "ptyterm --daemon-status: expected nothing trimmed yet" >&2
+  exit 1
+}
+
+# The third session does not fit until the least recently active ring gives
+# up some of its capacity.
+./ptyterm --create --socket="$sock" /bin/sh -c 'sleep 30' >/dev/null 2>&1 || {
+  echo "ptyterm --create 3: expected success" >&2
+  exit 1
+}
+[ "$(capacity 1)" -lt 65536 ] || {
+  echo "memory limit: expected session 1 to be trimmed" >&2
+  exit 1
+}
+[ "$(capacity 2)" = 65536 ] && [ "$(capacity 3)" = 65536 ] || {
+  echo "memory limit: expected sessions 2 and 3 untouched" >&2
+  exit 1
+}
+used=$(status_value memory_used)
+[ "$used" -le 204800 ] || {
+  echo "memory limit: memory_used=$used is over the limit" >&2
+  exit 1
+}
+[ "$(status_value trimmed_bytes)" -eq $((65536 - $(capacity 1))) ] || {
+  echo "memory limit: trimmed_bytes does not match the trimmed ring" >&2
+  exit 1
+}
+
+# Requests that cannot fit fail without trimming anything.
+if ./ptyterm --resize-buffer=1M --session=3 --socket="$sock" >/dev/null 2>"$tmpdir/resize.err"; then
+  echo "ptyterm --resize-buffer=1M: expected failure" >&2
+  exit 1
+fi
+grep -q 'memory limit reached' "$tmpdir/resize.err" || {
+  echo "ptyterm --resize-buffer=1M: expected memory limit reached" >&2
+  cat "$tmpdir/resize.err" >&2
+  exit 1
+}
+if ./ptyterm --create --buffer-size=1M --socket="$sock" /bin/true >/dev/null 2>"$tmpdir/create.err"; then
+  echo "ptyterm --create --buffer-size=1M: expected failure" >&2
+  exit 1
+fi
+grep -q 'memory limit reached' "$tmpdir/create.err" || {
+  echo "ptyterm --create --buffer-size=1M: expected memory limit reached" >&2
+  cat "$tmpdir/create.err" >&2
+  exit 1
+}
+[ "$(capacity 2)" = 65536 ] || {
+  echo "memory limit: a failed request trimmed session 2" >&2
+  exit 1
+}
+
+# A request that fits after trimming takes from the idle sessions.
+./ptyterm --resize-buffer=100K --session=3 --socket="$sock" >/dev/null || {
+  echo "ptyterm --resize-buffer=100K: expected success" >&2
+  exit 1
+}
+[ "$(capacity 3)" = 102400 ] || {
+  echo "ptyterm --resize-buffer=100K: expected buffer_capacity=102400" >&2
+  exit 1
+}
+used=$(status_value memory_used)
+[ "$used" -le 204800 ] || {
+  echo "memory limit: memory_used=$used is over the limit after resize" >&2
+  exit 1
+}
+
+# Output is charged as it arrives: past the limit, a session gives up its
+# oldest compressed history blocks.
+kill "$daemon_pid"
+wait "$daemon_pid" 2>/dev/null || true
+daemon_pid=
+rm -f "$sock"
+./ptytermd --socket="$sock" --output-buffer=64K --memory-limit=1M --compressed-history >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd --compressed-history did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+./ptyterm --create --socket="$sock" /bin/sh -c 'stty -onlcr; awk "BEGIN { srand(1); for (i = 0; i < 300000; i++) print i, rand() }"; echo output-done; sleep 30' >/dev/null 2>&1 || {
+  echo "ptyterm --create with compressed history: expected success" >&2
+  exit 1
+}
+
+i=0
+while :; do
+  ./ptyterm --recv --peek --recv-size=64 --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/history.out" 2>"$tmpdir/history.err" || {
+    echo "ptyterm --recv with compressed history: expected success" >&2
+    cat "$tmpdir/history.err" >&2
+    exit 1
+  }
+  [ "$(status_value history_bytes)" -gt 0 ] &&
+    ./ptyterm --recv --peek --recv-lines=-1 --recv-format=raw --session=1 --socket="$sock" 2>/dev/null | grep -q '^output-done' && break
+  i=$((i + 1))
+  if [ "$i" -ge 100 ]; then
+    echo "ptyterm --recv with compressed history: expected the output to end" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+used=$(status_value memory_used)
+[ "$used" -le 1048576 ] || {
+  echo "memory limit: memory_used=$used is over the limit with compressed history" >&2
+  ./ptyterm --daemon-status --status-format=kv --socket="$sock" >&2
+  exit 1
+}
+grep -q 'truncated=yes' "$tmpdir/history.err" || {
+  echo "memory limit: expected the oldest history dropped" >&2
+  cat "$tmpdir/history.err" >&2
+  exit 1
+}
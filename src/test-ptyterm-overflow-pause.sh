@@ -0,0 +1,214 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-overflow-pause.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+attach_pid=
+
+cleanup() {
+  if [ -n "${attach_pid}" ] && kill -0 "$attach_pid" 2>/dev/null; then
+    kill "$attach_pid" 2>/dev/null || true
+    wait "$attach_pid" 2>/dev/null || true
+  fi
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" --output-buffer=64 --overflow=pause >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'stty -onlcr; i=0; while [ $i -lt 40 ]; do echo "line-$i"; i=$((i + 1)); done; sleep 30' 2>&1) || {
+  echo "ptyterm --create for overflow pause: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+sleep 1
+
+info_out=$(./ptyterm --buffer-info --session=1 --socket="$sock" --status-format=kv 2>&1) || {
+  echo "ptyterm --buffer-info under pause: expected success" >&2
+  printf '%s\n' "$info_out" >&2
+  exit 1
+}
+
+for expected in 'buffer_used=64' 'dropped_bytes=0' 'paused_on_full=1'; do
+  printf '%s\n' "$info_out" | grep -q "^$expected\$" || {
+    echo "ptyterm --buffer-info under pause: expected $expected" >&2
+    printf '%s\n' "$info_out" >&2
+    exit 1
+  }
+done
+
+# Each recv frees ring space and lets the daemon read more; nothing may be
+# lost along the way.
+: >"$tmpdir/received"
+i=0
+while [ "$i" -lt 40 ]; do
+  ./ptyterm --recv --recv-size=64 --recv-format=raw --recv-control=with --session=1 --socket="$sock" >>"$tmpdir/received" 2>/dev/null || {
+    echo "ptyterm --recv under pause: expected success" >&2
+    exit 1
+  }
+  grep -q '^line-39$' "$tmpdir/received" && break
+  i=$((i + 1))
+  sleep 0.2
+done
+
+i=0
+: >"$tmpdir/expected"
+while [ "$i" -lt 40 ]; do
+  echo "line-$i" >>"$tmpdir/expected"
+  i=$((i + 1))
+done
+
+cmp "$tmpdir/expected" "$tmpdir/received" || {
+  echo "ptyterm --recv under pause: expected every line exactly once" >&2
+  cat "$tmpdir/received" >&2
+  exit 1
+}
+
+info_out=$(./ptyterm --buffer-info --session=1 --socket="$sock" --status-format=kv 2>&1) || {
+  echo "ptyterm --buffer-info after draining: expected success" >&2
+  printf '%s\n' "$info_out" >&2
+  exit 1
+}
+
+printf '%s\n' "$info_out" | grep -q '^paused_on_full=0$' || {
+  echo "ptyterm --buffer-info after draining: expected paused_on_full=0" >&2
+  printf '%s\n' "$info_out" >&2
+  exit 1
+}
+
+# An attached client keeps the master flowing; output the recv cursor never
+# got is then reported as dropped rather than lost silently.
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'stty -onlcr; sleep 2; i=0; while [ $i -lt 40 ]; do echo "line-$i"; i=$((i + 1)); done; sleep 30' 2>&1) || {
+  echo "ptyterm --create for attached overflow pause: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+./ptyterm --attach --session=2 --socket="$sock" </dev/null >/dev/null 2>"$tmpdir/attach.err" &
+attach_pid=$!
+
+sleep 4
+
+info_out=$(./ptyterm --buffer-info --session=2 --socket="$sock" --status-format=kv 2>&1) || {
+  echo "ptyterm --buffer-info while attached under pause: expected success" >&2
+  printf '%s\n' "$info_out" >&2
+  exit 1
+}
+kill "$attach_pid" 2>/dev/null || true
+wait "$attach_pid" 2>/dev/null || true
+attach_pid=
+
+for expected in 'buffer_used=64' 'paused_on_full=0'; do
+  printf '%s\n' "$info_out" | grep -q "^$expected\$" || {
+    echo "ptyterm --buffer-info while attached under pause: expected $expected" >&2
+    printf '%s\n' "$info_out" >&2
+    exit 1
+  }
+done
+
+printf '%s\n' "$info_out" | grep -q '^dropped_bytes=[1-9]' || {
+  echo "ptyterm --buffer-info while attached under pause: expected dropped bytes" >&2
+  printf '%s\n' "$info_out" >&2
+  exit 1
+}
+
+# A named cursor holds a paused session back until it is deleted or has
+# gone unused for --cursor-idle.
+kill "$daemon_pid"
+wait "$daemon_pid" 2>/dev/null || true
+daemon_pid=
+rm -f "$sock"
+./ptytermd --socket="$sock" --output-buffer=64 --overflow=pause --cursor-idle=5s >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd --cursor-idle did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+# drain_session ID: receives on the default cursor into $tmpdir/received
+# until line-39 arrives and checks that every line came through once.
+drain_session() {
+  i=0
+  while [ "$i" -lt 100 ]; do
+    ./ptyterm --recv --recv-size=64 --recv-format=raw --recv-control=with --session="$1" --socket="$sock" >>"$tmpdir/received" 2>/dev/null || {
+      echo "ptyterm --recv from session $1 with a named cursor: expected success" >&2
+      exit 1
+    }
+    grep -q '^line-39$' "$tmpdir/received" && break
+    i=$((i + 1))
+    sleep 0.2
+  done
+  cmp "$tmpdir/expected" "$tmpdir/received" || {
+    echo "ptyterm --recv from session $1 with a named cursor: expected every line exactly once" >&2
+    cat "$tmpdir/received" >&2
+    exit 1
+  }
+}
+
+n=1
+while [ "$n" -le 2 ]; do
+  ./ptyterm --create --socket="$sock" /bin/sh -c 'stty -onlcr; sleep 1; i=0; while [ $i -lt 40 ]; do echo "line-$i"; i=$((i + 1)); done; sleep 30' >/dev/null 2>&1 || {
+    echo "ptyterm --create #$n for named cursors under pause: expected success" >&2
+    exit 1
+  }
+  ./ptyterm --recv --recv-cursor=stale --recv-size=1 --session="$n" --socket="$sock" >/dev/null 2>&1 || {
+    echo "ptyterm --recv --recv-cursor=stale on session $n: expected success" >&2
+    exit 1
+  }
+  n=$((n + 1))
+done
+
+sleep 1.5
+./ptyterm --recv --recv-size=64 --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/received" 2>/dev/null
+info_out=$(./ptyterm --buffer-info --session=1 --socket="$sock" --status-format=kv 2>&1)
+printf '%s\n' "$info_out" | grep -q '^paused_on_full=1$' || {
+  echo "ptyterm --buffer-info with an unread named cursor: expected paused_on_full=1" >&2
+  printf '%s\n' "$info_out" >&2
+  exit 1
+}
+
+./ptyterm --cursor-delete=stale --session=1 --socket="$sock" >/dev/null 2>&1 || {
+  echo "ptyterm --cursor-delete: expected success" >&2
+  exit 1
+}
+out=$(./ptyterm --cursor-delete=stale --session=1 --socket="$sock" 2>&1) && {
+  echo "ptyterm --cursor-delete of a deleted cursor: expected failure" >&2
+  exit 1
+}
+printf '%s\n' "$out" | grep -q 'cursor not found' || {
+  echo "ptyterm --cursor-delete of a deleted cursor: expected cursor not found" >&2
+  printf '%s\n' "$out" >&2
+  exit 1
+}
+drain_session 1
+
+# Session 2 still has its cursor, which goes idle while the default one
+# drains.
+: >"$tmpdir/received"
+drain_session 2
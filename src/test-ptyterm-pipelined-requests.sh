@@ -0,0 +1,78 @@
+#!/bin/sh
+set -eu
+
+command -v perl >/dev/null 2>&1 || exit 77
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-pipelined-requests.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'sleep 30' 2>&1) || {
+  echo "ptyterm --create for pipelined requests: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+# Write several requests in one burst on one connection, half-close it and
+# print "type request_id" for every reply.
+out=$(timeout 10 perl -MIO::Socket::UNIX -MSocket -e '
+  my $s = IO::Socket::UNIX->new(Peer => $ARGV[0]) or die "connect: $!\n";
+  sub frame {
+    my ($type, $id, $payload) = @_;
+    return pack("VvvVV", 0x50545953, 2, $type, length($payload), $id) . $payload;
+  }
+  syswrite($s, frame(18, 7, "") . frame(1, 8, pack("l<", -1)) .
+               frame(3, 9, pack("l<", 99)) . frame(3, 10, pack("l<", 1)));
+  shutdown($s, SHUT_WR);
+  while (1) {
+    my $header = "";
+    while (length($header) < 16) {
+      my $n = sysread($s, $header, 16 - length($header), length($header));
+      exit 0 if !$n;
+    }
+    my (undef, undef, $type, $size, $id) = unpack("VvvVV", $header);
+    my $payload = "";
+    while (length($payload) < $size) {
+      my $n = sysread($s, $payload, $size - length($payload),
+                      length($payload));
+      die "short payload\n" if !$n;
+    }
+    print "$type $id\n";
+  }
+' "$sock" 2>&1) || {
+  echo "pipelined requests: expected replies" >&2
+  printf '%s\n' "$out" >&2
+  exit 1
+}
+
+expected=$(printf '19 7\n2 8\n5 9\n4 10')
+[ "$out" = "$expected" ] || {
+  echo "pipelined requests: expected in-order replies with request ids" >&2
+  printf '%s\n' "$out" >&2
+  exit 1
+}
+
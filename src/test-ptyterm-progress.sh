@@ -0,0 +1,114 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-progress.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" --output-buffer=4096 --coalesce-progress >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+# Two progress bars of 2000 frames each, about 40 KB of redraws in all,
+# around ordinary lines.  Only the first and last frame of each bar should
+# reach the 4 KiB ring.
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'stty -onlcr; awk "BEGIN { print \"fetching\"; printf \"0%%\"; for (i = 1; i <= 2000; i++) printf \"\\rdownloaded %d of 2000\", i; printf \"\\r\\n\"; print \"unpacking\"; for (i = 1; i <= 2000; i++) printf \"\\r[%d]\", i; print \"\"; print \"done\" }"; sleep 30' 2>&1) || {
+  echo "ptyterm --create for progress: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+printf 'fetching\n0%%\rdownloaded 2000 of 2000\r\nunpacking\n\r[2000]\ndone\n' >"$tmpdir/expected"
+
+i=0
+while :; do
+  ./ptyterm --recv --peek --recv-size=8192 --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/received" 2>"$tmpdir/recv.err" || {
+    echo "ptyterm --recv for progress: expected success" >&2
+    cat "$tmpdir/recv.err" >&2
+    exit 1
+  }
+  grep -q '^done$' "$tmpdir/received" && break
+  i=$((i + 1))
+  if [ "$i" -ge 100 ]; then
+    echo "ptyterm --recv for progress: expected the last line" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+cmp "$tmpdir/expected" "$tmpdir/received" || {
+  echo "ptytermd --coalesce-progress: expected only the first and last frames" >&2
+  od -c "$tmpdir/received" | head -20 >&2
+  exit 1
+}
+
+info_out=$(./ptyterm --buffer-info --session=1 --socket="$sock" --status-format=kv 2>&1)
+printf '%s\n' "$info_out" | grep -q '^dropped_bytes=0$' || {
+  echo "ptyterm --buffer-info for progress: expected no dropped bytes" >&2
+  printf '%s\n' "$info_out" >&2
+  exit 1
+}
+
+# The screen is fed the raw stream and shows the last frame in place.
+./ptyterm --snapshot --session=1 --socket="$sock" >"$tmpdir/snapshot" 2>&1 || {
+  echo "ptyterm --snapshot for progress: expected success" >&2
+  cat "$tmpdir/snapshot" >&2
+  exit 1
+}
+grep -q 'downloaded 2000 of 2000' "$tmpdir/snapshot" || {
+  echo "ptyterm --snapshot for progress: expected the last frame on screen" >&2
+  cat "$tmpdir/snapshot" >&2
+  exit 1
+}
+
+# A screen copy is not taken while a frame is held back: replaying from
+# one would draw the frame twice.  Here a 120-column frame wraps, so a
+# second pass would push "after" down a row.
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'awk "BEGIN { for (i = 0; i < 20; i++) printf \"filler line %02d ..................................................\\n\", i; printf \"50%%\\r\"; for (i = 0; i < 120; i++) printf \"x\" }"; sleep 2; printf "\nafter\n"; sleep 2; echo more; sleep 30' 2>&1) || {
+  echo "ptyterm --create for progress replay: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+i=0
+until ./ptyterm --snapshot --session=2 --socket="$sock" 2>/dev/null | grep -q '^more$'; do
+  i=$((i + 1))
+  if [ "$i" -ge 100 ]; then
+    echo "ptyterm --snapshot for progress replay: expected the last line" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+./ptyterm --snapshot --before=1s --session=2 --socket="$sock" >"$tmpdir/replay" 2>&1 || {
+  echo "ptyterm --snapshot --before for progress replay: expected success" >&2
+  cat "$tmpdir/replay" >&2
+  exit 1
+}
+grep -q '^after$' "$tmpdir/replay" && ! grep -q '^more$' "$tmpdir/replay" &&
+  [ "$(grep -c '^x\{80\}$' "$tmpdir/replay")" -eq 1 ] &&
+  grep -A1 '^x\{40\}$' "$tmpdir/replay" | grep -q '^after$' || {
+  echo "ptyterm --snapshot --before for progress replay: expected the frame drawn once" >&2
+  cat "$tmpdir/replay" >&2
+  exit 1
+}
@@ -0,0 +1,103 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-recv-cursors.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+
+if ./ptyterm --recv-cursor=logs --session=1 --socket="$sock" >/dev/null 2>&1; then
+  echo "ptyterm --recv-cursor without --recv: expected failure" >&2
+  exit 1
+fi
+
+if ./ptyterm --recv --recv-cursor=0123456789012345678901234567890123456789 --session=1 --socket="$sock" >/dev/null 2>&1; then
+  echo "ptyterm --recv-cursor with a long name: expected failure" >&2
+  exit 1
+fi
+
+./ptytermd --socket="$sock" >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'stty -echo -onlcr; echo alpha; echo beta; exec cat' 2>&1) || {
+  echo "ptyterm --create for recv cursors: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+./ptyterm --recv --recv-until=beta --recv-timeout=5s --peek --session=1 --socket="$sock" >/dev/null 2>&1 || {
+  echo "ptyterm --recv --peek for recv cursors: expected initial output" >&2
+  exit 1
+}
+
+# recv_as NAME SIZE: reads through cursor NAME into $tmpdir/NAME.out and
+# leaves its status line in $tmpdir/NAME.err.
+recv_as() {
+  ./ptyterm --recv --recv-cursor="$1" --recv-size="$2" --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/$1.out" 2>"$tmpdir/$1.err" || {
+    echo "ptyterm --recv --recv-cursor=$1: expected success" >&2
+    cat "$tmpdir/$1.err" >&2
+    exit 1
+  }
+}
+
+expect_recv() {
+  printf "$2" >"$tmpdir/expected"
+  cmp "$tmpdir/expected" "$tmpdir/$1.out" || {
+    echo "ptyterm --recv --recv-cursor=$1: unexpected payload" >&2
+    cat "$tmpdir/$1.out" >&2
+    exit 1
+  }
+  grep -q "$3" "$tmpdir/$1.err" || {
+    echo "ptyterm --recv --recv-cursor=$1: expected status $3" >&2
+    cat "$tmpdir/$1.err" >&2
+    exit 1
+  }
+}
+
+recv_as logs 4096
+expect_recv logs 'alpha\nbeta\n' 'next-offset=11; lag=0; truncated=no'
+
+recv_as llm 6
+expect_recv llm 'alpha\n' 'next-offset=6; lag=5; truncated=no'
+
+./ptyterm --recv --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/default.out" 2>"$tmpdir/default.err" || {
+  echo "ptyterm --recv on the default cursor: expected success" >&2
+  exit 1
+}
+expect_recv default 'alpha\nbeta\n' 'next-offset=11; lag=0'
+
+./ptyterm --send='gamma\n' --session=1 --socket="$sock" >/dev/null 2>&1 || {
+  echo "ptyterm --send for recv cursors: expected success" >&2
+  exit 1
+}
+./ptyterm --recv --recv-cursor=logs --recv-until=gamma --recv-timeout=5s --peek --session=1 --socket="$sock" >/dev/null 2>&1 || {
+  echo "ptyterm --recv --peek for recv cursors: expected echoed line" >&2
+  exit 1
+}
+
+recv_as logs 4096
+expect_recv logs 'gamma\n' 'next-offset=17; lag=0'
+
+recv_as llm 4096
+expect_recv llm 'beta\ngamma\n' 'next-offset=17; lag=0'
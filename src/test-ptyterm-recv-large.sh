@@ -0,0 +1,78 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-recv-large.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" --output-buffer=1M >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+# 20000 lines of 11 bytes are 220000 bytes, several recv chunks' worth.
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'stty -onlcr; i=10000; while [ $i -lt 30000 ]; do echo "line-$i"; i=$((i + 1)); done; echo done-marker; sleep 30' 2>&1) || {
+  echo "ptyterm --create for large recv: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+i=0
+while :; do
+  info_out=$(./ptyterm --buffer-info --session=1 --socket="$sock" --status-format=kv 2>&1) || {
+    echo "ptyterm --buffer-info for large recv: expected success" >&2
+    printf '%s\n' "$info_out" >&2
+    exit 1
+  }
+  printf '%s\n' "$info_out" | grep -q '^buffer_used=220012$' && break
+  i=$((i + 1))
+  if [ "$i" -ge 100 ]; then
+    echo "ptyterm --buffer-info for large recv: expected all output buffered" >&2
+    printf '%s\n' "$info_out" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+./ptyterm --recv --recv-size=4294967295 --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/received" 2>"$tmpdir/recv.err" || {
+  echo "ptyterm --recv with a huge size: expected success" >&2
+  cat "$tmpdir/recv.err" >&2
+  exit 1
+}
+
+i=10000
+while [ "$i" -lt 30000 ]; do
+  echo "line-$i"
+  i=$((i + 1))
+done >"$tmpdir/expected"
+echo done-marker >>"$tmpdir/expected"
+
+cmp "$tmpdir/expected" "$tmpdir/received" || {
+  echo "ptyterm --recv with a huge size: expected all output in order" >&2
+  exit 1
+}
+
+grep -q '^recv 220012 bytes; offsets 0\.\.220012; next-offset=220012; lag=0; truncated=no; reason=ok$' "$tmpdir/recv.err" || {
+  echo "ptyterm --recv with a huge size: expected one status line for all chunks" >&2
+  cat "$tmpdir/recv.err" >&2
+  exit 1
+}
@@ -0,0 +1,109 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-recv-lines.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" --output-buffer=100 >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+if ./ptyterm --from-line=1 --session=1 --socket="$sock" >/dev/null 2>&1; then
+  echo "ptyterm --from-line without --recv: expected failure" >&2
+  exit 1
+fi
+
+if ./ptyterm --recv --recv-lines=-2 --from-line=1 --session=1 --socket="$sock" >/dev/null 2>&1; then
+  echo "ptyterm --recv with two line starts: expected failure" >&2
+  exit 1
+fi
+
+if ./ptyterm --recv --from-line=0 --session=1 --socket="$sock" >/dev/null 2>&1; then
+  echo "ptyterm --recv --from-line=0: expected failure" >&2
+  exit 1
+fi
+
+# 2000 lines of 10 bytes each leave the last 10 in the 100-byte ring.
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'stty -onlcr; i=1000; while [ $i -lt 3000 ]; do echo "line-$i"; i=$((i + 1)); done; sleep 30' 2>&1) || {
+  echo "ptyterm --create for recv lines: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+i=0
+while :; do
+  info_out=$(./ptyterm --buffer-info --session=1 --socket="$sock" --status-format=kv 2>&1) || {
+    echo "ptyterm --buffer-info for recv lines: expected success" >&2
+    printf '%s\n' "$info_out" >&2
+    exit 1
+  }
+  printf '%s\n' "$info_out" | grep -q '^dropped_bytes=19900$' && break
+  i=$((i + 1))
+  if [ "$i" -ge 50 ]; then
+    echo "ptyterm --buffer-info for recv lines: expected dropped_bytes=19900" >&2
+    printf '%s\n' "$info_out" >&2
+    exit 1
+  fi
+  sleep 0.2
+done
+
+# recv_lines NAME OPTIONS...: reads with the given line options into
+# $tmpdir/NAME.out and leaves the status line in $tmpdir/NAME.err.
+recv_lines() {
+  name=$1
+  shift
+  ./ptyterm --recv "$@" --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/$name.out" 2>"$tmpdir/$name.err" || {
+    echo "ptyterm --recv $*: expected success" >&2
+    cat "$tmpdir/$name.err" >&2
+    exit 1
+  }
+}
+
+expect_recv() {
+  printf "$2" >"$tmpdir/expected"
+  cmp "$tmpdir/expected" "$tmpdir/$1.out" || {
+    echo "ptyterm --recv ($1): unexpected payload" >&2
+    cat "$tmpdir/$1.out" >&2
+    exit 1
+  }
+  grep -q "$3" "$tmpdir/$1.err" || {
+    echo "ptyterm --recv ($1): expected status $3" >&2
+    cat "$tmpdir/$1.err" >&2
+    exit 1
+  }
+}
+
+recv_lines last --recv-lines=-3
+expect_recv last 'line-2997\nline-2998\nline-2999\n' 'offsets 19970..20000; next-offset=0; .*truncated=no'
+
+recv_lines from --from-line=1996
+expect_recv from 'line-2995\nline-2996\nline-2997\nline-2998\nline-2999\n' 'offsets 19950..20000; .*truncated=no'
+
+recv_lines dropped --from-line=1
+expect_recv dropped 'line-2990\nline-2991\nline-2992\nline-2993\nline-2994\nline-2995\nline-2996\nline-2997\nline-2998\nline-2999\n' 'offsets 19900..20000; .*truncated=yes'
+
+recv_lines first --recv-lines=2
+expect_recv first 'line-2990\nline-2991\n' 'next-offset=19920; .*reason=lines_reached'
+
+recv_lines second --recv-lines=2
+expect_recv second 'line-2992\nline-2993\n' 'next-offset=19940; .*truncated=no; reason=lines_reached'
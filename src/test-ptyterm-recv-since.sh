@@ -0,0 +1,165 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-recv-since.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+
+if ./ptyterm --since=1s --session=1 --socket="$sock" >/dev/null 2>&1; then
+  echo "ptyterm --since without --recv: expected failure" >&2
+  exit 1
+fi
+
+if ./ptyterm --recv --since=1s --recv-until=x --session=1 --socket="$sock" >/dev/null 2>&1; then
+  echo "ptyterm --recv --since with --recv-until: expected failure" >&2
+  exit 1
+fi
+
+if ./ptyterm --recv --since=1s --before=2s --session=1 --socket="$sock" >/dev/null 2>&1; then
+  echo "ptyterm --recv with an empty time range: expected failure" >&2
+  exit 1
+fi
+
+./ptytermd --socket="$sock" >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'stty -echo -onlcr; echo older; sleep 2; echo newer; exec cat' 2>&1) || {
+  echo "ptyterm --create for recv time ranges: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+./ptyterm --recv --recv-until=newer --recv-timeout=5s --peek --session=1 --socket="$sock" >/dev/null 2>&1 || {
+  echo "ptyterm --recv --peek for recv time ranges: expected both lines" >&2
+  exit 1
+}
+
+# recv_range NAME OPTIONS...: reads with the given range options into
+# $tmpdir/NAME.out and leaves the status line in $tmpdir/NAME.err.
+recv_range() {
+  name=$1
+  shift
+  ./ptyterm --recv "$@" --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/$name.out" 2>"$tmpdir/$name.err" || {
+    echo "ptyterm --recv $*: expected success" >&2
+    cat "$tmpdir/$name.err" >&2
+    exit 1
+  }
+}
+
+expect_recv() {
+  printf "$2" >"$tmpdir/expected"
+  cmp "$tmpdir/expected" "$tmpdir/$1.out" || {
+    echo "ptyterm --recv ($1): unexpected payload" >&2
+    cat "$tmpdir/$1.out" >&2
+    exit 1
+  }
+  grep -q "$3" "$tmpdir/$1.err" || {
+    echo "ptyterm --recv ($1): expected status $3" >&2
+    cat "$tmpdir/$1.err" >&2
+    exit 1
+  }
+}
+
+recv_range since --since=1s
+expect_recv since 'newer\n' 'offsets 6..12; next-offset=0; lag=12'
+
+recv_range before --before=1s
+expect_recv before 'older\n' 'offsets 0..6; next-offset=6; lag=6; .*reason=range_end'
+
+recv_range rest
+expect_recv rest 'newer\n' 'offsets 6..12; next-offset=12; lag=0'
+
+./ptyterm --snapshot --before=1s --session=1 --socket="$sock" >"$tmpdir/snapshot.out" 2>&1 || {
+  echo "ptyterm --snapshot --before: expected success" >&2
+  cat "$tmpdir/snapshot.out" >&2
+  exit 1
+}
+grep -q 'older' "$tmpdir/snapshot.out" && ! grep -q 'newer' "$tmpdir/snapshot.out" || {
+  echo "ptyterm --snapshot --before: expected the screen before the second line" >&2
+  cat "$tmpdir/snapshot.out" >&2
+  exit 1
+}
+
+./ptyterm --snapshot --session=1 --socket="$sock" >"$tmpdir/snapshot.out" 2>&1 || {
+  echo "ptyterm --snapshot: expected success" >&2
+  exit 1
+}
+grep -q 'newer' "$tmpdir/snapshot.out" || {
+  echo "ptyterm --snapshot: expected the current screen" >&2
+  cat "$tmpdir/snapshot.out" >&2
+  exit 1
+}
+
+# A past screen is rebuilt from a screen checkpoint, so it survives the
+# ring dropping the start of the stream, and keeps the size it had then.
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'stty -echo; i=0; while [ $i -lt 200 ]; do echo "filler-line-$i-xxxxxxxxxxxxxxxxxxxx"; i=$((i + 1)); done; echo marker-old; sleep 2; echo marker-mid; sleep 2; echo marker-new; exec cat' 2>&1) || {
+  echo "ptyterm --create for replay checkpoints: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+# wait_screen TEXT: waits for TEXT to show on the current screen.
+wait_screen() {
+  i=0
+  until ./ptyterm --snapshot --session=2 --socket="$sock" 2>/dev/null | grep -q "^$1\$"; do
+    i=$((i + 1))
+    if [ "$i" -ge 50 ]; then
+      echo "ptyterm --snapshot for replay checkpoints: expected $1" >&2
+      exit 1
+    fi
+    sleep 0.1
+  done
+}
+
+wait_screen marker-mid
+./ptyterm --resize --rows=30 --cols=100 --session=2 --socket="$sock" >/dev/null 2>&1 || {
+  echo "ptyterm --resize for replay checkpoints: expected success" >&2
+  exit 1
+}
+wait_screen marker-new
+
+./ptyterm --snapshot --before=3s --session=2 --socket="$sock" >"$tmpdir/early.out" 2>&1 || {
+  echo "ptyterm --snapshot --before after the ring wrapped: expected success" >&2
+  cat "$tmpdir/early.out" >&2
+  exit 1
+}
+grep -q '^rows: 24$' "$tmpdir/early.out" && grep -q '^marker-old$' "$tmpdir/early.out" &&
+  ! grep -q 'marker-mid' "$tmpdir/early.out" || {
+  echo "ptyterm --snapshot --before=3s: expected the 24-row screen before marker-mid" >&2
+  cat "$tmpdir/early.out" >&2
+  exit 1
+}
+
+./ptyterm --snapshot --before=1s --session=2 --socket="$sock" >"$tmpdir/late.out" 2>&1 || {
+  echo "ptyterm --snapshot --before after a resize: expected success" >&2
+  cat "$tmpdir/late.out" >&2
+  exit 1
+}
+grep -q '^rows: 30$' "$tmpdir/late.out" && grep -q '^marker-mid$' "$tmpdir/late.out" &&
+  ! grep -q 'marker-new' "$tmpdir/late.out" || {
+  echo "ptyterm --snapshot --before=1s: expected the resized screen before marker-new" >&2
+  cat "$tmpdir/late.out" >&2
+  exit 1
+}
@@ -0,0 +1,114 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-recv-until.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+
+long=$(printf '%0300d' 0)
+if ./ptyterm --recv --recv-until="$long" --session=1 --socket="$sock" >/dev/null 2>"$tmpdir/long.err"; then
+  echo "ptyterm --recv-until with a long pattern: expected failure" >&2
+  exit 1
+fi
+grep -q 'recv-until is longer than 256 bytes' "$tmpdir/long.err" || {
+  echo "ptyterm --recv-until with a long pattern: expected validation error" >&2
+  cat "$tmpdir/long.err" >&2
+  exit 1
+}
+
+# Sessions are owned by worker threads, so a match is reported to the main
+# loop from another thread.
+./ptytermd --socket="$sock" --threads=2 >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'stty raw -echo; exec cat' 2>&1) || {
+  echo "ptyterm --create for recv until: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+# The pattern arrives in two pieces, so it spans two reads of the master.
+(
+  sleep 1
+  ./ptyterm --send='xxab' --session=1 --socket="$sock" >/dev/null 2>&1
+  sleep 1
+  ./ptyterm --send='cdyy' --session=1 --socket="$sock" >/dev/null 2>&1
+) &
+sender_pid=$!
+
+./ptyterm --recv --recv-until=abcd --recv-timeout=10s --recv-format=raw --session=1 --socket="$sock" >"$tmpdir/split.out" 2>"$tmpdir/split.err" || {
+  echo "ptyterm --recv-until across reads: expected success" >&2
+  cat "$tmpdir/split.err" >&2
+  exit 1
+}
+wait "$sender_pid"
+printf 'xxabcd' | cmp - "$tmpdir/split.out" || {
+  echo "ptyterm --recv-until across reads: expected output through the match" >&2
+  od -An -c "$tmpdir/split.out" >&2
+  exit 1
+}
+grep -q 'offsets 0..6; next-offset=6; .*reason=match_reached' "$tmpdir/split.err" || {
+  echo "ptyterm --recv-until across reads: expected match_reached status" >&2
+  cat "$tmpdir/split.err" >&2
+  exit 1
+}
+
+./ptyterm --recv --recv-format=raw --session=1 --socket="$sock" >"$tmpdir/rest.out" 2>/dev/null || {
+  echo "ptyterm --recv after a match: expected success" >&2
+  exit 1
+}
+printf 'yy' | cmp - "$tmpdir/rest.out" || {
+  echo "ptyterm --recv after a match: expected the bytes past the match" >&2
+  od -An -c "$tmpdir/rest.out" >&2
+  exit 1
+}
+
+# A waiting client that goes away must not hold up the daemon.
+./ptyterm --recv --recv-until=never --session=1 --socket="$sock" >/dev/null 2>&1 &
+waiter_pid=$!
+sleep 1
+kill "$waiter_pid"
+wait "$waiter_pid" 2>/dev/null || true
+
+./ptyterm --list --session=1 --socket="$sock" >/dev/null 2>&1 || {
+  echo "ptyterm --list after an abandoned wait: expected success" >&2
+  exit 1
+}
+
+# A wait with no timeout ends when the session does.
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'sleep 1; exit 0' 2>&1) || {
+  echo "ptyterm --create for an exiting session: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+if ./ptyterm --recv --recv-until=never --session=2 --socket="$sock" >/dev/null 2>"$tmpdir/exit.err"; then
+  echo "ptyterm --recv-until on an exiting session: expected failure" >&2
+  exit 1
+fi
+grep -q 'reason=session_exited' "$tmpdir/exit.err" || {
+  echo "ptyterm --recv-until on an exiting session: expected session_exited" >&2
+  cat "$tmpdir/exit.err" >&2
+  exit 1
+}
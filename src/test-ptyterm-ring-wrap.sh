@@ -0,0 +1,90 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-ring-wrap.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" --output-buffer=100 >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+# 2000 lines of 10 bytes each wrap the 100-byte ring many times over reads
+# of varying size.
+create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'stty -onlcr; i=1000; while [ $i -lt 3000 ]; do echo "line-$i"; i=$((i + 1)); done; sleep 30' 2>&1) || {
+  echo "ptyterm --create for ring wrap: expected success" >&2
+  printf '%s\n' "$create_out" >&2
+  exit 1
+}
+
+i=0
+while :; do
+  info_out=$(./ptyterm --buffer-info --session=1 --socket="$sock" --status-format=kv 2>&1) || {
+    echo "ptyterm --buffer-info for ring wrap: expected success" >&2
+    printf '%s\n' "$info_out" >&2
+    exit 1
+  }
+  printf '%s\n' "$info_out" | grep -q '^dropped_bytes=19900$' && break
+  i=$((i + 1))
+  if [ "$i" -ge 50 ]; then
+    echo "ptyterm --buffer-info for ring wrap: expected dropped_bytes=19900" >&2
+    printf '%s\n' "$info_out" >&2
+    exit 1
+  fi
+  sleep 0.2
+done
+
+printf '%s\n' "$info_out" | grep -q '^buffer_used=100$' || {
+  echo "ptyterm --buffer-info for ring wrap: expected buffer_used=100" >&2
+  printf '%s\n' "$info_out" >&2
+  exit 1
+}
+
+./ptyterm --recv --recv-size=100 --recv-format=raw --recv-control=with --session=1 --socket="$sock" >"$tmpdir/received" 2>/dev/null || {
+  echo "ptyterm --recv for ring wrap: expected success" >&2
+  exit 1
+}
+
+i=2990
+: >"$tmpdir/expected"
+while [ "$i" -lt 3000 ]; do
+  echo "line-$i" >>"$tmpdir/expected"
+  i=$((i + 1))
+done
+
+cmp "$tmpdir/expected" "$tmpdir/received" || {
+  echo "ptyterm --recv for ring wrap: expected the newest 100 bytes" >&2
+  cat "$tmpdir/received" >&2
+  exit 1
+}
+
+./ptyterm --snapshot --session=1 --socket="$sock" >"$tmpdir/snapshot" || {
+  echo "ptyterm --snapshot for ring wrap: expected success" >&2
+  exit 1
+}
+
+grep -q 'line-2999 *$' "$tmpdir/snapshot" || {
+  echo "ptyterm --snapshot for ring wrap: expected the last line on screen" >&2
+  cat "$tmpdir/snapshot" >&2
+  exit 1
+}
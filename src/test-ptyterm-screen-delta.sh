@@ -0,0 +1,113 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-screen-delta.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+./ptyterm --create --socket="$sock" /bin/sh -c 'stty raw -echo; exec cat' >/dev/null 2>&1 || {
+  echo "ptyterm --create for screen delta: expected success" >&2
+  exit 1
+}
+sleep 1
+
+# snapshot_value KEY [OPTIONS]: prints KEY from a kv --snapshot.
+snapshot_value() {
+  key=$1
+  shift
+  ./ptyterm --snapshot --session=1 --status-format=kv --socket="$sock" "$@" | sed -n "s/^$key=//p"
+}
+
+./ptyterm --send='row01\r\nrow02\r\nrow03\r\n' --session=1 --socket="$sock" >/dev/null
+i=0
+until snapshot_value row_3 | grep -q '^row03'; do
+  i=$((i + 1))
+  if [ "$i" -ge 50 ]; then
+    echo "ptyterm --snapshot: expected row03 on screen" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+base=$(snapshot_value generation)
+
+./ptyterm --send='\x1b[5;1Hchanged' --session=1 --socket="$sock" >/dev/null
+i=0
+until snapshot_value row_5 | grep -q '^changed'; do
+  i=$((i + 1))
+  if [ "$i" -ge 50 ]; then
+    echo "ptyterm --snapshot: expected the changed row on screen" >&2
+    exit 1
+  fi
+  sleep 0.1
+done
+
+./ptyterm --snapshot --since-generation="$base" --session=1 --status-format=kv --socket="$sock" >"$tmpdir/delta" || {
+  echo "ptyterm --snapshot --since-generation: expected success" >&2
+  exit 1
+}
+grep -q '^delta=rows$' "$tmpdir/delta" &&
+  grep -q '^changed_rows=1$' "$tmpdir/delta" &&
+  grep -q '^row_5=changed' "$tmpdir/delta" &&
+  grep -q '^cursor_row=5$' "$tmpdir/delta" &&
+  [ "$(grep -c '^row_' "$tmpdir/delta")" = 1 ] || {
+  echo "ptyterm --snapshot --since-generation: expected only row 5" >&2
+  cat "$tmpdir/delta" >&2
+  exit 1
+}
+
+generation=$(sed -n 's/^generation=//p' "$tmpdir/delta")
+./ptyterm --snapshot --since-generation="$generation" --session=1 --status-format=kv --socket="$sock" >"$tmpdir/unchanged"
+grep -q '^changed_rows=0$' "$tmpdir/unchanged" || {
+  echo "ptyterm --snapshot --since-generation: expected no changes at the current generation" >&2
+  cat "$tmpdir/unchanged" >&2
+  exit 1
+}
+
+# Without a known base, or with one from the future, every row comes back.
+for since in 0 $((generation + 100)); do
+  ./ptyterm --snapshot --since-generation="$since" --session=1 --status-format=kv --socket="$sock" >"$tmpdir/full"
+  grep -q '^delta=full$' "$tmpdir/full" &&
+    [ "$(grep -c '^row_' "$tmpdir/full")" = 24 ] || {
+    echo "ptyterm --snapshot --since-generation=$since: expected a full frame" >&2
+    cat "$tmpdir/full" >&2
+    exit 1
+  }
+done
+
+# A resize marks every row.
+./ptyterm --resize --rows=10 --cols=40 --session=1 --socket="$sock" >/dev/null
+./ptyterm --snapshot --since-generation="$generation" --session=1 --status-format=kv --socket="$sock" >"$tmpdir/resized"
+grep -q '^changed_rows=10$' "$tmpdir/resized" || {
+  echo "ptyterm --snapshot --since-generation after resize: expected every row" >&2
+  cat "$tmpdir/resized" >&2
+  exit 1
+}
+
+if ./ptyterm --since-generation=1 --session=1 --socket="$sock" >/dev/null 2>&1; then
+  echo "ptyterm --since-generation without --snapshot: expected failure" >&2
+  exit 1
+fi
@@ -97,6 +97,53 @@ if grep -q '^BASCII$' "$snapshot_out"; then
   exit 1
 fi
 
+long_line=$(printf '%080d' 0)
+send_out=$(./ptyterm --send="${long_line}WRAP\\xc3\\xa9D\\r\\n" --session=1 --socket="$sock" 2>&1) || {
+  echo "ptyterm --send for wrapped text: expected success" >&2
+  printf '%s\n' "$send_out" >&2
+  exit 1
+}
+
+sleep 1
+
+./ptyterm --snapshot --session=1 --socket="$sock" >"$snapshot_out" || {
+  echo "ptyterm --snapshot after wrapped text: expected success" >&2
+  cat "$snapshot_out" >&2 || true
+  exit 1
+}
+
+grep -q "^${long_line}\$" "$snapshot_out" || {
+  echo "ptyterm --snapshot: expected a full-width row before the wrap" >&2
+  cat "$snapshot_out" >&2 || true
+  exit 1
+}
+
+grep -q '^WRAP??D$' "$snapshot_out" || {
+  echo "ptyterm --snapshot: expected wrapped text with 8-bit bytes shown as ?" >&2
+  cat "$snapshot_out" >&2 || true
+  exit 1
+}
+
+send_out=$(./ptyterm --send='\e]0;TITLE\x07SHOWN\e[1;31\x18\r\n' --session=1 --socket="$sock" 2>&1) || {
+  echo "ptyterm --send for title and cancelled sequence: expected success" >&2
+  printf '%s\n' "$send_out" >&2
+  exit 1
+}
+
+sleep 1
+
+./ptyterm --snapshot --session=1 --socket="$sock" >"$snapshot_out" || {
+  echo "ptyterm --snapshot after title: expected success" >&2
+  cat "$snapshot_out" >&2 || true
+  exit 1
+}
+
+grep -q '^SHOWN$' "$snapshot_out" || {
+  echo "ptyterm --snapshot: expected title string and cancelled sequence to be consumed" >&2
+  cat "$snapshot_out" >&2 || true
+  exit 1
+}
+
 send_out=$(./ptyterm --send='\e[?1049hALT\r\n' --session=1 --socket="$sock" 2>&1) || {
   echo "ptyterm --send for alt screen: expected success" >&2
   printf '%s\n' "$send_out" >&2
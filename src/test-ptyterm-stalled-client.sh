@@ -0,0 +1,76 @@
+#!/bin/sh
+set -eu
+
+command -v perl >/dev/null 2>&1 || exit 77
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-stalled-client.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+stalled_pid=
+
+cleanup() {
+  if [ -n "${stalled_pid}" ] && kill -0 "$stalled_pid" 2>/dev/null; then
+    kill "$stalled_pid" 2>/dev/null || true
+    wait "$stalled_pid" 2>/dev/null || true
+  fi
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+mkdir -p "$tmpdir"
+./ptytermd --socket="$sock" >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+# Send half of a message header and then go quiet.
+perl -MIO::Socket::UNIX -e '
+  my $s = IO::Socket::UNIX->new(Peer => $ARGV[0]) or die "connect: $!\n";
+  syswrite($s, "SYTP\001\000");
+  sleep 30;
+' "$sock" 2>"$tmpdir/stalled.err" &
+stalled_pid=$!
+sleep 1
+
+out=$(timeout 10 ./ptyterm --create --socket="$sock" /bin/sh -c 'sleep 30' 2>&1) || {
+  echo "ptyterm --create with a stalled client: expected success" >&2
+  printf '%s\n' "$out" >&2
+  exit 1
+}
+
+printf '%s\n' "$out" | grep -q '^session_id=1$' || {
+  echo "ptyterm --create with a stalled client: expected session id 1" >&2
+  printf '%s\n' "$out" >&2
+  exit 1
+}
+
+out=$(timeout 10 ./ptyterm --list --socket="$sock" 2>&1) || {
+  echo "ptyterm --list with a stalled client: expected success" >&2
+  printf '%s\n' "$out" >&2
+  exit 1
+}
+
+printf '%s\n' "$out" | grep -q '^1	' || {
+  echo "ptyterm --list with a stalled client: expected session 1" >&2
+  printf '%s\n' "$out" >&2
+  exit 1
+}
+
+out=$(timeout 10 ./ptyterm --daemon-status --socket="$sock" 2>&1) || {
+  echo "ptyterm --daemon-status with a stalled client: expected success" >&2
+  printf '%s\n' "$out" >&2
+  exit 1
+}
@@ -0,0 +1,132 @@
+#!/bin/sh
+set -eu
+
+tmpdir=${TMPDIR:-/tmp}/ptyterm-threads.$$
+sock=$tmpdir/daemon.sock
+daemon_pid=
+
+cleanup() {
+  if [ -n "${daemon_pid}" ] && kill -0 "$daemon_pid" 2>/dev/null; then
+    kill "$daemon_pid" 2>/dev/null || true
+    wait "$daemon_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmpdir"
+}
+trap cleanup EXIT HUP INT TERM
+
+out=$(./ptytermd --threads=0 2>&1) && {
+  echo "ptytermd --threads=0: expected failure" >&2
+  exit 1
+}
+printf '%s\n' "$out" | grep -q 'invalid threads' || {
+  echo "ptytermd --threads=0: expected invalid threads message" >&2
+  printf '%s\n' "$out" >&2
+  exit 1
+}
+
+mkdir -p "$tmpdir"
+./ptytermd --threads=3 --socket="$sock" >"$tmpdir/daemon.out" 2>"$tmpdir/daemon.err" &
+daemon_pid=$!
+
+i=0
+while [ ! -e "$sock" ]; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd did not create socket" >&2
+    cat "$tmpdir/daemon.err" >&2 || true
+    exit 1
+  fi
+  sleep 1
+done
+
+# Sessions land on different workers round-robin; each must still serve
+# send, recv and exit tracking.
+n=1
+while [ "$n" -le 6 ]; do
+  create_out=$(./ptyterm --create --socket="$sock" /bin/sh -c 'read line; echo "got-$line"; exit 3' 2>&1) || {
+    echo "ptyterm --create #$n with --threads: expected success" >&2
+    printf '%s\n' "$create_out" >&2
+    exit 1
+  }
+  printf '%s\n' "$create_out" | grep -q "^session_id=$n\$" || {
+    echo "ptyterm --create #$n with --threads: expected session id $n" >&2
+    printf '%s\n' "$create_out" >&2
+    exit 1
+  }
+  n=$((n + 1))
+done
+
+n=1
+while [ "$n" -le 6 ]; do
+  ./ptyterm --send="line$n\\n" --session="$n" --socket="$sock" >/dev/null 2>&1 || {
+    echo "ptyterm --send to session $n with --threads: expected success" >&2
+    exit 1
+  }
+  n=$((n + 1))
+done
+
+# A recv that does not wait is answered once the owning worker has
+# drained the session on its behalf.
+n=1
+while [ "$n" -le 6 ]; do
+  ./ptyterm --recv --peek --session="$n" --socket="$sock" >/dev/null 2>"$tmpdir/peek.err" || {
+    echo "ptyterm --recv --peek from session $n with --threads: expected success" >&2
+    cat "$tmpdir/peek.err" >&2 || true
+    exit 1
+  }
+  n=$((n + 1))
+done
+
+n=1
+while [ "$n" -le 6 ]; do
+  recv_out=$(./ptyterm --recv --recv-until="got-line$n" --recv-timeout=5s --session="$n" --socket="$sock" 2>&1) || {
+    echo "ptyterm --recv from session $n with --threads: expected success" >&2
+    printf '%s\n' "$recv_out" >&2
+    exit 1
+  }
+  printf '%s\n' "$recv_out" | grep -q "got-line$n" || {
+    echo "ptyterm --recv from session $n with --threads: expected echoed line" >&2
+    printf '%s\n' "$recv_out" >&2
+    exit 1
+  }
+  n=$((n + 1))
+done
+
+i=0
+while :; do
+  list_out=$(./ptyterm --list --socket="$sock" 2>&1) || {
+    echo "ptyterm --list with --threads: expected success" >&2
+    printf '%s\n' "$list_out" >&2
+    exit 1
+  }
+  exited=$(printf '%s\n' "$list_out" | grep -c "	exited	" || true)
+  [ "$exited" -eq 6 ] && break
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptyterm --list with --threads: expected 6 exited sessions" >&2
+    printf '%s\n' "$list_out" >&2
+    exit 1
+  fi
+  sleep 1
+done
+
+stop_out=$(./ptyterm --daemon-stop --socket="$sock" 2>&1) || {
+  echo "ptyterm --daemon-stop with --threads: expected success" >&2
+  printf '%s\n' "$stop_out" >&2
+  exit 1
+}
+
+i=0
+while kill -0 "$daemon_pid" 2>/dev/null; do
+  i=$((i + 1))
+  if [ "$i" -ge 10 ]; then
+    echo "ptytermd --threads: expected daemon to exit after stop" >&2
+    exit 1
+  fi
+  sleep 1
+done
+wait "$daemon_pid" || {
+  echo "ptytermd --threads: expected clean exit status" >&2
+  exit 1
+}
+daemon_pid=
@@ -0,0 +1,7 @@
+#!/bin/sh
+set -eu
+
+./ptyterm-vtgen | cmp -s - "${srcdir:-.}/ptyterm-vt-table.h" || {
+  echo "ptyterm-vt-table.h is stale: run make vt-table" >&2
+  exit 1
+}